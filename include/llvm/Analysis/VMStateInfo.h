@@ -0,0 +1,106 @@
+//===- VMStateInfo.h - Availability of abstract VM states -------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares VMStateInfo, the analysis of the abstract VM states
+// (jvmstate_ calls) in a function shared by the passes maintaining them and
+// by safepoint placement.  It answers two questions:
+//
+//  - Which vm state reaches a call?  That is the state of the closest anchor
+//    (a store of a jvmstate_ to llvm.jvmstate_anchor, or a call holding a
+//    jvmstate_ as its first argument) found walking backwards from the call
+//    through its block and then its dominators.  The call itself counts.
+//
+//  - Is some other vm state available before a jvmstate_, i.e. reached along
+//    every path without passing an instruction which can't be replayed?  Such
+//    a jvmstate_ is redundant unless a call holds it.
+//
+// Both are computed together in a reverse post order sweep over the blocks,
+// with the available states kept as bit vectors indexed by vm state number.
+// Loops need further sweeps until the available sets stop shrinking.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_ANALYSIS_VMSTATEINFO_H
+#define LLVM_ANALYSIS_VMSTATEINFO_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Pass.h"
+#include <vector>
+
+namespace llvm {
+
+class CallInst;
+class DominatorTree;
+class Function;
+class Instruction;
+class StoreInst;
+class raw_ostream;
+
+class VMStateInfo {
+public:
+  /// Analyze F, discarding any previous results.  The results are invalid
+  /// once F is modified.
+  void compute(Function &F, DominatorTree &DT);
+  void clear();
+
+  /// The jvmstate_ calls in the function, in layout order
+  ArrayRef<CallInst *> getVMStates() const { return VMStates; }
+
+  /// The stores of a jvmstate_ to llvm.jvmstate_anchor in the function, in
+  /// layout order
+  ArrayRef<StoreInst *> getAnchorStores() const { return AnchorStores; }
+
+  /// Returns the vm state reaching the call or invoke I (other than a
+  /// jvmstate_), or null if there is none or I is unreachable.  Unlike the
+  /// rest of the results this stays valid across changes to F which don't
+  /// add, move or remove anchors.
+  CallInst *getReachingVMState(const Instruction *I) const {
+    return ReachingStates.lookup(I);
+  }
+
+  /// Returns true if another vm state is available before the jvmstate_ VMS
+  bool isAvailableBefore(const CallInst *VMS) const;
+
+  void print(raw_ostream &OS) const;
+
+private:
+  /// Numbering of the vm states, indexing the bit vectors
+  DenseMap<const CallInst *, unsigned> VMStateNumbers;
+  std::vector<CallInst *> VMStates;
+  std::vector<StoreInst *> AnchorStores;
+
+  DenseMap<const Instruction *, CallInst *> ReachingStates;
+
+  /// The vm states which have another one available before them
+  BitVector AvailableBefore;
+};
+
+/// Legacy analysis pass which computes VMStateInfo
+class VMStateInfoWrapperPass : public FunctionPass {
+  VMStateInfo Info;
+
+public:
+  static char ID;
+
+  VMStateInfoWrapperPass();
+
+  VMStateInfo &getVMStateInfo() { return Info; }
+  const VMStateInfo &getVMStateInfo() const { return Info; }
+
+  bool runOnFunction(Function &F) override;
+  void getAnalysisUsage(AnalysisUsage &AU) const override;
+  void releaseMemory() override { Info.clear(); }
+  void print(raw_ostream &OS, const Module *M = nullptr) const override;
+};
+
+} // end namespace llvm
+
+#endif
@@ -242,6 +242,13 @@ public:
   /// selection was successful.
   bool SelectInstruction(const Instruction *I);
 
+  /// Return the last of the gc.relocate and gc.result calls directly following
+  /// the call statepoint Statepoint, or Statepoint itself if there are none.
+  /// They are selected along with the statepoint, so if it falls back to
+  /// SelectionDAG they have to go along.
+  static const Instruction *
+  getLastStatepointResult(const Instruction *Statepoint);
+
   /// Do "fast" instruction selection for the given LLVM IR operator
   /// (Instruction or ConstantExpr), and append generated machine instructions
   /// to the current block. Return true if selection was successful.
@@ -542,6 +549,13 @@ private:
 
   bool SelectStackmap(const CallInst *I);
   bool SelectPatchpoint(const CallInst *I);
+  bool SelectStatepoint(const CallInst *I);
+  bool lowerStatepoint(const CallInst *I);
+  bool addStatepointSpill(SmallVectorImpl<MachineOperand> &Ops,
+                          const Value *V, DenseMap<unsigned, int> &Slots,
+                          unsigned &NumSlots);
+  bool SelectGCRelocate(const CallInst *I);
+  bool SelectGCResult(const CallInst *I);
   bool LowerCall(const CallInst *I);
   bool SelectCall(const User *Call);
   bool SelectIntrinsicCall(const IntrinsicInst *II);
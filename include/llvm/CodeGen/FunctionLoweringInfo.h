@@ -93,6 +93,17 @@ public:
   /// basic blocks.
   SmallVector<unsigned, 50> StatepointStackSlots;
 
+  /// StatepointRelocationSlots - For each invoked statepoint, the stack slot
+  /// each gc pointer was spilled to.  The gc.relocates of an invoke are in
+  /// its normal and unwind destinations and reload the value from there.
+  DenseMap<const Instruction*, DenseMap<const Value*, int> >
+    StatepointRelocationSlots;
+
+  /// StatepointResultRegs - For each invoked statepoint with a result, the
+  /// virtual register the result of the call is exported in for its
+  /// gc.result.
+  DenseMap<const Instruction*, unsigned> StatepointResultRegs;
+
   /// MBB - The current block.
   MachineBasicBlock *MBB;
 
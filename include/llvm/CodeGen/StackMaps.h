@@ -82,8 +82,14 @@ public:
 };
 
 // Statepoint operands:
-// <num call arguments>, <call target>, [call arguments],
+// [<def>...], <num call arguments>, <call target>, [call arguments],
 // <StackMaps::ConstantOp>, <flags>, [vm state and gc values]
+//
+// The gc values are either spilled to a stack slot or, if they were passed in
+// registers, held in the register they arrive in.  Each gc value in a register
+// has a def, tied to the first operand holding the value, which is the
+// relocated value after the call.  The register allocator can thus only
+// assign it a callee saved register (or fold it to a stack slot after all).
 class StatepointOpers {
 private:
   enum {
@@ -92,22 +98,36 @@ private:
   };
 
 public:
-  explicit StatepointOpers(const MachineInstr *MI):
-    MI(MI) { }
+  explicit StatepointOpers(const MachineInstr *MI);
+
+  // Get the number of gc values passed in registers
+  unsigned getNumDefs() const {
+    return NumDefs;
+  }
+
+  // Get the number of arguments of the call
+  unsigned getNumCallArgs() const {
+    return MI->getOperand(NumDefs + NCallArgsPos).getImm();
+  }
+
+  // Get starting index of the call arguments
+  unsigned getCallArgsIdx() const {
+    return NumDefs + 2;
+  }
 
   // Get starting index of non call related arguments
   // (statepoint flags, vm state and gc state)
   unsigned getVarIdx() const {
-    return MI->getOperand(NCallArgsPos).getImm() + 2;
+    return getCallArgsIdx() + getNumCallArgs();
   }
 
-  unsigned getCallerVMStateIdx() const {
-    // <StackMaps::ConstantOp> for flags, <flags>, <StackMaps::ConstantOp> for callerVMState
+  unsigned getNumCallerFramesIdx() const {
+    // <StackMaps::ConstantOp> for flags, <flags>, <StackMaps::ConstantOp> for numCallerFrames
     return getVarIdx() + 3;
   }
 
   unsigned getBciIdx() const {
-    // getCallerVMStateIdx(), callerVMState, <StackMaps::ConstantOp> for bci
+    // getNumCallerFramesIdx(), numCallerFrames, <StackMaps::ConstantOp> for bci
     return getVarIdx() + 5;
   }
 
@@ -126,12 +146,20 @@ public:
     return getVarIdx() + 11;
   }
 
+  // Get the index of the operand following the location starting at Idx
+  unsigned getNextLocationIdx(unsigned Idx) const;
+
+  // Get starting index of the gc state, past the vm state of the statepoint
+  // and the frames of its inlined callers
+  unsigned getGCStateIdx() const;
+
   const MachineOperand &getCallTarget() const {
-    return MI->getOperand(CallTargetPos);
+    return MI->getOperand(NumDefs + CallTargetPos);
   }
 
 private:
   const MachineInstr *MI;
+  unsigned NumDefs;
 };
 
 class StackMaps {
@@ -190,6 +218,7 @@ public: //HACK: exposed for our use
   typedef SmallVector<LiveOutReg, 8> LiveOutVec;
   typedef MapVector<int64_t, int64_t> ConstantPool;
   typedef MapVector<const MCSymbol *, uint64_t> FnStackSizeMap;
+  typedef MapVector<const MCSymbol *, unsigned> FnNumCallsitesMap;
 
   struct CallsiteInfo {
     const MCExpr *CSOffsetExpr;
@@ -210,6 +239,8 @@ public: //HACK: exposed for our use
   CallsiteInfoList CSInfos;
   ConstantPool ConstPool;
   FnStackSizeMap FnStackSize;
+  /// The callsites of each function, which are consecutive in CSInfos.
+  FnNumCallsitesMap FnNumCallsites;
 
 public: // Hack: Exposed for PATCHPOINT
 
@@ -247,6 +278,9 @@ public: // Hack: Exposed for PATCHPOINT
 
   /// \brief Emit the callsite info for each stackmap/patchpoint intrinsic call.
   void emitCallsiteEntries(MCStreamer &OS, const TargetRegisterInfo *TRI);
+
+  /// \brief Emit the whole stack map in the version 2 encoding.
+  void emitStackMapV2(MCStreamer &OS, const TargetRegisterInfo *TRI);
 };
 
 }
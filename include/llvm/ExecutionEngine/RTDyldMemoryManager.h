@@ -76,6 +76,19 @@ public:
 
   virtual void deregisterEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size);
 
+  /// Register a stack map (.llvm_stackmaps) section once its relocations
+  /// have been applied, so that the runtime can find the stack map records
+  /// of the JIT-ed code.  \p Addr and \p LoadAddr are as for registerEHFrames;
+  /// the function addresses in the section are target addresses.
+  ///
+  /// The default implementation does nothing.
+  virtual void registerStackMaps(uint8_t *Addr, uint64_t LoadAddr,
+                                 size_t Size) {}
+
+  /// Called before the memory holding a registered stack map is released.
+  virtual void deregisterStackMaps(uint8_t *Addr, uint64_t LoadAddr,
+                                   size_t Size) {}
+
   /// This method returns the address of the specified function or variable.
   /// It is used to resolve symbols during module linking.
   virtual uint64_t getSymbolAddress(const std::string &Name);
@@ -86,6 +86,13 @@ public:
 
   void deregisterEHFrames();
 
+  /// Register any stack map sections that have been loaded but not previously
+  /// registered with the memory manager.  Like registerEHFrames, this must
+  /// be called after relocations have been resolved.
+  void registerStackMaps();
+
+  void deregisterStackMaps();
+
   bool hasError();
   StringRef getErrorString();
 
@@ -15,12 +15,16 @@
 #ifndef LLVM_EXECUTIONENGINE_SECTIONMEMORYMANAGER_H
 #define LLVM_EXECUTIONENGINE_SECTIONMEMORYMANAGER_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ExecutionEngine/RuntimeDyld.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/Memory.h"
+#include <system_error>
 
 namespace llvm {
+class StackMapRegistry;
+
 /// This is a simple memory manager which implements the methods called by
 /// the RuntimeDyld class to allocate memory for section-based loading of
 /// objects, usually those generated by the MCJIT execution engine.
@@ -39,7 +43,7 @@ class SectionMemoryManager : public RTDyldMemoryManager {
   void operator=(const SectionMemoryManager&) LLVM_DELETED_FUNCTION;
 
 public:
-  SectionMemoryManager() { }
+  SectionMemoryManager() : StackMaps(nullptr) { }
   virtual ~SectionMemoryManager();
 
   /// \brief Allocates a memory block of (at least) the given size suitable for
@@ -82,6 +86,34 @@ public:
   /// This method is called from finalizeMemory.
   virtual void invalidateInstructionCache();
 
+  /// \brief Record a stack map section of a loaded object.
+  ///
+  /// The section is added to the registry set with setStackMapRegistry, if
+  /// any.  A section the registry rejects is still recorded, and the error is
+  /// kept for getStackMapError.
+  void registerStackMaps(uint8_t *Addr, uint64_t LoadAddr,
+                         size_t Size) override;
+
+  void deregisterStackMaps(uint8_t *Addr, uint64_t LoadAddr,
+                           size_t Size) override;
+
+  /// \brief The stack map sections registered and not yet deregistered.
+  ArrayRef<sys::MemoryBlock> getStackMapSections() const {
+    return StackMapSections;
+  }
+
+  /// \brief Index the stack maps of the objects loaded from now on in
+  /// \p Registry, which must outlive this memory manager.
+  ///
+  /// The stack maps are removed from the registry when they are deregistered
+  /// or at the latest when their memory is released.
+  void setStackMapRegistry(StackMapRegistry *Registry) { StackMaps = Registry; }
+
+  /// \brief The error of the last stack map section the registry rejected, if
+  /// any.  Version 1 sections of more than one function can't be indexed; the
+  /// code has to be compiled with -stackmap-version=2 for them.
+  std::error_code getStackMapError() const { return StackMapError; }
+
 private:
   struct MemoryGroup {
       SmallVector<sys::MemoryBlock, 16> AllocatedMem;
@@ -98,6 +130,10 @@ private:
   MemoryGroup CodeMem;
   MemoryGroup RWDataMem;
   MemoryGroup RODataMem;
+
+  SmallVector<sys::MemoryBlock, 4> StackMapSections;
+  StackMapRegistry *StackMaps;
+  std::error_code StackMapError;
 };
 
 }
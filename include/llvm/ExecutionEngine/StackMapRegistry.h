@@ -0,0 +1,85 @@
+//===- StackMapRegistry.h - Index of JIT-ed stack maps ----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares StackMapRegistry, which indexes the callsite records of
+// the stack map sections of JIT-ed objects by return address, so that a
+// runtime walking the stack (e.g. to find the roots for a collection) can
+// look up the record of each frame without parsing the sections again.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_STACKMAPREGISTRY_H
+#define LLVM_EXECUTIONENGINE_STACKMAPREGISTRY_H
+
+#include "llvm/Object/StackMapParser.h"
+#include <memory>
+#include <system_error>
+#include <vector>
+
+namespace llvm {
+
+/// The callsite records of a set of stack map sections, in a single table
+/// sorted by return address (the function address plus the instruction
+/// offset of the record).  Lookups are a binary search over the table.
+///
+/// The registry reads the sections in place, so a section must stay mapped
+/// until it is unregistered.  It does no locking of its own; a client which
+/// loads code while another thread walks the stack has to synchronize them.
+class StackMapRegistry {
+public:
+  typedef object::StackMapParser::Callsite Callsite;
+
+  /// A callsite record, with the function it is in.
+  struct CallsiteRecord {
+    uint64_t FunctionAddress;
+    uint64_t StackSize;
+    Callsite Record;
+    /// The stack map the record is from, for the constants it refers to.
+    const object::StackMapParser *StackMap;
+
+    uint64_t getReturnAddress() const {
+      return FunctionAddress + Record.InstructionOffset;
+    }
+  };
+
+  StackMapRegistry();
+  ~StackMapRegistry();
+
+  /// Add the records of the stack map section at Addr.  Version 1 sections
+  /// only say which function a record is in if there is a single function,
+  /// so others are rejected with object_error::parse_failed.
+  std::error_code registerStackMap(const uint8_t *Addr, size_t Size);
+
+  /// Remove the records of the section at Addr.  Returns false if it isn't
+  /// registered.
+  bool unregisterStackMap(const uint8_t *Addr);
+
+  /// Returns the record with the given return address, or null if there is
+  /// none.
+  const CallsiteRecord *lookup(uint64_t ReturnAddress) const;
+
+  unsigned getNumStackMaps() const { return StackMaps.size(); }
+  unsigned getNumCallsites() const { return Index.size(); }
+
+private:
+  StackMapRegistry(const StackMapRegistry &) LLVM_DELETED_FUNCTION;
+  void operator=(const StackMapRegistry &) LLVM_DELETED_FUNCTION;
+
+  struct RegisteredStackMap;
+
+  std::vector<std::unique_ptr<RegisteredStackMap>> StackMaps;
+
+  /// The records of all the stack maps, sorted by return address
+  typedef std::pair<uint64_t, const CallsiteRecord *> IndexEntry;
+  std::vector<IndexEntry> Index;
+};
+
+} // end namespace llvm
+
+#endif
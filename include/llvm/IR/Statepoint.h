@@ -20,6 +20,12 @@ bool isGCRelocate(const ImmutableCallSite &CS);
 bool isGCResult(const Instruction *inst);
 bool isGCResult(const ImmutableCallSite &CS);
 
+bool isGCLandingToken(const Instruction *inst);
+
+/// Returns the statepoint a gc_relocate or gc_result token refers to.  For
+/// a gc_landing_token this is the invoke in the landing pad's predecessor.
+const Instruction *getStatepointForToken(const Value *token);
+
 template <typename InstructionTy, typename ValueTy, typename CallSiteTy>
 class StatepointBase {
   CallSiteTy callSite;
@@ -41,7 +47,9 @@ public:
   int numCallArgs() {
     return cast<ConstantInt>(callSite.getArgument(1))->getZExtValue();
   }
-  int callerVM() {
+  /// The number of inlined caller frames flattened into the vm state after
+  /// this frame's (see caller_frames_begin)
+  int numCallerFrames() {
     return cast<ConstantInt>(callSite.getArgument(3))->getZExtValue();
   }
   int bci() {
@@ -100,10 +108,7 @@ public:
     return call_args_end();
   }
   typename CallSiteTy::arg_iterator vm_state_end() {
-    int offset = 8 + numCallArgs() + 2 * numJavaStackElements() +
-                 2 * numJavaLocals() + numJavaMonitors();
-    assert(offset <= (int)callSite.arg_size());
-    return callSite.arg_begin() + offset;
+    return caller_frames_end();
   }
 
   typename CallSiteTy::arg_iterator vm_state_stack_begin() {
@@ -124,7 +129,35 @@ public:
     return vm_state_locals_end();
   }
   typename CallSiteTy::arg_iterator vm_state_monitors_end() {
-    return vm_state_end();
+    return caller_frames_begin();
+  }
+
+  /// The frames of the inlined callers follow the monitors, innermost caller
+  /// first.  Each starts with its bci, #stack, #locals and #monitors followed
+  /// by its stack and local (type, value) pairs and its monitors, i.e. it is
+  /// laid out like the frame above with the header inline.
+  typename CallSiteTy::arg_iterator caller_frames_begin() {
+    int offset = 8 + numCallArgs() + 2 * numJavaStackElements() +
+                 2 * numJavaLocals() + numJavaMonitors();
+    assert(offset <= (int)callSite.arg_size());
+    return callSite.arg_begin() + offset;
+  }
+  typename CallSiteTy::arg_iterator caller_frames_end() {
+    typename CallSiteTy::arg_iterator I = caller_frames_begin();
+    for (int i = 0, e = numCallerFrames(); i != e; ++i) {
+      assert(I + 4 <= callSite.arg_end() && "out of bounds!");
+      I += callerFrameSize(I);
+    }
+    assert(I <= callSite.arg_end() && "out of bounds!");
+    return I;
+  }
+
+  /// The number of arguments taken by the caller frame starting at I
+  static int callerFrameSize(typename CallSiteTy::arg_iterator I) {
+    int numStack = cast<ConstantInt>(I[1].get())->getZExtValue();
+    int numLocals = cast<ConstantInt>(I[2].get())->getZExtValue();
+    int numMonitors = cast<ConstantInt>(I[3].get())->getZExtValue();
+    return 4 + 2 * numStack + 2 * numLocals + numMonitors;
   }
 
   typename CallSiteTy::arg_iterator gc_args_begin() {
@@ -182,7 +215,11 @@ public:
   }
 
   const Instruction *statepoint() {
-    return cast<Instruction>(_relocate.getArgument(0));
+    return getStatepointForToken(_relocate.getArgument(0));
+  }
+  /// Does this relocate the value along the exceptional edge of an invoke?
+  bool isExceptional() {
+    return isGCLandingToken(cast<Instruction>(_relocate.getArgument(0)));
   }
   int basePtrIndex() {
     return cast<ConstantInt>(_relocate.getArgument(1))->getZExtValue();
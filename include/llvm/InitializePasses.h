@@ -129,6 +129,7 @@ void initializeEarlyCSEPass(PassRegistry&);
 void initializeExpandISelPseudosPass(PassRegistry&);
 void initializeFindUsedTypesPass(PassRegistry&);
 void initializeFunctionAttrsPass(PassRegistry&);
+void initializeInferGCLeafFunctionsPass(PassRegistry&);
 void initializeGCMachineCodeAnalysisPass(PassRegistry&);
 void initializeGCModuleInfoPass(PassRegistry&);
 void initializeGVNPass(PassRegistry&);
@@ -282,6 +283,7 @@ void initializeRemovePhantomArgPass(PassRegistry&);
 void initializeRemoveFakeVMStateCallsPass(PassRegistry&);
 void initializeRemoveRedundantVMStatesPass(PassRegistry&);
 void initializeMergeNonDominatingVMStatesPass(PassRegistry&);
+void initializeVMStateInfoWrapperPassPass(PassRegistry&);
 void initializeStackMapLivenessPass(PassRegistry&);
 void initializeLoadCombinePass(PassRegistry&);
 }
@@ -0,0 +1,105 @@
+//===- StackMapParser.h - Parser for the .llvm_stackmaps section -*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a parser for the .llvm_stackmaps section in either of
+// the encodings StackMaps emits.  Version 1 sections are walked in place,
+// version 2 sections are read through StackMapV2Reader.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_OBJECT_STACKMAPPARSER_H
+#define LLVM_OBJECT_STACKMAPPARSER_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/Object/StackMapV2.h"
+
+namespace llvm {
+namespace object {
+
+class StackMapParser {
+public:
+  typedef StackMapV2Reader::LocationKind LocationKind;
+  typedef StackMapV2Reader::Location Location;
+  typedef StackMapV2Reader::LiveOut LiveOut;
+  typedef StackMapV2Reader::Function Function;
+  typedef StackMapV2Reader::Callsite Callsite;
+
+  /// Walks the callsite records in section order, decoding each into a
+  /// buffer owned by the iterator.  Advancing reads the next record in place,
+  /// so walking a mapped section allocates nothing past the first records
+  /// with more locations than the buffer's inline storage.
+  class callsite_iterator {
+  public:
+    const Callsite &operator*() const { return CS; }
+    const Callsite *operator->() const { return &CS; }
+    callsite_iterator &operator++();
+    bool operator==(const callsite_iterator &RHS) const {
+      return Idx == RHS.Idx;
+    }
+    bool operator!=(const callsite_iterator &RHS) const {
+      return !(*this == RHS);
+    }
+
+  private:
+    friend class StackMapParser;
+    callsite_iterator(const StackMapParser &Parser, unsigned Idx,
+                      uint64_t Offset);
+    void decode();
+
+    const StackMapParser *Parser;
+    unsigned Idx;
+    /// The offset of the record following the current one, for version 1.
+    uint64_t NextOffset;
+    Callsite CS;
+  };
+
+  /// Check that Data is a well formed stack map of a known version.  The
+  /// accessors below rely on this and do no further checking.
+  static ErrorOr<StackMapParser> create(StringRef Data);
+
+  unsigned getVersion() const { return Version; }
+
+  unsigned getNumFunctions() const { return NumFunctions; }
+  /// Returns the function record Idx.  Version 1 does not map functions to
+  /// their callsites, so FirstCallsite and NumCallsites are only valid when
+  /// hasFunctionCallsites().
+  Function getFunction(unsigned Idx) const;
+  bool hasFunctionCallsites() const { return Version != 1; }
+
+  unsigned getNumConstants() const { return NumConstants; }
+  int64_t getConstant(unsigned Idx) const;
+
+  unsigned getNumCallsites() const { return NumCallsites; }
+  callsite_iterator callsite_begin() const;
+  callsite_iterator callsite_end() const;
+
+  /// The size of the stack map in bytes.
+  size_t getSize() const { return Data.size(); }
+
+private:
+  StackMapParser(StringRef Data);
+
+  const uint8_t *getBase() const {
+    return reinterpret_cast<const uint8_t *>(Data.data());
+  }
+  /// Decodes the version 1 record at Offset, returning the offset of the
+  /// next record, or 0 if the record is malformed.
+  uint64_t decodeV1Callsite(uint64_t Offset, Callsite &Result) const;
+
+  StringRef Data;
+  unsigned Version;
+  unsigned NumFunctions, NumConstants, NumCallsites;
+  uint64_t RecordsOffset;
+  Optional<StackMapV2Reader> V2;
+};
+
+} // end namespace object.
+} // end namespace llvm.
+
+#endif
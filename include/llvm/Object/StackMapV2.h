@@ -0,0 +1,109 @@
+//===- StackMapV2.h - Reader for version 2 stack maps -----------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a reader for the version 2 encoding of the
+// .llvm_stackmaps section (see StackMaps::emitStackMapV2).  It works in place
+// on the section contents, e.g. as mapped by the runtime, and reads them in
+// host byte order.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_OBJECT_STACKMAPV2_H
+#define LLVM_OBJECT_STACKMAPV2_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/ErrorOr.h"
+
+namespace llvm {
+namespace object {
+
+class StackMapV2Reader {
+public:
+  enum LocationKind {
+    Register = 1, Direct, Indirect, Constant, ConstantIndex
+  };
+
+  struct Location {
+    LocationKind Kind;
+    unsigned Size;
+    unsigned DwarfRegNum;
+    int32_t Offset;
+  };
+
+  struct LiveOut {
+    unsigned DwarfRegNum;
+    unsigned Size;
+  };
+
+  struct Function {
+    uint64_t Address;
+    uint64_t StackSize;
+    unsigned FirstCallsite;
+    unsigned NumCallsites;
+  };
+
+  /// A decoded callsite record.
+  struct Callsite {
+    uint64_t ID;
+    uint32_t InstructionOffset;
+    SmallVector<Location, 8> Locations;
+    SmallVector<LiveOut, 4> LiveOuts;
+  };
+
+  /// Check that Data is a well formed version 2 stack map.  The accessors
+  /// below rely on this and do no further checking.
+  static ErrorOr<StackMapV2Reader> create(StringRef Data);
+
+  unsigned getNumFunctions() const { return NumFunctions; }
+  Function getFunction(unsigned Idx) const;
+
+  unsigned getNumConstants() const { return NumConstants; }
+  int64_t getConstant(unsigned Idx) const;
+
+  /// The distinct locations, shared between the callsites using them.
+  unsigned getNumLocations() const { return NumLocations; }
+  Location getLocation(unsigned Idx) const;
+
+  unsigned getNumCallsites() const { return NumCallsites; }
+  uint32_t getInstructionOffset(unsigned Idx) const;
+  void getCallsite(unsigned Idx, Callsite &Result) const;
+
+  /// Returns the index of the function starting at Address, or -1.  This is
+  /// a linear scan; a runtime with many functions will want to index them by
+  /// their relocated address itself.
+  int findFunction(uint64_t Address) const;
+
+  /// Returns the index of the callsite of function FnIdx at InstructionOffset
+  /// (i.e. the return address for a statepoint), or -1.  The callsites of a
+  /// function are sorted by offset, so this is a binary search.
+  int findCallsite(unsigned FnIdx, uint32_t InstructionOffset) const;
+
+  /// The size of the stack map in bytes.
+  size_t getSize() const { return Data.size(); }
+
+private:
+  StackMapV2Reader(StringRef Data);
+
+  const uint8_t *getBase() const {
+    return reinterpret_cast<const uint8_t *>(Data.data());
+  }
+  uint32_t getRecordOffset(unsigned Idx) const;
+  bool decodeCallsite(unsigned Idx, Callsite &Result) const;
+
+  StringRef Data;
+  unsigned NumFunctions, NumConstants, NumLocations, NumCallsites;
+  uint64_t FunctionsOffset, CallsitesOffset, LocationsOffset, RecordsOffset;
+};
+
+} // end namespace object.
+} // end namespace llvm.
+
+#endif
@@ -178,6 +178,13 @@ ModulePass *createStripDeadPrototypesPass();
 ///
 Pass *createFunctionAttrsPass();
 
+//===----------------------------------------------------------------------===//
+/// createInferGCLeafFunctionsPass - This pass discovers functions which can
+/// never reach a safepoint and marks them "gc-leaf-inferred", so that
+/// safepoint placement treats calls to them as leaf calls.
+///
+Pass *createInferGCLeafFunctionsPass();
+
 //===----------------------------------------------------------------------===//
 /// createMergeFunctionsPass - This pass discovers identical functions and
 /// collapses them.
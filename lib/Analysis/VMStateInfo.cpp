@@ -0,0 +1,283 @@
+//===- VMStateInfo.cpp - Availability of abstract VM states ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements VMStateInfo.  The availability analysis is an
+// optimistic forward dataflow: meet is set intersection, and the initial
+// (TOP) value of each block is the set of vm states defined in it or in its
+// dominators, which is the universe of states that could possibly be
+// available there.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Analysis/VMStateInfo.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/JVMState.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "vmstate-info"
+
+/// Returns true if executing I again after a vm state is reentered is
+/// unobservable, i.e. a vm state before I may stand in for one after it.
+static bool canBeSafelyReplayed(const Instruction *I) {
+  // Any store -> bad
+  // Any volatile load -> bad
+  // Any fence, cmpxcmp, atomicrmw -> bad
+  // Any call -> bad
+  // Any write to memory -> bad
+  // (could be more aggressive on several)
+  // terminators -> safe
+  // math -> safe
+  // unordered load -> safe
+  if (const StoreInst *SI = dyn_cast<StoreInst>(I)) {
+    // The anchor instruction is the only store instruction that can
+    // be safely replayed.
+    return isJVMStateAnchorInstruction(SI);
+  }
+
+  if (const LoadInst* LI = dyn_cast<LoadInst>(I)) {
+    // Be conservative for the moment and say that any 'special' load can not
+    // be replayed safely.
+    if (LI->isAtomic() || LI->isVolatile() || !LI->isUnordered()) {
+      return false;
+    }
+    // fallthrough
+  }
+
+  // Be conservative, anything with ordering or write semantics,
+  // assume we can't replay
+  if (isa<FenceInst>(I) || isa<AtomicCmpXchgInst>(I) ||
+      isa<AtomicRMWInst>(I)) {
+    return false;
+  }
+
+  if (isa<CallInst>(I) || isa<InvokeInst>(I)) {
+    if (isJVMState(I)) {
+      return true;
+    }
+
+    ImmutableCallSite CS(I);
+    // Note: It is likely NOT safe to use read only here.  The
+    // function could contain volatile load or fence with implied
+    // ordering.  (Not sure about the exact semantics here, so be
+    // conservative)
+    //
+    // if( CS.onlyReadsMemory() ) {
+    //   return true;
+    // }
+    if (const Function *F = CS.getCalledFunction()) {
+      // This routine is known (by the frontend) to be idempotent and
+      // replayable.  This attribute could probably be generalized for other
+      // purposes, but for now, we use one specific to this purpose
+      if( F->getFnAttribute("vmstate-idempotent").getValueAsString().equals("true") ) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  return !I->mayWriteToMemory();
+}
+
+void VMStateInfo::clear() {
+  VMStateNumbers.clear();
+  VMStates.clear();
+  AnchorStores.clear();
+  ReachingStates.clear();
+  AvailableBefore.clear();
+}
+
+void VMStateInfo::compute(Function &F, DominatorTree &DT) {
+  clear();
+
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB) {
+      if (isJVMState(&I)) {
+        VMStateNumbers[cast<CallInst>(&I)] = VMStates.size();
+        VMStates.push_back(cast<CallInst>(&I));
+      } else if (isJVMStateAnchorInstruction(&I)) {
+        AnchorStores.push_back(cast<StoreInst>(&I));
+      }
+    }
+  // Every anchor stores a vm state, and so does every call holding one.
+  if (VMStates.empty())
+    return;
+
+  const unsigned NumStates = VMStates.size();
+  AvailableBefore.resize(NumStates);
+
+  // Unreachable blocks are left out.  Nothing is available in them, and
+  // no call in them is reached by a vm state.
+  std::vector<BasicBlock *> Blocks;
+  DenseMap<const BasicBlock *, unsigned> BlockNumbers;
+  ReversePostOrderTraversal<Function *> RPOT(&F);
+  for (BasicBlock *BB : RPOT) {
+    BlockNumbers[BB] = Blocks.size();
+    Blocks.push_back(BB);
+  }
+  const unsigned NumBlocks = Blocks.size();
+
+  // The states available on exit from a block which has an instruction that
+  // can't be replayed are the states after the last one.  Any other block
+  // adds its own states to those available on entry.
+  std::vector<BitVector> Gen(NumBlocks, BitVector(NumStates));
+  BitVector ClobbersAll(NumBlocks);
+  std::vector<BitVector> AvailIn(NumBlocks), AvailOut(NumBlocks);
+
+  // A block is visited after its immediate dominator, which hands down the
+  // state reaching its end and the states defined in it or above.
+  {
+    std::vector<CallInst *> ReachingOut(NumBlocks);
+    std::vector<BitVector> Dominating(NumBlocks);
+    for (unsigned B = 0; B != NumBlocks; ++B) {
+      CallInst *State = nullptr;
+      if (DomTreeNode *IDom = DT.getNode(Blocks[B])->getIDom()) {
+        unsigned IDomNumber = BlockNumbers.lookup(IDom->getBlock());
+        State = ReachingOut[IDomNumber];
+        Dominating[B] = Dominating[IDomNumber];
+      } else {
+        Dominating[B].resize(NumStates);
+      }
+
+      for (Instruction &I : *Blocks[B]) {
+        if (isJVMStateAnchorInstruction(&I)) {
+          State = dyn_cast<CallInst>(cast<StoreInst>(&I)->getValueOperand());
+        } else if (CallInst *CI = dyn_cast<CallInst>(&I)) {
+          // a call that holds a vmstate at callsite also acts
+          // as a VMSAnchor
+          if (CI->getNumArgOperands() != 0 && isJVMState(CI->getArgOperand(0)))
+            State = cast<CallInst>(CI->getArgOperand(0));
+        }
+        if (State && (isa<CallInst>(&I) || isa<InvokeInst>(&I)) &&
+            !isJVMState(&I))
+          ReachingStates[&I] = State;
+
+        if (!canBeSafelyReplayed(&I)) {
+          ClobbersAll.set(B);
+          Gen[B].reset();
+        } else if (isJVMState(&I)) {
+          unsigned N = VMStateNumbers.lookup(cast<CallInst>(&I));
+          Gen[B].set(N);
+          Dominating[B].set(N);
+        }
+      }
+      ReachingOut[B] = State;
+
+      // The optimistic starting point
+      AvailOut[B] = ClobbersAll.test(B) ? Gen[B] : Dominating[B];
+    }
+  }
+
+  // Every sweep can only shrink the exit sets, so this terminates.  Without
+  // loops the second sweep finds nothing to change.
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (unsigned B = 0; B != NumBlocks; ++B) {
+      BitVector &In = AvailIn[B];
+      In.reset();
+      In.resize(NumStates);
+      bool First = true;
+      for (pred_iterator PI = pred_begin(Blocks[B]), PE = pred_end(Blocks[B]);
+           PI != PE; ++PI) {
+        DenseMap<const BasicBlock *, unsigned>::const_iterator P =
+          BlockNumbers.find(*PI);
+        if (P == BlockNumbers.end())
+          continue; // an unreachable edge
+        if (First)
+          In = AvailOut[P->second];
+        else
+          In &= AvailOut[P->second];
+        First = false;
+      }
+
+      BitVector Out = Gen[B];
+      if (!ClobbersAll.test(B))
+        Out |= In;
+      if (Out != AvailOut[B]) {
+        assert(!Out.test(AvailOut[B]) && "we're not monotonic!");
+        AvailOut[B] = std::move(Out);
+        Changed = true;
+      }
+    }
+  }
+
+  for (unsigned B = 0; B != NumBlocks; ++B) {
+    BitVector &Avail = AvailIn[B];
+    for (Instruction &I : *Blocks[B]) {
+      if (!canBeSafelyReplayed(&I)) {
+        Avail.reset();
+      } else if (isJVMState(&I)) {
+        unsigned N = VMStateNumbers.lookup(cast<CallInst>(&I));
+        if (Avail.any())
+          AvailableBefore.set(N);
+        Avail.set(N);
+      }
+    }
+    assert(Avail == AvailOut[B] &&
+           "this is not the fixed point you are looking for!");
+  }
+}
+
+bool VMStateInfo::isAvailableBefore(const CallInst *VMS) const {
+  DenseMap<const CallInst *, unsigned>::const_iterator I =
+    VMStateNumbers.find(VMS);
+  assert(I != VMStateNumbers.end() && "not a vm state of this function");
+  return AvailableBefore.test(I->second);
+}
+
+void VMStateInfo::print(raw_ostream &OS) const {
+  if (VMStates.empty())
+    return;
+  for (const CallInst *VMS : VMStates) {
+    OS << "  ";
+    VMS->printAsOperand(OS, false);
+    if (isAvailableBefore(VMS))
+      OS << ": another state available before";
+    OS << "\n";
+  }
+  for (const BasicBlock &BB : *VMStates.front()->getParent()->getParent())
+    for (const Instruction &I : BB)
+      if (CallInst *VMS = getReachingVMState(&I)) {
+        OS << "  reaching ";
+        VMS->printAsOperand(OS, false);
+        OS << ":" << I << "\n";
+      }
+}
+
+char VMStateInfoWrapperPass::ID = 0;
+INITIALIZE_PASS_BEGIN(VMStateInfoWrapperPass, "vmstate-info",
+                      "VM State Availability", true, true)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_END(VMStateInfoWrapperPass, "vmstate-info",
+                    "VM State Availability", true, true)
+
+VMStateInfoWrapperPass::VMStateInfoWrapperPass() : FunctionPass(ID) {
+  initializeVMStateInfoWrapperPassPass(*PassRegistry::getPassRegistry());
+}
+
+void VMStateInfoWrapperPass::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.setPreservesAll();
+}
+
+bool VMStateInfoWrapperPass::runOnFunction(Function &F) {
+  Info.compute(F, getAnalysis<DominatorTreeWrapperPass>().getDomTree());
+  return false;
+}
+
+void VMStateInfoWrapperPass::print(raw_ostream &OS, const Module *) const {
+  Info.print(OS);
+}
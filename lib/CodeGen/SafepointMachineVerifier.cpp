@@ -5,6 +5,9 @@
 #define DEBUG_TYPE "codegen-sp-verifier"
 
 #include "llvm/CodeGen/Passes.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
@@ -13,7 +16,6 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetInstrInfo.h"
 #include "llvm/Target/TargetMachine.h"
-#include "llvm/CodeGen/MachineDominators.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/StackMaps.h"
 #include "llvm/Support/CommandLine.h"
@@ -27,12 +29,40 @@ static cl::opt<bool> PrintOnly(
     "safepoint-machineInstr-verifier-print-only",
     cl::init(false));
 
+/// Verifying every function is too slow to leave on in production builds, so
+/// allow checking a sample of them.  Which functions are checked depends only
+/// on their names, so a failure found this way can be reproduced.
+static cl::opt<unsigned> SamplePercent(
+    "safepoint-machineInstr-verifier-sample", cl::init(100),
+    cl::desc("Percentage of functions checked by "
+             "-verify-safepoint-machineinstrs (default = 100)"));
+
+STATISTIC(NumFunctionsVerified, "Number of functions verified");
+STATISTIC(NumFunctionsSkipped, "Number of functions skipped by sampling");
+STATISTIC(NumIllegalUses, "Number of uses of unrelocated values found");
+
 namespace {
+  /// The unrelocated virtual registers generated and killed by a block, and
+  /// those unrelocated on entry and exit, indexed by virtual register index.
+  struct BlockState {
+    BitVector Gen, Kill, In, Out;
+  };
+
   class SafepointMachineVerifier : public MachineFunctionPass {
     virtual bool runOnMachineFunction(MachineFunction &MF);
 
     const MachineRegisterInfo *MRI;
     const TargetInstrInfo *TII;
+    const MachineFrameInfo *MFI;
+
+    /// The stack slots stored to since the last statepoint in the current
+    /// block, and the virtual register stored to each of them.  Both are
+    /// indexed by frame index - MFI->getObjectIndexBegin().
+    BitVector SpilledSlots;
+    std::vector<unsigned> SlotVRegs;
+
+    /// Scratch set for computing the copies of a register.
+    BitVector Visited;
 
   public:
     static char ID; // Pass identification, replacement for typeid
@@ -41,91 +71,61 @@ namespace {
     }
 
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
-      AU.addRequired<MachineDominatorTree>();
-      AU.addPreserved<MachineDominatorTree>();
+      AU.setPreservesAll();
       MachineFunctionPass::getAnalysisUsage(AU);
     }
 
   private:
-    void addTransativeClosure(unsigned reg, std::set<unsigned>& invalid) {
-      if (invalid.find(reg) != invalid.end()) {
-        return;
-      }
-
-      // Physical registers are non-SSA form that the verifier can not handle.
-      // We believe the implementation to be conservative (i.e. not to report
-      // false positives) and the set of potential errors missed by this are
-      // small due to the fact that values passed to physical registers are
-      // unlikely passed to other vregs (i.e. values passed to calling
-      // convention physical registers are only directly used by calls) and
-      // values passed from physical registers are unlikely passed twice to
-      // different vregs (i.e. rax pass the return value to only one vreg).
-      if (TargetRegisterInfo::isPhysicalRegister(reg)) {
-        return;
-      }
-
-      invalid.insert(reg);
-
-      for (MachineRegisterInfo::use_iterator I = MRI->use_begin(reg),
-             E = MRI->use_end(); I!=E; I++) {
+    bool isSampled(const MachineFunction &MF) const {
+      if (SamplePercent >= 100)
+        return true;
+      return hash_value(MF.getName()) % 100 < SamplePercent;
+    }
 
-        MachineOperand& Use = *I;
-        MachineInstr *UseMI = Use.getParent();
-        if (UseMI->isCopy()) {
-          assert(UseMI->getOperand(0).isReg() && UseMI->getOperand(1).isReg() && "copy must be between two registers");
-          if (UseMI->getOperand(0).getReg() == reg) {
-            addTransativeClosure(UseMI->getOperand(1).getReg(), invalid);
-          } else {
-            addTransativeClosure(UseMI->getOperand(0).getReg(), invalid);
-          }
-        }
-      }
+    void startBlock() {
+      SpilledSlots.reset();
     }
 
-    unsigned getGCStartIndex(MachineInstr* MI) {
-      StatepointOpers statepoint = StatepointOpers(MI);
-      assert(MI->getOperand(statepoint.getStackNumIdx()).isImm()
-          && MI->getOperand(statepoint.getLocalNumIdx()).isImm()
-          && MI->getOperand(statepoint.getMonitorNumIdx()).isImm()
-          && "deopt numbers must be immediate");
-      unsigned num_stack =
-          MI->getOperand(statepoint.getStackNumIdx()).getImm();
-      unsigned num_local =
-          MI->getOperand(statepoint.getLocalNumIdx()).getImm();
-      unsigned num_monitor =
-          MI->getOperand(statepoint.getMonitorNumIdx()).getImm();
-      unsigned gc_start = statepoint.getMonitorNumIdx() + 1;
-
-      // skip deopt values
-      for (unsigned i = 0; i < num_stack + num_local + num_monitor; i++) {
-        if (i < num_stack + num_local) {
-          // first skip StackMaps::ConstantOp and deopt value type int
-          // this does not apply to monitors
-          gc_start += 2;
+    void computeLocalState(MachineBasicBlock &MBB, BlockState &State,
+                           bool &HasStatepoint);
+    void checkBlock(MachineBasicBlock &MBB,
+                    const std::vector<BlockState> &States);
+    void transfer(MachineInstr *MI, SmallVectorImpl<unsigned> &Kills,
+                  SmallVectorImpl<unsigned> &Gens);
+    void reportIllegalUse(MachineInstr *MI);
+
+    /// Add the virtual register Reg, and every virtual register copied from
+    /// it, to Result.  A value copied to or from a physical register is not
+    /// followed.  Those are unlikely to be used other than directly by a
+    /// call or to be copied to more than one virtual register, so this misses
+    /// few errors and reports no false ones.
+    void addTransitiveCopies(unsigned Reg, SmallVectorImpl<unsigned> &Result) {
+      if (!TargetRegisterInfo::isVirtualRegister(Reg))
+        return;
+      unsigned Begin = Result.size();
+      SmallVector<unsigned, 8> Worklist(1, Reg);
+      while (!Worklist.empty()) {
+        unsigned R = Worklist.pop_back_val();
+        unsigned Idx = TargetRegisterInfo::virtReg2Index(R);
+        if (Visited.test(Idx))
+          continue;
+        Visited.set(Idx);
+        Result.push_back(R);
+
+        for (MachineRegisterInfo::use_iterator I = MRI->use_begin(R),
+               E = MRI->use_end(); I != E; ++I) {
+          MachineInstr *UseMI = I->getParent();
+          if (!UseMI->isCopy())
+            continue;
+          unsigned Dst = UseMI->getOperand(0).getReg();
+          if (TargetRegisterInfo::isVirtualRegister(Dst))
+            Worklist.push_back(Dst);
         }
-        MachineOperand& MO = MI->getOperand(gc_start);
-
-        // frame index value is lowered to 4 operands as below
-        // MIB.addImm(StackMaps::IndirectMemRefOp);
-        // MIB.addImm(MF.getFrameInfo()->getObjectSize(MO.getIndex()));
-        // MIB.addFrameIndex(MO.getIndex());
-        // MIB.addImm(0);
-        // Refer to TargetLoweringBase.cpp for more details
-
-        // This assert need to be changed if we change the fact that
-        // all vmstate values are spilled
-        assert(MO.isImm() && MO.getImm() == StackMaps::IndirectMemRefOp
-            && "VMState values are all spilled and must be frame indexes");
-        gc_start += 4;
       }
-
-      return gc_start;
+      for (unsigned i = Begin, e = Result.size(); i != e; ++i)
+        Visited.reset(TargetRegisterInfo::virtReg2Index(Result[i]));
     }
   };
-
-  struct bb_exit_state {
-    std::set<unsigned> _invalid;
-  };
 }
 char SafepointMachineVerifier::ID = 0;
 char &llvm::SafepointMachineVerifierID = SafepointMachineVerifier::ID;
@@ -139,182 +139,212 @@ FunctionPass *llvm::createSafepointMachineVerifierPass() {
   return new SafepointMachineVerifier();
 }
 
-bool SafepointMachineVerifier::runOnMachineFunction(MachineFunction &MF) {
-  MRI = &MF.getRegInfo();
-  TII = MF.getTarget().getInstrInfo();
+/// Compute the effect of MI on the set of unrelocated values: the registers
+/// it defines become valid, and at a statepoint the gc values it reports,
+/// along with their copies, become unrelocated.
+void SafepointMachineVerifier::transfer(MachineInstr *MI,
+                                        SmallVectorImpl<unsigned> &Kills,
+                                        SmallVectorImpl<unsigned> &Gens) {
+  for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
+    const MachineOperand &MO = MI->getOperand(i);
+    if (MO.isReg() && MO.isDef() &&
+        TargetRegisterInfo::isVirtualRegister(MO.getReg()))
+      Kills.push_back(MO.getReg());
+  }
 
-  // There is no need to keep a frame index and vreg pair for each basic block and we dont care about joint them.
-  // Consider the following examples:
-  // mov vreg1, stack0            mov vreg2, stack0
-  // statepoint stack0            statepoint stack0
-  //                \              /
-  //               statepoint stack0
-  // and
-  // mov vreg1, stack0            mov vreg2, stack0
-  // statepoint stack0            statepoint stack0
-  // mov stack0, vreg3            mov stack0, vreg4
-  //                \              /
-  //               vreg5 = phi vreg3, vreg4
-  //               mov vreg5, stack0
-  //               statepoint stack0
-  // Those should be identical machine instructions based on how smart llvm is to fold the phi node.
-  // Either case we dont need to care about joining the frame index and vreg pairs from the incoming blocks,
-  // and we will always record the correct invalid vregs. In the first example, we could use either pair from
-  // the left incoming block or right incoming block, it dosn't matter because we will record both vreg1
-  // and vreg2 in the invalid list. In the second example, the pair is updated by vreg5 from both incoming
-  // block, and will record vreg5 in the invalid list.
-  std::map<int, unsigned> frameIndexVRegPair;
-  std::map<MachineBasicBlock*, bb_exit_state> state;
-  std::vector<MachineBasicBlock*> worklist;
-
-  // We put basic blocks those contain spills (instead of statepoint) into the worklist because we need to record
-  // them first. As spills dominate statepoint, we should not miss any statepoint. Statepoints those have no spills
-  // must be reachable from a statepoint which has spills.
-  for (MachineFunction::iterator I = MF.begin(), E = MF.end();
-      I != E; I++) {
-    MachineBasicBlock* MBB = &*I;
-    for (MachineBasicBlock::iterator MII = MBB->begin(),
-             MIE = MBB->end(); MII != MIE; MII++) {
-      MachineInstr* MI = &*MII;
-      if (MI->mayStore()) {
-        worklist.push_back(MBB);
-        break;
-      }
-    }
+  // Track gc values being spilled.
+  int FI;
+  unsigned SpilledReg = TII->isStoreToStackSlot(MI, FI);
+  if (SpilledReg != 0) {
+    unsigned Slot = FI - MFI->getObjectIndexBegin();
+    SpilledSlots.set(Slot);
+    SlotVRegs[Slot] = SpilledReg;
   }
 
-  // iterate until the invalid states stablize, checking on every iteration.
-  while (!worklist.empty()) {
-    MachineBasicBlock* currentBlock = worklist.back();
-    worklist.pop_back();
-
-    std::set<unsigned> validByDef;
-
-    for (MachineBasicBlock::iterator itr = currentBlock->begin(), end = currentBlock->getFirstNonPHI();
-        itr != end; itr++) {
-      MachineInstr* inst = &*itr;
-
-      assert(inst->isPHI() && "must be phi");
-      for (unsigned i = 1; i < inst->getNumOperands(); i = i + 2) {
-        if (inst->getOperand(i).isReg()) {
-          unsigned reg = inst->getOperand(i).getReg();
-          assert(i+1 < inst->getNumOperands() && inst->getOperand(i+1).isMBB() && "Could not find incoming basic block");
-          MachineBasicBlock* incomingBB = inst->getOperand(i+1).getMBB();
-          // here we dont need to care about RelocationPHIEscapes like the IR verifer
-          // because those unused relocation phis should be cleaned up by the optimizer
-          if (state[incomingBB]._invalid.find(reg) != state[incomingBB]._invalid.end()) {
-            errs() << "Illegal use of unrelocated machine value after safepoint found!\n";
-            errs() << "MachineInstr: ";
-            inst->dump();
-            if (!PrintOnly)
-              assert(0 && "use of invalid unrelocated machine value after safepoint!");
-          }
-        }
-      }
-      assert(inst->getOperand(0).isReg() && inst->getOperand(0).isDef()
-          && "phi shuold be assigned to a reg");
-      validByDef.insert(inst->getOperand(0).getReg());
-    }
+  if (MI->getOpcode() != TargetOpcode::STATEPOINT)
+    return;
+
+  for (unsigned i = StatepointOpers(MI).getGCStateIdx(),
+                e = MI->getNumOperands(); i != e; ++i) {
+    const MachineOperand &MO = MI->getOperand(i);
+    // We cannot assert there is always a spill for a slot, because we could
+    // spill a 0 (null value) to the stack.
+    if (MO.isFI() && SpilledSlots.test(MO.getIndex() -
+                                       MFI->getObjectIndexBegin()))
+      addTransitiveCopies(SlotVRegs[MO.getIndex() - MFI->getObjectIndexBegin()],
+                          Gens);
+    // gc values kept in registers are redefined by the statepoint
+    // itself; the incoming vreg is stale afterwards.
+    if (MO.isReg() && MO.isUse())
+      addTransitiveCopies(MO.getReg(), Gens);
+  }
 
-    std::set<unsigned> invalid;
-    // join all incoming invalid list from its predecessors
-    for (MachineBasicBlock::pred_iterator PI = currentBlock->pred_begin(), E = currentBlock->pred_end(); PI != E; ++PI) {
-      MachineBasicBlock* Pred = *PI;
-      bb_exit_state exit = state[Pred];
-      invalid.insert(exit._invalid.begin(), exit._invalid.end());
-    }
+  // After each statepoint the spills need to be forgotten, otherwise a
+  // slot a null was stored to for a later statepoint (which is not a
+  // register spill) would still be paired with the earlier value.
+  startBlock();
+}
 
-    // if an invalid value reaches its def, it should be removed from the list
-    for(std::set<unsigned>::iterator itr = validByDef.begin(), end = validByDef.end();
-        itr != end; itr++) {
-      std::set<unsigned>::iterator invalid_itr = invalid.find(*itr);
-      if( invalid_itr != invalid.end() ) {
-        invalid.erase(invalid_itr);
-      }
+void SafepointMachineVerifier::computeLocalState(MachineBasicBlock &MBB,
+                                                 BlockState &State,
+                                                 bool &HasStatepoint) {
+  startBlock();
+  SmallVector<unsigned, 8> Kills, Gens;
+  for (MachineBasicBlock::iterator I = MBB.begin(), E = MBB.end(); I != E;
+       ++I) {
+    if (I->getOpcode() == TargetOpcode::STATEPOINT)
+      HasStatepoint = true;
+    Kills.clear();
+    Gens.clear();
+    transfer(&*I, Kills, Gens);
+    for (unsigned Reg : Kills) {
+      unsigned Idx = TargetRegisterInfo::virtReg2Index(Reg);
+      State.Gen.reset(Idx);
+      State.Kill.set(Idx);
     }
+    for (unsigned Reg : Gens) {
+      unsigned Idx = TargetRegisterInfo::virtReg2Index(Reg);
+      State.Gen.set(Idx);
+      State.Kill.reset(Idx);
+    }
+  }
+}
 
-    // now scan the rest of the machine instruction in the block
-    for (MachineBasicBlock::iterator itr = currentBlock->getFirstNonPHI(), end = currentBlock->end(); itr != end; itr++) {
-      MachineInstr* inst = &*itr;
-
-      if (inst->getNumOperands() > 0) {
-        // first remove new def from the invalid list
-        for (unsigned i = 0; i < inst->getNumOperands(); i++) {
-          if (inst->getOperand(i).isReg() && inst->getOperand(i).isDef() && invalid.find(inst->getOperand(i).getReg()) != invalid.end()) {
-            invalid.erase(invalid.find(inst->getOperand(i).getReg()));
-          }
-        }
-
-        // check whether any operand is invalid
-        if (inst->getOpcode() != TargetOpcode::STATEPOINT) {
-          for (unsigned i = 1; i < inst->getNumOperands(); i++) {
-            if (!(!inst->getOperand(i).isReg() || !inst->getOperand(i).isUse()
-                || invalid.find(inst->getOperand(i).getReg()) == invalid.end())) {
-              errs() << "Illegal use of unrelocated machine value after safepoint found!\n";
-              errs() << "MachineInstr: ";
-              inst->dump();
-              if (!PrintOnly)
-                assert(0 && "use of invalid unrelocated value after safepoint!");
-            }
-          }
-        } else {
-          // only check call argument for statepoint because vmstate is not updated properly (a known bug)
-          assert(inst->getOperand(0).isImm() && "number of call args must be immediate");
-          int num_arg = inst->getOperand(0).getImm();
-          for (int i = 2; i < 2 + num_arg; i++) {
-            if (!(!inst->getOperand(i).isReg() || !inst->getOperand(i).isUse()
-                || invalid.find(inst->getOperand(i).getReg()) == invalid.end())) {
-              errs() << "Illegal use of unrelocated machine value after safepoint found!\n";
-              errs() << "MachineInstr: ";
-              inst->dump();
-              if (!PrintOnly)
-                assert(0 && "use of invalid unrelocated value after safepoint!");
-            }
-          }
-        }
+void SafepointMachineVerifier::reportIllegalUse(MachineInstr *MI) {
+  ++NumIllegalUses;
+  errs() << "Illegal use of unrelocated machine value after safepoint found!\n";
+  errs() << "MachineInstr: ";
+  MI->dump();
+  if (!PrintOnly)
+    assert(0 && "use of invalid unrelocated value after safepoint!");
+}
 
-        // track gc value from spills
-        int FI;
-        unsigned spilledReg = TII->isStoreToStackSlot(inst, FI);
-        if (spilledReg != 0) {
-          frameIndexVRegPair[FI] = spilledReg;
+/// Walk MBB with the final dataflow state, reporting every use of a value
+/// which is unrelocated at that point.
+void SafepointMachineVerifier::checkBlock(
+    MachineBasicBlock &MBB, const std::vector<BlockState> &States) {
+  startBlock();
+  BitVector Invalid = States[MBB.getNumber()].In;
+  SmallVector<unsigned, 8> Kills, Gens;
+  for (MachineBasicBlock::iterator I = MBB.begin(), E = MBB.end(); I != E;
+       ++I) {
+    MachineInstr *MI = &*I;
+
+    // A phi uses its operands at the end of the incoming blocks.  We don't
+    // need to care about relocation phis which escape like the IR verifier
+    // does, because unused relocation phis are cleaned up by the optimizer.
+    if (MI->isPHI()) {
+      for (unsigned i = 1, e = MI->getNumOperands(); i < e; i += 2) {
+        const MachineOperand &MO = MI->getOperand(i);
+        if (!MO.isReg() || !TargetRegisterInfo::isVirtualRegister(MO.getReg()))
+          continue;
+        const MachineBasicBlock *Pred = MI->getOperand(i + 1).getMBB();
+        if (States[Pred->getNumber()].Out.test(
+              TargetRegisterInfo::virtReg2Index(MO.getReg()))) {
+          reportIllegalUse(MI);
+          break;
         }
+      }
+    }
 
-        if (inst->getOpcode() == TargetOpcode::STATEPOINT) {
-          unsigned gc_start = getGCStartIndex(inst);
-
-          for (unsigned i = gc_start, e = inst->getNumOperands(); i != e; i++) {
-            MachineOperand& MO = inst->getOperand(i);
-            if (MO.isFI() && frameIndexVRegPair.find(MO.getIndex()) != frameIndexVRegPair.end()) {
-              // We cannot assert there is always a match, because we could
-              // spill a 0 (null value) to the stack and that stack does not
-              // have a match vreg
-              addTransativeClosure(frameIndexVRegPair[MO.getIndex()], invalid);
-            }
-          }
-
-          // after each statepoint, the frameIndex2vreg pair need to be cleared
-          // otherwise the previous pair relation might give us wrong
-          // information. eg. at statepoint1, we spill a vmstate value vreg1 to
-          // frame1 and record it into frameIndexVRegPair, and then at
-          // statepoint2, we spill a null (constant 0) gc value to frame1.
-          // Since we only record spill of registers, frame1 is not updated by
-          // the null spill and still paired with vreg1. We would end up
-          // recording vreg1 as a relocated gc value which is wrong.
-          frameIndexVRegPair.clear();
-
+    Kills.clear();
+    Gens.clear();
+    transfer(MI, Kills, Gens);
+    for (unsigned Reg : Kills)
+      Invalid.reset(TargetRegisterInfo::virtReg2Index(Reg));
+
+    if (!MI->isPHI()) {
+      // Only check the call arguments of a statepoint, because its vm state
+      // is not updated properly (a known bug).
+      unsigned Begin = 0, End = MI->getNumOperands();
+      if (MI->getOpcode() == TargetOpcode::STATEPOINT) {
+        StatepointOpers Statepoint(MI);
+        Begin = Statepoint.getCallArgsIdx();
+        End = Begin + Statepoint.getNumCallArgs();
+      }
+      for (unsigned i = Begin; i != End; ++i) {
+        const MachineOperand &MO = MI->getOperand(i);
+        if (MO.isReg() && MO.isUse() &&
+            TargetRegisterInfo::isVirtualRegister(MO.getReg()) &&
+            Invalid.test(TargetRegisterInfo::virtReg2Index(MO.getReg()))) {
+          reportIllegalUse(MI);
+          break;
         }
       }
     }
 
-    if (state[currentBlock]._invalid != invalid) {
-      state[currentBlock]._invalid = invalid;
-      for (MachineBasicBlock::succ_iterator PI = currentBlock->succ_begin(),
-          E = currentBlock->succ_end(); PI != E; ++PI) {
-        MachineBasicBlock *Succ = *PI;
-        worklist.push_back(Succ);
+    for (unsigned Reg : Gens)
+      Invalid.set(TargetRegisterInfo::virtReg2Index(Reg));
+  }
+}
+
+bool SafepointMachineVerifier::runOnMachineFunction(MachineFunction &MF) {
+  if (!isSampled(MF)) {
+    ++NumFunctionsSkipped;
+    return false;
+  }
+  ++NumFunctionsVerified;
+
+  MRI = &MF.getRegInfo();
+  TII = MF.getTarget().getInstrInfo();
+  MFI = MF.getFrameInfo();
+
+  // After register allocation there is nothing left to check.
+  unsigned NumVRegs = MRI->getNumVirtRegs();
+  if (NumVRegs == 0)
+    return false;
+
+  unsigned NumSlots = MFI->getObjectIndexEnd() - MFI->getObjectIndexBegin();
+  SpilledSlots.clear();
+  SpilledSlots.resize(NumSlots);
+  SlotVRegs.assign(NumSlots, 0);
+  Visited.clear();
+  Visited.resize(NumVRegs);
+
+  // The set of unrelocated values is a forward, may dataflow problem over
+  // virtual registers: a statepoint generates the values it reports (and
+  // their copies), a definition kills the register it defines.  Compute the
+  // effect of each block once, then iterate to a fixed point in reverse post
+  // order, which visits a block's predecessors first except along back edges.
+  //
+  // Which value a stack slot holds is only tracked within a block.  The
+  // statepoint lowering stores its gc values right before the statepoint, so
+  // this only misses slots stored to in an earlier block.
+  std::vector<BlockState> States(MF.getNumBlockIDs());
+  bool HasStatepoint = false;
+  for (MachineFunction::iterator I = MF.begin(), E = MF.end(); I != E; ++I) {
+    BlockState &State = States[I->getNumber()];
+    State.Gen.resize(NumVRegs);
+    State.Kill.resize(NumVRegs);
+    State.In.resize(NumVRegs);
+    State.Out.resize(NumVRegs);
+    computeLocalState(*I, State, HasStatepoint);
+  }
+  if (!HasStatepoint)
+    return false;
+
+  ReversePostOrderTraversal<MachineFunction *> RPOT(&MF);
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (MachineBasicBlock *MBB : RPOT) {
+      BlockState &State = States[MBB->getNumber()];
+      for (MachineBasicBlock::pred_iterator PI = MBB->pred_begin(),
+             PE = MBB->pred_end(); PI != PE; ++PI)
+        State.In |= States[(*PI)->getNumber()].Out;
+
+      // Out = Gen | (In & ~Kill)
+      BitVector Out = State.In;
+      Out.reset(State.Kill);
+      Out |= State.Gen;
+      if (Out != State.Out) {
+        State.Out = Out;
+        Changed = true;
       }
     }
   }
+
+  for (MachineBasicBlock *MBB : RPOT)
+    checkBlock(*MBB, States);
   return false;
 }
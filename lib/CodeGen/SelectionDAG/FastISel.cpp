@@ -42,6 +42,7 @@
 #include "llvm/CodeGen/Analysis.h"
 #include "llvm/CodeGen/FastISel.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "llvm/Analysis/Loads.h"
@@ -59,6 +60,7 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Operator.h"
+#include "llvm/IR/Statepoint.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Target/TargetInstrInfo.h"
@@ -846,6 +848,356 @@ bool FastISel::SelectPatchpoint(const CallInst *I) {
   return true;
 }
 
+const Instruction *
+FastISel::getLastStatepointResult(const Instruction *Statepoint) {
+  const Instruction *Last = Statepoint;
+  for (BasicBlock::const_iterator I = std::next(BasicBlock::const_iterator(
+         Statepoint)), E = Statepoint->getParent()->end(); I != E; ++I) {
+    const CallInst *CI = dyn_cast<CallInst>(I);
+    if (!CI || (!isGCRelocate(CI) && !isGCResult(CI)) ||
+        CI->getArgOperand(0) != Statepoint)
+      break;
+    Last = I;
+  }
+  return Last;
+}
+
+/// Returns true if V is recorded in the vm state of a statepoint as the
+/// constant Imm rather than spilled.  This matches SelectionDAGBuilder.
+static bool getStatepointConstant(const Value *V, int64_t &Imm) {
+  Imm = 0;
+  if (const auto *C = dyn_cast<ConstantInt>(V)) {
+    if (C->getBitWidth() > 64)
+      return false;
+    Imm = C->getBitWidth() == 1 ? C->getZExtValue() : C->getSExtValue();
+    return true;
+  }
+  if (const auto *C = dyn_cast<ConstantFP>(V)) {
+    APInt Bits = C->getValueAPF().bitcastToAPInt();
+    if (Bits.getBitWidth() > 64)
+      return false;
+    Imm = Bits.getZExtValue();
+    return true;
+  }
+  return isa<ConstantPointerNull>(V) || isa<UndefValue>(V);
+}
+
+/// \brief Spill a value incoming to a statepoint and add its stack slot to the
+/// statepoint operands.
+///
+/// Each register is spilled once per statepoint.  As in SelectionDAGBuilder,
+/// the slots are reused by position from FuncInfo.StatepointStackSlots.
+bool FastISel::addStatepointSpill(SmallVectorImpl<MachineOperand> &Ops,
+                                  const Value *V,
+                                  DenseMap<unsigned, int> &Slots,
+                                  unsigned &NumSlots) {
+  EVT VT = TLI.getValueType(V->getType(), /*AllowUnknown=*/true);
+  if (VT == MVT::Other || !VT.isSimple() || !TLI.isTypeLegal(VT))
+    return false;
+  unsigned Reg = getRegForValue(V);
+  if (!Reg)
+    return false;
+
+  MachineFrameInfo &MFI = *FuncInfo.MF->getFrameInfo();
+  DenseMap<unsigned, int>::iterator It = Slots.find(Reg);
+  int FI;
+  if (It != Slots.end()) {
+    FI = It->second;
+  } else {
+    unsigned Size = VT.getStoreSize();
+    unsigned Align = DL.getPrefTypeAlignment(V->getType());
+    if (NumSlots == FuncInfo.StatepointStackSlots.size()) {
+      FI = MFI.CreateStackObject(Size, Align, false);
+      FuncInfo.StatepointStackSlots.push_back(FI);
+    } else {
+      // A slot reused by position may have been created for a smaller value.
+      FI = FuncInfo.StatepointStackSlots[NumSlots];
+      if (MFI.getObjectSize(FI) < Size)
+        MFI.setObjectSize(FI, Size);
+      if (MFI.getObjectAlignment(FI) < Align)
+        MFI.setObjectAlignment(FI, Align);
+    }
+    ++NumSlots;
+    Slots[Reg] = FI;
+
+    TII.storeRegToStackSlot(*FuncInfo.MBB, FuncInfo.InsertPt, Reg,
+                            /*isKill=*/false, FI, MRI.getRegClass(Reg), &TRI);
+  }
+
+  // The custom inserter turns the frame index into a memory reference.
+  Ops.push_back(MachineOperand::CreateFI(FI));
+  return true;
+}
+
+bool FastISel::SelectStatepoint(const CallInst *I) {
+  // The code emitted so far goes if the statepoint falls back to
+  // SelectionDAG, which spills the values again.
+  flushLocalValueMap();
+  MachineBasicBlock::iterator SavedInsertPt = FuncInfo.InsertPt;
+  if (lowerStatepoint(I))
+    return true;
+  recomputeInsertPt();
+  if (SavedInsertPt != FuncInfo.InsertPt)
+    removeDeadCode(FuncInfo.InsertPt, SavedInsertPt);
+  return false;
+}
+
+/// \brief Lower a call statepoint along with its gc.relocate and gc.result
+/// calls, which are deferred until now.
+///
+/// This builds the same STATEPOINT as SelectionDAGBuilder::visitStatepoint:
+/// the call is lowered by the target, and every value in the vm state and gc
+/// state which isn't a constant is spilled, so each gc.relocate loads its
+/// value back.
+bool FastISel::lowerStatepoint(const CallInst *I) {
+  ImmutableCallSite CS(I);
+  ImmutableStatepoint Statepoint(CS);
+
+  // Each use must be in the run selected with the statepoint.
+  SmallVector<const CallInst *, 8> Relocates, Results;
+  const Instruction *Last = getLastStatepointResult(I);
+  for (BasicBlock::const_iterator It = I; &*It != Last;) {
+    const CallInst *R = cast<CallInst>(++It);
+    if (isGCRelocate(R))
+      Relocates.push_back(R);
+    else
+      Results.push_back(R);
+  }
+  if (Relocates.size() + Results.size() != I->getNumUses())
+    return false;
+
+  SmallVector<MachineOperand, 32> Args;
+  DenseMap<unsigned, int> Slots;
+  unsigned NumSlots = 0;
+
+  // The vm state, including the frames of the inlined callers.  Every frame's
+  // slots are laid out alike.
+  ImmutableCallSite::arg_iterator VI = Statepoint.vm_state_begin();
+  int NumStack = Statepoint.numJavaStackElements();
+  int NumLocals = Statepoint.numJavaLocals();
+  int NumMonitors = Statepoint.numJavaMonitors();
+  for (int Frame = 0, E = Statepoint.numCallerFrames(); ; ++Frame) {
+    for (int i = 0, e = NumStack + NumLocals + NumMonitors; i != e; ++i) {
+      // Stack and local slots lead with their type.
+      if (i < NumStack + NumLocals) {
+        Args.push_back(MachineOperand::CreateImm(StackMaps::ConstantOp));
+        Args.push_back(MachineOperand::CreateImm(
+          cast<ConstantInt>((VI++)->get())->getSExtValue()));
+      }
+      const Value *V = (VI++)->get();
+      int64_t Imm;
+      if (getStatepointConstant(V, Imm)) {
+        Args.push_back(MachineOperand::CreateImm(StackMaps::ConstantOp));
+        Args.push_back(MachineOperand::CreateImm(Imm));
+      } else if (!addStatepointSpill(Args, V, Slots, NumSlots))
+        return false;
+    }
+
+    if (Frame == E)
+      break;
+    // bci, #stack, #locals, #monitors of the next caller
+    for (int i = 0; i != 4; ++i) {
+      Args.push_back(MachineOperand::CreateImm(StackMaps::ConstantOp));
+      Args.push_back(MachineOperand::CreateImm(
+        cast<ConstantInt>(VI[i].get())->getSExtValue()));
+    }
+    NumStack = cast<ConstantInt>(VI[1].get())->getZExtValue();
+    NumLocals = cast<ConstantInt>(VI[2].get())->getZExtValue();
+    NumMonitors = cast<ConstantInt>(VI[3].get())->getZExtValue();
+    VI += 4;
+  }
+  assert(VI == Statepoint.vm_state_end() && "malformed caller frames");
+
+  // The gc state: a (derived, base) pair per distinct relocated register,
+  // with the truly derived pointers first.  Pairs holds the derived and base
+  // registers and the first relocate of each.
+  SmallVector<std::tuple<unsigned, unsigned, const CallInst *>, 8> Pairs;
+  SmallSet<unsigned, 8> Seen;
+  for (const CallInst *R : Relocates) {
+    GCRelocateOperands Opers(R);
+    unsigned Reg = getRegForValue(Opers.derivedPtr());
+    unsigned BaseReg = getRegForValue(Opers.basePtr());
+    if (!Reg || !BaseReg)
+      return false;
+    if (Seen.insert(Reg))
+      Pairs.push_back(std::make_tuple(Reg, BaseReg, R));
+  }
+  std::stable_partition(Pairs.begin(), Pairs.end(),
+    [](const std::tuple<unsigned, unsigned, const CallInst *> &P) {
+      return std::get<0>(P) != std::get<1>(P);
+    });
+  for (auto &P : Pairs) {
+    GCRelocateOperands Opers(std::get<2>(P));
+    if (!addStatepointSpill(Args, Opers.derivedPtr(), Slots, NumSlots) ||
+        !addStatepointSpill(Args, Opers.basePtr(), Slots, NumSlots))
+      return false;
+  }
+
+  // Lower the actual call.
+  // Attributes for args start at offset 1, after the return attribute.
+  const Value *Callee = Statepoint.actualCallee();
+  FunctionType *FTy = cast<FunctionType>(
+    cast<PointerType>(Callee->getType())->getElementType());
+  unsigned ArgBegin = Statepoint.call_args_begin() - CS.arg_begin();
+  unsigned NumArgs = Statepoint.numCallArgs();
+  ArgListTy CallArgs;
+  CallArgs.reserve(NumArgs);
+  for (unsigned ArgI = ArgBegin, ArgE = ArgBegin + NumArgs; ArgI != ArgE;
+       ++ArgI) {
+    Value *V = I->getArgOperand(ArgI);
+    ArgListEntry Entry;
+    Entry.Val = V;
+    Entry.Ty = V->getType();
+    Entry.setAttributes(&CS, ArgI + 1);
+    CallArgs.push_back(Entry);
+  }
+
+  CallingConv::ID CC = CS.getCallingConv();
+  CallLoweringInfo CLI;
+  CLI.setCallee(CC, FTy->getReturnType(), Callee, std::move(CallArgs),
+                FTy->getNumParams());
+  CLI.IsVarArg = FTy->isVarArg();
+  CLI.IsReturnValueUsed = !Results.empty();
+  if (!LowerCallTo(CLI))
+    return false;
+  assert(CLI.Call && "No call instruction specified.");
+
+  // Build the STATEPOINT in place of the call.  The call arguments passed in
+  // registers are explicit uses.
+  MachineInstrBuilder MIB = BuildMI(*FuncInfo.MBB, CLI.Call, DbgLoc,
+                                    TII.get(TargetOpcode::STATEPOINT));
+  MIB.addImm(CLI.OutRegs.size());
+  MIB.addOperand(CLI.Call->getOperand(0));
+  for (auto Reg : CLI.OutRegs)
+    MIB.addReg(Reg);
+
+  // Flags and calling convention masked together, then the metadata
+  // (#caller frames, bci, #stack, #locals, #monitors).
+  int Flags = cast<ConstantInt>(CS.getArgument(2))->getZExtValue();
+  assert(Flags == 0 && "not expected to be used");
+  MIB.addImm(StackMaps::ConstantOp);
+  MIB.addImm(Flags | ((unsigned)CC << 1));
+  int Metadata[] = { Statepoint.numCallerFrames(), Statepoint.bci(),
+                     Statepoint.numJavaStackElements(),
+                     Statepoint.numJavaLocals(),
+                     Statepoint.numJavaMonitors() };
+  for (int M : Metadata) {
+    MIB.addImm(StackMaps::ConstantOp);
+    MIB.addImm(M);
+  }
+
+  for (auto &MO : Args)
+    MIB.addOperand(MO);
+
+  // The register mask and the implicit operands of the call.  Like the
+  // STATEPOINT SelectionDAG emits, this leaves out the argument registers
+  // already used and the registers the call opcode reads (the stack pointer),
+  // and defines those read by the call frame destroy after it.
+  const MCInstrDesc &CallDesc = CLI.Call->getDesc();
+  const uint16_t *CallUses = CallDesc.getImplicitUses();
+  const uint16_t *CallUsesEnd = CallUses + CallDesc.getNumImplicitUses();
+  for (unsigned i = 1, e = CLI.Call->getNumOperands(); i != e; ++i) {
+    const MachineOperand &MO = CLI.Call->getOperand(i);
+    if (MO.isRegMask()) {
+      MIB.addOperand(MO);
+      const MCInstrDesc &Destroy = TII.get(TII.getCallFrameDestroyOpcode());
+      for (const uint16_t *R = Destroy.getImplicitUses(),
+                          *RE = R + Destroy.getNumImplicitUses(); R != RE; ++R)
+        MIB.addReg(*R, RegState::ImplicitDefine);
+      continue;
+    }
+    if (!MO.isReg() || !MO.isImplicit())
+      continue;
+    if (MO.isUse() &&
+        (std::find(CLI.OutRegs.begin(), CLI.OutRegs.end(), MO.getReg()) !=
+           CLI.OutRegs.end() ||
+         std::find(CallUses, CallUsesEnd, MO.getReg()) != CallUsesEnd))
+      continue;
+    MIB.addOperand(MO);
+  }
+
+  CLI.Call->eraseFromParent();
+
+  // Now the deferred results.  The relocated values are reloaded after the
+  // call, once per register.
+  for (const CallInst *R : Results)
+    if (CLI.NumResultRegs && !R->use_empty())
+      UpdateValueMap(R, CLI.ResultReg, CLI.NumResultRegs);
+
+  DenseMap<unsigned, unsigned> Reloads;
+  for (const CallInst *R : Relocates) {
+    if (R->use_empty())
+      continue;
+    unsigned Reg = getRegForValue(GCRelocateOperands(R).derivedPtr());
+    unsigned &ResultReg = Reloads[Reg];
+    if (!ResultReg) {
+      const TargetRegisterClass *RC = MRI.getRegClass(Reg);
+      ResultReg = createResultReg(RC);
+      TII.loadRegFromStackSlot(*FuncInfo.MBB, FuncInfo.InsertPt, ResultReg,
+                               Slots[Reg], RC, &TRI);
+    }
+    UpdateValueMap(R, ResultReg);
+  }
+  return true;
+}
+
+/// Returns true if I is among the gc.relocate and gc.result calls selected
+/// with the call statepoint SP.
+static bool isDeferredStatepointResult(const CallInst *I,
+                                       const Instruction *SP) {
+  if (isa<InvokeInst>(SP) || I->getParent() != SP->getParent())
+    return false;
+  const Instruction *Last = FastISel::getLastStatepointResult(SP);
+  for (BasicBlock::const_iterator It = SP; &*It != Last;)
+    if (&*++It == I)
+      return true;
+  return false;
+}
+
+bool FastISel::SelectGCRelocate(const CallInst *I) {
+  GCRelocateOperands Opers(I);
+  const Instruction *SP = Opers.statepoint();
+  if (isDeferredStatepointResult(I, SP))
+    return true;
+  if (!isa<InvokeInst>(SP))
+    return false;
+
+  // The relocates of an invoke are in its normal or unwind destination.  They
+  // reload the slot the value was spilled to when the invoke was lowered.
+  DenseMap<const Value *, int> &Slots = FuncInfo.StatepointRelocationSlots[SP];
+  DenseMap<const Value *, int>::iterator It = Slots.find(Opers.derivedPtr());
+  assert(It != Slots.end() && "relocated value of invoke not spilled");
+
+  EVT VT = TLI.getValueType(I->getType(), /*AllowUnknown=*/true);
+  if (VT == MVT::Other || !VT.isSimple() || !TLI.isTypeLegal(VT))
+    return false;
+  const TargetRegisterClass *RC = TLI.getRegClassFor(VT.getSimpleVT());
+  unsigned ResultReg = createResultReg(RC);
+  TII.loadRegFromStackSlot(*FuncInfo.MBB, FuncInfo.InsertPt, ResultReg,
+                           It->second, RC, &TRI);
+  UpdateValueMap(I, ResultReg);
+  return true;
+}
+
+bool FastISel::SelectGCResult(const CallInst *I) {
+  const Instruction *SP = cast<Instruction>(I->getArgOperand(0));
+  if (isDeferredStatepointResult(I, SP))
+    return true;
+  if (!isa<InvokeInst>(SP))
+    return false;
+
+  // The result of an invoke was exported from its block.
+  DenseMap<const Instruction *, unsigned>::iterator It =
+    FuncInfo.StatepointResultRegs.find(SP);
+  assert(It != FuncInfo.StatepointResultRegs.end() &&
+         "result of invoked statepoint not exported");
+  EVT VT = TLI.getValueType(I->getType(), /*AllowUnknown=*/true);
+  if (VT == MVT::Other || !VT.isSimple() || !TLI.isTypeLegal(VT))
+    return false;
+  UpdateValueMap(I, It->second);
+  return true;
+}
+
 /// Returns an AttributeSet representing the attributes applied to the return
 /// value of the given call.
 static AttributeSet getReturnAttrs(FastISel::CallLoweringInfo &CLI) {
@@ -1209,6 +1561,14 @@ bool FastISel::SelectIntrinsicCall(const IntrinsicInst *II) {
   case Intrinsic::experimental_patchpoint_void:
   case Intrinsic::experimental_patchpoint_i64:
     return SelectPatchpoint(II);
+  case Intrinsic::statepoint:
+    return SelectStatepoint(II);
+  case Intrinsic::gc_relocate:
+    return SelectGCRelocate(II);
+  case Intrinsic::gc_result_int:
+  case Intrinsic::gc_result_float:
+  case Intrinsic::gc_result_ptr:
+    return SelectGCResult(II);
   }
 
   return FastLowerIntrinsicCall(II);
@@ -242,6 +242,8 @@ void FunctionLoweringInfo::clear() {
   ByValArgFrameIndexMap.clear();
   RegFixups.clear();
   StatepointStackSlots.clear();
+  StatepointRelocationSlots.clear();
+  StatepointResultRegs.clear();
 }
 
 /// CreateReg - Allocate a single virtual register for the given type.
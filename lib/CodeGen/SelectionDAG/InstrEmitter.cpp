@@ -212,7 +212,11 @@ void InstrEmitter::CreateVirtualRegisters(SDNode *Node,
          "IMPLICIT_DEF should have been handled as a special case elsewhere!");
 
   unsigned NumResults = CountResults(Node);
-  for (unsigned i = 0; i < II.getNumDefs(); ++i) {
+  unsigned NumDefs = II.getNumDefs();
+  // The relocated gc pointers defined by a STATEPOINT are variadic
+  if (Node->getMachineOpcode() == TargetOpcode::STATEPOINT)
+    NumDefs = NumResults;
+  for (unsigned i = 0; i < NumDefs; ++i) {
     // If the specific node value is only used by a CopyToReg and the dest reg
     // is a vreg in the same register class, use the CopyToReg'd destination
     // register instead of creating a new vreg.
@@ -232,7 +236,7 @@ void InstrEmitter::CreateVirtualRegisters(SDNode *Node,
         RC = VTRC;
     }
 
-    if (II.OpInfo[i].isOptionalDef()) {
+    if (i < II.getNumOperands() && II.OpInfo[i].isOptionalDef()) {
       // Optional def must be a physical register.
       unsigned NumResults = CountResults(Node);
       VRBase = cast<RegisterSDNode>(Node->getOperand(i-NumResults))->getReg();
@@ -750,10 +754,15 @@ EmitMachineNode(SDNode *Node, bool IsClone, bool IsCloned,
     }
     ScratchRegs = TLI->getScratchRegisters((CallingConv::ID) CC);
   }
+  // The results of a STATEPOINT are the relocated values of the gc pointers
+  // passed to it in registers.  They are not described by II.
+  if (Opc == TargetOpcode::STATEPOINT)
+    NumDefs = NumResults;
 
   unsigned NumImpUses = 0;
   unsigned NodeOperands =
-    countOperands(Node, II.getNumOperands() - NumDefs, NumImpUses);
+    countOperands(Node, II.getNumOperands() > NumDefs ?
+                          II.getNumOperands() - NumDefs : 0, NumImpUses);
   bool HasPhysRegOuts = NumResults > NumDefs && II.getImplicitDefs()!=nullptr;
 #ifndef NDEBUG
   unsigned NumMIOperands = NodeOperands + NumResults;
@@ -785,6 +794,23 @@ EmitMachineNode(SDNode *Node, bool IsClone, bool IsCloned,
     AddOperand(MIB, Node->getOperand(i), i-NumSkip+NumDefs, &II,
                VRBaseMap, /*IsDebug=*/false, IsClone, IsCloned);
 
+  // Tie each relocated gc pointer to the first operand passing in the value
+  if (Opc == TargetOpcode::STATEPOINT && NumDefs) {
+    unsigned VarIdx =
+      cast<ConstantSDNode>(Node->getOperand(0))->getZExtValue() + 2;
+    SmallVector<SDValue, 8> Seen;
+    unsigned Def = 0;
+    for (unsigned i = VarIdx; i != NodeOperands; ++i) {
+      SDValue Op = Node->getOperand(i);
+      if (!MIB->getOperand(NumDefs + i).isReg() ||
+          std::find(Seen.begin(), Seen.end(), Op) != Seen.end())
+        continue;
+      Seen.push_back(Op);
+      MIB->tieOperands(Def++, NumDefs + i);
+    }
+    assert(Def == NumDefs && "a relocated gc pointer without its value");
+  }
+
   // Add scratch registers as implicit def and early clobber
   if (ScratchRegs)
     for (unsigned i = 0; ScratchRegs[i]; ++i)
@@ -79,6 +79,29 @@ LimitFPPrecision("limit-float-precision",
 STATISTIC(NumSlotsAllocatedForStatepoints, "Number of stack slots allocated for statepoints");
 STATISTIC(NumOfStatepoints, "Number of statepoint nodes encountered");
 STATISTIC(StatepointMaxSlotsRequired, "Maximum number of stack slots required for a singe statepoint");
+STATISTIC(NumGCPtrsInRegisters, "Number of statepoint gc pointers passed in registers");
+
+/// The number of gc pointers at each statepoint which may be handed to the
+/// register allocator rather than spilled.  Those which the allocator can put
+/// in a callee saved register are recorded as Register locations, the rest
+/// are still folded into stack slots.  A tied def has to be among the first
+/// 15 operands of a MachineInstr, which bounds this.
+static cl::opt<unsigned>
+MaxStatepointGCRegs("statepoint-max-gc-regs",
+                    cl::desc("Maximum number of gc pointers passed in "
+                             "registers at each statepoint"),
+                    cl::init(0));
+static const unsigned StatepointGCRegsLimit = 15;
+
+/// When optimizing, give every value spilled at a statepoint a spill slot of
+/// its own and let StackSlotColoring share them based on their live ranges,
+/// together with the register allocator's spill slots.  Otherwise slots are
+/// reused by position across all statepoints in the function.
+static cl::opt<bool>
+StatepointSlotColoring("statepoint-stack-slot-coloring",
+                       cl::desc("Share statepoint spill slots through "
+                                "stack slot coloring"),
+                       cl::init(true));
 
 // Limit the width of DAG chains. This is important in general to prevent
 // prevent DAG-based analysis from blowing up. For example, alias analysis and
@@ -2010,24 +2033,7 @@ void SelectionDAGBuilder::visitInvoke(const InvokeInst &I) {
     if( Fn->getIntrinsicID() == Intrinsic::donothing) {
       // Ignore invokes to @llvm.donothing: jump directly to the next BB.
     } else if ( Fn->getIntrinsicID() == Intrinsic::statepoint) {
-      errs() << "Warning: Code Generation for Invoke of statepoint isn't actually implemented yet\n";
-      errs() << "Warning: THIS CODE WAS MISCOMPILED!!!\n";
-      // Adding support here won't be particularly hard.  We'll basically
-      // refactor out most of visitStatepoint and conditionally invoke it after
-      // LowerCallTo below.  I'm holding off for the moment to avoid nasty
-      // merge conflicts with Igor's out of tree changes to that function.
-
-      // HACK: Avoid crashing for the moment, but miscompile this code!
-      // Drop into normal successor.
-      DAG.setRoot(DAG.getNode(ISD::BR, getCurSDLoc(),
-                              MVT::Other, getControlRoot(),
-                              DAG.getBasicBlock(Return)));
-
-      // The GCRelocate code doesn't work without encountering a safepoint
-      // first.  Fail here with a clear message
-      assert( I.use_empty() && "Can't even miscompile invoke of statepoints with uses");
-
-      return;
+      visitStatepoint(&I, LandingPad);
     } else {
       // Why is this true?
       assert( false && "no other intrinsic is invokable");
@@ -5465,9 +5471,14 @@ SelectionDAGBuilder::visitIntrinsicCall(const CallInst &I, unsigned Intrinsic) {
     return nullptr;
   }
   case Intrinsic::statepoint: {
-    visitStatepoint(I);
+    visitStatepoint(&I);
     return 0;
   }
+  case Intrinsic::gc_landing_token:
+    // Only the gc.relocates in the landing pad use this, and they find the
+    // invoke through it at the IR level.
+    setValue(&I, DAG.getConstant(-1, MVT::i32));
+    return 0;
   case Intrinsic::gc_result_int:
   case Intrinsic::gc_result_float:
   case Intrinsic::gc_result_ptr: {
@@ -6951,20 +6962,40 @@ void SelectionDAGBuilder::visitStackmap(const CallInst &CI) {
 SDValue SelectionDAGBuilder::StatepointLoweringState::allocateStackSlot(EVT ValueType,
                                                                         SelectionDAGBuilder &Builder) {
   NumSlotsAllocated++;
-  
-  if (NumSlotsAllocated > Builder.FuncInfo.StatepointStackSlots.size()) {
+  if( NumSlotsAllocated > StatepointMaxSlotsRequired ) {
+    StatepointMaxSlotsRequired = NumSlotsAllocated;
+  }
+
+  MachineFrameInfo *MFI = Builder.DAG.getMachineFunction().getFrameInfo();
+  const DataLayout *DL = Builder.DAG.getTarget().getDataLayout();
+  unsigned Size = ValueType.getStoreSize();
+  unsigned Align =
+    DL->getPrefTypeAlignment(ValueType.getTypeForEVT(*Builder.DAG.getContext()));
+
+  // Spill slots are what StackSlotColoring knows how to share.  It only runs
+  // along with the optimizing register allocator.
+  bool Coloring = StatepointSlotColoring &&
+    Builder.DAG.getTarget().getOptLevel() != CodeGenOpt::None;
+
+  if (Coloring ||
+      NumSlotsAllocated > Builder.FuncInfo.StatepointStackSlots.size()) {
     // record stats
     NumSlotsAllocatedForStatepoints++;
-    if( NumSlotsAllocated > StatepointMaxSlotsRequired ) {
-      StatepointMaxSlotsRequired = NumSlotsAllocated;
+
+    if (Coloring) {
+      const int FI = MFI->CreateSpillStackObject(Size, Align);
+      return Builder.DAG.getFrameIndex(FI, ValueType);
     }
-    
-    SDValue SpillSlot = Builder.DAG.CreateStackTemporary(ValueType);
-    const unsigned FI = cast<FrameIndexSDNode>(SpillSlot)->getIndex();
+    const int FI = MFI->CreateStackObject(Size, Align, false);
     Builder.FuncInfo.StatepointStackSlots.push_back(FI);
-    return SpillSlot;
+    return Builder.DAG.getFrameIndex(FI, ValueType);
   } else {
+    // A slot reused by position may have been created for a smaller value.
     const unsigned FI = Builder.FuncInfo.StatepointStackSlots[NumSlotsAllocated - 1];
+    if (MFI->getObjectSize(FI) < Size)
+      MFI->setObjectSize(FI, Size);
+    if (MFI->getObjectAlignment(FI) < Align)
+      MFI->setObjectAlignment(FI, Align);
     return Builder.DAG.getFrameIndex(FI, ValueType);
   }
 }
@@ -7031,18 +7062,20 @@ namespace {
   }
 
   // Extract call from statepoint, lower it and return pointer to the
-  // call node.
+  // call node.  An invoked statepoint passes its landing pad, which brackets
+  // the call with EH labels.
   // Also update NodeMap so that getValue(statepoint) will reference lowered call result
-  static SDNode *lowerCallFromStatepoint(const CallInst &CI, 
+  static SDNode *lowerCallFromStatepoint(ImmutableCallSite CS,
+                                          MachineBasicBlock *LandingPad,
                                           SelectionDAGBuilder &Builder) {
     
-    assert( Intrinsic::statepoint == dyn_cast<IntrinsicInst>(&CI)->getIntrinsicID() &&
-            "function called must be the statepoint function");
+    assert(isStatepoint(CS) &&
+           "function called must be the statepoint function");
 
-    int NumCallArgs = dyn_cast<ConstantInt>(CI.getArgOperand(1))->getZExtValue();
+    int NumCallArgs = cast<ConstantInt>(CS.getArgument(1))->getZExtValue();
     assert(NumCallArgs >= 0 && "non-negative");
 
-    ImmutableStatepoint statepointOpers(&CI);
+    ImmutableStatepoint statepointOpers(CS);
 
     // Lower the actual call itself - This is a bit of a hack, but we want to
     // avoid modifying the actual lowering code.  This is similiar in intent to
@@ -7059,10 +7092,12 @@ namespace {
     CallInst::const_op_iterator arg_end = statepointOpers.call_args_end();
     args.insert(args.end(), arg_begin, arg_end); 
     CallInst* tmp = CallInst::Create(ActualCallee, args);
-    tmp->setTailCall(CI.isTailCall());
-    tmp->setCallingConv(CI.getCallingConv());
-    tmp->setAttributes(CI.getAttributes());
-    Builder.LowerCallTo(tmp, Builder.getValue(ActualCallee), false);
+    tmp->setTailCall(CS.isCall() &&
+                     cast<CallInst>(CS.getInstruction())->isTailCall());
+    tmp->setCallingConv(CS.getCallingConv());
+    tmp->setAttributes(CS.getAttributes());
+    Builder.LowerCallTo(tmp, Builder.getValue(ActualCallee), false,
+                        LandingPad);
 
     // Handle the return value of the call iff any. 
     const bool hasDef = !tmp->getType()->isVoidTy();
@@ -7070,10 +7105,10 @@ namespace {
       // The value of the statepoint itself will be the value of call itself.
       // We'll replace the actually call node shortly.  gc_result will grab
       // this value.
-      Builder.setValue(&CI, Builder.getValue(tmp));
+      Builder.setValue(CS.getInstruction(), Builder.getValue(tmp));
     } else {
       // The token value is never used from here on, just generate a poison value
-      Builder.setValue(&CI, Builder.DAG.getIntPtrConstant(-1));
+      Builder.setValue(CS.getInstruction(), Builder.DAG.getIntPtrConstant(-1));
     }
     // Remove the fake entry we created so we don't have a hanging reference
     // after we delete this node.
@@ -7089,8 +7124,13 @@ namespace {
     // We just emitted a call, so it should be last thing generated
     SDValue Chain = Builder.DAG.getRoot();
 
-    // Find closest CALLSEQ_END walking back through lowered nodes if needed
+    // Find closest CALLSEQ_END walking back through lowered nodes if needed.
+    // The call of an invoke is followed by the EH label ending its try range.
     SDNode* CallEnd = Chain.getNode();
+    if (LandingPad) {
+      assert(CallEnd->getOpcode() == ISD::EH_LABEL && "expected end label");
+      CallEnd = CallEnd->getOperand(0).getNode();
+    }
     int sanity = 0;
     while (CallEnd->getOpcode() != ISD::CALLSEQ_END) {
       CallEnd = CallEnd->getGluedNode();
@@ -7136,26 +7176,44 @@ namespace {
   //   Ptrs - derived pointers incoming to this statepoint
   // Elements of this arrays should be in one-to-one correspondence with each other
   // i.e Bases[i], Ptrs[i] are from the same gcrelocate call
+  // The gc.landing_token in the unwind destination of an invoked statepoint,
+  // or null.  
+  static const Instruction *getLandingToken(const Instruction &Statepoint) {
+    const InvokeInst *II = dyn_cast<InvokeInst>(&Statepoint);
+    if (!II)
+      return nullptr;
+    for (const Instruction &I : *II->getUnwindDest())
+      if (isGCLandingToken(&I))
+        return &I;
+    return nullptr;
+  }
+
   static void getIncomingStatepointGCValues(SmallVectorImpl<const Value*> &Bases,
                                             SmallVectorImpl<const Value*> &Ptrs,
-                                            const CallInst &Statepoint,
+                                            const Instruction &Statepoint,
                                             SelectionDAGBuilder &Builder)
   {
-    // Search for relocated pointers
-    for (Value::const_user_iterator I = Statepoint.user_begin(), 
-                                    E = Statepoint.user_end();
-         I != E;
-         ++I)
-    {
-      assert((isGCRelocate(*I) || isGCResult(*I)) && "the only possible uses of a statepoint token!");
+    // Search for relocated pointers.  An invoke relocates along its
+    // exceptional edge too, through the landing token.
+    const Instruction *Tokens[] = { &Statepoint, getLandingToken(Statepoint) };
+    for (const Instruction *Token : Tokens) {
+      if (!Token)
+        continue;
+      for (Value::const_user_iterator I = Token->user_begin(),
+                                      E = Token->user_end();
+           I != E;
+           ++I)
+      {
+        assert((isGCRelocate(*I) || isGCResult(*I)) && "the only possible uses of a statepoint token!");
 
-      // gc_result is handled separately, no need to track here
-      if (isGCResult(*I)) continue;
+        // gc_result is handled separately, no need to track here
+        if (isGCResult(*I)) continue;
 
-      std::pair<const Value*, const Value*> info = parseGCRelocCall(*cast<CallInst>(*I), &Statepoint);
+        std::pair<const Value*, const Value*> info = parseGCRelocCall(*cast<CallInst>(*I), &Statepoint);
 
-      Bases.push_back(info.first);
-      Ptrs.push_back(info.second);
+        Bases.push_back(info.first);
+        Ptrs.push_back(info.second);
+      }
     }
 
     // Note: The next two steps are really geared at multiple instruction
@@ -7213,15 +7271,36 @@ namespace {
     return std::make_pair(loc, Chain);
   }
 
+  // Can the gc pointer incoming to the current statepoint be passed in a
+  // register?  The first MaxStatepointGCRegs suitable values are.
+  static bool passGCValueInRegister(SDValue Incoming,
+                                    const SmallVectorImpl<SDValue> &GCRegs,
+                                    SelectionDAGBuilder &Builder) {
+    if (std::find(GCRegs.begin(), GCRegs.end(), Incoming) != GCRegs.end())
+      return true;
+    if (GCRegs.size() >= std::min(MaxStatepointGCRegs.getValue(),
+                                  StatepointGCRegsLimit))
+      return false;
+    // Constants and undef have nothing worth keeping in a register.  A value
+    // already spilled for the vm state keeps sharing that slot.
+    return !isa<ConstantSDNode>(Incoming) &&
+           Incoming.getOpcode() != ISD::UNDEF &&
+           !Builder.StatepointLowering.getLocation(Incoming).getNode();
+  }
+
   // Lower gc pointers incoming to statepoint.
   // Get all gc pointers from gcrelocate intrinsics referenced from statepoint,
-  // clean them up, and store all of them to stack.
+  // clean them up, and store them to stack unless they are passed in registers
+  // (see MaxStatepointGCRegs).  GCRegs gets the distinct values passed in
+  // registers in order of their first appearance; the statepoint defines the
+  // relocated value of each.  The gc.relocates of an invoke are in other
+  // blocks and reload from the stack, so it passes everything there.
   // lowered_args will contain ready to use operands for machine code statepoint.
   // Additionaly set's up dag root to last emitted store.
-  // TODO: Use callee saved registers when possible
   // TODO: Do not store constants to stack
   static void lowerStatepointGCState(SmallVectorImpl<SDValue> &lowered_args,
-                                     const CallInst &Statepoint,
+                                     SmallVectorImpl<SDValue> &GCRegs,
+                                     const Instruction &Statepoint,
                                      SelectionDAGBuilder &Builder)
   {
     SmallVector<const Value*, 10> bases, ptrs;
@@ -7237,18 +7316,68 @@ namespace {
       const Value *ir = i % 2 ? bases[i/2] : ptrs[i/2];
       SDValue incoming = Builder.getValue(ir);
 
+      if (!isa<InvokeInst>(Statepoint) &&
+          passGCValueInRegister(incoming, GCRegs, Builder)) {
+        if (std::find(GCRegs.begin(), GCRegs.end(), incoming) == GCRegs.end())
+          GCRegs.push_back(incoming);
+        lowered_args.push_back(incoming);
+        continue;
+      }
+
       std::pair<SDValue, SDValue> res =
         lowerIncomingStatepointValue(incoming, Chain, Builder);
 
       lowered_args.push_back(res.first);
       Chain = res.second;
     }
+    NumGCPtrsInRegisters += GCRegs.size();
 
     Builder.DAG.setRoot(Chain);
   }
 
-  // Lower vmstate arguments of the statepoint.
-  // Currently we unconditionally spill all of them onto stack.
+  // Lower one value of the vmstate.  Constants and undef are recorded as
+  // constants rather than spilled; undef slots are dead, so any value will
+  // do.  Constants too large for a location are moved into the constant pool
+  // when the stack map is emitted.
+  static void lowerStatepointVMStateValue(SmallVectorImpl<SDValue> &lowered_args,
+                                          const Value *V, SDValue &Chain,
+                                          SelectionDAGBuilder &Builder)
+  {
+    bool IsConstant = true;
+    int64_t Imm = 0;
+    if (const ConstantInt *C = dyn_cast<ConstantInt>(V)) {
+      if (C->getBitWidth() == 1)
+        Imm = C->getZExtValue();
+      else if (C->getBitWidth() <= 64)
+        Imm = C->getSExtValue();
+      else
+        IsConstant = false;
+    } else if (const ConstantFP *C = dyn_cast<ConstantFP>(V)) {
+      APInt Bits = C->getValueAPF().bitcastToAPInt();
+      if (Bits.getBitWidth() <= 64)
+        Imm = Bits.getZExtValue();
+      else
+        IsConstant = false;
+    } else if (!isa<ConstantPointerNull>(V) && !isa<UndefValue>(V)) {
+      IsConstant = false;
+    }
+
+    if (IsConstant) {
+      lowered_args.push_back(
+        Builder.DAG.getTargetConstant(StackMaps::ConstantOp, MVT::i64));
+      lowered_args.push_back(Builder.DAG.getTargetConstant(Imm, MVT::i64));
+      return;
+    }
+
+    std::pair<SDValue, SDValue> res =
+      lowerIncomingStatepointValue(Builder.getValue(V), Chain, Builder);
+    lowered_args.push_back(res.first);
+    Chain = res.second;
+  }
+
+  // Lower vmstate arguments of the statepoint, including the frames of the
+  // inlined callers.
+  // Currently we unconditionally spill all non-constant values onto stack.
   // Non-csr registers in vmstate could lead to the fact that values in them
   // will be overwritten by subsequent calls. Even if they do not contain gc pointers.
   // In general we can use csr registers for non-gcptr values but we don't do that now.
@@ -7258,47 +7387,45 @@ namespace {
   {
     SDValue chain = Builder.getRoot();
 
-    for (int i = 0, e = Statepoint.numJavaStackElements(); i != e; ++i) {
-      lowered_args.push_back(
-        Builder.DAG.getTargetConstant(StackMaps::ConstantOp, MVT::i64));
-      lowered_args.push_back(Builder.DAG.getTargetConstant(
-        Statepoint.javaStackElementTypeAt(i).coerceToInt(), MVT::i32));
-
-      SDValue val = Builder.getValue(Statepoint.javaStackElementAt(i));
-
-      std::pair<SDValue, SDValue> res =
-        lowerIncomingStatepointValue(val, chain, Builder);
-      lowered_args.push_back(res.first);
-      chain = res.second;
-    }
-    for (int i = 0, e = Statepoint.numJavaLocals(); i != e; ++i) {
-      lowered_args.push_back(
-        Builder.DAG.getTargetConstant(StackMaps::ConstantOp, MVT::i64));
-      lowered_args.push_back(
-        Builder.DAG.getTargetConstant(
-          Statepoint.javaLocalTypeAt(i).coerceToInt(), MVT::i32));
-
-      SDValue val = Builder.getValue(Statepoint.javaLocalAt(i));
-
-      std::pair<SDValue, SDValue> res =
-        lowerIncomingStatepointValue(val, chain, Builder);
-      lowered_args.push_back(res.first);
-      chain = res.second;
-    }
-    for (int i = 0, e = Statepoint.numJavaMonitors(); i != e; ++i) {
-      SDValue val = Builder.getValue(Statepoint.javaMonitorAt(i));
+    // Every frame's slots are laid out alike, only the header of the
+    // statepoint's own frame is elsewhere (see visitStatepoint).
+    ImmutableCallSite::arg_iterator I = Statepoint.vm_state_begin();
+    int numStack = Statepoint.numJavaStackElements();
+    int numLocals = Statepoint.numJavaLocals();
+    int numMonitors = Statepoint.numJavaMonitors();
+    for (int frame = 0, e = Statepoint.numCallerFrames(); ; ++frame) {
+      for (int i = 0; i != numStack + numLocals; ++i) {
+        lowered_args.push_back(
+          Builder.DAG.getTargetConstant(StackMaps::ConstantOp, MVT::i64));
+        lowered_args.push_back(Builder.DAG.getTargetConstant(
+          cast<ConstantInt>((I++)->get())->getSExtValue(), MVT::i32));
+        lowerStatepointVMStateValue(lowered_args, (I++)->get(), chain, Builder);
+      }
+      for (int i = 0; i != numMonitors; ++i)
+        lowerStatepointVMStateValue(lowered_args, (I++)->get(), chain, Builder);
 
-      std::pair<SDValue, SDValue> res =
-        lowerIncomingStatepointValue(val, chain, Builder);
-      lowered_args.push_back(res.first);
-      chain = res.second;
+      if (frame == e)
+        break;
+      // bci, #stack, #locals, #monitors of the next caller
+      for (int i = 0; i != 4; ++i) {
+        lowered_args.push_back(
+          Builder.DAG.getTargetConstant(StackMaps::ConstantOp, MVT::i64));
+        lowered_args.push_back(Builder.DAG.getTargetConstant(
+          cast<ConstantInt>(I[i].get())->getSExtValue(), MVT::i64));
+      }
+      numStack = cast<ConstantInt>(I[1].get())->getZExtValue();
+      numLocals = cast<ConstantInt>(I[2].get())->getZExtValue();
+      numMonitors = cast<ConstantInt>(I[3].get())->getZExtValue();
+      I += 4;
     }
+    assert(I == Statepoint.vm_state_end() && "malformed caller frames");
 
     Builder.DAG.setRoot(chain);
   }
 }
 
-void SelectionDAGBuilder::visitStatepoint(const CallInst &CI) {
+void SelectionDAGBuilder::visitStatepoint(ImmutableCallSite CS,
+                                          MachineBasicBlock *LandingPad) {
   // The basic scheme here is that information about both the original call and
   // the safepoint is encoded in the CallInst.  We create a temporary call and
   // lower it, then reverse engineer the calling sequence.
@@ -7306,17 +7433,21 @@ void SelectionDAGBuilder::visitStatepoint(const CallInst &CI) {
   NumOfStatepoints++;
 
   // Check some preconditions for sanity
-  assert(isStatepoint(&CI) && "function called must be the statepoint function");
-  assert(CI.getNumArgOperands() >= 7 && "Must have leading params");
+  assert(isStatepoint(CS) && "function called must be the statepoint function");
+  assert(CS.arg_size() >= 7 && "Must have leading params");
+  assert(CS.isInvoke() == (LandingPad != nullptr) &&
+         "an invoke must have a landing pad");
+  const Instruction &CI = *CS.getInstruction();
 
   // Clear state
   StatepointLowering.startNewStatepoint();
 
 #ifndef NDEBUG
-  // Consistency check
+  // Consistency check.  The gc.relocates of an invoke are in other blocks
+  // and not tracked.
   for (Value::const_user_iterator I = CI.user_begin(), 
          E = CI.user_end();
-       I != E;
+       I != E && !CS.isInvoke();
        ++I)
   {
     const CallInst *gcRelocCall = dyn_cast<CallInst>(*I);
@@ -7334,16 +7465,17 @@ void SelectionDAGBuilder::visitStatepoint(const CallInst &CI) {
   }
 #endif
 
-  ImmutableStatepoint statepoint(&CI);
+  ImmutableStatepoint statepoint(CS);
 
   // Lower statepoint vmstate and gcstate arguments
   // Curently this emits stores of all gc and vm values into stack
   SmallVector<SDValue, 10> lowered_args;
+  SmallVector<SDValue, 4> GCRegs;
   lowerStatepointVMState(lowered_args, statepoint, *this);
-  lowerStatepointGCState(lowered_args, CI, *this);
+  lowerStatepointGCState(lowered_args, GCRegs, CI, *this);
 
   // Get call node, we will replace it later with statepoint
-  SDNode *CallNode = lowerCallFromStatepoint(CI, *this);
+  SDNode *CallNode = lowerCallFromStatepoint(CS, LandingPad, *this);
 
   // Construct the actual STATEPOINT node with all the appropriate arguments
   // and return values.
@@ -7395,16 +7527,16 @@ void SelectionDAGBuilder::visitStatepoint(const CallInst &CI) {
 
   // Add a leading constant argument with the Flags and the calling convention
   // masked together
-  CallingConv::ID CallConv = CI.getCallingConv();
-  int Flags = dyn_cast<ConstantInt>(CI.getArgOperand(2))->getZExtValue();
+  CallingConv::ID CallConv = CS.getCallingConv();
+  int Flags = cast<ConstantInt>(CS.getArgument(2))->getZExtValue();
   assert( Flags == 0 && "not expected to be used" );
   Ops.push_back(DAG.getTargetConstant(StackMaps::ConstantOp, MVT::i64));
   Ops.push_back(DAG.getTargetConstant(Flags | ((unsigned)CallConv << 1), MVT::i64));
 
   // Copy the VM state data into the STATEPOINT
-  // - First, the metadata (bci, #stack, #local, #nummon)
+  // - First, the metadata (#caller frames, bci, #stack, #local, #nummon)
   //
-  int metadata[] = { statepoint.callerVM(), statepoint.bci(), statepoint.numJavaStackElements(),
+  int metadata[] = { statepoint.numCallerFrames(), statepoint.bci(), statepoint.numJavaStackElements(),
                      statepoint.numJavaLocals(), statepoint.numJavaMonitors() };
 
   for (int i = 0; i < 5; i++) {
@@ -7428,8 +7560,11 @@ void SelectionDAGBuilder::visitStatepoint(const CallInst &CI) {
   if (Glue.getNode())
     Ops.push_back(Glue);
 
-  // Compute return values
+  // Compute return values.  The relocated values of the gc pointers passed in
+  // registers come first.
   SmallVector<EVT, 21> ValueVTs;
+  for (SDValue V : GCRegs)
+    ValueVTs.push_back(V.getValueType());
   ValueVTs.push_back(MVT::Other);
   ValueVTs.push_back(MVT::Glue); //provide a glue output since we consume one
                                  //as input.  This allows someone else to chain
@@ -7439,11 +7574,55 @@ void SelectionDAGBuilder::visitStatepoint(const CallInst &CI) {
   SDNode* StatepointMCNode = DAG.getMachineNode(TargetOpcode::STATEPOINT, getCurSDLoc(),
                                                   NodeTys, Ops);
 
-  // Replace original call
-  DAG.ReplaceAllUsesWith(CallNode, StatepointMCNode); // This may update Root
+  // Replace original call, i.e. its chain and glue results
+  assert(CallNode->getNumValues() == 2 && "expected chain and glue");
+  const unsigned NumGCRegs = GCRegs.size();
+  // This may update Root
+  DAG.ReplaceAllUsesOfValueWith(SDValue(CallNode, 0),
+                                SDValue(StatepointMCNode, NumGCRegs));
+  DAG.ReplaceAllUsesOfValueWith(SDValue(CallNode, 1),
+                                SDValue(StatepointMCNode, NumGCRegs + 1));
   // Remove originall call node
   DAG.DeleteNode(CallNode);
 
+  // The gc.relocates of the values passed in registers use the results
+  for (unsigned i = 0; i < NumGCRegs; ++i)
+    StatepointLowering.setRelocLocation(GCRegs[i],
+                                        SDValue(StatepointMCNode, i));
+
+  // The gc.result and gc.relocates of an invoke are in its normal and unwind
+  // destinations.  Record the spill slot of each gc pointer and export the
+  // result of the call for them.  The stack map recorded at the return
+  // address describes the frame for the exceptional return as well.
+  if (CS.isInvoke()) {
+    DenseMap<const Value*, int> &Slots =
+      FuncInfo.StatepointRelocationSlots[&CI];
+    for (ImmutableCallSite::arg_iterator I = statepoint.gc_args_begin(),
+           E = statepoint.gc_args_end(); I != E; ++I) {
+      SDValue Loc = StatepointLowering.getLocation(getValue(*I));
+      if (Loc.getNode())
+        Slots[*I] = cast<FrameIndexSDNode>(Loc)->getIndex();
+    }
+
+    Type *RetTy = cast<FunctionType>(
+      cast<PointerType>(statepoint.actualCallee()->getType())
+        ->getElementType())->getReturnType();
+    if (!RetTy->isVoidTy()) {
+      const TargetLowering *TLI = TM.getTargetLowering();
+      unsigned Reg = FuncInfo.CreateRegs(RetTy);
+      RegsForValue RFV(*DAG.getContext(), *TLI, Reg, RetTy);
+      SDValue Chain = DAG.getEntryNode();
+      RFV.getCopyToRegs(getValue(&CI), DAG, getCurSDLoc(), Chain, nullptr,
+                        nullptr);
+      PendingExports.push_back(Chain);
+      FuncInfo.StatepointResultRegs[&CI] = Reg;
+    }
+
+    // The token itself is exported to the relocates, which never look at it
+    removeValue(&CI);
+    setValue(&CI, DAG.getConstant(-1, MVT::i32));
+  }
+
   // DON'T set the root - under the assumption that it's already set past the
   // inserted node we created.
 
@@ -7470,10 +7649,48 @@ void SelectionDAGBuilder::visitGCResult(const CallInst &CI) {
   assert( Intrinsic::statepoint == CS.getCalledFunction()->getIntrinsicID() &&
           "first argument must be a statepoint token");
 
+  // The result of an invoke was exported from its block
+  if (CS.isInvoke()) {
+    DenseMap<const Instruction*, unsigned>::iterator It =
+      FuncInfo.StatepointResultRegs.find(statepoint);
+    assert(It != FuncInfo.StatepointResultRegs.end() &&
+           "result of invoked statepoint not exported");
+    RegsForValue RFV(*DAG.getContext(), *TM.getTargetLowering(), It->second,
+                     CI.getType());
+    SDValue Chain = DAG.getEntryNode();
+    setValue(&CI, RFV.getCopyFromRegs(DAG, FuncInfo, getCurSDLoc(), Chain,
+                                      nullptr));
+    return;
+  }
+
   setValue(&CI, getValue(statepoint));
 }
 
 void SelectionDAGBuilder::visitGCRelocate(const CallInst &CI) {
+  // The gc.relocates of an invoke are in its normal or unwind destination.
+  // They reload the slot the value was spilled to when the invoke was
+  // lowered.
+  GCRelocateOperands relocateOpers(&CI);
+  const Instruction *SP = relocateOpers.statepoint();
+  if (isa<InvokeInst>(SP)) {
+    DenseMap<const Value*, int> &Slots =
+      FuncInfo.StatepointRelocationSlots[SP];
+    DenseMap<const Value*, int>::iterator It =
+      Slots.find(relocateOpers.derivedPtr());
+    assert(It != Slots.end() && "relocated value of invoke not spilled");
+
+    const TargetLowering *TLI = TM.getTargetLowering();
+    SDValue SpillSlot = DAG.getFrameIndex(It->second, TLI->getPointerTy());
+    SDValue Chain = getRoot();
+    SDValue Load = DAG.getLoad(TLI->getValueType(CI.getType()), getCurSDLoc(),
+                               Chain, SpillSlot,
+                               MachinePointerInfo::getFixedStack(It->second),
+                               false, false, false, 0);
+    DAG.setRoot(Load.getValue(1));
+    setValue(&CI, Load);
+    return;
+  }
+
 #ifndef NDEBUG
   // Consistency check
   StatepointLowering.relocCallVisited(CI);
@@ -170,8 +170,10 @@ public:
       PendingGCRelocateCalls.erase(itr);
     }
 
-    /// Get a stack slot we can use to store an value of type ValueType.  This
-    /// will hopefully be a recylced slot from another statepoint.
+    /// Get a stack slot we can use to store an value of type ValueType.  When
+    /// optimizing this is a fresh spill slot which StackSlotColoring later
+    /// shares based on liveness; otherwise it is recycled by position from
+    /// another statepoint.
     SDValue allocateStackSlot(EVT ValueType,
                               SelectionDAGBuilder &Builder);
   private:
@@ -854,7 +856,8 @@ private:
   void visitStackmap(const CallInst &I);
   void visitPatchpoint(const CallInst &I);
 
-  void visitStatepoint(const CallInst &I);
+  void visitStatepoint(ImmutableCallSite CS,
+                       MachineBasicBlock *LandingPad = nullptr);
   void visitGCRelocate(const CallInst &I);
   void visitGCResult(const CallInst &I);
 
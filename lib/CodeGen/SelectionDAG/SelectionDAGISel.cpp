@@ -40,6 +40,7 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Statepoint.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
@@ -1177,9 +1178,16 @@ void SelectionDAGISel::SelectAllBasicBlocks(const Function &Fn) {
               R = FuncInfo->CreateRegs(Inst->getType());
           }
 
+          // The gc.relocate and gc.result calls following a statepoint were
+          // left for it, so they are lowered along with it.
+          BasicBlock::const_iterator End = BI;
+          if (isStatepoint(Inst))
+            End = std::next(BasicBlock::const_iterator(
+              FastISel::getLastStatepointResult(Inst)));
+
           bool HadTailCall = false;
           MachineBasicBlock::iterator SavedInsertPt = FuncInfo->InsertPt;
-          SelectBasicBlock(Inst, BI, HadTailCall);
+          SelectBasicBlock(Inst, End, HadTailCall);
 
           // If the call was emitted as a tail call, we're done with the block.
           // We also need to delete any previously emitted instructions.
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/CodeGen/StackMaps.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/CodeGen/AsmPrinter.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
@@ -20,18 +21,20 @@
 #include "llvm/MC/MCStreamer.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/LEB128.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOpcodes.h"
 #include "llvm/Target/TargetRegisterInfo.h"
 #include <iterator>
+#include <tuple>
 
 using namespace llvm;
 
 #define DEBUG_TYPE "stackmaps"
 
 static cl::opt<int> StackMapVersion("stackmap-version", cl::init(1),
-  cl::desc("Specify the stackmap encoding version (default = 1)"));
+  cl::desc("Specify the stackmap encoding version, 1 or 2 (default = 1)"));
 
 const char *StackMaps::WSMP = "Stack Maps: ";
 
@@ -53,6 +56,49 @@ PatchPointOpers::PatchPointOpers(const MachineInstr *MI)
 #endif
 }
 
+StatepointOpers::StatepointOpers(const MachineInstr *MI)
+  : MI(MI), NumDefs(0) {
+  // The relocated gc values in registers are the leading explicit defs
+  for (unsigned e = MI->getNumOperands(); NumDefs < e; ++NumDefs) {
+    const MachineOperand &MO = MI->getOperand(NumDefs);
+    if (!MO.isReg() || !MO.isDef() || MO.isImplicit())
+      break;
+  }
+}
+
+unsigned StatepointOpers::getNextLocationIdx(unsigned Idx) const {
+  const MachineOperand &MO = MI->getOperand(Idx);
+  if (!MO.isImm())
+    return Idx + 1;
+  switch (MO.getImm()) {
+  default: llvm_unreachable("Unrecognized operand type.");
+  case StackMaps::DirectMemRefOp: return Idx + 3;
+  case StackMaps::IndirectMemRefOp: return Idx + 4;
+  case StackMaps::ConstantOp: return Idx + 2;
+  }
+}
+
+unsigned StatepointOpers::getGCStateIdx() const {
+  // Each caller frame repeats the bci and counts of the statepoint's own
+  // header as constants ahead of its slots.
+  unsigned NumFrames = 1 + MI->getOperand(getNumCallerFramesIdx()).getImm();
+  unsigned Idx = getStackNumIdx();
+  for (unsigned Frame = 0; Frame != NumFrames; ++Frame) {
+    if (Frame)
+      Idx += 3; // <StackMaps::ConstantOp>, bci, <StackMaps::ConstantOp>
+    int64_t NumStack = MI->getOperand(Idx).getImm();
+    int64_t NumLocals = MI->getOperand(Idx + 2).getImm();
+    int64_t NumMonitors = MI->getOperand(Idx + 4).getImm();
+    Idx += 5;
+    // Stack elements and locals are each preceded by their type
+    for (int64_t i = 0; i != NumStack + NumLocals; ++i)
+      Idx = getNextLocationIdx(getNextLocationIdx(Idx));
+    for (int64_t i = 0; i != NumMonitors; ++i)
+      Idx = getNextLocationIdx(Idx);
+  }
+  return Idx;
+}
+
 unsigned PatchPointOpers::getNextScratchIdx(unsigned StartIdx) const {
   if (!StartIdx)
     StartIdx = getVarIdx();
@@ -71,7 +117,7 @@ unsigned PatchPointOpers::getNextScratchIdx(unsigned StartIdx) const {
 }
 
 StackMaps::StackMaps(AsmPrinter &AP) : AP(AP) {
-  if (StackMapVersion != 1)
+  if (StackMapVersion != 1 && StackMapVersion != 2)
     llvm_unreachable("Unsupported stackmap version!");
 }
 
@@ -233,6 +279,7 @@ void StackMaps::recordStackMapOpers(const MachineInstr &MI, uint64_t ID,
     OutContext);
 
   CSInfos.push_back(CallsiteInfo(CSOffsetExpr, ID, Locations, LiveOuts));
+  FnNumCallsites[AP.CurrentFnSym]++;
 
   // Record the stack size of the current function.
   const MachineFrameInfo *MFI = AP.MF->getFrameInfo();
@@ -274,6 +321,30 @@ void StackMaps::recordPatchPoint(const MachineInstr &MI) {
 #endif
 }
 
+/// Compute the dwarf register number and offset a location is encoded with.
+static void getEncodedLocation(const StackMaps::Location &Loc,
+                               const TargetRegisterInfo *TRI,
+                               unsigned &RegNo, int &Offset) {
+  RegNo = 0;
+  Offset = Loc.Offset;
+  if (Loc.Reg) {
+    RegNo = getDwarfRegNum(Loc.Reg, TRI);
+
+    // If this is a register location, put the subregister byte offset in
+    // the location offset.
+    if (Loc.LocType == StackMaps::Location::Register) {
+      assert(!Loc.Offset && "Register location should have zero offset");
+      unsigned LLVMRegNo = TRI->getLLVMRegNum(RegNo, false);
+      unsigned SubRegIdx = TRI->getSubRegIndex(LLVMRegNo, Loc.Reg);
+      if (SubRegIdx)
+        Offset = TRI->getSubRegIdxOffset(SubRegIdx);
+    }
+  } else {
+    assert(Loc.LocType != StackMaps::Location::Register &&
+           "Missing location register");
+  }
+}
+
 /// Emit the stackmap header.
 ///
 /// Header {
@@ -403,25 +474,9 @@ void StackMaps::emitCallsiteEntries(MCStreamer &OS,
 
     unsigned OperIdx = 0;
     for (const auto &Loc : CSLocs) {
-      unsigned RegNo = 0;
-      int Offset = Loc.Offset;
-      if(Loc.Reg) {
-        RegNo = getDwarfRegNum(Loc.Reg, TRI);
-
-        // If this is a register location, put the subregister byte offset in
-        // the location offset.
-        if (Loc.LocType == Location::Register) {
-          assert(!Loc.Offset && "Register location should have zero offset");
-          unsigned LLVMRegNo = TRI->getLLVMRegNum(RegNo, false);
-          unsigned SubRegIdx = TRI->getSubRegIndex(LLVMRegNo, Loc.Reg);
-          if (SubRegIdx)
-            Offset = TRI->getSubRegIdxOffset(SubRegIdx);
-        }
-      }
-      else {
-        assert(Loc.LocType != Location::Register &&
-               "Missing location register");
-      }
+      unsigned RegNo;
+      int Offset;
+      getEncodedLocation(Loc, TRI, RegNo, Offset);
 
       DEBUG(dbgs() << WSMP << "  Loc " << OperIdx << ": ";
             switch (Loc.LocType) {
@@ -483,6 +538,129 @@ void StackMaps::emitCallsiteEntries(MCStreamer &OS,
   }
 }
 
+/// Emit the stack map in the version 2 encoding.  It has the same contents
+/// as version 1, but is laid out for a runtime which looks up the record of
+/// a return address directly in the mapped section.
+///
+/// Header {
+///   uint8  : Stack Map Version (2)
+///   uint8  : Reserved (expected to be 0)
+///   uint16 : Reserved (expected to be 0)
+/// }
+/// uint32 : NumFunctions
+/// uint32 : NumConstants
+/// uint32 : NumLocations
+/// uint32 : NumRecords
+/// uint32 : Reserved (expected to be 0)
+/// int64  : Constants[NumConstants]
+/// StkSizeRecord[NumFunctions] {
+///   uint64 : Function Address
+///   uint64 : Stack Size
+///   uint32 : Index of the first CallsiteEntry of the function
+///   uint32 : Number of CallsiteEntries of the function
+/// }
+/// CallsiteEntry[NumRecords] {
+///   uint32 : Instruction Offset
+///   uint32 : Offset of the StkMapRecord from the start of the records
+/// }
+/// Location[NumLocations] {
+///   uint8  : Register | Direct | Indirect | Constant | ConstantIndex
+///   uint8  : Size in Bytes
+///   uint16 : Dwarf RegNum
+///   int32  : Offset
+/// }
+/// StkMapRecord[NumRecords], each field ULEB128 encoded {
+///   PatchPoint ID
+///   NumLocations
+///   Location index[NumLocations]
+///   NumLiveOuts
+///   LiveOuts[NumLiveOuts] {
+///     Dwarf RegNum
+///     Size in Bytes
+///   }
+/// }
+/// uint8 : Padding (to align to 8 byte)
+///
+/// The callsite entries of a function are in instruction order, so they are
+/// sorted by offset and can be binary searched.  Identical locations are
+/// emitted once and shared between the records using them.
+void StackMaps::emitStackMapV2(MCStreamer &OS, const TargetRegisterInfo *TRI) {
+  typedef std::tuple<unsigned, unsigned, unsigned, int> EncodedLocation;
+  std::map<EncodedLocation, unsigned> LocationIndex;
+  std::vector<EncodedLocation> UniqueLocations;
+  SmallString<256> Records;
+  raw_svector_ostream RecordOS(Records);
+  std::vector<uint64_t> RecordOffsets;
+  RecordOffsets.reserve(CSInfos.size());
+
+  for (const auto &CSI : CSInfos) {
+    RecordOffsets.push_back(RecordOS.tell());
+    encodeULEB128(CSI.ID, RecordOS);
+    encodeULEB128(CSI.Locations.size(), RecordOS);
+    for (const auto &Loc : CSI.Locations) {
+      unsigned RegNo;
+      int Offset;
+      getEncodedLocation(Loc, TRI, RegNo, Offset);
+      EncodedLocation Key(Loc.LocType, Loc.Size, RegNo, Offset);
+      auto Result = LocationIndex.insert(
+        std::make_pair(Key, (unsigned)UniqueLocations.size()));
+      if (Result.second)
+        UniqueLocations.push_back(Key);
+      encodeULEB128(Result.first->second, RecordOS);
+    }
+    encodeULEB128(CSI.LiveOuts.size(), RecordOS);
+    for (const auto &LO : CSI.LiveOuts) {
+      encodeULEB128(LO.RegNo, RecordOS);
+      encodeULEB128(LO.Size, RecordOS);
+    }
+  }
+  RecordOS.flush();
+
+  DEBUG(dbgs() << WSMP << "version 2: " << FnStackSize.size()
+               << " functions, " << ConstPool.size() << " constants, "
+               << UniqueLocations.size() << " unique locations, "
+               << CSInfos.size() << " callsites, " << Records.size()
+               << " bytes of records\n");
+
+  // Header.
+  OS.EmitIntValue(2, 1); // Version.
+  OS.EmitIntValue(0, 1); // Reserved.
+  OS.EmitIntValue(0, 2); // Reserved.
+  OS.EmitIntValue(FnStackSize.size(), 4);
+  OS.EmitIntValue(ConstPool.size(), 4);
+  OS.EmitIntValue(UniqueLocations.size(), 4);
+  OS.EmitIntValue(CSInfos.size(), 4);
+  OS.EmitIntValue(0, 4); // Reserved.
+
+  emitConstantPoolEntries(OS);
+
+  unsigned FirstCallsite = 0;
+  for (auto const &FR : FnStackSize) {
+    unsigned NumCallsites = FnNumCallsites.lookup(FR.first);
+    OS.EmitSymbolValue(FR.first, 8);
+    OS.EmitIntValue(FR.second, 8);
+    OS.EmitIntValue(FirstCallsite, 4);
+    OS.EmitIntValue(NumCallsites, 4);
+    FirstCallsite += NumCallsites;
+  }
+  assert(FirstCallsite == CSInfos.size() && "callsite without a function");
+
+  for (unsigned i = 0, e = CSInfos.size(); i != e; ++i) {
+    OS.EmitValue(CSInfos[i].CSOffsetExpr, 4);
+    OS.EmitIntValue(RecordOffsets[i], 4);
+  }
+
+  for (const auto &Loc : UniqueLocations) {
+    OS.EmitIntValue(std::get<0>(Loc), 1);
+    OS.EmitIntValue(std::get<1>(Loc), 1);
+    OS.EmitIntValue(std::get<2>(Loc), 2);
+    OS.EmitIntValue(std::get<3>(Loc), 4);
+  }
+
+  OS.EmitBytes(Records);
+  OS.EmitValueToAlignment(8);
+}
+
 /// Serialize the stackmap data.
 void StackMaps::serializeToStackMapSection() {
   (void) WSMP;
@@ -508,13 +686,18 @@ void StackMaps::serializeToStackMapSection() {
 
   // Serialize data.
   DEBUG(dbgs() << "********** Stack Map Output **********\n");
-  emitStackmapHeader(OS);
-  emitFunctionFrameRecords(OS);
-  emitConstantPoolEntries(OS);
-  emitCallsiteEntries(OS, TRI);
+  if (StackMapVersion == 2) {
+    emitStackMapV2(OS, TRI);
+  } else {
+    emitStackmapHeader(OS);
+    emitFunctionFrameRecords(OS);
+    emitConstantPoolEntries(OS);
+    emitCallsiteEntries(OS, TRI);
+  }
   OS.AddBlankLine();
 
   // Clean up.
   CSInfos.clear();
   ConstPool.clear();
+  FnNumCallsites.clear();
 }
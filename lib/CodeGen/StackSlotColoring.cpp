@@ -29,6 +29,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetInstrInfo.h"
 #include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetRegisterInfo.h"
 #include <vector>
 using namespace llvm;
 
@@ -43,10 +44,12 @@ static cl::opt<int> DCELimit("ssc-dce-limit", cl::init(-1), cl::Hidden);
 
 STATISTIC(NumEliminated, "Number of stack slots eliminated due to coloring");
 STATISTIC(NumDead,       "Number of trivially dead stack accesses eliminated");
+STATISTIC(NumStatepointSlots, "Number of statepoint spill slots colored");
 
 namespace {
   class StackSlotColoring : public MachineFunctionPass {
     LiveStacks* LS;
+    SlotIndexes* SI;
     MachineFrameInfo *MFI;
     const TargetInstrInfo  *TII;
     const MachineBlockFrequencyInfo *MBFI;
@@ -103,6 +106,7 @@ namespace {
 
   private:
     void InitializeSlots();
+    void AddStatepointSlotIntervals(MachineFunction &MF);
     void ScanForSpillSlotRefs(MachineFunction &MF);
     bool OverlapWithAssignments(LiveInterval *li, int Color) const;
     int ColorSlot(LiveInterval *li);
@@ -134,6 +138,71 @@ namespace {
   };
 }
 
+/// AddStatepointSlotIntervals - Statepoint lowering spills the values live
+/// across a statepoint into spill slots of its own before register
+/// allocation, so they have no live intervals in LiveStacks.  Give the ones
+/// whose references all lie in a single block, starting with the store that
+/// fills them, an interval from that store to their last use so they can be
+/// colored together with the register allocator's spill slots.
+void StackSlotColoring::AddStatepointSlotIntervals(MachineFunction &MF) {
+  unsigned NumObjs = MFI->getObjectIndexEnd();
+  SmallVector<MachineInstr*, 16> First(NumObjs, nullptr);
+  SmallVector<MachineInstr*, 16> Last(NumObjs, nullptr);
+  SmallVector<unsigned, 16> StoredReg(NumObjs, 0);
+  BitVector Candidates(NumObjs);
+  BitVector Rejected(NumObjs);
+
+  for (MachineFunction::iterator MBBI = MF.begin(), E = MF.end();
+       MBBI != E; ++MBBI) {
+    for (MachineBasicBlock::iterator MII = MBBI->begin(), EE = MBBI->end();
+         MII != EE; ++MII) {
+      MachineInstr *MI = &*MII;
+      if (MI->isDebugValue())
+        continue;
+      for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
+        MachineOperand &MO = MI->getOperand(i);
+        if (!MO.isFI())
+          continue;
+        int FI = MO.getIndex();
+        if (FI < 0 || !MFI->isSpillSlotObjectIndex(FI) || LS->hasInterval(FI))
+          continue;
+        if (MI->getOpcode() == TargetOpcode::STATEPOINT)
+          Candidates.set(FI);
+        if (!First[FI]) {
+          int StoreFI;
+          unsigned Reg = TII->isStoreToStackSlot(MI, StoreFI);
+          if (!Reg || StoreFI != FI ||
+              !TargetRegisterInfo::isPhysicalRegister(Reg))
+            Rejected.set(FI);
+          StoredReg[FI] = Reg;
+          First[FI] = MI;
+        } else if (First[FI]->getParent() != MI->getParent()) {
+          Rejected.set(FI);
+        }
+        Last[FI] = MI;
+      }
+    }
+  }
+
+  Candidates.reset(Rejected);
+  const TargetRegisterInfo *TRI = MF.getTarget().getRegisterInfo();
+  for (int FI = Candidates.find_first(); FI != -1;
+       FI = Candidates.find_next(FI)) {
+    if (MFI->isDeadObjectIndex(FI))
+      continue;
+    SlotIndex Start = SI->getInstructionIndex(First[FI]).getRegSlot();
+    SlotIndex End = SI->getInstructionIndex(Last[FI]).getDeadSlot();
+    // The slot holds whatever the filling store spilled, so it gets the
+    // register class of that register like any other spill slot.
+    const TargetRegisterClass *RC =
+      TRI->getMinimalPhysRegClass(StoredReg[FI]);
+    LiveInterval &LI = LS->getOrCreateInterval(FI, RC);
+    VNInfo *VNI = LI.getNextValue(Start, LS->getVNInfoAllocator());
+    LI.addSegment(LiveInterval::Segment(Start, End, VNI));
+    ++NumStatepointSlots;
+  }
+}
+
 /// ScanForSpillSlotRefs - Scan all the machine instructions for spill slot
 /// references and update spill slot weights.
 void StackSlotColoring::ScanForSpillSlotRefs(MachineFunction &MF) {
@@ -424,10 +493,13 @@ bool StackSlotColoring::runOnMachineFunction(MachineFunction &MF) {
   MFI = MF.getFrameInfo();
   TII = MF.getTarget().getInstrInfo();
   LS = &getAnalysis<LiveStacks>();
+  SI = &getAnalysis<SlotIndexes>();
   MBFI = &getAnalysis<MachineBlockFrequencyInfo>();
 
   bool Changed = false;
 
+  AddStatepointSlotIntervals(MF);
+
   unsigned NumSlots = LS->getNumIntervals();
   if (NumSlots == 0)
     // Nothing to do!
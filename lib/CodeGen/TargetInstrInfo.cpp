@@ -435,6 +435,84 @@ static MachineInstr* foldPatchpoint(MachineFunction &MF,
   return NewMI;
 }
 
+/// foldStatepoint - Fold a stack slot into a statepoint.  A gc pointer the
+/// statepoint keeps in a register is defined by the statepoint as well (the
+/// relocated value) and tied to its use.  Spilling that def folds the pair
+/// into a single indirect stack slot reference, which the collector updates
+/// in place -- the same form lowering uses for gc pointers on the stack.
+static MachineInstr* foldStatepoint(MachineFunction &MF,
+                                    MachineInstr *MI,
+                                    const SmallVectorImpl<unsigned> &Ops,
+                                    int FrameIndex,
+                                    const TargetInstrInfo &TII) {
+  StatepointOpers opers(MI);
+  unsigned NumDefs = opers.getNumDefs();
+  unsigned StartIdx = opers.getVarIdx();
+
+  // Collect the operands to fold.  A folded def takes its tied use with it;
+  // the call target and arguments are not foldable.
+  SmallVector<unsigned, 8> FoldIdx;
+  for (SmallVectorImpl<unsigned>::const_iterator I = Ops.begin(), E = Ops.end();
+       I != E; ++I) {
+    const MachineOperand &MO = MI->getOperand(*I);
+    if (MO.isDef()) {
+      FoldIdx.push_back(*I);
+      FoldIdx.push_back(MI->findTiedOperandIdx(*I));
+      continue;
+    }
+    if (*I < StartIdx)
+      return nullptr;
+    // A tied use is only foldable together with its def.
+    if (MO.isTied() &&
+        std::find(Ops.begin(), Ops.end(), MI->findTiedOperandIdx(*I)) ==
+        Ops.end())
+      return nullptr;
+    FoldIdx.push_back(*I);
+  }
+
+  MachineInstr *NewMI =
+    MF.CreateMachineInstr(TII.get(MI->getOpcode()), MI->getDebugLoc(), true);
+  MachineInstrBuilder MIB(MF, NewMI);
+
+  // Remember where each surviving operand ends up so the remaining ties can
+  // be re-applied.
+  SmallVector<unsigned, 32> NewIdx(MI->getNumOperands(), ~0U);
+  for (unsigned i = 0; i < MI->getNumOperands(); ++i) {
+    MachineOperand &MO = MI->getOperand(i);
+    bool Fold = std::find(FoldIdx.begin(), FoldIdx.end(), i) != FoldIdx.end();
+    if (!Fold) {
+      NewIdx[i] = NewMI->getNumOperands();
+      MIB.addOperand(MO);
+      continue;
+    }
+    // A folded def simply disappears; its tied use carries the slot.
+    if (i < NumDefs)
+      continue;
+    unsigned SpillSize;
+    unsigned SpillOffset;
+    // Compute the spill slot size and offset.
+    const TargetRegisterClass *RC =
+      MF.getRegInfo().getRegClass(MO.getReg());
+    bool Valid = TII.getStackSlotRange(RC, MO.getSubReg(), SpillSize,
+                                       SpillOffset, &MF.getTarget());
+    if (!Valid)
+      report_fatal_error("cannot spill statepoint subregister operand");
+    MIB.addImm(StackMaps::IndirectMemRefOp);
+    MIB.addImm(SpillSize);
+    MIB.addFrameIndex(FrameIndex);
+    MIB.addImm(SpillOffset);
+  }
+
+  for (unsigned i = 0; i < NumDefs; ++i) {
+    if (NewIdx[i] == ~0U)
+      continue;
+    unsigned UseIdx = MI->findTiedOperandIdx(i);
+    assert(NewIdx[UseIdx] != ~0U && "Folded the use of a live def");
+    NewMI->tieOperands(NewIdx[i], NewIdx[UseIdx]);
+  }
+  return NewMI;
+}
+
 /// foldMemoryOperand - Attempt to fold a load or store of the specified stack
 /// slot into the specified machine instruction for the specified operand(s).
 /// If this is possible, a new instruction is returned with the specified
@@ -462,6 +540,8 @@ TargetInstrInfo::foldMemoryOperand(MachineBasicBlock::iterator MI,
       MI->getOpcode() == TargetOpcode::PATCHPOINT) {
     // Fold stackmap/patchpoint.
     NewMI = foldPatchpoint(MF, MI, Ops, FI, *this);
+  } else if (MI->getOpcode() == TargetOpcode::STATEPOINT) {
+    NewMI = foldStatepoint(MF, MI, Ops, FI, *this);
   } else {
     // Ask the target to do the actual folding.
     NewMI =foldMemoryOperandImpl(MF, MI, Ops, FI);
@@ -979,6 +979,19 @@ TargetLoweringBase::emitPatchPoint(MachineInstr *MI,
     for (unsigned i = OperIdx + 1; i != MI->getNumOperands(); ++i)
       MIB.addOperand(MI->getOperand(i));
 
+    // addOperand does not preserve ties.  Statepoints tie the relocated
+    // values they define to the gc pointers they use, so re-apply them.
+    // Tied defs always lead the operand list, ahead of any frame index.
+    unsigned Growth = MIB->getNumOperands() - MI->getNumOperands();
+    for (unsigned i = 0, e = MI->getNumOperands(); i != e; ++i) {
+      const MachineOperand &DefMO = MI->getOperand(i);
+      if (!DefMO.isReg() || !DefMO.isDef() || !DefMO.isTied())
+        continue;
+      unsigned UseIdx = MI->findTiedOperandIdx(i);
+      assert(i < OperIdx && "Tied def after a frame index?");
+      MIB->tieOperands(i, UseIdx > OperIdx ? UseIdx + Growth : UseIdx);
+    }
+
     // Inherit previous memory operands.
     MIB->setMemRefs(MI->memoperands_begin(), MI->memoperands_end());
     assert(MIB->mayLoad() && "Folded a stackmap use to a non-load!");
@@ -1001,7 +1014,7 @@ TargetLoweringBase::emitPatchPoint(MachineInstr *MI,
 
     // Replace the instruction and update the operand index.
     MBB->insert(MachineBasicBlock::iterator(MI), MIB);
-    OperIdx += (MIB->getNumOperands() - MI->getNumOperands()) - 1;
+    OperIdx += Growth - 1;
     MI->eraseFromParent();
     MI = MIB;
   }
@@ -79,6 +79,7 @@ MCJIT::~MCJIT() {
   //
   Modules.clear();
   Dyld.deregisterEHFrames();
+  Dyld.deregisterStackMaps();
 
   LoadedObjectList::iterator it, end;
   for (it = LoadedObjects.begin(), end = LoadedObjects.end(); it != end; ++it) {
@@ -224,6 +225,9 @@ void MCJIT::finalizeLoadedModules() {
   // Register EH frame data for any module we own which has been loaded
   Dyld.registerEHFrames();
 
+  // Register the stack maps, now that their function addresses are resolved
+  Dyld.registerStackMaps();
+
   // Set page permissions.
   MemMgr.finalizeMemory();
 }
@@ -71,6 +71,16 @@ public:
     ClientMM->deregisterEHFrames(Addr, LoadAddr, Size);
   }
 
+  void registerStackMaps(uint8_t *Addr, uint64_t LoadAddr,
+                         size_t Size) override {
+    ClientMM->registerStackMaps(Addr, LoadAddr, Size);
+  }
+
+  void deregisterStackMaps(uint8_t *Addr, uint64_t LoadAddr,
+                           size_t Size) override {
+    ClientMM->deregisterStackMaps(Addr, LoadAddr, Size);
+  }
+
   bool finalizeMemory(std::string *ErrMsg = nullptr) override {
     return ClientMM->finalizeMemory(ErrMsg);
   }
@@ -14,6 +14,7 @@
 
 #include "llvm/Config/config.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/ExecutionEngine/StackMapRegistry.h"
 #include "llvm/Support/MathExtras.h"
 
 namespace llvm {
@@ -165,7 +166,32 @@ void SectionMemoryManager::invalidateInstructionCache() {
                                             CodeMem.AllocatedMem[i].size());
 }
 
+void SectionMemoryManager::registerStackMaps(uint8_t *Addr, uint64_t LoadAddr,
+                                             size_t Size) {
+  if (StackMaps)
+    if (std::error_code EC = StackMaps->registerStackMap(Addr, Size))
+      StackMapError = EC;
+  StackMapSections.push_back(sys::MemoryBlock(Addr, Size));
+}
+
+void SectionMemoryManager::deregisterStackMaps(uint8_t *Addr,
+                                               uint64_t LoadAddr,
+                                               size_t Size) {
+  for (unsigned i = 0, e = StackMapSections.size(); i != e; ++i) {
+    if (StackMapSections[i].base() != Addr)
+      continue;
+    if (StackMaps)
+      StackMaps->unregisterStackMap(Addr);
+    StackMapSections.erase(StackMapSections.begin() + i);
+    return;
+  }
+}
+
 SectionMemoryManager::~SectionMemoryManager() {
+  while (!StackMapSections.empty())
+    deregisterStackMaps((uint8_t *)StackMapSections.back().base(), 0,
+                        StackMapSections.back().size());
+
   for (unsigned i = 0, e = CodeMem.AllocatedMem.size(); i != e; ++i)
     sys::Memory::releaseMappedMemory(CodeMem.AllocatedMem[i]);
   for (unsigned i = 0, e = RWDataMem.AllocatedMem.size(); i != e; ++i)
@@ -40,6 +40,31 @@ void RuntimeDyldImpl::registerEHFrames() {}
 
 void RuntimeDyldImpl::deregisterEHFrames() {}
 
+void RuntimeDyldImpl::registerStackMaps() {
+  if (!MemMgr)
+    return;
+  for (int i = 0, e = UnregisteredStackMapSections.size(); i != e; ++i) {
+    SID StackMapSID = UnregisteredStackMapSections[i];
+    MemMgr->registerStackMaps(Sections[StackMapSID].Address,
+                              Sections[StackMapSID].LoadAddress,
+                              Sections[StackMapSID].Size);
+    RegisteredStackMapSections.push_back(StackMapSID);
+  }
+  UnregisteredStackMapSections.clear();
+}
+
+void RuntimeDyldImpl::deregisterStackMaps() {
+  if (!MemMgr)
+    return;
+  for (int i = 0, e = RegisteredStackMapSections.size(); i != e; ++i) {
+    SID StackMapSID = RegisteredStackMapSections[i];
+    MemMgr->deregisterStackMaps(Sections[StackMapSID].Address,
+                                Sections[StackMapSID].LoadAddress,
+                                Sections[StackMapSID].Size);
+  }
+  RegisteredStackMapSections.clear();
+}
+
 // Resolve the relocations for all symbols we currently know about.
 void RuntimeDyldImpl::resolveRelocations() {
   MutexGuard locked(lock);
@@ -209,6 +234,20 @@ ObjectImage *RuntimeDyldImpl::loadObject(ObjectImage *InputObject) {
   // Give the subclasses a chance to tie-up any loose ends.
   finalizeLoad(*Obj, LocalSections);
 
+  // Look for and record the stack map section.  It has relocations for the
+  // function addresses, so it has been loaded if the object has one.
+  for (ObjSectionToIDMap::iterator i = LocalSections.begin(),
+                                   e = LocalSections.end();
+       i != e; ++i) {
+    StringRef Name;
+    Check(i->first.getName(Name));
+    if ((Name == ".llvm_stackmaps" || Name == "__llvm_stackmaps") &&
+        Sections[i->second].Address) {
+      UnregisteredStackMapSections.push_back(i->second);
+      break;
+    }
+  }
+
   return Obj.release();
 }
 
@@ -813,4 +852,14 @@ void RuntimeDyld::deregisterEHFrames() {
     Dyld->deregisterEHFrames();
 }
 
+void RuntimeDyld::registerStackMaps() {
+  if (Dyld)
+    Dyld->registerStackMaps();
+}
+
+void RuntimeDyld::deregisterStackMaps() {
+  if (Dyld)
+    Dyld->deregisterStackMaps();
+}
+
 } // end namespace llvm
@@ -220,6 +220,11 @@ protected:
   // sections containing relocations should be. Defaults to 'false'.
   bool ProcessAllSections;
 
+  // The stack map sections of the loaded objects, before and after they have
+  // been registered with the memory manager.
+  SmallVector<SID, 2> UnregisteredStackMapSections;
+  SmallVector<SID, 2> RegisteredStackMapSections;
+
   // This mutex prevents simultaneously loading objects from two different
   // threads.  This keeps us from having to protect individual data structures
   // and guarantees that section allocation requests to the memory manager
@@ -402,6 +407,10 @@ public:
 
   virtual void deregisterEHFrames();
 
+  void registerStackMaps();
+
+  void deregisterStackMaps();
+
   virtual void finalizeLoad(ObjectImage &ObjImg, ObjSectionToIDMap &SectionMap) {}
 };
 
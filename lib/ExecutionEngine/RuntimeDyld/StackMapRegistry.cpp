@@ -0,0 +1,125 @@
+//===- StackMapRegistry.cpp - Index of JIT-ed stack maps ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements StackMapRegistry.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/StackMapRegistry.h"
+#include "llvm/Object/Error.h"
+#include <algorithm>
+
+using namespace llvm;
+using namespace llvm::object;
+
+struct StackMapRegistry::RegisteredStackMap {
+  RegisteredStackMap(const uint8_t *Addr, const StackMapParser &Parser)
+      : Addr(Addr), Parser(Parser) {}
+
+  const uint8_t *Addr;
+  StackMapParser Parser;
+  /// The decoded records.  This isn't resized once they are indexed.
+  std::vector<CallsiteRecord> Records;
+
+  bool contains(const CallsiteRecord *R) const {
+    return R >= Records.data() && R < Records.data() + Records.size();
+  }
+};
+
+namespace {
+typedef std::pair<uint64_t, const StackMapRegistry::CallsiteRecord *>
+    IndexEntry;
+
+struct IndexEntryLess {
+  bool operator()(const IndexEntry &LHS, const IndexEntry &RHS) const {
+    return LHS.first < RHS.first;
+  }
+  bool operator()(const IndexEntry &LHS, uint64_t RHS) const {
+    return LHS.first < RHS;
+  }
+};
+}
+
+StackMapRegistry::StackMapRegistry() {}
+
+StackMapRegistry::~StackMapRegistry() {}
+
+std::error_code StackMapRegistry::registerStackMap(const uint8_t *Addr,
+                                                   size_t Size) {
+  ErrorOr<StackMapParser> Parser = StackMapParser::create(
+      StringRef(reinterpret_cast<const char *>(Addr), Size));
+  if (std::error_code EC = Parser.getError())
+    return EC;
+  if (!Parser->hasFunctionCallsites() && Parser->getNumCallsites() != 0 &&
+      Parser->getNumFunctions() != 1)
+    return object_error::parse_failed;
+
+  std::unique_ptr<RegisteredStackMap> SM(
+      new RegisteredStackMap(Addr, *Parser));
+  const StackMapParser &P = SM->Parser;
+  SM->Records.resize(P.getNumCallsites());
+
+  // Decode the records in section order, which groups them by function.
+  unsigned FnIdx = 0, Idx = 0;
+  StackMapParser::Function Fn = {0, 0, 0, 0};
+  if (P.getNumFunctions() != 0)
+    Fn = P.getFunction(0);
+  for (StackMapParser::callsite_iterator I = P.callsite_begin(),
+                                         E = P.callsite_end();
+       I != E; ++I, ++Idx) {
+    if (P.hasFunctionCallsites())
+      while (Idx >= Fn.FirstCallsite + Fn.NumCallsites)
+        Fn = P.getFunction(++FnIdx);
+    CallsiteRecord &R = SM->Records[Idx];
+    R.FunctionAddress = Fn.Address;
+    R.StackSize = Fn.StackSize;
+    R.Record = *I;
+    R.StackMap = &P;
+  }
+
+  // Merge the new records into the index.
+  size_t OldSize = Index.size();
+  Index.reserve(OldSize + SM->Records.size());
+  for (unsigned i = 0, e = SM->Records.size(); i != e; ++i)
+    Index.push_back(IndexEntry(SM->Records[i].getReturnAddress(),
+                               &SM->Records[i]));
+  std::stable_sort(Index.begin() + OldSize, Index.end(), IndexEntryLess());
+  std::inplace_merge(Index.begin(), Index.begin() + OldSize, Index.end(),
+                     IndexEntryLess());
+
+  StackMaps.push_back(std::move(SM));
+  return object_error::success;
+}
+
+bool StackMapRegistry::unregisterStackMap(const uint8_t *Addr) {
+  for (unsigned i = 0, e = StackMaps.size(); i != e; ++i) {
+    if (StackMaps[i]->Addr != Addr)
+      continue;
+
+    const RegisteredStackMap &SM = *StackMaps[i];
+    size_t NewSize = 0;
+    for (size_t j = 0, je = Index.size(); j != je; ++j)
+      if (!SM.contains(Index[j].second))
+        Index[NewSize++] = Index[j];
+    Index.resize(NewSize);
+
+    StackMaps.erase(StackMaps.begin() + i);
+    return true;
+  }
+  return false;
+}
+
+const StackMapRegistry::CallsiteRecord *
+StackMapRegistry::lookup(uint64_t ReturnAddress) const {
+  std::vector<IndexEntry>::const_iterator I = std::lower_bound(
+      Index.begin(), Index.end(), ReturnAddress, IndexEntryLess());
+  if (I == Index.end() || I->first != ReturnAddress)
+    return nullptr;
+  return I->second;
+}
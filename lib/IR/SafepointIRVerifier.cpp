@@ -24,8 +24,9 @@
 #include "llvm/InitializePasses.h"
 #include "llvm/Pass.h"
 #include "llvm/Analysis/CFG.h"
-#include "llvm/ADT/DenseSet.h"
-#include "llvm/ADT/SetOperations.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SparseBitVector.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
@@ -73,134 +74,6 @@ struct SafepointIRVerifier : public FunctionPass {
   }
 };
 
-namespace {
-// Walk through the def-use chains and seek out any other Value which is
-// simply a GEP or bitcast from the one we know got invalidated.  Since the
-// object may have moved, all these are invalid as well.
-// Note: We can't walk PHIs or Selects despite how tempting it might seem.
-// Without reasoning about control flow, that might not have been the dynamic
-// value which got invalidated.
-void add_transative_closure(Value *gcptr, DenseSet<Value *> &invalid) {
-  if (invalid.find(gcptr) != invalid.end()) {
-    // base case - do not continue
-    return;
-  }
-
-  // TODO-PERF: separate an inner function to allow use of batched insert
-
-  // we dont want to add a null into the invalid
-  if (isa<Constant>(gcptr)) {
-    assert((isa<ConstantPointerNull>(gcptr) || isa<UndefValue>(gcptr)) &&
-           "We should not record a constant as a gc pointer except for null");
-  } else {
-    invalid.insert(gcptr);
-  }
-  // First walk up the def chain if there's anything above us that should
-  // have been invalidated as well.
-  if (Instruction *inst = dyn_cast<Instruction>(gcptr)) {
-    if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(inst)) {
-      Value *Op = GEP->getOperand(0);
-      add_transative_closure(Op, invalid);
-    } else if (BitCastInst *cast = dyn_cast<BitCastInst>(inst)) {
-      Value *Op = cast->getOperand(0);
-      add_transative_closure(Op, invalid);
-    }
-  }
-
-  // Second, walk through all of our uses looking for things which should
-  // have been invalidated as well.
-  for (Value::user_iterator I = gcptr->user_begin(), E = gcptr->user_end();
-       I != E; I++) {
-    if (isa<CastInst>(*I) || isa<GetElementPtrInst>(*I)) {
-      add_transative_closure(*I, invalid);
-    }
-  }
-}
-
-void add_dominating_defs(Instruction *term, DenseSet<Value *> &invalid,
-                         DominatorTree *DT) {
-  // This function is basically a copy from
-  // SafepointPlacementImpl::findLiveGCValuesAtInst
-  // The only difference is that we record all possible gc pointers which
-  // dominate the safepoint and dont do any liveness check.
-  assert(!isa<PHINode>(term) &&
-         "term shoud be a safepoint and can not be a phi node");
-  Function *F = term->getParent()->getParent();
-  for (Function::arg_iterator argitr = F->arg_begin(), argend = F->arg_end();
-       argitr != argend; argitr++) {
-    Argument &arg = *argitr;
-    if (isGCPointerType(arg.getType())) {
-      add_transative_closure(&arg, invalid);
-    }
-  }
-
-  BasicBlock *pred = term->getParent();
-  for (DomTreeNode *currentNode = DT->getNode(pred); currentNode;
-       currentNode = currentNode->getIDom()) {
-    BasicBlock *BBI = currentNode->getBlock();
-    assert(isPotentiallyReachable(BBI, pred) &&
-           "dominated block must be reachable");
-    for (BasicBlock::iterator itr = BBI->begin(), end = BBI->end(); itr != end;
-         itr++) {
-      Instruction &inst = *itr;
-
-      if (pred == BBI && (&inst) == term) {
-        break;
-      }
-
-      if (!isGCPointerType(inst.getType())) {
-        continue;
-      }
-
-      if (IntrinsicInst *II = dyn_cast<IntrinsicInst>(&inst)) {
-        if (II->getIntrinsicID() == Intrinsic::statepoint) {
-          continue;
-        }
-      }
-      add_transative_closure(&inst, invalid);
-    }
-  }
-}
-
-struct bb_state {
-  /// The set of values which are known to be invalid on entry to
-  /// the basic block.  WARNING: PHIs may validly contain uses of
-  /// values in this set.  This can be used to avoid traversing the
-  /// rest of the basic block, but you must still scan the PHI nodes!
-  DenseSet<Value *> InvalidOnEntry;
-
-  /// The set of values known to be invalid on exit from the basic
-  /// block.
-  DenseSet<Value *> InvalidOnExit;
-};
-}
-
-static void ComputeInvalidSetAtStatepoint(CallSite &CS,
-                                          DenseSet<Value *> &invalid,
-                                          DominatorTree &DT) {
-  Instruction *inst = CS.getInstruction();
-  Statepoint statepoint(CS);
-
-  for (ImmutableCallSite::arg_iterator i = statepoint.gc_args_begin(),
-                                       e = statepoint.gc_args_end();
-       i != e; i++) {
-    Value *op = *i;
-
-    assert(isa<Argument>(op) || isa<Constant>(op) || isa<Instruction>(op));
-
-    // Add this Value and any other pointers we can find to the same
-    // base object -- all are invalid to use after the safepoint
-    add_transative_closure(op, invalid);
-  }
-
-  add_dominating_defs(inst, invalid, &DT);
-
-  // TODO: we should expand the invalidation set to include the
-  // transative closure of bitcasts and geps (both uses and ops) from
-  // the invalidated Values.  Those are invalid too, but might not be
-  // explicitly listed due to liveness.
-}
-
 static bool RelocationPHIEscapes(PHINode *node) {
   if (!AllowNonEscapingUnrelocatedValues) {
     return true;
@@ -230,211 +103,291 @@ static bool RelocationPHIEscapes(PHINode *node) {
   return false;
 }
 
-/// A helper struct to manager insertion and removal into
-/// a worklist.  Items are processed in LIFO order except
-/// that items are only inserted once and not duplicated.
-/// This 'no multiple visits' property has a major impact
-/// on large IR graphs.  (80% reduction on motivating example)
-/// The order is unimportant for correctness, but is
-/// general considered good for data flow convergence.
-/// (no data has been gathered for that last point)
-struct Worklist {
-  // initial allocation of 200 picked more or less at random
-  // we want it large enough for most functions, but small
-  // enough to not waste tons of stack space.  Given we
-  // should be shallow and near a leaf at this point, we
-  // could afford to be even more generous.
-  SmallVector<BasicBlock *, 200> Worklist;
-  DenseSet<BasicBlock *> OnList;
-
-  void push_back(BasicBlock *BB) {
-    if (OnList.count(BB)) {
-      // already in the worklist
-      return;
-    }
-    Worklist.push_back(BB);
-    OnList.insert(BB);
+namespace {
+typedef SparseBitVector<> ValueSet;
+
+/// Computes and checks the sets of invalid (unrelocated) values of one
+/// function.  The arguments and instructions are numbered in function order,
+/// so sets of them are sparse bit vectors and the values defined by a block
+/// are a contiguous range of numbers.
+///
+/// A statepoint invalidates every gc pointer defined before it in the
+/// dominator tree, along with everything derived from them.  Rather than
+/// walking the dominator chain of each statepoint, this set is maintained
+/// incrementally while walking the dominator tree depth first.
+class SafepointIRVerifierImpl {
+public:
+  SafepointIRVerifierImpl(Function &F, DominatorTree &DT) : F(F), DT(DT) {}
+
+  void verify();
+
+private:
+  struct BlockState {
+    /// Invalidated by the statepoints of the block and still invalid on
+    /// exit from it.
+    ValueSet Gen;
+    /// Defined in the block, so valid on exit unless in Gen.
+    ValueSet Kill;
+    /// Invalid on entry to the block.  WARNING: PHIs may validly contain
+    /// uses of values in this set, they must be checked against the exit
+    /// state of the incoming block instead.
+    ValueSet In;
+    /// Invalid on exit from the block.
+    ValueSet Out;
+  };
+
+  int getNumber(const Value *V) const {
+    DenseMap<const Value *, unsigned>::const_iterator I = Numbers.find(V);
+    return I == Numbers.end() ? -1 : (int)I->second;
   }
-  BasicBlock *next() {
-    BasicBlock *BB = Worklist.back();
-    Worklist.pop_back();
 
-    OnList.erase(BB);
-    return BB;
-  }
+  void addTransitiveClosure(Value *V, ValueSet &Set, ValueSet *Closed,
+                            std::vector<unsigned> *Added);
+  void visitDef(Instruction *I);
+  void getStatepointInvalidations(ImmutableCallSite CS, ValueSet &Result);
+  void computeLocalState(BasicBlock *BB);
+  void checkBlock(BasicBlock *BB);
+  void reportIllegalUse(const char *Message, Value *Def, Instruction *Use);
+
+  template <typename Fn> void walkDominatorTree(Fn Visit);
+
+  Function &F;
+  DominatorTree &DT;
+  DenseMap<const Value *, unsigned> Numbers;
+  DenseMap<const BasicBlock *, BlockState> States;
+
+  /// The gc pointers defined before the current point in its dominators,
+  /// with their transitive closures.  Closed under addTransitiveClosure.
+  ValueSet Dominating;
+  /// The numbers added to Dominating by the blocks on the current dominator
+  /// tree path, so they can be removed again when leaving the blocks.
+  std::vector<unsigned> DominatingAdded;
+};
+}
 
-  bool empty() const {
-    return Worklist.empty();
+// Walk through the def-use chains and seek out any other Value which is
+// simply a GEP or bitcast from the one we know got invalidated.  Since the
+// object may have moved, all these are invalid as well.
+// Note: We can't walk PHIs or Selects despite how tempting it might seem.
+// Without reasoning about control flow, that might not have been the dynamic
+// value which got invalidated.
+//
+// Values already in Set, or in Closed, have had their closure added before
+// and are not walked again.  The numbers of the values added are appended to
+// Added, if given.
+void SafepointIRVerifierImpl::addTransitiveClosure(
+    Value *V, ValueSet &Set, ValueSet *Closed,
+    std::vector<unsigned> *Added) {
+  SmallVector<Value *, 16> Worklist(1, V);
+  while (!Worklist.empty()) {
+    Value *Cur = Worklist.pop_back_val();
+    int Num = getNumber(Cur);
+    if (Num < 0) {
+      // we dont want to add a null into the invalid set
+      assert((isa<ConstantPointerNull>(Cur) || isa<UndefValue>(Cur) ||
+              !isa<Constant>(Cur)) &&
+             "We should not record a constant as a gc pointer except for null");
+      continue;
+    }
+    if ((Closed && Closed->test(Num)) || !Set.test_and_set(Num))
+      continue;
+    if (Added)
+      Added->push_back(Num);
+
+    // First walk up the def chain if there's anything above us that should
+    // have been invalidated as well.
+    if (isa<GetElementPtrInst>(Cur) || isa<BitCastInst>(Cur))
+      Worklist.push_back(cast<Instruction>(Cur)->getOperand(0));
+
+    // Second, walk through all of our uses looking for things which should
+    // have been invalidated as well.
+    for (User *U : Cur->users())
+      if (isa<CastInst>(U) || isa<GetElementPtrInst>(U))
+        Worklist.push_back(U);
   }
-};
+}
 
-bool SafepointIRVerifier::runOnFunction(Function &F) {
-  DT.recalculate(const_cast<Function &>(F));
-  /* TODO: Additional invariants to check
-     - There can be exactly one 'original' value in each relocation phi.
-     - Each basic block can contain at most one relocation phi for each
-     original value.
-   */
+/// Record a definition in the dominating set.  Like
+/// SafepointPlacementImpl::findLiveGCValuesAtInst, except we record all gc
+/// pointers and don't do any liveness check.
+void SafepointIRVerifierImpl::visitDef(Instruction *I) {
+  if (isGCPointerType(I->getType()) && !isStatepoint(I))
+    addTransitiveClosure(I, Dominating, nullptr, &DominatingAdded);
+}
 
-  // All states start empty
-  DenseMap<BasicBlock *, bb_state> state;
-  Worklist worklist;
-
-  DenseMap<Instruction *, DenseSet<Value *>> StatepointInvalidations;
-
-  // Start with all of the blocks containing statepoints, iterate from there to
-  // establish and check the invalid sets
-  for (inst_iterator itr = inst_begin(F), end = inst_end(F); itr != end;
-       itr++) {
-    Instruction *inst = &*itr;
-    if (isa<InvokeInst>(inst) || isa<CallInst>(inst)) {
-      CallSite CS(inst);
-      Function *F = CS.getCalledFunction();
-      if (F && F->getIntrinsicID() == Intrinsic::statepoint) {
-        worklist.push_back(inst->getParent());
-
-        // The invalidation set for a given instruction doesn't change
-        // during iteration.  Since computing the invalid set for a statepoit
-        // is rather expensive, recompute it once and cache the result.
-        ComputeInvalidSetAtStatepoint(CS, StatepointInvalidations[inst], DT);
-      }
+/// Compute the values invalid after a statepoint: those it relocates, and
+/// any other pointers we can find to the same base objects.
+void SafepointIRVerifierImpl::getStatepointInvalidations(ImmutableCallSite CS,
+                                                         ValueSet &Result) {
+  // The relocated values nearly always dominate the statepoint, so only
+  // walk the closure of those which don't.
+  ValueSet Extra;
+  ImmutableStatepoint Statepoint(CS);
+  for (ImmutableCallSite::arg_iterator I = Statepoint.gc_args_begin(),
+                                       E = Statepoint.gc_args_end();
+       I != E; ++I) {
+    Value *Op = *I;
+    assert(isa<Argument>(Op) || isa<Constant>(Op) || isa<Instruction>(Op));
+    addTransitiveClosure(Op, Extra, &Dominating, nullptr);
+  }
+  Result |= Dominating;
+  Result |= Extra;
+}
+
+/// Walk the dominator tree depth first, calling Visit on each block with
+/// Dominating holding the values defined in its strict dominators.  Visit
+/// calls visitDef on each instruction in order.
+template <typename Fn>
+void SafepointIRVerifierImpl::walkDominatorTree(Fn Visit) {
+  Dominating.clear();
+  DominatingAdded.clear();
+  for (Function::arg_iterator I = F.arg_begin(), E = F.arg_end(); I != E; ++I)
+    if (isGCPointerType(I->getType()))
+      addTransitiveClosure(&*I, Dominating, nullptr, nullptr);
+
+  struct StackEntry {
+    DomTreeNode *Node;
+    DomTreeNode::iterator NextChild;
+    size_t AddedMark;
+  };
+  SmallVector<StackEntry, 32> Stack;
+  DomTreeNode *Root = DT.getRootNode();
+  StackEntry Entry = { Root, Root->begin(), DominatingAdded.size() };
+  Stack.push_back(Entry);
+  Visit(Root->getBlock());
+  while (!Stack.empty()) {
+    StackEntry &Top = Stack.back();
+    if (Top.NextChild != Top.Node->end()) {
+      DomTreeNode *Child = *Top.NextChild++;
+      StackEntry ChildEntry = { Child, Child->begin(), DominatingAdded.size() };
+      Stack.push_back(ChildEntry);
+      Visit(Child->getBlock());
+      continue;
     }
+    // Leaving the block, forget what it defined.
+    for (size_t i = Top.AddedMark, e = DominatingAdded.size(); i != e; ++i)
+      Dominating.reset(DominatingAdded[i]);
+    DominatingAdded.resize(Top.AddedMark);
+    Stack.pop_back();
   }
+}
 
-  // iterate until the invalid states stablize, checking on every iteration.
-  // The check could be pulled into a single post pass, but why bother?
-  while (!worklist.empty()) {
-    BasicBlock *current = worklist.next();
-
-    DenseSet<Value *> nowvalid;
-    // First, handle all the PHINodes in a path sensative manner
-    for (BasicBlock::iterator itr = current->begin(),
-                              end = current->getFirstNonPHI();
-         itr != end; itr++) {
-      Instruction *inst = &*itr;
-      PHINode *phi = cast<PHINode>(inst);
+void SafepointIRVerifierImpl::computeLocalState(BasicBlock *BB) {
+  BlockState &State = States[BB];
+  for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+    unsigned Num = Numbers[&*I];
+    State.Kill.set(Num);
+    if (isStatepoint(&*I))
+      getStatepointInvalidations(ImmutableCallSite(&*I), State.Gen);
+    visitDef(&*I);
+    // A definition, e.g. via a backedge, is valid after it.
+    State.Gen.reset(Num);
+  }
+}
+
+void SafepointIRVerifierImpl::reportIllegalUse(const char *Message, Value *Def,
+                                               Instruction *Use) {
+  errs() << Message;
+  errs() << "Def: ";
+  Def->dump();
+  errs() << "Use: ";
+  Use->dump();
+  if (!PrintOnly)
+    assert(0 && "use of invalid unrelocated value after safepoint!");
+}
+
+void SafepointIRVerifierImpl::checkBlock(BasicBlock *BB) {
+  ValueSet Invalid = States[BB].In;
+  for (BasicBlock::iterator I = BB->begin(), E = BB->end(); I != E; ++I) {
+    Instruction *Inst = &*I;
+    if (PHINode *Phi = dyn_cast<PHINode>(Inst)) {
       // The 'use' check for a phi needs to be path sensative.  Remember, a
       // phi use is valid if the use if valid in the source block, not the
       // current block!
-      for (size_t i = 0; i < phi->getNumIncomingValues(); i++) {
-        Value *InVal = phi->getIncomingValue(i);
-        BasicBlock *inBB = phi->getIncomingBlock(i);
-        if (state[inBB].InvalidOnExit.find(InVal) !=
-            state[inBB].InvalidOnExit.end()) {
-          if (RelocationPHIEscapes(phi)) {
-            errs() << "Illegal use of unrelocated value in phi edge-reachable "
-                      "from safepoint found!\n";
-            errs() << "Def: ";
-            InVal->dump();
-            errs() << "Use: ";
-            inst->dump();
-            if (!PrintOnly)
-              assert(state[inBB].InvalidOnExit.find(InVal) ==
-                         state[inBB].InvalidOnExit.end() &&
-                     "use of invalid unrelocated value after safepoint!");
-          }
-        }
+      for (unsigned i = 0, e = Phi->getNumIncomingValues(); i != e; ++i) {
+        Value *InVal = Phi->getIncomingValue(i);
+        int Num = getNumber(InVal);
+        DenseMap<const BasicBlock *, BlockState>::iterator InState =
+            States.find(Phi->getIncomingBlock(i));
+        if (Num >= 0 && InState != States.end() &&
+            InState->second.Out.test(Num) && RelocationPHIEscapes(Phi))
+          reportIllegalUse("Illegal use of unrelocated value in phi edge-"
+                           "reachable from safepoint found!\n", InVal, Phi);
+      }
+    } else {
+      for (unsigned i = 0, e = Inst->getNumOperands(); i != e; ++i) {
+        Value *Op = Inst->getOperand(i);
+        int Num = getNumber(Op);
+        if (Num >= 0 && Invalid.test(Num))
+          reportIllegalUse("Illegal use of unrelocated value after "
+                           "safepoint found!\n", Op, Inst);
       }
-      nowvalid.insert(phi);
-    }
-
-    // Anything invalid an _any_ of our input blocks is invalid in this one
-    DenseSet<Value *> invalid;
-    for (pred_iterator PI = pred_begin(current), E = pred_end(current);
-         PI != E; ++PI) {
-      BasicBlock *Pred = *PI;
-      bb_state exit = state[Pred];
-      invalid.insert(exit.InvalidOnExit.begin(), exit.InvalidOnExit.end());
-    }
 
-    // We don't need to rescan the block if the state on entry is the same.
-    // Note that we DO have to perform the path sensative phi check above
-    // since a value could be newly invalidated along some particular edge
-    if (!invalid.empty() &&
-        set_equals(state[current].InvalidOnEntry, invalid)) {
-      // The empty check is to ensure we process the bb at least once.
-      // Since an empty invalid set doesn't contribute to the invalid
-      // set of it's successor, we shouldn't renter a bb with the set empty
-      continue;
+      // Anything relocated by a statepoint is invalid after it.
+      if (isStatepoint(Inst))
+        getStatepointInvalidations(ImmutableCallSite(Inst), Invalid);
     }
-    state[current].InvalidOnEntry = invalid;
-
+    visitDef(Inst);
     // If we encounter a def via a backedge, remove it from the set of
-    // invalid uses - in this case, all phi defs are valid, no matter what cam
-    // in through the merge set
-    set_subtract(invalid, nowvalid);
-
-    // Then scan through all the rest of the instructions, checking for invalid
-    // uses and
-    for (BasicBlock::iterator itr = current->getFirstNonPHI(),
-                              end = current->end();
-         itr != end; itr++) {
-      Instruction *inst = &*itr;
-
-      // Check all the uses
-      for (size_t i = 0; i < inst->getNumOperands(); i++) {
-        Value *op = inst->getOperand(i);
-        if (invalid.find(op) != invalid.end()) {
-          errs()
-              << "Illegal use of unrelocated value after safepoint found!\n";
-          errs() << "Def: ";
-          op->dump();
-          errs() << "Use: ";
-          inst->dump();
-          if (!PrintOnly)
-            assert(invalid.find(op) == invalid.end() &&
-                   "use of invalid unrelocated value after safepoint!");
-        }
-      }
-
-      // if this is a statepoint, expand the invalid set.  Anything relocated
-      // by this safepoint is now invalid.
-      if (isa<InvokeInst>(inst) || isa<CallInst>(inst)) {
-        CallSite CS(inst);
-        Function *F = CS.getCalledFunction();
-        if (F && F->getIntrinsicID() == Intrinsic::statepoint) {
+    // invalid values.  In particular all phi defs are valid, no matter what
+    // came in through the merge.
+    Invalid.reset(Numbers[Inst]);
+  }
+}
 
-          // see the note above about stablity and precomputation
-          assert(
-              StatepointInvalidations.count(inst) &&
-              "must have precomputed an invalidation set for each statepoint");
+void SafepointIRVerifierImpl::verify() {
+  bool HasStatepoint = false;
+  unsigned Num = 0;
+  for (Function::arg_iterator I = F.arg_begin(), E = F.arg_end(); I != E; ++I)
+    Numbers[&*I] = Num++;
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+    Numbers[&*I] = Num++;
+    HasStatepoint |= isStatepoint(&*I);
+  }
+  if (!HasStatepoint)
+    return;
 
-          set_union(invalid, StatepointInvalidations[inst]);
-        }
+  walkDominatorTree([this](BasicBlock *BB) { computeLocalState(BB); });
+
+  // Anything invalid on exit of _any_ of our predecessors is invalid in this
+  // block.  Iterate to a fixed point in reverse post order, which visits the
+  // predecessors of a block first except along backedges.
+  ReversePostOrderTraversal<Function *> RPOT(&F);
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (BasicBlock *BB : RPOT) {
+      BlockState &State = States[BB];
+      for (pred_iterator PI = pred_begin(BB), PE = pred_end(BB); PI != PE;
+           ++PI) {
+        DenseMap<const BasicBlock *, BlockState>::const_iterator Pred =
+            States.find(*PI);
+        if (Pred != States.end())
+          State.In |= Pred->second.Out;
       }
-      // If we encounter a def via a backedge, remove it from the set of
-      // invalid uses
-      invalid.erase(inst);
-    }
 
-    // If our output has changed, add any successor blocks to the worklist
-    if (!set_equals(state[current].InvalidOnExit, invalid)) {
-#if 0
-      //TODO: Add some logging
-      if( TraceIVMSP ) {
-        errs() << "update: " << Succ << " ";
-        state[Succ].dump();
-        errs() << " -> ";
-        entry.dump();
-        errs() << "\n";
-      }
-#endif
-      state[current].InvalidOnExit = invalid;
-      if (!invalid.empty()) {
-        // We are guaranteed to visit each statepoint block once since
-        // we manually added them on the worklist.  These are the only
-        // blocks which can map empty => nonempty on anything other
-        // than the first iteraion.
-        for (succ_iterator PI = succ_begin(current), E = succ_end(current);
-             PI != E; ++PI) {
-          BasicBlock *Succ = *PI;
-          // TODO-PERF: could prune if invalid subset of successor incoming
-          // and we walked the phis eagerly here to handle path sensativity
-          worklist.push_back(Succ);
-        }
+      // Out = Gen | (In & ~Kill)
+      ValueSet Out;
+      Out.intersectWithComplement(State.In, State.Kill);
+      Out |= State.Gen;
+      if (Out != State.Out) {
+        State.Out = Out;
+        Changed = true;
       }
     }
-  } // while( !worklist.empty() )
+  }
+
+  walkDominatorTree([this](BasicBlock *BB) { checkBlock(BB); });
+}
+
+bool SafepointIRVerifier::runOnFunction(Function &F) {
+  /* TODO: Additional invariants to check
+     - There can be exactly one 'original' value in each relocation phi.
+     - Each basic block can contain at most one relocation phi for each
+     original value.
+   */
+  DT.recalculate(F);
+  SafepointIRVerifierImpl(F, DT).verify();
 
   // No modification, ever
   return false;
@@ -60,6 +60,25 @@ bool llvm::isGCResult(const Instruction *inst) {
   return false;
 }
 
+bool llvm::isGCLandingToken(const Instruction *inst) {
+  if (const CallInst *call = dyn_cast<CallInst>(inst)) {
+    if (const Function *F = call->getCalledFunction()) {
+      return F->getIntrinsicID() == Intrinsic::gc_landing_token;
+    }
+  }
+  return false;
+}
+
+const Instruction *llvm::getStatepointForToken(const Value *token) {
+  const Instruction *inst = cast<Instruction>(token);
+  if (isGCLandingToken(inst)) {
+    const BasicBlock *pred = inst->getParent()->getUniquePredecessor();
+    assert(pred && "landing token without a unique predecessor");
+    return pred->getTerminator();
+  }
+  return inst;
+}
+
 cl::opt<bool> AllFunctions("spp-all-functions", cl::init(false));
 
 bool llvm::isGCPointerType(llvm::Type *Ty) {
@@ -2601,13 +2601,36 @@ void Verifier::visitIntrinsicFunctionCall(Intrinsic::ID ID, CallInst &CI) {
             "token must be from a statepoint", &CI, CI.getArgOperand(0));
     break;
   }
+  case Intrinsic::gc_landing_token: {
+    // The token stands in for an invoke of a statepoint in the landing pad
+    // that invoke unwinds to.
+    BasicBlock *BB = CI.getParent();
+    Assert1(BB->isLandingPad(),
+            "gc.landing_token must be in a landing pad", &CI);
+    BasicBlock *Pred = BB->getUniquePredecessor();
+    InvokeInst *II = Pred ? dyn_cast<InvokeInst>(Pred->getTerminator()) : NULL;
+    Assert1(II && II->getUnwindDest() == BB && isStatepoint(II),
+            "gc.landing_token must follow the invoke of a statepoint", &CI);
+    for (User *U : CI.users())
+      Assert2(isa<Instruction>(U) && isGCRelocate(cast<Instruction>(U)),
+              "gc.relocate is the only use of gc.landing_token", &CI, U);
+    break;
+  }
   case Intrinsic::gc_relocate: {
     // Some checks to ensure gc.relocate has the correct set of
     // parameters.  TODO: we can make these tests much stricter.
     Assert1(CI.getNumArgOperands() == 3, "wrong number of arguments", &CI);
 
-    // Are we tied to a statepoint properly?
-    CallSite StatepointCS(CI.getArgOperand(0));
+    // Are we tied to a statepoint properly?  Along the exceptional edge of an
+    // invoke that is through the landing pad's gc.landing_token.
+    Value *Token = CI.getArgOperand(0);
+    if (isa<Instruction>(Token) && isGCLandingToken(cast<Instruction>(Token))) {
+      BasicBlock *Pred = cast<Instruction>(Token)->getParent()
+                             ->getUniquePredecessor();
+      Assert2(Pred, "gc.landing_token needs a unique predecessor", &CI, Token);
+      Token = Pred->getTerminator();
+    }
+    CallSite StatepointCS(Token);
     const Function *spFn =
         StatepointCS.getInstruction() ? StatepointCS.getCalledFunction() : NULL;
     Assert2(spFn && spFn->isDeclaration() &&
@@ -0,0 +1,183 @@
+//===- StackMapParser.cpp - Parser for the .llvm_stackmaps section --------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the stack map parser.  The version 1 layout is
+// documented at StackMaps::emitStackmapHeader and the functions following it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Object/StackMapParser.h"
+#include "llvm/Object/Error.h"
+#include "llvm/Support/Endian.h"
+
+using namespace llvm;
+using namespace object;
+
+namespace {
+const uint64_t V1HeaderSize = 16;
+const uint64_t V1FunctionSize = 16;
+const uint64_t V1ConstantSize = 8;
+const uint64_t V1RecordHeaderSize = 16;
+const uint64_t V1LocationSize = 8;
+const uint64_t V1LiveOutSize = 4;
+
+template <typename T> T readAt(const uint8_t *Base, uint64_t Offset) {
+  return support::endian::read<T, support::native, support::unaligned>(
+    Base + Offset);
+}
+}
+
+StackMapParser::StackMapParser(StringRef Data)
+  : Data(Data), Version(Data[0]), NumFunctions(0), NumConstants(0),
+    NumCallsites(0), RecordsOffset(0) {}
+
+ErrorOr<StackMapParser> StackMapParser::create(StringRef Data) {
+  if (Data.empty())
+    return object_error::unexpected_eof;
+
+  StackMapParser Parser(Data);
+  switch (Parser.Version) {
+  case 1: {
+    if (Data.size() < V1HeaderSize)
+      return object_error::unexpected_eof;
+    const uint8_t *Base = Parser.getBase();
+    Parser.NumFunctions = readAt<uint32_t>(Base, 4);
+    Parser.NumConstants = readAt<uint32_t>(Base, 8);
+    Parser.NumCallsites = readAt<uint32_t>(Base, 12);
+    // The counts are 32 bit, so this can't overflow.
+    Parser.RecordsOffset = V1HeaderSize +
+                           Parser.NumFunctions * V1FunctionSize +
+                           Parser.NumConstants * V1ConstantSize;
+    if (Parser.RecordsOffset > Data.size())
+      return object_error::unexpected_eof;
+
+    Callsite CS;
+    uint64_t Offset = Parser.RecordsOffset;
+    for (unsigned C = 0; C != Parser.NumCallsites; ++C)
+      if (!(Offset = Parser.decodeV1Callsite(Offset, CS)))
+        return object_error::parse_failed;
+    return Parser;
+  }
+  case 2: {
+    ErrorOr<StackMapV2Reader> Reader = StackMapV2Reader::create(Data);
+    if (std::error_code EC = Reader.getError())
+      return EC;
+    Parser.NumFunctions = Reader->getNumFunctions();
+    Parser.NumConstants = Reader->getNumConstants();
+    Parser.NumCallsites = Reader->getNumCallsites();
+    Parser.V2 = std::move(*Reader);
+    return Parser;
+  }
+  default:
+    return object_error::parse_failed;
+  }
+}
+
+StackMapParser::Function StackMapParser::getFunction(unsigned Idx) const {
+  if (V2)
+    return V2->getFunction(Idx);
+  assert(Idx < NumFunctions && "function index out of range");
+  uint64_t Offset = V1HeaderSize + Idx * V1FunctionSize;
+  Function Fn;
+  Fn.Address = readAt<uint64_t>(getBase(), Offset);
+  Fn.StackSize = readAt<uint64_t>(getBase(), Offset + 8);
+  Fn.FirstCallsite = 0;
+  Fn.NumCallsites = 0;
+  return Fn;
+}
+
+int64_t StackMapParser::getConstant(unsigned Idx) const {
+  if (V2)
+    return V2->getConstant(Idx);
+  assert(Idx < NumConstants && "constant index out of range");
+  return readAt<int64_t>(getBase(), V1HeaderSize +
+                                    NumFunctions * V1FunctionSize +
+                                    Idx * V1ConstantSize);
+}
+
+uint64_t StackMapParser::decodeV1Callsite(uint64_t Offset,
+                                          Callsite &Result) const {
+  Result.Locations.clear();
+  Result.LiveOuts.clear();
+
+  const uint8_t *Base = getBase();
+  uint64_t Size = Data.size();
+  if (Offset + V1RecordHeaderSize > Size)
+    return 0;
+  Result.ID = readAt<uint64_t>(Base, Offset);
+  Result.InstructionOffset = readAt<uint32_t>(Base, Offset + 8);
+  unsigned NumLocs = readAt<uint16_t>(Base, Offset + 14);
+  Offset += V1RecordHeaderSize;
+
+  // The locations are followed by the padding and the live out count.
+  if (Offset + NumLocs * V1LocationSize + 4 > Size)
+    return 0;
+  for (unsigned L = 0; L != NumLocs; ++L, Offset += V1LocationSize) {
+    Location Loc;
+    Loc.Kind = LocationKind(readAt<uint8_t>(Base, Offset));
+    Loc.Size = readAt<uint8_t>(Base, Offset + 1);
+    Loc.DwarfRegNum = readAt<uint16_t>(Base, Offset + 2);
+    Loc.Offset = readAt<int32_t>(Base, Offset + 4);
+    if (Loc.Kind < StackMapV2Reader::Register ||
+        Loc.Kind > StackMapV2Reader::ConstantIndex)
+      return 0;
+    if (Loc.Kind == StackMapV2Reader::ConstantIndex &&
+        (Loc.Offset < 0 || unsigned(Loc.Offset) >= NumConstants))
+      return 0;
+    Result.Locations.push_back(Loc);
+  }
+
+  unsigned NumLiveOuts = readAt<uint16_t>(Base, Offset + 2);
+  Offset += 4;
+  if (Offset + NumLiveOuts * V1LiveOutSize > Size)
+    return 0;
+  for (unsigned L = 0; L != NumLiveOuts; ++L, Offset += V1LiveOutSize) {
+    LiveOut LO = { readAt<uint16_t>(Base, Offset),
+                   readAt<uint8_t>(Base, Offset + 3) };
+    Result.LiveOuts.push_back(LO);
+  }
+
+  Offset = (Offset + 7) & ~uint64_t(7);
+  if (Offset > Size)
+    return 0;
+  return Offset;
+}
+
+StackMapParser::callsite_iterator::callsite_iterator(
+    const StackMapParser &Parser, unsigned Idx, uint64_t Offset)
+  : Parser(&Parser), Idx(Idx), NextOffset(Offset) {
+  decode();
+}
+
+void StackMapParser::callsite_iterator::decode() {
+  if (Idx == Parser->NumCallsites)
+    return;
+  if (Parser->V2) {
+    Parser->V2->getCallsite(Idx, CS);
+    return;
+  }
+  NextOffset = Parser->decodeV1Callsite(NextOffset, CS);
+  assert(NextOffset && "callsite was checked by create");
+}
+
+StackMapParser::callsite_iterator &
+StackMapParser::callsite_iterator::operator++() {
+  assert(Idx != Parser->NumCallsites && "incrementing end iterator");
+  ++Idx;
+  decode();
+  return *this;
+}
+
+StackMapParser::callsite_iterator StackMapParser::callsite_begin() const {
+  return callsite_iterator(*this, 0, RecordsOffset);
+}
+
+StackMapParser::callsite_iterator StackMapParser::callsite_end() const {
+  return callsite_iterator(*this, NumCallsites, 0);
+}
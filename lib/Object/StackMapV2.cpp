@@ -0,0 +1,212 @@
+//===- StackMapV2.cpp - Reader for version 2 stack maps -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the reader for version 2 stack maps.  The layout is
+// documented at StackMaps::emitStackMapV2.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Object/StackMapV2.h"
+#include "llvm/Object/Error.h"
+#include "llvm/Support/Endian.h"
+
+using namespace llvm;
+using namespace object;
+
+namespace {
+const uint64_t HeaderSize = 24;
+const uint64_t ConstantSize = 8;
+const uint64_t FunctionSize = 24;
+const uint64_t CallsiteEntrySize = 8;
+const uint64_t LocationSize = 8;
+
+template <typename T> T readAt(const uint8_t *Base, uint64_t Offset) {
+  return support::endian::read<T, support::native, support::unaligned>(
+    Base + Offset);
+}
+
+/// Decode a ULEB128 value without running past End.
+bool readULEB128(const uint8_t *&Ptr, const uint8_t *End, uint64_t &Value) {
+  Value = 0;
+  unsigned Shift = 0;
+  while (Ptr != End) {
+    uint8_t Byte = *Ptr++;
+    if (Shift >= 64)
+      return false;
+    Value |= uint64_t(Byte & 0x7f) << Shift;
+    Shift += 7;
+    if (!(Byte & 0x80))
+      return true;
+  }
+  return false;
+}
+}
+
+StackMapV2Reader::StackMapV2Reader(StringRef Data) : Data(Data) {
+  const uint8_t *Base = getBase();
+  NumFunctions = readAt<uint32_t>(Base, 4);
+  NumConstants = readAt<uint32_t>(Base, 8);
+  NumLocations = readAt<uint32_t>(Base, 12);
+  NumCallsites = readAt<uint32_t>(Base, 16);
+  FunctionsOffset = HeaderSize + NumConstants * ConstantSize;
+  CallsitesOffset = FunctionsOffset + NumFunctions * FunctionSize;
+  LocationsOffset = CallsitesOffset + NumCallsites * CallsiteEntrySize;
+  RecordsOffset = LocationsOffset + NumLocations * LocationSize;
+}
+
+ErrorOr<StackMapV2Reader> StackMapV2Reader::create(StringRef Data) {
+  if (Data.size() < HeaderSize)
+    return object_error::unexpected_eof;
+  if (Data[0] != 2)
+    return object_error::parse_failed;
+
+  // The counts are 32 bit, so none of the offsets can overflow.
+  StackMapV2Reader Reader(Data);
+  if (Reader.RecordsOffset > Data.size())
+    return object_error::unexpected_eof;
+
+  // The callsites of the functions are consecutive and sorted by offset.
+  uint64_t NextCallsite = 0;
+  for (unsigned F = 0; F != Reader.NumFunctions; ++F) {
+    Function Fn = Reader.getFunction(F);
+    if (Fn.FirstCallsite != NextCallsite ||
+        NextCallsite + Fn.NumCallsites > Reader.NumCallsites)
+      return object_error::parse_failed;
+    NextCallsite += Fn.NumCallsites;
+    for (unsigned C = 1; C < Fn.NumCallsites; ++C)
+      if (Reader.getInstructionOffset(Fn.FirstCallsite + C - 1) >
+          Reader.getInstructionOffset(Fn.FirstCallsite + C))
+        return object_error::parse_failed;
+  }
+  if (NextCallsite != Reader.NumCallsites)
+    return object_error::parse_failed;
+
+  for (unsigned L = 0; L != Reader.NumLocations; ++L) {
+    Location Loc = Reader.getLocation(L);
+    if (Loc.Kind < Register || Loc.Kind > ConstantIndex)
+      return object_error::parse_failed;
+    if (Loc.Kind == ConstantIndex &&
+        (Loc.Offset < 0 || unsigned(Loc.Offset) >= Reader.NumConstants))
+      return object_error::parse_failed;
+  }
+
+  Callsite CS;
+  for (unsigned C = 0; C != Reader.NumCallsites; ++C)
+    if (!Reader.decodeCallsite(C, CS))
+      return object_error::parse_failed;
+
+  return Reader;
+}
+
+StackMapV2Reader::Function StackMapV2Reader::getFunction(unsigned Idx) const {
+  assert(Idx < NumFunctions && "function index out of range");
+  uint64_t Offset = FunctionsOffset + Idx * FunctionSize;
+  Function Fn;
+  Fn.Address = readAt<uint64_t>(getBase(), Offset);
+  Fn.StackSize = readAt<uint64_t>(getBase(), Offset + 8);
+  Fn.FirstCallsite = readAt<uint32_t>(getBase(), Offset + 16);
+  Fn.NumCallsites = readAt<uint32_t>(getBase(), Offset + 20);
+  return Fn;
+}
+
+int64_t StackMapV2Reader::getConstant(unsigned Idx) const {
+  assert(Idx < NumConstants && "constant index out of range");
+  return readAt<int64_t>(getBase(), HeaderSize + Idx * ConstantSize);
+}
+
+StackMapV2Reader::Location StackMapV2Reader::getLocation(unsigned Idx) const {
+  assert(Idx < NumLocations && "location index out of range");
+  uint64_t Offset = LocationsOffset + Idx * LocationSize;
+  Location Loc;
+  Loc.Kind = LocationKind(readAt<uint8_t>(getBase(), Offset));
+  Loc.Size = readAt<uint8_t>(getBase(), Offset + 1);
+  Loc.DwarfRegNum = readAt<uint16_t>(getBase(), Offset + 2);
+  Loc.Offset = readAt<int32_t>(getBase(), Offset + 4);
+  return Loc;
+}
+
+uint32_t StackMapV2Reader::getInstructionOffset(unsigned Idx) const {
+  assert(Idx < NumCallsites && "callsite index out of range");
+  return readAt<uint32_t>(getBase(),
+                          CallsitesOffset + Idx * CallsiteEntrySize);
+}
+
+uint32_t StackMapV2Reader::getRecordOffset(unsigned Idx) const {
+  assert(Idx < NumCallsites && "callsite index out of range");
+  return readAt<uint32_t>(getBase(),
+                          CallsitesOffset + Idx * CallsiteEntrySize + 4);
+}
+
+bool StackMapV2Reader::decodeCallsite(unsigned Idx, Callsite &Result) const {
+  Result.Locations.clear();
+  Result.LiveOuts.clear();
+  Result.InstructionOffset = getInstructionOffset(Idx);
+
+  uint64_t RecordOffset = RecordsOffset + getRecordOffset(Idx);
+  if (RecordOffset >= Data.size())
+    return false;
+  const uint8_t *Ptr = getBase() + RecordOffset;
+  const uint8_t *End = getBase() + Data.size();
+
+  uint64_t NumLocs, NumLiveOuts;
+  if (!readULEB128(Ptr, End, Result.ID) || !readULEB128(Ptr, End, NumLocs))
+    return false;
+  // Every entry takes at least a byte, which bounds the counts.
+  if (NumLocs > uint64_t(End - Ptr))
+    return false;
+  for (uint64_t L = 0; L != NumLocs; ++L) {
+    uint64_t LocIdx;
+    if (!readULEB128(Ptr, End, LocIdx) || LocIdx >= NumLocations)
+      return false;
+    Result.Locations.push_back(getLocation(LocIdx));
+  }
+
+  if (!readULEB128(Ptr, End, NumLiveOuts) ||
+      NumLiveOuts > uint64_t(End - Ptr))
+    return false;
+  for (uint64_t L = 0; L != NumLiveOuts; ++L) {
+    uint64_t RegNo, Size;
+    if (!readULEB128(Ptr, End, RegNo) || !readULEB128(Ptr, End, Size))
+      return false;
+    LiveOut LO = { unsigned(RegNo), unsigned(Size) };
+    Result.LiveOuts.push_back(LO);
+  }
+  return true;
+}
+
+void StackMapV2Reader::getCallsite(unsigned Idx, Callsite &Result) const {
+  bool Valid = decodeCallsite(Idx, Result);
+  (void)Valid;
+  assert(Valid && "callsite was checked by create");
+}
+
+int StackMapV2Reader::findFunction(uint64_t Address) const {
+  for (unsigned F = 0; F != NumFunctions; ++F)
+    if (readAt<uint64_t>(getBase(), FunctionsOffset + F * FunctionSize) ==
+        Address)
+      return F;
+  return -1;
+}
+
+int StackMapV2Reader::findCallsite(unsigned FnIdx,
+                                   uint32_t InstructionOffset) const {
+  Function Fn = getFunction(FnIdx);
+  unsigned Lo = Fn.FirstCallsite, Hi = Fn.FirstCallsite + Fn.NumCallsites;
+  while (Lo < Hi) {
+    unsigned Mid = Lo + (Hi - Lo) / 2;
+    if (getInstructionOffset(Mid) < InstructionOffset)
+      Lo = Mid + 1;
+    else
+      Hi = Mid;
+  }
+  if (Lo != Fn.FirstCallsite + Fn.NumCallsites &&
+      getInstructionOffset(Lo) == InstructionOffset)
+    return Lo;
+  return -1;
+}
@@ -0,0 +1,137 @@
+//===- InferGCLeafFunctions.cpp - Find functions which never safepoint ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a bottom-up walk of the call graph which marks the
+// functions that can never reach a safepoint with "gc-leaf-inferred"="true".
+// Safepoint placement then treats calls to them as leaf calls (no statepoint,
+// no relocations) and places no entry poll in them.
+//
+// A function qualifies if its body is known, it has no cycles, it isn't
+// recursive, and every call in it is to a leaf: an intrinsic which never
+// safepoints, a function marked "gc-leaf-function", or a function inferred
+// here.  Allocation goes through a runtime call, so such a function doesn't
+// allocate either.  Without loops or recursion it finishes in bounded time,
+// which is why it needs no poll of its own.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/IPO.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/CallGraphSCCPass.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/JVMState.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "infer-gc-leaf"
+
+STATISTIC(NumInferred, "Number of functions marked gc-leaf-inferred");
+
+namespace {
+  struct InferGCLeafFunctions : public CallGraphSCCPass {
+    static char ID; // Pass identification, replacement for typeid
+    InferGCLeafFunctions() : CallGraphSCCPass(ID) {
+      initializeInferGCLeafFunctionsPass(*PassRegistry::getPassRegistry());
+    }
+
+    bool runOnSCC(CallGraphSCC &SCC) override;
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.setPreservesCFG();
+      CallGraphSCCPass::getAnalysisUsage(AU);
+    }
+  };
+}
+
+char InferGCLeafFunctions::ID = 0;
+INITIALIZE_PASS_BEGIN(InferGCLeafFunctions, "infer-gc-leaf",
+                "Infer GC leaf functions", false, false)
+INITIALIZE_PASS_DEPENDENCY(CallGraphWrapperPass)
+INITIALIZE_PASS_END(InferGCLeafFunctions, "infer-gc-leaf",
+                "Infer GC leaf functions", false, false)
+
+Pass *llvm::createInferGCLeafFunctionsPass() {
+  return new InferGCLeafFunctions();
+}
+
+/// Returns true if the call CS can't reach a safepoint.  This follows
+/// isGCLeafFunction in safepoint placement, except that calls which are
+/// already statepoints obviously do reach one.
+static bool isLeafCall(ImmutableCallSite CS) {
+  const Instruction *I = CS.getInstruction();
+  if (isJVMState(I))
+    return true; // removed before code generation
+  if (isa<InlineAsm>(CS.getCalledValue()))
+    return true; // placement never makes these parse points
+
+  if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(I)) {
+    switch (II->getIntrinsicID()) {
+    default:
+      return true;
+    case Intrinsic::memset:
+    case Intrinsic::memmove:
+    case Intrinsic::memcpy:
+    case Intrinsic::statepoint:
+      return false;
+    }
+  }
+
+  // Indirect calls could go anywhere
+  const Function *Callee = CS.getCalledFunction();
+  if (!Callee)
+    return false;
+  return Callee->getFnAttribute("gc-leaf-function")
+                .getValueAsString().equals("true") ||
+         Callee->getFnAttribute("gc-leaf-inferred")
+                .getValueAsString().equals("true");
+}
+
+static bool isInferableGCLeaf(Function &F) {
+  // The body may be replaced at link time
+  if (F.isDeclaration() || F.mayBeOverridden())
+    return false;
+  // The poll is where safepoints come from
+  if (F.getName().equals("gc.safepoint_poll"))
+    return false;
+
+  for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I)
+    if ((isa<CallInst>(*I) || isa<InvokeInst>(*I)) &&
+        !isLeafCall(ImmutableCallSite(&*I)))
+      return false;
+
+  // A loop would get a backedge poll.
+  SmallVector<std::pair<const BasicBlock *, const BasicBlock *>, 4> Backedges;
+  FindFunctionBackedges(F, Backedges);
+  return Backedges.empty();
+}
+
+bool InferGCLeafFunctions::runOnSCC(CallGraphSCC &SCC) {
+  // Mutual recursion can't be bounded, so only a singleton SCC qualifies.
+  // A self call is rejected by isLeafCall since F isn't marked yet.
+  if (!SCC.isSingular())
+    return false;
+
+  Function *F = (*SCC.begin())->getFunction();
+  if (!F || F->getFnAttribute("gc-leaf-function")
+                .getValueAsString().equals("true") ||
+      F->getFnAttribute("gc-leaf-inferred")
+        .getValueAsString().equals("true"))
+    return false;
+  if (!isInferableGCLeaf(*F))
+    return false;
+
+  F->addFnAttr("gc-leaf-inferred", "true");
+  ++NumInferred;
+  return true;
+}
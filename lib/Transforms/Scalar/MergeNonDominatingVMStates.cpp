@@ -2,6 +2,8 @@
 
 #include "llvm/ADT/DenseSet.h"
 
+#include "llvm/Analysis/VMStateInfo.h"
+
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Dominators.h"
@@ -106,15 +108,18 @@ struct MergeNonDominatingVMStates : public FunctionPass {
     if (!shouldGetSafepoints(F)) { return false; }
     if (shouldComputeLocations) { computeLocations(F); }
     DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
-    return mergeVMStates(F, DT);
+    const VMStateInfo &Info =
+      getAnalysis<VMStateInfoWrapperPass>().getVMStateInfo();
+    return mergeVMStates(F, DT, Info);
   }
 
-  bool mergeVMStates(Function &, DominatorTree &);
+  bool mergeVMStates(Function &, DominatorTree &, const VMStateInfo &);
   void phiOfVMStatesToVMStateOfPhis(PHINode *, StoreInst *, DominatorTree &DT);
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     AU.setPreservesCFG();
     AU.addRequired<DominatorTreeWrapperPass>();
+    AU.addRequired<VMStateInfoWrapperPass>();
   }
 
   // shouldGetSafepoints(F) is true if F needs safepoints.
@@ -122,16 +127,11 @@ struct MergeNonDominatingVMStates : public FunctionPass {
   bool isFunctionAttrTrue(Function &F, const char *);
 
   void computeLocations(Function &);
-  bool isUseInFunction(Instruction *, Function &);
 };
 
 } // end anonymous namespace
 
 
-bool MergeNonDominatingVMStates::isUseInFunction(Instruction *Instr, Function &F) {
-  return Instr->getParent()->getParent() == &F;
-}
-
 bool MergeNonDominatingVMStates::shouldGetSafepoints(Function &F) {
   return isFunctionAttrTrue(F, "gc-add-backedge-safepoints") ||
       isFunctionAttrTrue(F, "gc-add-call-safepoints") ||
@@ -144,7 +144,8 @@ bool MergeNonDominatingVMStates::isFunctionAttrTrue(Function &F,
 }
 
 // Main entry point for the algorithm
-bool MergeNonDominatingVMStates::mergeVMStates(Function &F, DominatorTree &DT) {
+bool MergeNonDominatingVMStates::mergeVMStates(Function &F, DominatorTree &DT,
+                                               const VMStateInfo &Info) {
   const char *anchorName = "llvm.jvmstate_anchor";
   Module &M = *F.getParent();
 
@@ -156,18 +157,20 @@ bool MergeNonDominatingVMStates::mergeVMStates(Function &F, DominatorTree &DT) {
     return false;
   }
 
-#ifndef NDEBUG
-  for (User *U : anchorVariable->users()) {
-    assert(isJVMState(cast<StoreInst>(U)->getValueOperand()) &&
-           "sanity: all stores to llvm.jvmstate_anchor should be "
-           "jvmstate_ calls");
+  std::vector<StoreInst *> anchorUsers;
+  for (StoreInst *SI : Info.getAnchorStores()) {
+    if (SI->getPointerOperand() == anchorVariable) {
+      assert(isJVMState(SI->getValueOperand()) &&
+             "sanity: all stores to llvm.jvmstate_anchor should be "
+             "jvmstate_ calls");
+      anchorUsers.push_back(SI);
+    }
   }
-#endif
 
   // No jvmstate_s we need to worry about, return early.  We can still
   // have VM states in the IR, as call VM states that don't manifest
   // as stores to the jvmstate_anchor
-  if (anchorVariable->use_empty()) { return false; }
+  if (anchorUsers.empty()) { return false; }
 
   // The core algorithm works by abusing the mem2reg pass.  Every
   // jvmstate_ we care about already is (volatile) stored to a global
@@ -199,22 +202,21 @@ bool MergeNonDominatingVMStates::mergeVMStates(Function &F, DominatorTree &DT) {
   AllocaInst *allocaAnchor =
       new AllocaInst(anchorType, "alloca_anchor", F.getEntryBlock().getFirstNonPHI());
 
-  std::vector<StoreInst *> anchorUsers;
-
-  for (User *U : anchorVariable->users()) {
-    if (isUseInFunction(cast<Instruction>(U), F))
-      anchorUsers.push_back(cast<StoreInst>(U));
-  }
-
   for (StoreInst *SI: anchorUsers) {
     SI->setVolatile(false);
     SI->replaceUsesOfWith(anchorVariable, allocaAnchor);
   }
 
+  // The stores mentioned in (1).  These are the only stores to the
+  // anchor left in F after promotion.
+  std::vector<StoreInst *> locationStores;
+  locationStores.reserve(locations.size());
+
   for (Instruction *I : locations) {
     // Add the stores mentioned in (1)
     LoadInst *currentVMState = new LoadInst(allocaAnchor, "current_vm_state", I);
-    new StoreInst(currentVMState, anchorVariable, true /* isVolatile */, I);
+    locationStores.push_back(
+        new StoreInst(currentVMState, anchorVariable, true /* isVolatile */, I));
   }
 
   assert(isAllocaPromotable(allocaAnchor) && "true by assumption!");
@@ -230,9 +232,9 @@ bool MergeNonDominatingVMStates::mergeVMStates(Function &F, DominatorTree &DT) {
 
     std::vector<StoreInst *> worklist;
 
-    for (User *U : anchorVariable->users()) {
-      if (isUseInFunction(cast<Instruction>(U), F) && isa<PHINode>(cast<StoreInst>(U)->getValueOperand())) {
-        worklist.push_back(cast<StoreInst>(U));
+    for (StoreInst *SI : locationStores) {
+      if (isa<PHINode>(SI->getValueOperand())) {
+        worklist.push_back(SI);
       }
     }
 
@@ -381,6 +383,8 @@ char MergeNonDominatingVMStates::ID = 0;
 INITIALIZE_PASS_BEGIN(MergeNonDominatingVMStates,
                       "merge-non-dominating-vmstates",
                       "Merge non-dominting VM states", false, false)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(VMStateInfoWrapperPass)
 INITIALIZE_PASS_END(MergeNonDominatingVMStates,
                     "merge-non-dominating-vmstates",
                     "Merge non-dominting VM states", false, false)
@@ -35,10 +35,17 @@
 #define DEBUG_TYPE "safepoint-placement"
 #include "llvm/InitializePasses.h"
 #include "llvm/Pass.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/SetOperations.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/LoopPass.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/VMStateInfo.h"
 #include "llvm/Analysis/CFG.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Dominators.h"
@@ -58,17 +65,54 @@
 #include "llvm/IR/Statepoint.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/IR/InstIterator.h"
+#include "llvm/Support/Atomic.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/YAMLTraits.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/Local.h"
 #include "llvm/Transforms/Utils/PromoteMemToReg.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+
+#include <thread>
 
 using namespace llvm;
 using namespace std;
 
+STATISTIC(NumLivenessValues, "Number of gc pointer values tracked by liveness");
+STATISTIC(NumLivenessBlockVisits, "Number of blocks visited by liveness");
+STATISTIC(NumLivenessIncrementalSeeds,
+          "Number of blocks reprocessed by incremental liveness updates");
+STATISTIC(LivenessBytes, "Bytes of bit vector storage used by liveness");
+STATISTIC(NumRelocationPHIs, "Number of phis inserted when rewriting relocated uses");
+STATISTIC(NumBoundedLoopPollsSkipped,
+          "Number of backedge polls skipped in loops with a bounded trip count");
+STATISTIC(NumCallDominatedPollsSkipped,
+          "Number of backedge polls skipped due to a call on every iteration");
+STATISTIC(NumEntryPollsSkipped,
+          "Number of entry polls skipped due to a call on every path");
+STATISTIC(NumStripMinedLoops, "Number of counted loops strip mined");
+STATISTIC(NumRelocates, "Number of gc.relocates inserted");
+STATISTIC(NumRematerialized,
+          "Number of derived pointers rematerialized instead of relocated");
+STATISTIC(NumPollsInserted, "Number of safepoint polls inserted");
+STATISTIC(NumStatepoints, "Number of statepoints inserted");
+STATISTIC(NumBaseDefsInserted, "Number of base phis and selects inserted");
+STATISTIC(NumLiveAtStatepoints,
+          "Number of gc pointers live across statepoints");
+
+// The phases of placement are timed under -time-passes in this group.  Poll
+// inlining is part of poll insertion and mem2reg is part of relocation
+// rewriting; their timers nest inside those of the enclosing phase.
+static const char *const TimerGroupName = "Safepoint Placement";
+
 // Debugging flag to verify IR at different levels of granularity
 // 0 - none
 // 1 - pre/post conditions of the entire pass
@@ -84,10 +128,50 @@ static cl::opt<int> VerifyIRLevel ("spp-verify-ir-level",
 
 // Ignore oppurtunities to avoid placing safepoints on backedges, useful for validation
 static cl::opt<bool> AllBackedges ("spp-all-backedges", cl::init(false));
+// Loops whose trip count scalar evolution can bound by at most this many
+// iterations don't need a backedge poll.  Loops with an exact constant trip
+// count are treated as finite regardless.
+static cl::opt<unsigned> MaxBoundedTripCount ("spp-max-bounded-trip-count",
+                                              cl::init(1024));
+// Don't place an entry or backedge poll when a call which needs a safepoint
+// is guaranteed to execute on every path through the region the poll
+// protects.  This assumes every such callee polls (or transitions to the
+// runtime) in bounded time, which holds when the whole module is compiled
+// with this placement, but not for arbitrary external code.
+static cl::opt<bool> ElideRedundantPolls ("spp-elide-redundant-polls",
+                                          cl::init(false));
+// Rather than polling on every iteration of a counted loop, split it into an
+// inner loop running at most StripMineChunk iterations without a poll and an
+// outer loop which polls once per chunk.
+static cl::opt<bool> StripMineLoops ("spp-strip-mine-loops", cl::init(false));
+static cl::opt<unsigned> StripMineChunk ("spp-strip-mine-chunk",
+                                         cl::init(1024));
+// Recompute derived pointers from their relocated base after each safepoint
+// rather than relocating them, when the target says the computation costs no
+// more than RematerializationThreshold
+static cl::opt<bool> RematerializeDerived ("spp-rematerialize-derived",
+                                           cl::init(false));
+static cl::opt<unsigned>
+RematerializationThreshold ("spp-rematerialization-threshold",
+                            cl::init(TargetTransformInfo::TCC_Basic));
 // Only go as far as confirming base pointers exist, useful for fault isolation
 static cl::opt<bool> BaseRewriteOnly ("spp-base-rewrite-only", cl::init(false) );
 // Add safepoints to all functions, not just the ones with attributes
 extern cl::opt<bool> AllFunctions;
+// Rewrite uses of relocated values via allocas and mem2reg rather than by
+// constructing SSA form directly.  Kept for comparison.
+static cl::opt<bool> RelocationViaAlloca ("spp-relocation-via-alloca",
+                                          cl::init(false));
+// Parallel liveness: the number of threads computing the gc pointer liveness
+// of functions, i.e. the dataflow and the live set at each parse point.  Only
+// the liveness is parallel.  Poll insertion, base pointers (which may insert
+// base phis and selects), statepoint creation and relocation modify the IR
+// and are always done serially; the output is identical to the single
+// threaded run.
+static cl::opt<unsigned>
+NumLivenessThreads("spp-liveness-threads", cl::init(1),
+                   cl::desc("Number of threads computing gc pointer "
+                            "liveness (the rest of placement is serial)"));
 // Include deopt state in safepoints?
 static cl::opt<bool> UseVMState ("spp-use-vm-state", cl::init(true) );
 
@@ -100,9 +184,13 @@ static cl::opt<bool> PrintLiveSetSize ("spp-print-liveset-size", cl::init(false)
 // Print out the base pointers for debugging
 static cl::opt<bool> PrintBasePointers("spp-print-base-pointers",
                                        cl::init(false));
+// Append a YAML document per function with histograms of the live set sizes
+// and relocate counts of its statepoints to the given file ("-" for stdout)
+static cl::opt<std::string> StatsYAMLFile("spp-stats-yaml", cl::init(""));
 // Use a single dataflow liveness pass rather than many reachability
-// queries for computing liveness of values over safepoints
-static cl::opt<bool> DataflowLiveness("spp-dataflow-liveness", cl::init(false));
+// queries for computing liveness of values over safepoints.  The
+// reachability queries are kept around for validation.
+static cl::opt<bool> DataflowLiveness("spp-dataflow-liveness", cl::init(true));
 
 // Bugpoint likes to reduce a crash into _any_ crash (including assertion
 // failures due to configuration problems).  If we're reducing a 'real' crash
@@ -123,6 +211,114 @@ static bool VMStateRequired() {
 }
 
 
+/// The result of the dataflow liveness analysis over gc pointers.  Only gc
+/// pointer values defined in the function (arguments and instructions) are
+/// tracked.  Each of them is given a dense number and all the per-block sets
+/// are bit vectors indexed by that number.  Blocks are numbered in reverse
+/// post order so that the per-block data lives in flat vectors as well.
+struct GCPtrLivenessData {
+  /// Dense numbering of the tracked gc pointer values
+  DenseMap<Value*, unsigned> ValueNumbers;
+  std::vector<Value*> Values;
+
+  /// Dense numbering of the basic blocks (reverse post order)
+  DenseMap<BasicBlock*, unsigned> BlockNumbers;
+  std::vector<BasicBlock*> Blocks;
+
+  /// Values used in a block before being defined there.  Uses by phis are
+  /// not included, they are accounted for along the incoming edge instead.
+  std::vector<BitVector> Gen;
+
+  /// Values defined in a block
+  std::vector<BitVector> Kill;
+
+  /// Values used by phis in the successors of a block along the edges
+  /// leaving that block
+  std::vector<BitVector> PhiUses;
+
+  /// Values live into a basic block (i.e. used by any instruction in this
+  /// basic block or ones reachable from here)
+  std::vector<BitVector> LiveIn;
+
+  /// Values live out of a basic block (i.e. live into any successor block)
+  std::vector<BitVector> LiveOut;
+
+  bool isTracked(Value* V) const { return ValueNumbers.count(V); }
+  unsigned getNumber(Value* V) const {
+    DenseMap<Value*, unsigned>::const_iterator I = ValueNumbers.find(V);
+    assert( I != ValueNumbers.end() && "not a tracked gc pointer");
+    return I->second;
+  }
+  unsigned getNumber(BasicBlock* BB) const {
+    DenseMap<BasicBlock*, unsigned>::const_iterator I = BlockNumbers.find(BB);
+    assert( I != BlockNumbers.end() && "block not numbered");
+    return I->second;
+  }
+};
+
+/// A summary of the safepoints placed in one function, written out for
+/// -spp-stats-yaml.  The histograms map a live set size (or relocate count)
+/// to the number of statepoints in the function with exactly that many.
+struct SafepointFunctionStats {
+  std::string Name;
+  unsigned Polls;
+  unsigned Statepoints;
+  unsigned Relocates;
+  unsigned Rematerialized;
+  std::map<unsigned, unsigned> LiveSetSizes;
+  std::map<unsigned, unsigned> RelocateCounts;
+
+  SafepointFunctionStats()
+    : Polls(0), Statepoints(0), Relocates(0), Rematerialized(0) {}
+};
+
+/// One bucket of a SafepointFunctionStats histogram, as written out
+struct SafepointHistogramBucket {
+  unsigned Size;
+  unsigned Count;
+};
+
+LLVM_YAML_IS_SEQUENCE_VECTOR(SafepointHistogramBucket)
+LLVM_YAML_IS_DOCUMENT_LIST_VECTOR(SafepointFunctionStats)
+
+namespace llvm {
+namespace yaml {
+template <> struct MappingTraits<SafepointHistogramBucket> {
+  static void mapping(IO &io, SafepointHistogramBucket &B) {
+    io.mapRequired("size", B.Size);
+    io.mapRequired("count", B.Count);
+  }
+};
+
+template <> struct MappingTraits<SafepointFunctionStats> {
+  static std::vector<SafepointHistogramBucket>
+  buckets(const std::map<unsigned, unsigned>& Histogram) {
+    std::vector<SafepointHistogramBucket> result;
+    for(auto Pair : Histogram) {
+      SafepointHistogramBucket B = { Pair.first, Pair.second };
+      result.push_back(B);
+    }
+    return result;
+  }
+  // Only ever written, never read back
+  static void mapping(IO &io, SafepointFunctionStats &S) {
+    std::vector<SafepointHistogramBucket> LiveSetSizes =
+      buckets(S.LiveSetSizes);
+    std::vector<SafepointHistogramBucket> RelocateCounts =
+      buckets(S.RelocateCounts);
+    io.mapRequired("function", S.Name);
+    io.mapRequired("polls", S.Polls);
+    io.mapRequired("statepoints", S.Statepoints);
+    io.mapRequired("relocates", S.Relocates);
+    io.mapRequired("rematerialized", S.Rematerialized);
+    io.mapRequired("live-set-sizes", LiveSetSizes);
+    io.mapRequired("relocate-counts", RelocateCounts);
+  }
+};
+}
+}
+
+
 /* Note: PlaceBackedgeSafepointsImpl need to be instances of ModulePass, not
    LoopPass.  LoopPass is not allowed to do any cross module optimization
    (such as inlining).  The PassManager will run FunctionPasses (of which the
@@ -148,6 +344,24 @@ static bool VMStateRequired() {
 
 namespace {
 
+/** A counted loop which can be strip mined rather than polling on every
+    iteration.  The loop is in simplified form, exits only from the latch, and
+    the latch branches back to the header while IVNext (the increment by one
+    of the header phi IV) is less than a loop invariant limit.  Cond is the
+    original exit test, which may be written in any equivalent form. */
+struct StripMineCandidate {
+  BasicBlock* Preheader;
+  BasicBlock* Header;
+  BasicBlock* Latch;
+  BasicBlock* Exit;
+  PHINode* IV;
+  ICmpInst* Cond;
+  /// True if the loop continues when Cond is true
+  bool ContinueOnTrue;
+  /// ult or slt, "continue while IVNext Pred Limit"
+  ICmpInst::Predicate Pred;
+  Value* Limit;
+};
 
 /** An analysis pass whose purpose is to identify each of the backedges in
     the function which require a safepoint poll to be inserted. */
@@ -157,6 +371,10 @@ struct PlaceBackedgeSafepointsImpl : public LoopPass {
   /// The output of the pass - gives a list of each backedge (described by
   /// pointing at the branch) which need a poll inserted.
   std::vector<TerminatorInst*> PollLocations;
+
+  /// The loops whose backedge poll should be moved to an outer loop created
+  /// by strip mining.  Each one's latch terminator is also in PollLocations.
+  std::vector<StripMineCandidate> StripMineCandidates;
   
   PlaceBackedgeSafepointsImpl()
     : LoopPass(ID) {
@@ -168,6 +386,8 @@ struct PlaceBackedgeSafepointsImpl : public LoopPass {
   void getAnalysisUsage(AnalysisUsage &AU) const override {
     // needed for determining if the loop is finite
     AU.addRequired<ScalarEvolution>();
+    // needed for finding calls which execute on every iteration
+    AU.addRequired<DominatorTreeWrapperPass>();
     // to ensure each edge has a single backedge
     // TODO: is this still required?
     AU.addRequiredID(LoopSimplifyID);
@@ -179,10 +399,76 @@ struct PlaceBackedgeSafepointsImpl : public LoopPass {
 
 };
 
+/** The type of the internal cache used inside the findBasePointers family
+    of functions.  From the callers perspective, this is an opaque type and
+    should not be inspected.
+
+    In the actual implementation this caches two relations:
+    - The base relation itself (i.e. this pointer is based on that one)
+    - The base defining value relation (i.e. before base_phi insertion)
+    Generally, after the execution of a full findBasePointer call, only the
+    base relation will remain.  Internally, we add a mixture of the two
+    types, then update all the second type to the first type
+*/
+typedef DenseMap<Value*, Value*> DefiningValueMapTy;
+
 cl::opt<bool> NoEntry ("spp-no-entry", cl::init(false));
 cl::opt<bool> NoCall ("spp-no-call", cl::init(false));
 cl::opt<bool> NoBackedge ("spp-no-backedge", cl::init(false));
 
+/// The body of gc.safepoint_poll, cloned and pruned once per module exactly
+/// as the inliner would, together with its dominator tree.  Each poll splices
+/// a plain copy of it into place and updates the dominator tree of the caller
+/// for just the new blocks.  Inlining the poll afresh and recomputing the
+/// dominator tree every time made poll insertion quadratic in the size of
+/// functions with many backedges.
+class SafepointPollTemplate {
+public:
+  explicit SafepointPollTemplate(Function* Poll);
+  ~SafepointPollTemplate();
+
+  /// Insert a copy of the poll body immediately before term, updating DT.
+  /// The result is identical to inlining a call to the poll placed there.
+  void expandBefore(Instruction* term, DominatorTree& DT);
+
+private:
+  SafepointPollTemplate(const SafepointPollTemplate&) LLVM_DELETED_FUNCTION;
+  void operator=(const SafepointPollTemplate&) LLVM_DELETED_FUNCTION;
+
+  Function* Poll;
+  /// The pruned clone of Poll's body.  It is not part of the module.
+  Function* Body;
+  /// The returns of Body, which become branches to the code after the poll
+  SmallVector<ReturnInst*, 2> Returns;
+  /// The blocks of Body other than the entry paired with their immediate
+  /// dominators, in dominator tree preorder
+  std::vector<std::pair<BasicBlock*, BasicBlock*> > DomOrder;
+  /// The block of Body dominating all the returns.  The code after the poll
+  /// is immediately dominated by its copy.
+  BasicBlock* ExitIDom;
+};
+
+/// The state carried for one function between the phases of safepoint
+/// placement.  See PlaceSafepoints::runOnModule.
+struct FunctionSafepointWork {
+  Function* F;
+  bool Modified;
+  DominatorTree DT;
+  /// The calls which need to become statepoints
+  std::vector<CallSite> ParsePoints;
+  /// Dummy calls keeping values live until the statepoints are inserted
+  std::vector<CallInst*> Holders;
+  /// The vm state for each parse point (if VMStateRequired())
+  VMStateInfo VMStates;
+  GCPtrLivenessData Liveness;
+  /// The gc pointers live across each parse point, computed along with
+  /// Liveness (and only with -spp-dataflow-liveness)
+  std::vector<std::set<Value*> > LiveSets;
+  SafepointFunctionStats Stats;
+
+  explicit FunctionSafepointWork(Function* F) : F(F), Modified(false) {}
+};
+
 struct PlaceSafepoints : public ModulePass {
   static char ID; // Pass identification, replacement for typeid
 
@@ -196,16 +482,38 @@ struct PlaceSafepoints : public ModulePass {
     EnableBackedgeSafepoints = !NoBackedge;
     EnableCallSafepoints = !NoCall;
   }
-  bool runOnModule(Module &M) override {
-    bool modified = false;
-    for(Function& F : M) {
-      modified |= runOnFunction(F);
-    }
-    return modified;
+  /// The summaries of the functions placed so far, for -spp-stats-yaml
+  std::vector<SafepointFunctionStats> ModuleStats;
+
+  /// The poll body for the module, built for the first poll inserted
+  std::unique_ptr<SafepointPollTemplate> PollTemplate;
+  SafepointPollTemplate& getPollTemplate(Module& M);
+
+  bool runOnModule(Module &M) override;
+
+  /// The poll body is a function outside the module which uses functions of
+  /// the module.  runOnModule already deletes it on the way out; make sure
+  /// it never outlives the pass so the use lists of those functions are
+  /// exact for whoever runs next.
+  bool doFinalization(Module &M) override {
+    PollTemplate.reset();
+    return false;
   }
-  bool runOnFunction(Function& F);
+
+  /// Insert polls and the vm state holders for the parse points.  Returns
+  /// false if there is nothing further to do for this function.
+  bool prepareFunction(FunctionSafepointWork& W);
+  /// Compute the gc pointer liveness of the function and the live set of
+  /// each parse point.  This does not modify the IR and is safe to run in
+  /// parallel.
+  static void analyzeFunction(FunctionSafepointWork& W);
+  void analyzeFunctions(ArrayRef<FunctionSafepointWork*> Batch);
+  /// Turn the parse points into statepoints and relocate
+  bool finishFunction(FunctionSafepointWork& W);
 
   void getAnalysisUsage(AnalysisUsage &AU) const override {
+    // Costs derived pointer rematerialization
+    AU.addRequired<TargetTransformInfo>();
     // We modify the graph wholesale (inlining, block insertion, etc).  We
     // preserve nothing at the moment.  We could potentially preserve dom tree
     // if that was worth doing
@@ -285,30 +593,6 @@ struct RemoveFakeVMStateCalls : public FunctionPass {
 };
 }
 
-struct GCPtrLivenessData {
-  /// Values live into this basic block (i.e. used by any
-  /// instruction in this basic block or ones reachable from here)
-  DenseMap<BasicBlock*, DenseSet<Value*> > LiveIn;
-
-  /// Values live out of this basic block (i.e. live into
-  /// any successor block)
-  DenseMap<BasicBlock*, DenseSet<Value*> > LiveOut;
-};
-
-namespace {
-  /** The type of the internal cache used inside the findBasePointers family
-      of functions.  From the callers perspective, this is an opaque type and
-      should not be inspected.
-
-      In the actual implementation this caches two relations:
-      - The base relation itself (i.e. this pointer is based on that one)
-      - The base defining value relation (i.e. before base_phi insertion)
-      Generally, after the execution of a full findBasePointer call, only the
-      base relation will remain.  Internally, we add a mixture of the two
-      types, then update all the second type to the first type
-  */
-  typedef std::map<Value*, Value*> DefiningValueMapTy;
-}
 
 // The following declarations call out the key steps of safepoint placement and
 // summarize their preconditions, postconditions, and side effects.  This is
@@ -330,8 +614,22 @@ namespace SafepointPlacementImpl {
     /// The bounds of the inserted code for the safepoint
     std::pair<Instruction*, Instruction*> safepoint;
 
+    /// For an invoke, the bounds of the relocations along the exceptional
+    /// edge: the gc_landing_token in the unwind destination and the last
+    /// instruction inserted after it.  Both null for a call.
+    std::pair<Instruction*, Instruction*> unwindSafepoint;
+
     /// The result of the safepointing call (or nullptr)
     Value* result;
+
+    /// Derived pointers which are recomputed from their relocated base after
+    /// the safepoint instead of being relocated, each paired with the
+    /// recomputed value.  These are not in the statepoint.
+    std::vector<std::pair<Value*, Instruction*> > rematerialized;
+
+    /// For an invoke, the same derived pointers recomputed along the
+    /// exceptional edge.  Empty for a call.
+    std::vector<std::pair<Value*, Instruction*> > unwindRematerialized;
     
     void verify() {
     }
@@ -343,6 +641,10 @@ namespace SafepointPlacementImpl {
                                  GCPtrLivenessData& OriginalLivenessData,
                                  const CallSite& CS,
                                  PartiallyConstructedSafepointRecord& result);
+  /// Print the live set of a parse point for -spp-print-liveset and
+  /// -spp-print-liveset-size.
+  void printParsePointLiveness(const CallSite& CS,
+                               const std::set<Value*>& liveset);
 
 
   /// Find the required based pointers (and adjust the live set) for the given
@@ -366,15 +668,18 @@ namespace SafepointPlacementImpl {
 
   /// Insert a safepoint (parse point) at the given call instruction.  Does not
   /// do relocation and does not remove the existing call.  That's handled by
-  /// the caller.
+  /// the caller.  TTI decides which derived pointers are cheap enough to
+  /// rematerialize rather than relocate.
   void InsertSafepoint(DominatorTree& DT, const CallSite& CS, CallInst* vmstate,
-                       PartiallyConstructedSafepointRecord& result);
+                       PartiallyConstructedSafepointRecord& result,
+                       const TargetTransformInfo& TTI);
 
   
-  // Insert a safepoint poll immediately before the given instruction.  Does
-  // not handle the parsability of state at the runtime call, that's the
-  // callers job.
-  void InsertSafepointPoll(DominatorTree& DT, Instruction* after,
+  // Insert a safepoint poll immediately before the given instruction, keeping
+  // DT up to date.  Does not handle the parsability of state at the runtime
+  // call, that's the callers job.
+  void InsertSafepointPoll(DominatorTree& DT, SafepointPollTemplate& Poll,
+                           Instruction* after,
                            std::vector<CallSite>& ParsePointsNeeded /*rval*/);
 
   bool isGCLeafFunction(const CallSite& CS);
@@ -435,7 +740,6 @@ namespace SafepointPlacementImpl {
                         DefiningValueMapTy& DVCache,
                         std::set<llvm::Value*>& newInsertedDefs);
 
-  CallInst* findVMState(llvm::Instruction* term, DominatorTree *DT);
 
   /** Inserts the actual code for a safepoint.  Currently this inserts a
       statepoint, gc_relocate(*) series, but that could change easily.  The
@@ -472,8 +776,38 @@ namespace SafepointPlacementImpl {
   void insertPHIsForNewDef(DominatorTree& DT, Function& F, Value* oldDef);
 
 
+  /// Returns true if derived is computed from base by a sequence of bitcasts
+  /// and geps whose total cost according to TTI is no more than
+  /// RematerializationThreshold.  If so, chain holds those instructions, the
+  /// one using base last.
+  bool findRematerializationChain(Value* derived, Value* base,
+                                  SmallVectorImpl<Instruction*>& chain,
+                                  const TargetTransformInfo& TTI);
+
+  /// Recompute each of the given derived pointers from the relocated value of
+  /// its base immediately after the safepoint described by result, and record
+  /// them in result.rematerialized.  For an invoke, they are recomputed along
+  /// both edges.
+  void rematerializeDerivedPointers(
+      const std::vector<std::pair<Value*, SmallVector<Instruction*, 4> > >& remat,
+      PartiallyConstructedSafepointRecord& result);
+  void rematerializeDerivedPointers(
+      const std::vector<std::pair<Value*, SmallVector<Instruction*, 4> > >& remat,
+      Instruction* statepoint,
+      const std::pair<Instruction*, Instruction*>& bounds,
+      std::vector<std::pair<Value*, Instruction*> >& rematerialized);
+
   // do all the relocation update via allocas and mem2reg
   void relocationViaAlloca(Function& F, DominatorTree& DT, const std::vector<Value*>& live, const std::vector<struct PartiallyConstructedSafepointRecord>& records);
+
+  /// Do all the relocation updates by constructing SSA form directly from the
+  /// gc_relocates.  For each live value, the original definition and its
+  /// gc_relocates are the available definitions; every use of the original
+  /// value is rewritten to the reaching definition, inserting phis only where
+  /// needed.  Produces the same result as relocationViaAlloca without the
+  /// O(live values * safepoints) loads and stores.
+  void relocationViaSSA(Function& F, const std::vector<Value*>& live,
+                        const std::vector<struct PartiallyConstructedSafepointRecord>& records);
 }
 
 using namespace SafepointPlacementImpl;
@@ -496,9 +830,107 @@ namespace {
       // the number of iterations from above
       TripCount = SE->getSmallConstantTripCount(L, LatchBlock);
     }
-    // TODO: it would be trivial to use a more restricted definition for pruning
-    // safepoints.  Maybe loops with trip counts less than some finite number?
-    return TripCount > 0;
+    if( TripCount > 0 ) {
+      return true;
+    }
+
+    // Otherwise, the trip count may still be bounded by a constant even if
+    // it's not known exactly (i.e. a narrow induction variable).  Only treat
+    // the loop as finite if the bound is small enough that the time to reach
+    // a safepoint outside the loop is acceptable.
+    const SCEVConstant* MaxBTC =
+      dyn_cast<SCEVConstant>(SE->getMaxBackedgeTakenCount(L));
+    if( !MaxBTC ) {
+      return false;
+    }
+    const APInt& BTC = MaxBTC->getValue()->getValue();
+    return BTC.getActiveBits() <= 64 &&
+      BTC.getZExtValue() < MaxBoundedTripCount;
+  }
+
+  /// Returns true if a call which needs a safepoint is contained in one of
+  /// the blocks on the dominator tree path from Start up to and including
+  /// Stop.  Such a call is guaranteed to execute on every path from Stop to
+  /// Start.
+  bool containsGuaranteedCall(BasicBlock* Start, BasicBlock* Stop,
+                              DominatorTree& DT) {
+    assert( DT.dominates(Stop, Start) && "no path to walk");
+    for(DomTreeNode* Node = DT.getNode(Start); Node; Node = Node->getIDom()) {
+      BasicBlock* BB = Node->getBlock();
+      for(Instruction& I : *BB) {
+        if( (isa<CallInst>(I) || isa<InvokeInst>(I)) &&
+            needsStatepoint(CallSite(&I)) ) {
+          return true;
+        }
+      }
+      if( BB == Stop ) {
+        break;
+      }
+    }
+    return false;
+  }
+
+  /// Returns true and fills in C if L is a counted loop which
+  /// stripMineLoop can handle.  The increment must not wrap in the sense of
+  /// the exit comparison, so that every chunk ends within StripMineChunk
+  /// iterations.
+  bool isStripMineCandidate(Loop* L, ScalarEvolution* SE,
+                            StripMineCandidate& C) {
+    C.Preheader = L->getLoopPreheader();
+    C.Header = L->getHeader();
+    C.Latch = L->getLoopLatch();
+    if( !C.Preheader || !C.Latch || L->getExitingBlock() != C.Latch ) {
+      return false;
+    }
+    BranchInst* BI = dyn_cast<BranchInst>(C.Latch->getTerminator());
+    if( !BI || !BI->isConditional() ) {
+      return false;
+    }
+    C.Cond = dyn_cast<ICmpInst>(BI->getCondition());
+    if( !C.Cond ) {
+      return false;
+    }
+    // Canonicalize to "continue while IVNext Pred Limit"
+    C.Pred = C.Cond->getPredicate();
+    Value* IVNext = C.Cond->getOperand(0);
+    C.Limit = C.Cond->getOperand(1);
+    if( !isa<Instruction>(IVNext) ||
+        !L->contains(cast<Instruction>(IVNext)) ) {
+      std::swap(IVNext, C.Limit);
+      C.Pred = ICmpInst::getSwappedPredicate(C.Pred);
+    }
+    C.ContinueOnTrue = BI->getSuccessor(0) == C.Header;
+    if( !C.ContinueOnTrue ) {
+      C.Pred = ICmpInst::getInversePredicate(C.Pred);
+    }
+    C.Exit = BI->getSuccessor(C.ContinueOnTrue ? 1 : 0);
+    if( (C.Pred != ICmpInst::ICMP_ULT && C.Pred != ICmpInst::ICMP_SLT) ||
+        !L->isLoopInvariant(C.Limit) ) {
+      return false;
+    }
+
+    BinaryOperator* Inc = dyn_cast<BinaryOperator>(IVNext);
+    if( !Inc || Inc->getOpcode() != Instruction::Add ) {
+      return false;
+    }
+    C.IV = dyn_cast<PHINode>(Inc->getOperand(0));
+    ConstantInt* Step = dyn_cast<ConstantInt>(Inc->getOperand(1));
+    if( !C.IV || C.IV->getParent() != C.Header || !Step || !Step->isOne() ||
+        C.IV->getIncomingValueForBlock(C.Latch) != Inc ) {
+      return false;
+    }
+    // The chunk length must be a positive value of the IV's type
+    if( StripMineChunk == 0 ||
+        !isUIntN(Step->getBitWidth() - 1, StripMineChunk) ) {
+      return false;
+    }
+    const SCEVAddRecExpr* AR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(Inc));
+    if( !AR || AR->getLoop() != L ) {
+      return false;
+    }
+    SCEV::NoWrapFlags Required =
+      C.Pred == ICmpInst::ICMP_ULT ? SCEV::FlagNUW : SCEV::FlagNSW;
+    return AR->getNoWrapFlags(Required) == Required;
   }
 
   void addBasesAsLiveValues(std::set<Value*>& liveset,
@@ -569,13 +1001,39 @@ namespace {
 
 }
 
+/// Find the vm state of each parse point and insert the holders which keep
+/// it live until the statepoints are created.  Must run before the liveness
+/// of the function is computed.
+static void prepareParsePoints(Function& F, DominatorTree& DT,
+                               std::vector<CallSite>& toUpdate,
+                               std::vector<CallInst*>& holders,
+                               VMStateInfo& VMStates);
+
 /// Given a set of patch points which need to be parsable, turn them in to
 /// statepoints.  WARNING: Destroys the CallSites, they no longer exist!
+/// holders, VMStates and OriginalLivenessData are as left by
+/// prepareParsePoints and computeGCPtrLiveness respectively.  With
+/// -spp-dataflow-liveness, LiveSets holds the live set of each parse point
+/// (and is consumed).
 static bool insertParsePoints(Function& F, DominatorTree& DT,
-                              std::vector<CallSite>& toUpdate);  
+                              DefiningValueMapTy& DVCache,
+                              std::vector<CallSite>& toUpdate,
+                              std::vector<CallInst*>& holders,
+                              const VMStateInfo& VMStates,
+                              GCPtrLivenessData& OriginalLivenessData,
+                              std::vector<std::set<Value*> >& LiveSets,
+                              const TargetTransformInfo& TTI,
+                              SafepointFunctionStats& Stats);
+
+/// Split the loop described by C into an inner loop which runs at most
+/// StripMineChunk iterations and an outer loop around it.  Returns the
+/// terminator of the outer loop's latch, which is where the poll belongs.
+/// Dominance information is invalidated.
+static TerminatorInst* stripMineLoop(const StripMineCandidate& C);
 
 bool PlaceBackedgeSafepointsImpl::runOnLoop(Loop* L, LPPassManager &LPM) {
   ScalarEvolution *SE = &getAnalysis<ScalarEvolution>();
+  DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 
   // Loop through all predecessors of the loop header and identify all
   // backedges.  We need to place a safepoint on every backedge (potentially).
@@ -612,11 +1070,18 @@ bool PlaceBackedgeSafepointsImpl::runOnLoop(Loop* L, LPPassManager &LPM) {
       if( mustBeFiniteCountedLoop(L, SE) ) {
         if( TraceLSP ) 
           errs() << "skipping safepoint placement in finite loop\n";
+        NumBoundedLoopPollsSkipped++;
         continue;
       }
 
-      // TODO: if the loop already contains a call safepoint, no backedge
-      // safepoint needed
+      // If every path around this backedge passes through a call, the callee
+      // will poll on our behalf.
+      if( ElideRedundantPolls && containsGuaranteedCall(pred, header, DT) ) {
+        if( TraceLSP )
+          errs() << "skipping safepoint placement in loop with call\n";
+        NumCallDominatedPollsSkipped++;
+        continue;
+      }
     }
 
     // We're unconditionally going to modify this loop.
@@ -627,6 +1092,13 @@ bool PlaceBackedgeSafepointsImpl::runOnLoop(Loop* L, LPPassManager &LPM) {
     // variables) and branches to the true header
     TerminatorInst * term = pred->getTerminator();
 
+    StripMineCandidate Candidate;
+    if( StripMineLoops && isStripMineCandidate(L, SE, Candidate) ) {
+      if( TraceLSP )
+        errs() << "strip mining counted loop\n";
+      StripMineCandidates.push_back(Candidate);
+    }
+
     if (TraceLSP) {
       errs() << "[LSP] terminator instruction: "; term->dump();
     }
@@ -637,6 +1109,123 @@ bool PlaceBackedgeSafepointsImpl::runOnLoop(Loop* L, LPPassManager &LPM) {
   return modified;
 }
 
+static TerminatorInst* stripMineLoop(const StripMineCandidate& C) {
+  // The new shape is:
+  //   preheader -> outer.header -> header ... latch
+  //   latch -> header (while IVNext < ChunkEnd) or outer.latch
+  //   outer.latch -> outer.header (while ExitIV < Limit) or exit
+  // Every header phi gets a counterpart in the outer header which carries its
+  // value from one chunk to the next.  The value of the IV on leaving the
+  // chunk is recomputed in the outer latch so that the inner loop's IV has no
+  // users outside of it, which LoopVectorize requires.
+  Function* F = C.Header->getParent();
+
+  // Collect the body of the loop before we change its shape
+  SmallPtrSet<BasicBlock*, 16> Body;
+  SmallVector<BasicBlock*, 16> Worklist;
+  Body.insert(C.Header);
+  Body.insert(C.Latch);
+  Worklist.push_back(C.Latch);
+  while( !Worklist.empty() ) {
+    BasicBlock* BB = Worklist.pop_back_val();
+    if( BB == C.Header ) {
+      continue;
+    }
+    for(pred_iterator PI = pred_begin(BB), E = pred_end(BB); PI != E; ++PI) {
+      if( Body.insert(*PI) ) {
+        Worklist.push_back(*PI);
+      }
+    }
+  }
+
+  LLVMContext& Ctx = F->getContext();
+  BasicBlock* OuterHeader =
+    BasicBlock::Create(Ctx, C.Header->getName() + ".outer", F, C.Header);
+  BasicBlock* OuterLatch =
+    BasicBlock::Create(Ctx, C.Header->getName() + ".outer.latch", F, C.Exit);
+
+  C.Preheader->getTerminator()->replaceUsesOfWith(C.Header, OuterHeader);
+  IRBuilder<> Builder(OuterHeader);
+  PHINode* OuterIV = nullptr;
+  for(BasicBlock::iterator I = C.Header->begin(); isa<PHINode>(I); ++I) {
+    PHINode* PN = cast<PHINode>(I);
+    PHINode* OuterPN = Builder.CreatePHI(PN->getType(), 2,
+                                         PN->getName() + ".outer");
+    OuterPN->addIncoming(PN->getIncomingValueForBlock(C.Preheader),
+                         C.Preheader);
+    OuterPN->addIncoming(PN->getIncomingValueForBlock(C.Latch), OuterLatch);
+    PN->setIncomingBlock(PN->getBasicBlockIndex(C.Preheader), OuterHeader);
+    PN->setIncomingValue(PN->getBasicBlockIndex(OuterHeader), OuterPN);
+    if( PN == C.IV ) {
+      OuterIV = OuterPN;
+    }
+  }
+  assert( OuterIV && "the induction variable is a header phi");
+
+  // ChunkEnd = min(OuterIV + StripMineChunk, Limit), where an overflowing
+  // sum means the limit is nearer.  The increment of the IV doesn't wrap, so
+  // any chunk ends within StripMineChunk iterations.
+  bool Signed = C.Pred == ICmpInst::ICMP_SLT;
+  Value* Sum = Builder.CreateAdd(OuterIV,
+                                 ConstantInt::get(OuterIV->getType(),
+                                                  StripMineChunk),
+                                 "chunk.sum");
+  Value* Overflow = Signed ? Builder.CreateICmpSLT(Sum, OuterIV, "chunk.ovf")
+                           : Builder.CreateICmpULT(Sum, OuterIV, "chunk.ovf");
+  Value* SumFirst = Signed ? Builder.CreateICmpSLT(Sum, C.Limit, "chunk.cmp")
+                           : Builder.CreateICmpULT(Sum, C.Limit, "chunk.cmp");
+  Value* Min = Builder.CreateSelect(SumFirst, Sum, C.Limit, "chunk.min");
+  Value* ChunkEnd = Builder.CreateSelect(Overflow, C.Limit, Min, "chunk.end");
+  Builder.CreateBr(C.Header);
+
+  // The inner loop exits at the end of the chunk.  Since ChunkEnd never
+  // exceeds Limit, it never runs past the original exit.
+  BranchInst* LatchBr = cast<BranchInst>(C.Latch->getTerminator());
+  Value* IVNext = C.IV->getIncomingValueForBlock(C.Latch);
+  Value* InChunk = new ICmpInst(LatchBr, C.Pred, IVNext, ChunkEnd,
+                                "in.chunk");
+  LatchBr->setCondition(InChunk);
+  LatchBr->setSuccessor(0, C.Header);
+  LatchBr->setSuccessor(1, OuterLatch);
+
+  // The chunk runs at least one iteration, and otherwise until IVNext
+  // reaches ChunkEnd, so ExitIV = max(OuterIV + 1, ChunkEnd).  The outer latch
+  // takes over the original exit test on that value.
+  Builder.SetInsertPoint(OuterLatch);
+  Value* First = Builder.CreateAdd(OuterIV,
+                                   ConstantInt::get(OuterIV->getType(), 1),
+                                   "chunk.first", !Signed, Signed);
+  Value* Short = Builder.CreateICmp(C.Pred, First, ChunkEnd, "chunk.short");
+  Value* ExitIV = Builder.CreateSelect(Short, ChunkEnd, First,
+                                       IVNext->getName() + ".chunk");
+  Value* More = Builder.CreateICmp(C.Pred, ExitIV, C.Limit, "more");
+  BranchInst* OuterBr = Builder.CreateCondBr(More, OuterHeader, C.Exit);
+  for(BasicBlock::iterator I = C.Exit->begin(); isa<PHINode>(I); ++I) {
+    PHINode* PN = cast<PHINode>(I);
+    PN->setIncomingBlock(PN->getBasicBlockIndex(C.Latch), OuterLatch);
+  }
+
+  SmallVector<Use*, 8> OutsideUses;
+  for(Use& U : IVNext->uses()) {
+    Instruction* User = cast<Instruction>(U.getUser());
+    BasicBlock* UseBB = User->getParent();
+    if( PHINode* PN = dyn_cast<PHINode>(User) ) {
+      UseBB = PN->getIncomingBlock(U);
+    }
+    if( !Body.count(UseBB) && User != ExitIV && User != More ) {
+      OutsideUses.push_back(&U);
+    }
+  }
+  for(Use* U : OutsideUses) {
+    U->set(ExitIV);
+  }
+  if( C.Cond->use_empty() ) {
+    C.Cond->eraseFromParent();
+  }
+  NumStripMinedLoops++;
+  return OuterBr;
+}
+
 static Instruction* findLocationForEntrySafepoint(Function &F, DominatorTree& DT) {
   bool shouldRun = AllFunctions ||
     F.getFnAttribute("gc-add-entry-safepoints").getValueAsString().equals("true");
@@ -650,6 +1239,13 @@ static Instruction* findLocationForEntrySafepoint(Function &F, DominatorTree& DT
     return nullptr;
   }
 
+  // -infer-gc-leaf only marks functions without loops, recursion or non-leaf
+  // calls.  They run in bounded time, and a poll here would make the calls
+  // to them parse points after all.
+  if( F.getFnAttribute("gc-leaf-inferred").getValueAsString().equals("true") ) {
+    return nullptr;
+  }
+
   // Conceptually, this poll needs to be on method entry, but in practice, we
   // place it as late in the entry block as possible.  We need to be after the
   // first BCI (to have a valid VM state), but there's no reason we can't be
@@ -657,7 +1253,27 @@ static Instruction* findLocationForEntrySafepoint(Function &F, DominatorTree& DT
   // This is required to ensure bounded time to safepoint in the face of
   // recursion.
   // PERF: Can we avoid this for non-recursive functions?
-  // PERF: Don't emit if call guaranteed to occur
+
+  // If a call is guaranteed to occur before every return, the callee polls
+  // on our behalf, and any recursion must pass through such a call.  The
+  // blocks which execute on every path to a return are exactly those which
+  // dominate the nearest common dominator of all the returning blocks.
+  if( ElideRedundantPolls ) {
+    BasicBlock* AllReturns = nullptr;
+    for(BasicBlock& BB : F) {
+      if( isa<ReturnInst>(BB.getTerminator()) ) {
+        AllReturns = AllReturns ?
+          DT.findNearestCommonDominator(AllReturns, &BB) : &BB;
+      }
+    }
+    if( AllReturns &&
+        containsGuaranteedCall(AllReturns, &F.getEntryBlock(), DT) ) {
+      if( TraceLSP )
+        errs() << "skipping entry safepoint due to guaranteed call\n";
+      NumEntryPollsSkipped++;
+      return nullptr;
+    }
+  }
 
   // Due to the way the frontend generates IR, we may have a couple of intial
   // basic blocks before the first bytecode.  These will be single-entry
@@ -732,12 +1348,28 @@ static void findCallSafepoints(Function &F,
 
 /// Compute the live-in set for every basic block in the function
 static void computeGCPtrLiveness(Function& F, GCPtrLivenessData& Data);
-/// Compute the live-in set for the location rbegin starting from
+/// Update a previously computed liveness solution after new instructions
+/// have been inserted into the function.  NewDefs are the newly inserted
+/// definitions (base phis, selects, and casts) and NewUses are the newly
+/// inserted instructions which use existing values.  Only the blocks
+/// containing them are reprocessed.  The CFG must not have changed and no
+/// instructions may have been removed since the solution was computed.
+static void updateGCPtrLiveness(GCPtrLivenessData& Data,
+                                const std::set<Value*>& NewDefs,
+                                const std::vector<Instruction*>& NewUses);
+/// Compute the live-in set for the location rend starting from
 /// the live-out set of the basic block
 static void computeGCPtrLiveness(BasicBlock::reverse_iterator rbegin,
                                  BasicBlock::reverse_iterator rend,
-                                 DenseSet<Value*>& LiveTmp);
+                                 const GCPtrLivenessData& Data,
+                                 BitVector& LiveTmp);
+
 
+/// Find the set of gc pointer values live immediately before inst (i.e. the
+/// values live across a safepoint at inst).
+static void findLiveSetAtInst(Instruction* inst,
+                              GCPtrLivenessData& Data,
+                              std::set<Value*>& out);
 
 /// Implement a unique function which doesn't require we sort the input
 /// vector.  Doing so has the effect of changing the output of a couple of
@@ -761,9 +1393,98 @@ static Function* getUseHolder(Function& F) {
   return Func;
 }
 
+/// Append the stack, local and monitor slots of the jvmstate to slots, then
+/// the frames of the callers it was inlined into, each with its header inline
+/// (see Statepoint::caller_frames_begin).  The chain ends at the first caller
+/// which is not itself a jvmstate, i.e. the root or a state passed in by a
+/// caller which hasn't been inlined.  Returns the number of caller frames.
+static int flattenVMState(CallInst* jvmStateCall, std::vector<Value*>& slots) {
+  IntegerType* i32Ty = Type::getInt32Ty(jvmStateCall->getContext());
+  int numCallerFrames = 0;
+  Value* frame = jvmStateCall;
+  do {
+    JVMState jvmState(frame);
+    if( frame != jvmStateCall ) {
+      numCallerFrames++;
+      slots.push_back( ConstantInt::get( i32Ty, jvmState.bci() ) );
+      slots.push_back( ConstantInt::get( i32Ty, jvmState.numStackElements() ) );
+      slots.push_back( ConstantInt::get( i32Ty, jvmState.numLocals() ) );
+      slots.push_back( ConstantInt::get( i32Ty, jvmState.numMonitors() ) );
+    }
 
-static bool insertParsePoints(Function& F, DominatorTree& DT,
-                              std::vector<CallSite>& toUpdate) {
+    for (int i = 0; i < jvmState.numStackElements(); i++) {
+      slots.push_back(ConstantInt::get(
+          i32Ty, jvmState.stackElementTypeAt(i).coerceToInt()));
+      slots.push_back(jvmState.stackElementAt(i));
+    }
+
+    for (int i = 0; i < jvmState.numLocals(); i++) {
+      slots.push_back(ConstantInt::get(
+          i32Ty, jvmState.localTypeAt(i).coerceToInt()));
+      slots.push_back(jvmState.localAt(i));
+    }
+
+    for (int i = 0; i < jvmState.numMonitors(); i++) {
+      slots.push_back(jvmState.monitorAt(i));
+    }
+    frame = jvmState.callerVMState();
+  } while( isJVMState(frame) );
+  return numCallerFrames;
+}
+
+
+/// Give every invoke parse point a normal and an unwind destination of its
+/// own.  The relocations along each edge are placed at the start of that
+/// destination, which must not be reachable along any other path.
+static bool normalizeInvokeParsePoints(std::vector<CallSite>& toUpdate) {
+  bool modified = false;
+  for(CallSite& CS : toUpdate) {
+    if( !CS.isInvoke() ) {
+      continue;
+    }
+    InvokeInst* invoke = cast<InvokeInst>(CS.getInstruction());
+    BasicBlock* BB = invoke->getParent();
+    if( !invoke->getUnwindDest()->getUniquePredecessor() ) {
+      SmallVector<BasicBlock*, 2> NewBBs;
+      SplitLandingPadPredecessors(invoke->getUnwindDest(), BB,
+                                  ".safepoint", ".safepoint.split",
+                                  nullptr, NewBBs);
+      modified = true;
+    }
+    if( !invoke->getNormalDest()->getUniquePredecessor() ) {
+      SplitCriticalEdge(invoke, 0);
+      modified = true;
+    }
+    // The gc_result and gc_relocates go in front of any uses, including
+    // those in phis of the destinations.
+    FoldSingleEntryPHINodes(invoke->getNormalDest());
+    FoldSingleEntryPHINodes(invoke->getUnwindDest());
+    assert( invoke->getNormalDest()->getUniquePredecessor() == BB &&
+            invoke->getUnwindDest()->getUniquePredecessor() == BB );
+  }
+  return modified;
+}
+
+/// The points directly after the parse point, where values which must be
+/// live across it are used.  For an invoke, that's the start of both
+/// destinations.
+static void getPointsAfterParsePoint(const CallSite& CS,
+                                     SmallVectorImpl<Instruction*>& points) {
+  if( CS.isInvoke() ) {
+    InvokeInst* invoke = cast<InvokeInst>(CS.getInstruction());
+    points.push_back(invoke->getNormalDest()->getFirstInsertionPt());
+    points.push_back(invoke->getUnwindDest()->getFirstInsertionPt());
+    return;
+  }
+  BasicBlock::iterator next(CS.getInstruction());
+  next++;
+  points.push_back(&*next);
+}
+
+static void prepareParsePoints(Function& F, DominatorTree& DT,
+                               std::vector<CallSite>& toUpdate,
+                               std::vector<CallInst*>& holders,
+                               VMStateInfo& VMStates) {
 #ifndef NDEBUG
   std::set<CallSite> uniqued;
   uniqued.insert(toUpdate.begin(), toUpdate.end());
@@ -776,68 +1497,83 @@ static bool insertParsePoints(Function& F, DominatorTree& DT,
     assert( CS.getInstruction()->getParent()->getParent() == &F );
   }
 
-  // A list of dummy calls added to the IR to keep various values obviously
-  // live in the IR.  We'll remove all of these when done.
-  std::vector<CallInst*> holders;
-  
+  // holders is a list of dummy calls added to the IR to keep various values
+  // obviously live in the IR.  We'll remove all of these when done.
+  assert( holders.empty() && "must be empty!");
+
   // Insert a dummy call with all of the arguments to the vm_state we'll need
   // for the actual safepoint insertion.  This ensures those arguments are held
   // live over safepoints between the current jvmstate and the eventual use
   // we'll insert below.
   if( VMStateRequired() ) {
+    VMStates.compute(F, DT);
     holders.reserve(holders.size() + toUpdate.size());
     for(size_t i = 0; i < toUpdate.size(); i++) {
       CallSite& CS = toUpdate[i];
-      assert( CS.isCall() && "implement invoke here");
 
-      // This must tbe the same jvmstate we find later
-      CallInst* vm_state = findVMState(CS.getInstruction(), &DT);
+      // This must be the same jvmstate we find later
+      CallInst* vm_state = VMStates.getReachingVMState(CS.getInstruction());
       BUGPOINT_CLEAN_EXIT_IF( !vm_state );
       assert( vm_state && "must find vm state or be scanning c++ source code");
 
-      // Create a clone then change the name for readability
-      CallInst* holder = cast<CallInst>(vm_state->clone());
-      holder->setCalledFunction( getUseHolder(F) );
-
-      // Insert the holder right after the parsepoint
-      BasicBlock::iterator next(CS.getInstruction());
-      next++;
-      CS.getInstruction()->getParent()->getInstList().insert(next, holder);
-      holders.push_back(holder);
+      // Insert a holder right after the parsepoint (along both edges of an
+      // invoke).  It uses exactly the values the statepoint will record,
+      // including those of the inlined caller frames.
+      std::vector<Value*> slots;
+      flattenVMState(vm_state, slots);
+      SmallVector<Instruction*, 2> points;
+      getPointsAfterParsePoint(CS, points);
+      for(Instruction* IP : points) {
+        holders.push_back( CallInst::Create(getUseHolder(F), slots, "", IP) );
+      }
     }
   }
+}
 
-
-  
+static bool insertParsePoints(Function& F, DominatorTree& DT,
+                              DefiningValueMapTy& DVCache,
+                              std::vector<CallSite>& toUpdate,
+                              std::vector<CallInst*>& holders,
+                              const VMStateInfo& VMStates,
+                              GCPtrLivenessData& OriginalLivenessData,
+                              std::vector<std::set<Value*> >& LiveSets,
+                              const TargetTransformInfo& TTI,
+                              SafepointFunctionStats& Stats) {
   std::vector<struct PartiallyConstructedSafepointRecord> records;
   records.reserve(toUpdate.size());
   // A) Identify all gc pointers which are staticly live at the given call
   // site.
-  GCPtrLivenessData OriginalLivenessData;
-  if( DataflowLiveness ) 
-    computeGCPtrLiveness(F, OriginalLivenessData);
-  for(size_t i = 0; i < toUpdate.size(); i++) {
-    CallSite& CS = toUpdate[i];
-    
-    struct PartiallyConstructedSafepointRecord info;
-    analyzeParsePointLiveness(DT, OriginalLivenessData, CS, info);
-    records.push_back(info);
+  {
+    NamedRegionTimer T("Liveness", TimerGroupName, TimePassesIsEnabled);
+    for(size_t i = 0; i < toUpdate.size(); i++) {
+      CallSite& CS = toUpdate[i];
+
+      struct PartiallyConstructedSafepointRecord info;
+      if( DataflowLiveness ) {
+        // Computed in the analysis phase
+        info.liveset.swap(LiveSets[i]);
+      } else {
+        analyzeParsePointLiveness(DT, OriginalLivenessData, CS, info);
+      }
+      printParsePointLiveness(CS, info.liveset);
+      records.push_back(info);
+    }
   }
   assert( records.size() == toUpdate.size());
 
-  // B) Find the base pointers for each live pointer
-  /* scope for caching */ {
-    // Cache the 'defining value' relation used in the computation and
-    // insertion of base phis and selects.  This ensures that we don't insert
-    // large numbers of duplicate base_phis.  
-    DefiningValueMapTy DVCache;
-    
+  // B) Find the base pointers for each live pointer.  DVCache caches the
+  // 'defining value' relation used in the computation and insertion of base
+  // phis and selects.  This ensures that we don't insert large numbers of
+  // duplicate base_phis.
+  {
+    NamedRegionTimer T("Base pointer search", TimerGroupName,
+                       TimePassesIsEnabled);
     for(size_t i = 0; i < records.size(); i++) {
       struct PartiallyConstructedSafepointRecord& info = records[i];
       CallSite& CS = toUpdate[i];
       findBasePointers(DT, DVCache, CS, info);
     }
-  } // end of cache scope
+  }
   assert( records.size() == toUpdate.size());
   
   // The base phi insertion logic (for any safepoint) may have inserted new
@@ -855,12 +1591,15 @@ static bool insertParsePoints(Function& F, DominatorTree& DT,
     allInsertedDefs.insert( info.newInsertedDefs.begin(),
                             info.newInsertedDefs.end() );
   }
+  NumBaseDefsInserted += allInsertedDefs.size();
   
   // We insert some dummy calls after each safepoint to definitely hold live
   // the base pointers which were identified for that safepoint.  We'll then
   // ask liveness for _every_ base inserted to see what is now live.  Then we
   // remove the dummy calls.
   holders.reserve(holders.size() + records.size());
+  std::vector<Instruction*> baseHolders;
+  baseHolders.reserve(records.size());
   for(size_t i = 0; i < records.size(); i++) {
     struct PartiallyConstructedSafepointRecord& info = records[i];
     CallSite& CS = toUpdate[i];
@@ -871,28 +1610,48 @@ static bool insertParsePoints(Function& F, DominatorTree& DT,
       bases.push_back(Pair.second);
     }
 
-    assert( CS.isCall() && "implement invoke here");
-
-    BasicBlock::iterator next(CS.getInstruction());
-    next++;    
-    CallInst* base_holder = CallInst::Create(Func, bases, "", next);
-    holders.push_back(base_holder);
+    SmallVector<Instruction*, 2> points;
+    getPointsAfterParsePoint(CS, points);
+    for(Instruction* IP : points) {
+      CallInst* base_holder = CallInst::Create(Func, bases, "", IP);
+      holders.push_back(base_holder);
+      baseHolders.push_back(base_holder);
+    }
   }
 
-  // TODO-PERF: Use the allInsertedDefs to restrict the size of
-  // the sets being passed around.  Worthwhile?
-  // TODO-PERF: only run if !allInsertedDefs.empty()
-  GCPtrLivenessData RevisedLivenessData;
-  if( DataflowLiveness ) 
-    computeGCPtrLiveness(F, RevisedLivenessData);
+  // Since the original liveness was computed, the only changes to the IR are
+  // the newly inserted base defs and the holders for the bases.  Neither
+  // changes the CFG and both can only extend liveness, so we update the
+  // original solution in place starting from just the affected blocks.
+  GCPtrLivenessData& RevisedLivenessData = OriginalLivenessData;
+  if( DataflowLiveness ) {
+    NamedRegionTimer T("Liveness", TimerGroupName, TimePassesIsEnabled);
+    updateGCPtrLiveness(RevisedLivenessData, allInsertedDefs, baseHolders);
+  }
+#ifndef NDEBUG
+  if( DataflowLiveness && VerifyIRLevel >= 3 ) {
+    // The incremental update must agree with a from scratch recomputation
+    GCPtrLivenessData FreshLivenessData;
+    computeGCPtrLiveness(F, FreshLivenessData);
+    for(size_t i = 0; i < toUpdate.size(); i++) {
+      std::set<Value*> incremental, fresh;
+      findLiveSetAtInst(toUpdate[i].getInstruction(), RevisedLivenessData, incremental);
+      findLiveSetAtInst(toUpdate[i].getInstruction(), FreshLivenessData, fresh);
+      assert( incremental == fresh && "incremental liveness update is wrong");
+    }
+  }
+#endif
   for(size_t i = 0; i < records.size(); i++) {
     struct PartiallyConstructedSafepointRecord& info = records[i];
     CallSite& CS = toUpdate[i];
 
-    if( DataflowLiveness )  {
-      fixupLiveness(RevisedLivenessData, CS, allInsertedDefs, info);
-    } else {
-      fixupLiveness(DT, CS, allInsertedDefs, info);
+    {
+      NamedRegionTimer T("Liveness", TimerGroupName, TimePassesIsEnabled);
+      if( DataflowLiveness )  {
+        fixupLiveness(RevisedLivenessData, CS, allInsertedDefs, info);
+      } else {
+        fixupLiveness(DT, CS, allInsertedDefs, info);
+      }
     }
     if (PrintBasePointers) {
       errs() << "Base Pairs: (w/Relocation)\n";
@@ -911,50 +1670,54 @@ static bool insertParsePoints(Function& F, DominatorTree& DT,
   // Now run through and insert the safepoints, but do _NOT_ update or remove
   // any existing uses.  We have references to live variables that need to
   // survive to the last iteration of this loop.
-  for(size_t i = 0; i < records.size(); i++) {
-    struct PartiallyConstructedSafepointRecord& info = records[i];
-    CallSite& CS = toUpdate[i];
-    // locate the defining VM state object for this location
-    CallInst* vm_state = nullptr;
-    if( VMStateRequired() ) {
-      vm_state = findVMState(CS.getInstruction(), &DT);
-      BUGPOINT_CLEAN_EXIT_IF( !vm_state );
-      assert( vm_state && "must find vm state or be scanning c++ source code");
-      // Note: There is an implicit assumption here that values in the VM state
-      // are live at the statepoint if-and-only-if they are live at the VM
-      // state.  We duplicate jvm_states before each possible statepoint right
-      // before this pass runs, so this should hold.
-      // As a result of this assumption, we don't need to adjust liveness for
-      // values at statepoints based on what jvm_states other statepoints might
-      // need.  This is an important simpllication.
+  {
+    NamedRegionTimer T("Statepoint creation", TimerGroupName,
+                       TimePassesIsEnabled);
+    for(size_t i = 0; i < records.size(); i++) {
+      struct PartiallyConstructedSafepointRecord& info = records[i];
+      CallSite& CS = toUpdate[i];
+      // locate the defining VM state object for this location
+      CallInst* vm_state = nullptr;
+      if( VMStateRequired() ) {
+        vm_state = VMStates.getReachingVMState(CS.getInstruction());
+        BUGPOINT_CLEAN_EXIT_IF( !vm_state );
+        assert( vm_state && "must find vm state or be scanning c++ source code");
+        // Note: There is an implicit assumption here that values in the VM state
+        // are live at the statepoint if-and-only-if they are live at the VM
+        // state.  We duplicate jvm_states before each possible statepoint right
+        // before this pass runs, so this should hold.
+        // As a result of this assumption, we don't need to adjust liveness for
+        // values at statepoints based on what jvm_states other statepoints might
+        // need.  This is an important simpllication.
+      }
+      // Note: This deletes the instruction refered to by the CallSite!
+      InsertSafepoint(DT, CS, vm_state, info, TTI);
+      info.verify();
     }
-    // Note: This deletes the instruction refered to by the CallSite!
-    InsertSafepoint(DT, CS, vm_state, info);
-    info.verify();
-  }
 
-  // Adjust all users of the old call sites to use the new ones instead
-  for(size_t i = 0; i < records.size(); i++) {
-    struct PartiallyConstructedSafepointRecord& info = records[i];
-    CallSite& CS = toUpdate[i];
-    BasicBlock* BB = CS.getInstruction()->getParent();
-    // If there's a result (which might be live at another safepoint), update it
-    if( info.result ) {
-      // Replace all uses with the new call
-      CS.getInstruction()->replaceAllUsesWith(info.result);
-    }
+    // Adjust all users of the old call sites to use the new ones instead
+    for(size_t i = 0; i < records.size(); i++) {
+      struct PartiallyConstructedSafepointRecord& info = records[i];
+      CallSite& CS = toUpdate[i];
+      BasicBlock* BB = CS.getInstruction()->getParent();
+      // If there's a result (which might be live at another safepoint), update it
+      if( info.result ) {
+        // Replace all uses with the new call
+        CS.getInstruction()->replaceAllUsesWith(info.result);
+      }
 
-    // Now that we've handled all uses, remove the original call itself
-    // Note: The insert point can't be the deleted instruction!
-    CS.getInstruction()->eraseFromParent();
-    /* scope */ {
-      // trip an assert if somehow this isn't a terminator
-      TerminatorInst* TI = BB->getTerminator();
-      (void)TI;
-      assert( (CS.isCall() || TI == info.safepoint.first) && "newly insert invoke is not terminator?");
+      // Now that we've handled all uses, remove the original call itself
+      // Note: The insert point can't be the deleted instruction!
+      CS.getInstruction()->eraseFromParent();
+      /* scope */ {
+        // trip an assert if somehow this isn't a terminator
+        TerminatorInst* TI = BB->getTerminator();
+        (void)TI;
+        assert( (CS.isCall() || TI == info.safepoint.first) && "newly insert invoke is not terminator?");
+      }
     }
   }
-  
+
   toUpdate.clear(); // prevent accident use of invalid CallSites
 
   if( VerifyIRLevel >= 2 ) {
@@ -973,6 +1736,20 @@ static bool insertParsePoints(Function& F, DominatorTree& DT,
     // we just grab that.
     Statepoint statepoint(info.safepoint.first);
     live.insert(live.end(), statepoint.gc_args_begin(), statepoint.gc_args_end());
+    for(auto Pair : info.rematerialized) {
+      live.push_back(Pair.first);
+    }
+
+    const unsigned relocates =
+      statepoint.gc_args_end() - statepoint.gc_args_begin();
+    const unsigned liveSetSize = relocates + info.rematerialized.size();
+    NumStatepoints++;
+    NumLiveAtStatepoints += liveSetSize;
+    Stats.Statepoints++;
+    Stats.Relocates += relocates;
+    Stats.Rematerialized += info.rematerialized.size();
+    Stats.LiveSetSizes[liveSetSize]++;
+    Stats.RelocateCounts[relocates]++;
   }
   unique_unsorted(live);
 
@@ -981,7 +1758,15 @@ static bool insertParsePoints(Function& F, DominatorTree& DT,
     assert( isGCPointerType(ptr->getType()) && "must be a gc pointer type");
   }
   
-  relocationViaAlloca(F, DT, live, records);
+  {
+    NamedRegionTimer T("Relocation rewriting", TimerGroupName,
+                       TimePassesIsEnabled);
+    if( RelocationViaAlloca ) {
+      relocationViaAlloca(F, DT, live, records);
+    } else {
+      relocationViaSSA(F, live, records);
+    }
+  }
 
   // Verify the result
   if( VerifyIRLevel >= 1 ) {
@@ -995,9 +1780,9 @@ static bool insertParsePoints(Function& F, DominatorTree& DT,
 
 
 // TODO:
-// - separate the analysis into it's own step
 // - convert the for-safepoint loop into a per-phase, per safepoint loop
-bool PlaceSafepoints::runOnFunction(Function &F) {
+bool PlaceSafepoints::prepareFunction(FunctionSafepointWork& W) {
+  Function& F = *W.F;
 
   if( F.isDeclaration() ||
       F.empty() ) {
@@ -1029,11 +1814,13 @@ bool PlaceSafepoints::runOnFunction(Function &F) {
 
   // Note: With the migration, we need to recompute this for each 'pass'.  Once
   // we merge these, we'll do it once before the analysis
-  DominatorTree DT;
+  DominatorTree& DT = W.DT;
   
-  std::vector<CallSite> ParsePointNeeded;
+  std::vector<CallSite>& ParsePointNeeded = W.ParsePoints;
 
   if( EnableBackedgeSafepoints ) {
+    NamedRegionTimer T("Poll insertion", TimerGroupName, TimePassesIsEnabled);
+
     // Construct a pass manager to run the LoopPass backedge logic.  We
     // need the pass manager to handle scheduling all the loop passes
     // appropriately.  Doing this by hand is painful and just not worth messing
@@ -1045,6 +1832,24 @@ bool PlaceSafepoints::runOnFunction(Function &F) {
     // (which it depends on) may.  i.e. analysis must be recalculated after run
     FPM.run(F);
 
+    // Strip mining moves the poll from the original latch to the latch of
+    // the new outer loop
+    if( !PBS->StripMineCandidates.empty() ) {
+      DenseMap<TerminatorInst*, TerminatorInst*> Moved;
+      for(const StripMineCandidate& C : PBS->StripMineCandidates) {
+        TerminatorInst* Old = C.Latch->getTerminator();
+        Moved[Old] = stripMineLoop(C);
+      }
+      for(TerminatorInst*& term : PBS->PollLocations) {
+        DenseMap<TerminatorInst*, TerminatorInst*>::iterator itr =
+          Moved.find(term);
+        if( itr != Moved.end() ) {
+          term = itr->second;
+        }
+      }
+      modified = true;
+    }
+
     // We preserve dominance information when inserting the poll, otherwise
     // we'd have to recalculate this on every insert
     DT.recalculate(F);
@@ -1058,7 +1863,10 @@ bool PlaceSafepoints::runOnFunction(Function &F) {
 
       // VM State handling is handled when making the runtime call sites parsable
       std::vector<CallSite> ParsePoints;
-      InsertSafepointPoll(DT, term, ParsePoints);
+      InsertSafepointPoll(DT, getPollTemplate(*F.getParent()), term,
+                          ParsePoints);
+      NumPollsInserted++;
+      W.Stats.Polls++;
 
       // Record the parse points for later use
       ParsePointNeeded.insert(ParsePointNeeded.end(),
@@ -1067,13 +1875,17 @@ bool PlaceSafepoints::runOnFunction(Function &F) {
   }
 
   if( EnableEntrySafepoints ) {
+    NamedRegionTimer T("Poll insertion", TimerGroupName, TimePassesIsEnabled);
     DT.recalculate(F);
     Instruction* term = findLocationForEntrySafepoint(F, DT);
     if( !term ) {
       // policy choice not to insert?
     } else {
       std::vector<CallSite> RuntimeCalls;
-      InsertSafepointPoll(DT, term, RuntimeCalls);
+      InsertSafepointPoll(DT, getPollTemplate(*F.getParent()), term,
+                          RuntimeCalls);
+      NumPollsInserted++;
+      W.Stats.Polls++;
       modified = true;
       ParsePointNeeded.insert(ParsePointNeeded.end(),
                               RuntimeCalls.begin(), RuntimeCalls.end());
@@ -1102,10 +1914,125 @@ bool PlaceSafepoints::runOnFunction(Function &F) {
     FPM.add(createMergeNonDominatingVMStatesPass(locations));
     FPM.run(F);
   }
-  // Any parse point (no matter what source) will be handled here
+  // Any parse point (no matter what source) will be handled from here on
+  modified |= normalizeInvokeParsePoints(ParsePointNeeded);
   DT.recalculate(F); // Needed?
-  modified |= insertParsePoints(F, DT, ParsePointNeeded);
+  prepareParsePoints(F, DT, ParsePointNeeded, W.Holders, W.VMStates);
+
+  W.Modified = modified;
+  return true;
+}
+
+void PlaceSafepoints::analyzeFunction(FunctionSafepointWork& W) {
+  // Note: This must not modify the IR or touch anything outside of W.  It
+  // may run concurrently with the analysis of other functions.
+  if( !DataflowLiveness )
+    return;
+  computeGCPtrLiveness(*W.F, W.Liveness);
+  W.LiveSets.resize(W.ParsePoints.size());
+  for(size_t i = 0; i < W.ParsePoints.size(); i++) {
+    findLiveSetAtInst(W.ParsePoints[i].getInstruction(), W.Liveness,
+                      W.LiveSets[i]);
+  }
+}
+
+bool PlaceSafepoints::finishFunction(FunctionSafepointWork& W) {
+  bool modified = W.Modified;
+  // The base defining value cache is shared by the parse points of the
+  // function.  The values it maps are function local (or constants, which
+  // are cheap to look up again), so it isn't kept across functions.
+  DefiningValueMapTy BDVCache;
+  modified |= insertParsePoints(*W.F, W.DT, BDVCache, W.ParsePoints,
+                                W.Holders, W.VMStates, W.Liveness, W.LiveSets,
+                                getAnalysis<TargetTransformInfo>(), W.Stats);
+  if( !StatsYAMLFile.empty() && (W.Stats.Polls || W.Stats.Statepoints) ) {
+    W.Stats.Name = W.F->getName();
+    ModuleStats.push_back(W.Stats);
+  }
+  return modified;
+}
+
+void PlaceSafepoints::analyzeFunctions(ArrayRef<FunctionSafepointWork*> Batch) {
+  const unsigned NumThreads =
+    std::min<unsigned>(NumLivenessThreads, Batch.size());
+  if( NumThreads <= 1 || !llvm_is_multithreaded() ) {
+    for(FunctionSafepointWork* W : Batch) {
+      analyzeFunction(*W);
+    }
+    return;
+  }
+
+  // Each thread (including this one) repeatedly claims the next unanalyzed
+  // function in the batch.
+  volatile sys::cas_flag Next = 0;
+  auto worker = [&]() {
+    while( true ) {
+      const unsigned Idx = sys::AtomicIncrement(&Next) - 1;
+      if( Idx >= Batch.size() ) {
+        break;
+      }
+      analyzeFunction(*Batch[Idx]);
+    }
+  };
+  std::vector<std::thread> Workers;
+  for(unsigned i = 1; i < NumThreads; i++) {
+    Workers.push_back(std::thread(worker));
+  }
+  worker();
+  for(std::thread& T : Workers) {
+    T.join();
+  }
+}
+
+bool PlaceSafepoints::runOnModule(Module &M) {
+  bool modified = false;
+
+  // Functions are handled in batches.  Within a batch, every function is
+  // prepared in module order, then the liveness of all of them is computed
+  // (potentially in parallel), and then the parse points are inserted, again
+  // in module order.
+  // Every step which modifies the IR - including the module level
+  // declarations for the poll, the use holder, and the statepoint intrinsics
+  // - thus happens serially and in exactly the order of the single threaded
+  // run, so the output does not depend on the number of threads.  With a
+  // single thread, a batch is a single function.
+  const size_t BatchSize =
+    NumLivenessThreads <= 1 ? 1 : 4 * NumLivenessThreads;
+  Module::iterator FI = M.begin(), FE = M.end();
+  while( FI != FE ) {
+    std::vector<std::unique_ptr<FunctionSafepointWork> > Work;
+    SmallVector<FunctionSafepointWork*, 16> Batch;
+    for(; FI != FE && Work.size() < BatchSize; FI++) {
+      Work.push_back(std::unique_ptr<FunctionSafepointWork>(
+                       new FunctionSafepointWork(&*FI)));
+      FunctionSafepointWork* W = Work.back().get();
+      if( prepareFunction(*W) ) {
+        Batch.push_back(W);
+      }
+    }
 
+    {
+      NamedRegionTimer T("Liveness", TimerGroupName, TimePassesIsEnabled);
+      analyzeFunctions(Batch);
+    }
+
+    for(FunctionSafepointWork* W : Batch) {
+      modified |= finishFunction(*W);
+    }
+  }
+  PollTemplate.reset();
+
+  if( !ModuleStats.empty() ) {
+    std::string ErrorInfo;
+    raw_fd_ostream OS(StatsYAMLFile.c_str(), ErrorInfo,
+                      sys::fs::F_Append | sys::fs::F_Text);
+    if( !ErrorInfo.empty() ) {
+      report_fatal_error("can't open " + StatsYAMLFile + ": " + ErrorInfo);
+    }
+    yaml::Output YOut(OS);
+    YOut << ModuleStats;
+    ModuleStats.clear();
+  }
   return modified;
 }
 
@@ -1125,12 +2052,14 @@ FunctionPass *llvm::createRemoveFakeVMStateCallsPass() {
 INITIALIZE_PASS_BEGIN(PlaceBackedgeSafepointsImpl,
                 "place-backedge-safepoints-impl", "Place Backedge Safepoints", false, false)
 INITIALIZE_PASS_DEPENDENCY(ScalarEvolution)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
 INITIALIZE_PASS_DEPENDENCY(LoopSimplify)
 INITIALIZE_PASS_END(PlaceBackedgeSafepointsImpl,
                 "place-backedge-safepoints-impl", "Place Backedge Safepoints", false, false)
 
 INITIALIZE_PASS_BEGIN(PlaceSafepoints,
                 "place-safepoints", "Place Safepoints", false, false)
+INITIALIZE_AG_DEPENDENCY(TargetTransformInfo)
 INITIALIZE_PASS_END(PlaceSafepoints,
                     "place-safepoints", "Place Safepoints", false, false)
 
@@ -1168,50 +2097,206 @@ bool SafepointPlacementImpl::isGCLeafFunction(const CallSite& CS) {
   if(isLeaf) {
     return true;
   }
+  // Or if -infer-gc-leaf proved it can never reach a safepoint.
+  if( F && F->getFnAttribute("gc-leaf-inferred").getValueAsString().equals("true") ) {
+    return true;
+  }
   return false;
 }
 
 
-void SafepointPlacementImpl::InsertSafepointPoll(DominatorTree& DT, Instruction* term,
-                                                 std::vector<CallSite>& ParsePointsNeeded /*rval*/) {  
-  Module* M = term->getParent()->getParent()->getParent();
-  assert(M);  
-
-  // Inline the safepoint poll implementation - this will get all the branch,
-  // control flow, etc..  Most importantly, it will introduce the actual slow
-  // path call - where we need to insert a safepoint (parsepoint).
-  FunctionType* ftype = FunctionType::get(Type::getVoidTy(M->getContext()), false);
-  assert(ftype && "null?");
-  // Note: This cast can fail if there's a function of the same name with a
-  // different type inserted previously
-  Function* F = dyn_cast<Function>(M->getOrInsertFunction("gc.safepoint_poll", ftype));
-  BUGPOINT_CLEAN_EXIT_IF( !(F && !F->empty()));
-  assert( F && !F->empty() && "definition must exist");
-  CallInst* poll = CallInst::Create(F, "", term);
-  
+SafepointPollTemplate::SafepointPollTemplate(Function* Poll)
+  : Poll(Poll), Body(nullptr), ExitIDom(nullptr) {
+  BUGPOINT_CLEAN_EXIT_IF( Poll->empty() );
+  assert( !Poll->empty() && "definition must exist");
+
+  // Prune the body the way InlineFunction does for a call without arguments,
+  // so that the copies come out just as the inlined code would.
+  Body = Function::Create(Poll->getFunctionType(), GlobalValue::PrivateLinkage,
+                          Poll->getName());
+  ValueToValueMapTy VMap;
+  ClonedCodeInfo Info;
+  CloneAndPruneFunctionInto(Body, Poll, VMap, /*ModuleLevelChanges=*/false,
+                            Returns, ".i", &Info);
+  assert( !Info.ContainsDynamicAllocas && "can't have allocs");
+
+  for(BasicBlock& BB : *Body) {
+    for(Instruction& I : BB) {
+      assert( !isa<AllocaInst>(I) && "can't have allocs");
+      // The call to the poll is neither a tail call nor nounwind, unless the
+      // poll itself is nounwind
+      if( CallInst* CI = dyn_cast<CallInst>(&I) ) {
+        CI->setTailCallKind(CallInst::TCK_None);
+        if( Poll->doesNotThrow() ) {
+          CI->setDoesNotThrow();
+        }
+      }
+    }
+  }
+
+  // If your poll function includes an unreachable at the end, that's not
+  // valid.  Bugpoint likes to create this, so check for it.
+  BUGPOINT_CLEAN_EXIT_IF( Returns.empty() );
+  assert( !Returns.empty() && "malformed poll function");
+
+  DominatorTree BodyDT;
+  BodyDT.recalculate(*Body);
+  for(df_iterator<DomTreeNode*> I = df_begin(BodyDT.getRootNode()),
+        E = df_end(BodyDT.getRootNode()); I != E; ++I) {
+    if( DomTreeNode* IDom = I->getIDom() ) {
+      DomOrder.push_back(std::make_pair(I->getBlock(), IDom->getBlock()));
+    }
+  }
+  ExitIDom = Returns[0]->getParent();
+  for(ReturnInst* RI : Returns) {
+    ExitIDom = BodyDT.findNearestCommonDominator(ExitIDom, RI->getParent());
+  }
+}
+
+SafepointPollTemplate::~SafepointPollTemplate() {
+  // Body uses values of the module, drop those before deleting it
+  Body->dropAllReferences();
+  delete Body;
+}
+
+void SafepointPollTemplate::expandBefore(Instruction* term, DominatorTree& DT) {
+  BasicBlock* OrigBB = term->getParent();
+  Function* Caller = OrigBB->getParent();
+  LLVMContext& Ctx = Caller->getContext();
+
+  if( Poll->hasGC() ) {
+    if( !Caller->hasGC() ) {
+      Caller->setGC(Poll->getGC());
+    }
+    assert( Caller->getGC() == Poll->getGC() && "can't inline the poll");
+  }
+
+  // Build the copy outside of the function and then add it block by block,
+  // so that its names are uniqued in the same order as by the inliner.
+  ValueToValueMapTy VMap;
+  std::vector<BasicBlock*> NewBlocks;
+  NewBlocks.reserve(Body->size());
+  for(BasicBlock& BB : *Body) {
+    BasicBlock* NewBB = BasicBlock::Create(Ctx, BB.getName());
+    for(Instruction& I : BB) {
+      Instruction* NewI = I.clone();
+      NewI->setName(I.getName());
+      NewBB->getInstList().push_back(NewI);
+      VMap[&I] = NewI;
+    }
+    VMap[&BB] = NewBB;
+    NewBlocks.push_back(NewBB);
+  }
+  for(BasicBlock* NewBB : NewBlocks) {
+    for(Instruction& I : *NewBB) {
+      RemapInstruction(&I, VMap, RF_NoModuleLevelChanges);
+    }
+    Caller->getBasicBlockList().push_back(NewBB);
+  }
+
+  // A single block is spliced in right before term.  No blocks are added.
+  if( NewBlocks.size() == 1 ) {
+    BasicBlock* NewBB = NewBlocks.front();
+    OrigBB->getInstList().splice(term, NewBB->getInstList(),
+                                 NewBB->begin(), NewBB->end());
+    NewBB->eraseFromParent();
+    cast<Instruction>(VMap[Returns[0]])->eraseFromParent();
+    return;
+  }
+
+  // Remember what OrigBB dominated, the code after the poll dominates it now
+  SmallVector<BasicBlock*, 8> Children;
+  for(DomTreeNode* Child : *DT.getNode(OrigBB)) {
+    Children.push_back(Child->getBlock());
+  }
+
+  // Otherwise the copy goes in between OrigBB and the code after the poll,
+  // as laid out by InlineFunction.
+  BasicBlock* AfterCallBB =
+    OrigBB->splitBasicBlock(term, Poll->getName() + ".exit");
+  TerminatorInst* Br = OrigBB->getTerminator();
+  Br->setOperand(0, NewBlocks.front());
+  Caller->getBasicBlockList().splice(AfterCallBB, Caller->getBasicBlockList(),
+                                     NewBlocks.front(), Caller->end());
+
+  // Note: The value map follows the block replacements below, so afterwards
+  // it maps the entry of Body to OrigBB and a single return block to
+  // AfterCallBB.
+  if( Returns.size() > 1 ) {
+    for(ReturnInst* RI : Returns) {
+      ReturnInst* NewRI = cast<ReturnInst>(VMap[RI]);
+      BranchInst* BI = BranchInst::Create(AfterCallBB, NewRI);
+      BI->setDebugLoc(NewRI->getDebugLoc());
+      NewRI->eraseFromParent();
+    }
+  } else {
+    ReturnInst* NewRI = cast<ReturnInst>(VMap[Returns[0]]);
+    BasicBlock* ReturnBB = NewRI->getParent();
+    ReturnBB->replaceAllUsesWith(AfterCallBB);
+    AfterCallBB->getInstList().splice(AfterCallBB->begin(),
+                                      ReturnBB->getInstList());
+    NewRI->eraseFromParent();
+    ReturnBB->eraseFromParent();
+  }
+
+  BasicBlock* CalleeEntry = NewBlocks.front();
+  CalleeEntry->replaceAllUsesWith(OrigBB);
+  OrigBB->getInstList().splice(Br, CalleeEntry->getInstList());
+  Br->eraseFromParent();
+  CalleeEntry->eraseFromParent();
+
+  // The copy of the body is dominated as the body is, with OrigBB standing
+  // in for the entry
+  for(const std::pair<BasicBlock*, BasicBlock*>& P : DomOrder) {
+    DT.addNewBlock(cast<BasicBlock>(VMap[P.first]),
+                   cast<BasicBlock>(VMap[P.second]));
+  }
+  if( Returns.size() > 1 ) {
+    DT.addNewBlock(AfterCallBB, cast<BasicBlock>(VMap[ExitIDom]));
+  }
+  for(BasicBlock* Child : Children) {
+    DT.changeImmediateDominator(Child, AfterCallBB);
+  }
+}
+
+SafepointPollTemplate& PlaceSafepoints::getPollTemplate(Module& M) {
+  if( !PollTemplate ) {
+    FunctionType* ftype = FunctionType::get(Type::getVoidTy(M.getContext()), false);
+    // Note: This cast can fail if there's a function of the same name with a
+    // different type inserted previously
+    Function* F = dyn_cast<Function>(M.getOrInsertFunction("gc.safepoint_poll", ftype));
+    BUGPOINT_CLEAN_EXIT_IF( !F );
+    assert( F && "gc.safepoint_poll has the wrong type");
+    PollTemplate.reset(new SafepointPollTemplate(F));
+  }
+  return *PollTemplate;
+}
+
+void SafepointPlacementImpl::InsertSafepointPoll(DominatorTree& DT,
+                                                 SafepointPollTemplate& Poll,
+                                                 Instruction* term,
+                                                 std::vector<CallSite>& ParsePointsNeeded /*rval*/) {
   if( VerifyIRLevel >= 3) { verifyFunction(*term->getParent()->getParent()); }
-  
-  // Record some information about the call site we're replacing
+
+  // Record some information about the location we're inserting at
   BasicBlock* OrigBB = term->getParent();
-  BasicBlock::iterator before(poll), after(poll);
+  BasicBlock::iterator before(term);
   bool isBegin(false);
   if( before == term->getParent()->begin() ) {
     isBegin = true;
   } else {
     before--;
   }
-  after++;
-  assert( after != poll->getParent()->end() && "must have successor");
-  assert( DT.dominates(before, after) && "trivially true");
-  
-  // do the actual inlining
-  InlineFunctionInfo IFI;
-  bool inlineStatus = InlineFunction(poll, IFI);
-  assert(inlineStatus && "inline must succeed");
-  
-  // Check post conditions
-  assert( IFI.StaticAllocas.empty() && "can't have allocs");
-  
+
+  // Splice in the safepoint poll implementation - this will get all the
+  // branch, control flow, etc..  Most importantly, it will introduce the
+  // actual slow path call - where we need to insert a safepoint (parsepoint).
+  {
+    NamedRegionTimer T("Poll template splicing", TimerGroupName,
+                       TimePassesIsEnabled);
+    Poll.expandBefore(term, DT);
+  }
+
   std::vector<CallInst*> calls; // new calls
   std::set<BasicBlock*> BBs; //new BBs + insertee
   // Include only the newly inserted instructions, Note: begin may not be valid
@@ -1220,21 +2305,12 @@ void SafepointPlacementImpl::InsertSafepointPoll(DominatorTree& DT, Instruction*
   if(isBegin) { start = OrigBB->begin(); }
   else { start = before; start++; }
 
-  // If your poll function includes an unreachable at the end, that's not
-  // valid.  Bugpoint likes to create this, so check for it.
-  BUGPOINT_CLEAN_EXIT_IF( !isPotentiallyReachable(&*start, &*after, nullptr, nullptr) );
-  assert( isPotentiallyReachable(&*start, &*after, nullptr, nullptr) &&
-          "malformed poll function");
-  
-  scanInlinedCode(&*(start), &*(after), calls, BBs);
-  
-  // Recompute since we've invalidated cached data.  Conceptually we
-  // shouldn't need to do this, but implementation wise we appear to.  Needed
-  // so we can insert safepoints correctly.
-  // TODO: update more cheaply
-  DT.recalculate(*after->getParent()->getParent());
-    
-  if( VerifyIRLevel >= 3 ) { verifyFunction(*term->getParent()->getParent()); }
+  scanInlinedCode(&*(start), term, calls, BBs);
+
+  if( VerifyIRLevel >= 3 ) {
+    verifyFunction(*term->getParent()->getParent());
+    DT.verifyDomTree();
+  }
 
   BUGPOINT_CLEAN_EXIT_IF(calls.empty());
   assert( !calls.empty() && "slow path not found for safepoint poll");
@@ -1306,16 +2382,17 @@ static void findLiveSetAtInst(Instruction* inst,
   BasicBlock* BB = inst->getParent();
 
   // Note: The copy is intentional and required
-  assert( Data.LiveOut.count(BB) );
-  DenseSet<Value*> LiveOut = Data.LiveOut[BB];
+  BitVector LiveOut = Data.LiveOut[Data.getNumber(BB)];
 
   // We want to handle the statepoint itself oddly.  It's
   // call result is not live (normal), nor are it's arguments
   // (unless they're used again later).  This adjustment is
   // specifically what we need to relocate 
   BasicBlock::reverse_iterator rend(inst);
-  computeGCPtrLiveness(BB->rbegin(), rend, LiveOut);
-  for( auto V : LiveOut ) {
+  computeGCPtrLiveness(BB->rbegin(), rend, Data, LiveOut);
+  for(int idx = LiveOut.find_first(); idx != -1;
+      idx = LiveOut.find_next(idx)) {
+    Value* V = Data.Values[idx];
     if( V != inst ) {
       out.insert(V);
     }
@@ -1334,6 +2411,11 @@ void SafepointPlacementImpl::analyzeParsePointLiveness(DominatorTree& DT,
   else
     findLiveGCValuesAtInst(inst, BB, DT, nullptr, liveset);
 
+  result.liveset = liveset;
+}
+
+void SafepointPlacementImpl::printParsePointLiveness(const CallSite& CS,
+                                                     const std::set<Value*>& liveset) {
   if( PrintLiveSet ) {
     // Note: This output is used by several of the test cases
     // The order of elemtns in a set is not stable, put them in a vec and sort by name
@@ -1350,7 +2432,6 @@ void SafepointPlacementImpl::analyzeParsePointLiveness(DominatorTree& DT,
     errs() << "Safepoint For: " << CS.getCalledValue()->getName() << "\n";
     errs() << "Number live values: " << liveset.size() << "\n";
   }
-  result.liveset = liveset;
 }
 
 void SafepointPlacementImpl::findBasePointers(DominatorTree& DT, DefiningValueMapTy& DVCache, const CallSite& CS,
@@ -1490,7 +2571,8 @@ void SafepointPlacementImpl::fixupLiveness(DominatorTree& DT, const CallSite& CS
   result.base_pairs = base_pairs;
 }
 void SafepointPlacementImpl::InsertSafepoint(DominatorTree& DT, const CallSite& CS, CallInst* vm_state,
-                                             SafepointPlacementImpl::PartiallyConstructedSafepointRecord& result) {
+                                             SafepointPlacementImpl::PartiallyConstructedSafepointRecord& result,
+                                             const TargetTransformInfo& TTI) {
   Instruction* inst = CS.getInstruction();
   BasicBlock* BB = inst->getParent();
   
@@ -1499,15 +2581,42 @@ void SafepointPlacementImpl::InsertSafepoint(DominatorTree& DT, const CallSite&
 
   // Third, do the actual placement.
   if( !BaseRewriteOnly ) {
-    
+
+    // Derived pointers at a constant offset from their base are recomputed
+    // from the relocated base rather than taking up a slot of their own.
+    std::vector<std::pair<Value*, SmallVector<Instruction*, 4> > > remat;
+    if( RematerializeDerived ) {
+      std::set<Value*> bases;
+      for(auto Pair : base_pairs) {
+        bases.insert(Pair.second);
+      }
+      for(Value* L : result.liveset) {
+        SmallVector<Instruction*, 4> chain;
+        assert( base_pairs.find(L) != base_pairs.end() );
+        Value* base = base_pairs.find(L)->second;
+        if( L != base && !bases.count(L) && !isa<Constant>(base) &&
+            findRematerializationChain(L, base, chain, TTI) ) {
+          remat.push_back(std::make_pair(L, chain));
+          liveset.erase(L);
+          base_pairs.erase(L);
+        }
+      }
+      // Like the statepoint arguments, keep the output stable for diffs
+      std::sort(remat.begin(), remat.end(),
+                [](const std::pair<Value*, SmallVector<Instruction*, 4> >& a,
+                   const std::pair<Value*, SmallVector<Instruction*, 4> >& b) {
+                  return order_by_name(a.first, b.first);
+                });
+    }
+
     // Convert to vector for efficient cross referencing. 
     std::vector<Value*> basevec, livevec;
     for(Value* L : liveset) {
       livevec.push_back(L);
       
-      assert( base_pairs.find(L) != base_pairs.end() );
-      Value* base = base_pairs[L];
-      basevec.push_back( base );
+      std::map<Value*, Value*>::iterator it = base_pairs.find(L);
+      assert( it != base_pairs.end() && "every live value needs a base");
+      basevec.push_back( it->second );
     }
     assert( livevec.size() == basevec.size() );
 
@@ -1517,6 +2626,10 @@ void SafepointPlacementImpl::InsertSafepoint(DominatorTree& DT, const CallSite&
     stablize_order(basevec, livevec);
     
     CreateSafepoint(CS, vm_state, basevec, livevec, result);
+    NumRelocates += livevec.size();
+    if( !remat.empty() ) {
+      rematerializeDerivedPointers(remat, result);
+    }
 
     if( VerifyIRLevel >= 3 ) {
       verifyFunction(*BB->getParent());
@@ -1639,101 +2752,255 @@ void SafepointPlacementImpl::findLiveGCValuesAtInst(Instruction* term, BasicBloc
   }
 }
 
-bool isNull(Value* V) {
-  return isa<Constant>(V) &&
-    cast<Constant>(V)->isNullValue();
-}
 static void computeGCPtrLiveness(BasicBlock::reverse_iterator rbegin,
                                  BasicBlock::reverse_iterator rend,
-                                 DenseSet<Value*>& LiveTmp) {
+                                 const GCPtrLivenessData& Data,
+                                 BitVector& LiveTmp) {
 
   for(BasicBlock::reverse_iterator ritr = rbegin;
       ritr != rend; ritr++) {
     Instruction* I = &*ritr;
 
     // KILL/Def - Remove this definition from LiveIn
-    LiveTmp.erase(I);
+    if( Data.isTracked(I) ) {
+      LiveTmp.reset(Data.getNumber(I));
+    }
+
+    // Uses by a phi are live along the incoming edge, not in the block
+    // containing the phi.  Those are handled via PhiUses.
+    if( isa<PHINode>(I) ) {
+      continue;
+    }
 
-    // USE - Add to the LiveIn set for this instruction
+    // USE - Add to the LiveIn set for this instruction.  Constants (including
+    // null and undef) are never numbered and thus never live.
     for(unsigned i = 0; i < I->getNumOperands(); i++) {
       Value* V = I->getOperand(i);
-      if( isGCPointerType(V->getType()) &&
-          !isNull(V) &&
-          !isa<UndefValue>(V) ) {
-        // The choice to exclude null and undef is arbitrary here.  Reconsider?
-        LiveTmp.insert(V);
+      if( Data.isTracked(V) ) {
+        LiveTmp.set(Data.getNumber(V));
       }
     }
+  }
+}
+
+/// Number every gc pointer value defined in the function and every
+/// reachable basic block, then size the per-block sets accordingly.
+static void numberGCPtrValues(Function& F, GCPtrLivenessData& Data) {
+  for(Argument& arg : F.args()) {
+    if( isGCPointerType(arg.getType()) ) {
+      Data.ValueNumbers[&arg] = Data.Values.size();
+      Data.Values.push_back(&arg);
+    }
+  }
 
-    if(false) {
-      ritr->dump();
-      for(auto itr = LiveTmp.begin(); itr != LiveTmp.end(); ++itr) {
-        (*itr)->dump();
-      };
-      errs() << "---\n";
+  ReversePostOrderTraversal<Function*> RPOT(&F);
+  for(ReversePostOrderTraversal<Function*>::rpo_iterator itr = RPOT.begin(),
+        end = RPOT.end(); itr != end; itr++) {
+    BasicBlock* BB = *itr;
+    Data.BlockNumbers[BB] = Data.Blocks.size();
+    Data.Blocks.push_back(BB);
+    for(Instruction& I : *BB) {
+      if( isGCPointerType(I.getType()) ) {
+        Data.ValueNumbers[&I] = Data.Values.size();
+        Data.Values.push_back(&I);
+      }
     }
   }
+
+  const unsigned NumValues = Data.Values.size();
+  const unsigned NumBlocks = Data.Blocks.size();
+  Data.Gen.assign(NumBlocks, BitVector(NumValues));
+  Data.Kill.assign(NumBlocks, BitVector(NumValues));
+  Data.PhiUses.assign(NumBlocks, BitVector(NumValues));
+  Data.LiveIn.assign(NumBlocks, BitVector(NumValues));
+  Data.LiveOut.assign(NumBlocks, BitVector(NumValues));
 }
 
-static void computeGCPtrLiveness(Function& F, GCPtrLivenessData& Data) {
+/// Compute the local (Gen, Kill, PhiUses) sets for a single block
+static void computeLocalGCPtrLiveness(BasicBlock* BB, GCPtrLivenessData& Data) {
+  const unsigned BBNum = Data.getNumber(BB);
 
-  // TODO-PERF: Insert each item into worklist at most
-  // once to reduce useless processing.
-  SmallVector<BasicBlock*, 200> worklist;
-  worklist.reserve(std::distance(F.begin(), F.end()));
-  for(Function::iterator itr = F.begin(), end = F.end();
-      itr != end; itr++) {
-    worklist.push_back(&*itr);
-    // TODO-PERF: Only see worklist with BB which contain
-    // uses of values we care about.  Is this profitable?
-    Data.LiveIn[&*itr] = DenseSet<Value*>();
-    Data.LiveOut[&*itr] = DenseSet<Value*>();
-  }
-  while( !worklist.empty() ) {
-    BasicBlock* BB = worklist.back();
-    worklist.pop_back();
-
-    // TODO-PERF: Use set size to avoid comparison against
-    // previous LiveOut value
-    DenseSet<Value*> LiveOut;
+  BitVector& Kill = Data.Kill[BBNum];
+  Kill.reset();
+  for(Instruction& I : *BB) {
+    if( Data.isTracked(&I) ) {
+      Kill.set(Data.getNumber(&I));
+    }
+  }
+
+  BitVector& Gen = Data.Gen[BBNum];
+  Gen.reset();
+  computeGCPtrLiveness(BB->rbegin(), BB->rend(), Data, Gen);
+
+  BitVector& PhiUses = Data.PhiUses[BBNum];
+  PhiUses.reset();
+  for( succ_iterator SI = succ_begin(BB), E = succ_end(BB);
+       SI != E; SI++) {
+    BasicBlock* succ = *SI;
+    for(BasicBlock::iterator II = succ->begin(); isa<PHINode>(II); II++) {
+      Value* V = cast<PHINode>(II)->getIncomingValueForBlock(BB);
+      if( Data.isTracked(V) ) {
+        PhiUses.set(Data.getNumber(V));
+      }
+    }
+  }
+}
+
+/// Iterate the liveness equations to a fixed point starting from the blocks
+/// in the worklist.  The current contents of LiveIn must be a lower bound on
+/// the final solution (i.e. liveness only ever grows here).
+static void solveGCPtrLiveness(GCPtrLivenessData& Data,
+                               SmallVectorImpl<unsigned>& Worklist,
+                               BitVector& InWorklist) {
+  BitVector LiveTmp(Data.Values.size());
+  while( !Worklist.empty() ) {
+    const unsigned BBNum = Worklist.pop_back_val();
+    InWorklist.reset(BBNum);
+    BasicBlock* BB = Data.Blocks[BBNum];
+    NumLivenessBlockVisits++;
+
+    // LiveOut = PhiUses U (LiveIn of each successor)
+    BitVector& LiveOut = Data.LiveOut[BBNum];
+    LiveOut = Data.PhiUses[BBNum];
     for( succ_iterator SI = succ_begin(BB), E = succ_end(BB);
          SI != E; SI++) {
-      BasicBlock* succ = *SI;
-      assert( Data.LiveIn.count(succ) );
-      set_union(LiveOut, Data.LiveIn[succ]);
+      LiveOut |= Data.LiveIn[Data.getNumber(*SI)];
     }
 
-    if( !LiveOut.empty() &&
-        set_equals(Data.LiveOut[BB], LiveOut) ) {
-      // If the liveout set hasn't changed (and we've processed
-      // the block at least once).  We'll never reenter a block
-      // w/ an empty LiveOut.
+    // LiveIn = Gen U (LiveOut - Kill)
+    LiveTmp = LiveOut;
+    LiveTmp.reset(Data.Kill[BBNum]);
+    LiveTmp |= Data.Gen[BBNum];
+
+    // Liveness only ever grows, so comparing against the previous LiveIn
+    // reduces to checking for newly live values.
+    BitVector& LiveIn = Data.LiveIn[BBNum];
+    if( !LiveTmp.test(LiveIn) ) {
       continue;
     }
-    Data.LiveOut[BB] = LiveOut;
-    
-    DenseSet<Value*> LiveTmp = LiveOut;
+    LiveIn = LiveTmp;
+
+    for( pred_iterator PI = pred_begin(BB), E = pred_end(BB);
+         PI != E; PI++ ) {
+      DenseMap<BasicBlock*, unsigned>::const_iterator PredItr =
+        Data.BlockNumbers.find(*PI);
+      if( PredItr == Data.BlockNumbers.end() ) {
+        // unreachable predecessor
+        continue;
+      }
+      const unsigned PredNum = PredItr->second;
+      if( InWorklist.test(PredNum) ) {
+        continue;
+      }
+      // No need to revisit a predecessor which already has everything
+      // live out of it.
+      if( !LiveIn.test(Data.LiveOut[PredNum]) ) {
+        continue;
+      }
+      InWorklist.set(PredNum);
+      Worklist.push_back(PredNum);
+    }
+  } // while( !Worklist.empty() )
+}
+
+/// Report the current bit vector storage of the liveness data via -stats.
+/// The time spent is reported by the "Liveness" timer with -time-passes.
+static void recordGCPtrLivenessStats(const GCPtrLivenessData& Data) {
+  // Five bit vectors per block, each rounded up to whole words
+  const size_t BytesPerSet =
+    (Data.Values.size() + 63) / 64 * sizeof(uint64_t);
+  LivenessBytes += 5 * BytesPerSet * Data.Blocks.size();
+}
+
+static void computeGCPtrLiveness(Function& F, GCPtrLivenessData& Data) {
+  numberGCPtrValues(F, Data);
+  NumLivenessValues += Data.Values.size();
 
-    //TODO-PERF: consider a special case for values live within one
-    // basic block when scanning entire BB
+  for(BasicBlock* BB : Data.Blocks) {
+    computeLocalGCPtrLiveness(BB, Data);
+  }
+
+  // Seed the worklist with every block.  The worklist is popped from the
+  // back and the blocks were numbered in reverse post order, so successors
+  // tend to be visited before their predecessors.  Each block is in the
+  // worklist at most once at any given time.
+  const unsigned NumBlocks = Data.Blocks.size();
+  SmallVector<unsigned, 200> Worklist;
+  Worklist.reserve(NumBlocks);
+  BitVector InWorklist(NumBlocks, true);
+  for(unsigned i = 0; i < NumBlocks; i++) {
+    Worklist.push_back(i);
+  }
+  solveGCPtrLiveness(Data, Worklist, InWorklist);
+
+  if( AreStatisticsEnabled() ) {
+    recordGCPtrLivenessStats(Data);
+  }
+}
 
-    computeGCPtrLiveness(BB->rbegin(), BB->rend(), LiveTmp);
+static void updateGCPtrLiveness(GCPtrLivenessData& Data,
+                                const std::set<Value*>& NewDefs,
+                                const std::vector<Instruction*>& NewUses) {
+  const unsigned NumBlocks = Data.Blocks.size();
+  BitVector InWorklist(NumBlocks);
+  SmallVector<unsigned, 64> Worklist;
+  auto addBlock = [&](BasicBlock* BB) {
+    const unsigned BBNum = Data.getNumber(BB);
+    if( !InWorklist.test(BBNum) ) {
+      InWorklist.set(BBNum);
+      Worklist.push_back(BBNum);
+    }
+  };
 
-    assert( Data.LiveIn.count(BB) );
-    const DenseSet<Value*>& OldLiveIn = Data.LiveIn[BB];
-    if( !set_equals(OldLiveIn, LiveTmp) ) {
-      Data.LiveIn[BB] = LiveTmp;
+  // Number the new definitions.  The existing numbers (and thus the current
+  // solution) remain valid, the new values simply aren't live anywhere yet.
+  for(Value* V : NewDefs) {
+    Instruction* I = cast<Instruction>(V);
+    if( !isGCPointerType(I->getType()) || Data.isTracked(I) ) {
+      continue;
+    }
+    Data.ValueNumbers[I] = Data.Values.size();
+    Data.Values.push_back(I);
+    NumLivenessValues++;
+  }
+  const unsigned NumValues = Data.Values.size();
+  for(unsigned i = 0; i < NumBlocks; i++) {
+    Data.Gen[i].resize(NumValues);
+    Data.Kill[i].resize(NumValues);
+    Data.PhiUses[i].resize(NumValues);
+    Data.LiveIn[i].resize(NumValues);
+    Data.LiveOut[i].resize(NumValues);
+  }
 
-      // empty -> no contribution to predecessor
-      if( !LiveTmp.empty() ) 
-        for( pred_iterator PI = pred_begin(BB), E = pred_end(BB);
-             PI != E; PI++ ) {
-          BasicBlock* pred = *PI;
-          // TODO-PERF: no need to push if LiveIn subset pred.LiveOut
-          worklist.push_back(pred);
+  // The local sets can only have changed in blocks which contain a new
+  // instruction, and - for new phis - in the predecessors supplying the
+  // incoming values.
+  for(Value* V : NewDefs) {
+    Instruction* I = cast<Instruction>(V);
+    addBlock(I->getParent());
+    if( isa<PHINode>(I) ) {
+      BasicBlock* BB = I->getParent();
+      for( pred_iterator PI = pred_begin(BB), E = pred_end(BB);
+           PI != E; PI++ ) {
+        if( Data.BlockNumbers.count(*PI) ) {
+          addBlock(*PI);
         }
+      }
     }
-  } // while( !worklist.empty() )
+  }
+  for(Instruction* I : NewUses) {
+    addBlock(I->getParent());
+  }
+  NumLivenessIncrementalSeeds += Worklist.size();
+
+  for(unsigned BBNum : Worklist) {
+    computeLocalGCPtrLiveness(Data.Blocks[BBNum], Data);
+  }
+  solveGCPtrLiveness(Data, Worklist, InWorklist);
+
+  if( AreStatisticsEnabled() ) {
+    recordGCPtrLivenessStats(Data);
+  }
 }
 
 namespace {
@@ -1931,24 +3198,32 @@ namespace {
 
   /// Returns the base defining value for this value.
   Value* findBaseDefiningValueCached(Value* I, DefiningValueMapTy& cache) {
-    if (cache.find(I) == cache.end()) {
-      cache[I] = findBaseDefiningValue(I);
+    DefiningValueMapTy::iterator itr = cache.find(I);
+    Value* def = nullptr;
+    if( itr != cache.end() ) {
+      def = itr->second;
+    } else {
+      // Note: findBaseDefiningValue does not touch the cache, so inserting
+      // afterwards is safe.
+      def = findBaseDefiningValue(I);
+      cache[I] = def;
     }
-    assert(cache.find(I) != cache.end());
+    assert(def);
 
     if( TraceLSP ) {
-      errs() << "fBDV-cached: " << I->getName() << " -> " << cache[I]->getName() << "\n";
+      errs() << "fBDV-cached: " << I->getName() << " -> " << def->getName() << "\n";
     }
-    return cache[I];
+    return def;
   }
 
   /// Return a base pointer for this value if known.  Otherwise, return it's
   /// base defining value.  
   Value* findBaseOrBDV(Value* I, DefiningValueMapTy& cache) {
     Value* def = findBaseDefiningValueCached(I, cache);
-    if( cache.count(def) ) {
+    DefiningValueMapTy::iterator itr = cache.find(def);
+    if( itr != cache.end() ) {
       // Either a base-of relation, or a self reference.  Caller must check.
-      return cache[def];
+      return itr->second;
     }
     // Only a BDV available
     return def;
@@ -2050,7 +3325,7 @@ namespace {
   class MeetPhiStates {
    public:
     // phiStates is a mapping from PHINodes and SelectInst's to PhiStates.
-    explicit MeetPhiStates(const std::map<Value *, PhiState> &phiStates) :
+    explicit MeetPhiStates(const DenseMap<Value *, PhiState> &phiStates) :
         phiStates(phiStates) { }
 
     // Destructively meet the current result with the base V.  V can
@@ -2068,7 +3343,7 @@ namespace {
     PhiState getResult() const { return currentResult; }
 
    private:
-    const std::map<Value *, PhiState> &phiStates;
+    const DenseMap<Value *, PhiState> &phiStates;
     PhiState currentResult;
 
     /// Return a phi state for a base defining value.  We'll generate a new
@@ -2082,7 +3357,7 @@ namespace {
     }
 
     PhiState lookupFromMap(Value *V) {
-      map<Value *, PhiState>::const_iterator I = phiStates.find(V);
+      DenseMap<Value *, PhiState>::const_iterator I = phiStates.find(V);
       assert(I != phiStates.end() && "lookup failed!");
       return I->second;
     }
@@ -2150,108 +3425,105 @@ namespace {
        overall worse solution.
     */
 
-    map<Value*, PhiState> states;
+    // The states of all phis & selects reachable from the initial one for
+    // which we don't already know a definite base value.  'order' records
+    // the order in which they were discovered so that any IR we insert below
+    // is independent of pointer values.  'dependents' records, for each
+    // state, the states whose meet reads it.
+    DenseMap<Value*, PhiState> states;
+    SmallVector<Value*, 16> order;
+    DenseMap<Value*, SmallVector<Value*, 2> > dependents;
+
+    // Return the base or BDV of each input of a phi or select
+    auto getInputBDVs = [&](Value* v, SmallVectorImpl<Value*>& inputs) {
+      inputs.clear();
+      if (PHINode* phi = dyn_cast<PHINode>(v)) {
+        unsigned NumPHIValues = phi->getNumIncomingValues();
+        assert( NumPHIValues > 0 && "zero input phis are illegal");
+        for (unsigned i = 0; i != NumPHIValues; ++i) {
+          inputs.push_back(findBaseOrBDV(phi->getIncomingValue(i), cache));
+        }
+      } else if (SelectInst* sel = dyn_cast<SelectInst>(v)) {
+        inputs.push_back(findBaseOrBDV(sel->getTrueValue(), cache));
+        inputs.push_back(findBaseOrBDV(sel->getFalseValue(), cache));
+      } else {
+        llvm_unreachable("no such state expected");
+      }
+    };
+
+    // Discover every phi & select reachable from the initial one.  Each is
+    // visited exactly once.
     states[def] = PhiState();
-    // Recursively fill in all phis & selects reachable from the initial one
-    // for which we don't already know a definite base value for
-    // PERF: Yes, this is as horribly inefficient as it looks.
-    bool done = false;
-    while (!done) {
-      done = true;
-      for(auto Pair : states) {
-        Value* v = Pair.first;
-        assert( !isKnownBaseResult(v) && "why did it get added?");
-        if (PHINode* phi = dyn_cast<PHINode>(v)) {
-          unsigned NumPHIValues = phi->getNumIncomingValues();
-          assert( NumPHIValues > 0 && "zero input phis are illegal");
-          for (unsigned i = 0; i != NumPHIValues; ++i) {
-            Value *InVal = phi->getIncomingValue(i);
-            Value *local = findBaseOrBDV(InVal, cache);
-            if (!isKnownBaseResult(local) &&
-                states.find(local) == states.end()) {
-              states[local] = PhiState();
-              done = false;
-            }
-          }
-        } else if (SelectInst* sel = dyn_cast<SelectInst>(v)) {
-          Value* local = findBaseOrBDV(sel->getTrueValue(), cache);
-          if (!isKnownBaseResult(local) &&
-              states.find(local) == states.end()) {
-            states[local] = PhiState();
-            done = false;
-          }
-          local = findBaseOrBDV(sel->getFalseValue(), cache);
-          if (!isKnownBaseResult(local) &&
-              states.find(local) == states.end()) {
-            states[local] = PhiState();
-            done = false;
-          }
+    order.push_back(def);
+    SmallVector<Value*, 4> inputs;
+    for (size_t i = 0; i < order.size(); i++) {
+      Value* v = order[i];
+      assert( !isKnownBaseResult(v) && "why did it get added?");
+      getInputBDVs(v, inputs);
+      for (Value* local : inputs) {
+        if (isKnownBaseResult(local)) {
+          continue;
+        }
+        if (states.insert(std::make_pair(local, PhiState())).second) {
+          order.push_back(local);
         }
+        dependents[local].push_back(v);
       }
     }
 
     if( TraceLSP ) {
       errs() << "States after initialization:\n";
-      for(auto Pair : states) {
-        Instruction* v = cast<Instruction>(Pair.first);
-        PhiState state = Pair.second;
+      for(Value* v : order) {
+        PhiState state = states[v];
         state.dump();
         v->dump();
       }
     }
 
-    
-
     // TODO: come back and revisit the state transitions around inputs which
     // have reached conflict state.  The current version seems too conservative.
 
-    bool progress = true;
-    size_t oldSize = 0;
-    while (progress) {
-      oldSize = states.size();
-      progress = false;
-      for(auto Pair : states) {
-        MeetPhiStates calculateMeet(states);
-        Value *v = Pair.first;
-        assert( !isKnownBaseResult(v) && "why did it get added?");
-        assert(isa<SelectInst>(v) || isa<PHINode>(v));
-        if (SelectInst *select = dyn_cast<SelectInst>(v)) {
-          calculateMeet.meetWith(findBaseOrBDV(select->getTrueValue(), cache));
-          calculateMeet.meetWith(findBaseOrBDV(select->getFalseValue(), cache));
-        } else if (PHINode *phi = dyn_cast<PHINode>(v)) {
-          for (unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
-            calculateMeet.meetWith(findBaseOrBDV(phi->getIncomingValue(i), cache));
-          }
-        } else {
-          llvm_unreachable("no such state expected");
-        }
+    // Run the optimistic algorithm with a worklist.  The lattice has height
+    // three, so each state changes at most twice and each change only
+    // requeues the states which read it.
+    SmallVector<Value*, 16> worklist(order.rbegin(), order.rend());
+    SmallPtrSet<Value*, 16> inWorklist(order.begin(), order.end());
+    while (!worklist.empty()) {
+      Value* v = worklist.pop_back_val();
+      inWorklist.erase(v);
+      assert(isa<SelectInst>(v) || isa<PHINode>(v));
+
+      MeetPhiStates calculateMeet(states);
+      getInputBDVs(v, inputs);
+      for (Value* local : inputs) {
+        calculateMeet.meetWith(local);
+      }
 
-        PhiState oldState = states[v];
-        PhiState newState = calculateMeet.getResult();
-        if (oldState != newState) {
-          progress = true;
-          states[v] = newState;
+      PhiState newState = calculateMeet.getResult();
+      if (states[v] == newState) {
+        continue;
+      }
+      states[v] = newState;
+      for (Value* user : dependents[v]) {
+        if (inWorklist.insert(user)) {
+          worklist.push_back(user);
         }
       }
-
-      assert(oldSize <= states.size());
-      assert(oldSize == states.size() || progress);
     }
 
     if( TraceLSP ) {
       errs() << "States after meet iteration:\n";
-      for(auto Pair : states) {
-        Instruction* v = cast<Instruction>(Pair.first);
-        PhiState state = Pair.second;
+      for(Value* v : order) {
+        PhiState state = states[v];
         state.dump();
         v->dump();
       }
     }
 
     // Insert Phis for all conflicts
-    for(auto Pair : states) {
-      Instruction* v = cast<Instruction>(Pair.first);
-      PhiState state = Pair.second;
+    for(Value* V : order) {
+      Instruction* v = cast<Instruction>(V);
+      PhiState state = states[v];
       assert( !isKnownBaseResult(v) && "why did it get added?");
       assert(!state.isUnknown() && "Optimistic algorithm didn't complete!");
       if (state.isConflict()) {
@@ -2282,9 +3554,9 @@ namespace {
     }
 
     // Fixup all the inputs of the new PHIs
-    for(auto Pair : states) {
-      Instruction* v = cast<Instruction>(Pair.first);
-      PhiState state = Pair.second;
+    for(Value* V : order) {
+      Instruction* v = cast<Instruction>(V);
+      PhiState state = states[v];
 
       assert( !isKnownBaseResult(v) && "why did it get added?");
       assert(!state.isUnknown() && "Optimistic algorithm didn't complete!");
@@ -2348,9 +3620,8 @@ namespace {
     // Cache all of our results so we can cheaply reuse them
     // NOTE: This is actually two caches: one of the base defining value
     // relation and one of the base pointer relation!  FIXME
-    for (auto item : states ) {
-      Value* v = item.first;
-      Value* base = item.second.getBase();
+    for (Value* v : order) {
+      Value* base = states[v].getBase();
       assert(v && base);
       assert( !isKnownBaseResult(v) && "why did it get added?");
 
@@ -2385,7 +3656,38 @@ void SafepointPlacementImpl::findBasePointers(
     std::map<llvm::Value*, llvm::Value*>& base_pairs,
     DominatorTree *DT, DefiningValueMapTy& DVCache,
     std::set<llvm::Value*>& newInsertedDefs) {
+  // The base phis and selects are created (and named) in the order the live
+  // values are visited, so visit them in program order rather than in the
+  // pointer order of the set: arguments first, then instructions by block
+  // (in function layout order) and position within the block.
+  DenseMap<const BasicBlock*, unsigned> BlockOrder;
+  std::vector<std::pair<std::pair<unsigned, unsigned>, Value*> > ordered;
+  ordered.reserve(live.size());
   for(Value* ptr : live) {
+    std::pair<unsigned, unsigned> key(0, 0);
+    if( Argument* A = dyn_cast<Argument>(ptr) ) {
+      key.second = A->getArgNo();
+    } else if( Instruction* I = dyn_cast<Instruction>(ptr) ) {
+      BasicBlock* BB = I->getParent();
+      if( BlockOrder.empty() ) {
+        unsigned N = 0;
+        for(BasicBlock& B : *BB->getParent()) {
+          BlockOrder[&B] = ++N;
+        }
+      }
+      key.first = BlockOrder[BB];
+      key.second = std::distance(BB->begin(), BasicBlock::iterator(I));
+    }
+    ordered.push_back(std::make_pair(key, ptr));
+  }
+  std::stable_sort(ordered.begin(), ordered.end(),
+                   [](const std::pair<std::pair<unsigned, unsigned>, Value*>& a,
+                      const std::pair<std::pair<unsigned, unsigned>, Value*>& b) {
+                     return a.first < b.first;
+                   });
+
+  for(auto& entry : ordered) {
+    Value* ptr = entry.second;
     Value *base = findBasePointer(ptr, DVCache, newInsertedDefs);
     assert( base && "failed to find base pointer");
     BUGPOINT_CLEAN_EXIT_IF(!isGCPointerType(base->getType()));
@@ -2399,50 +3701,6 @@ void SafepointPlacementImpl::findBasePointers(
   }
 }
 
-CallInst* SafepointPlacementImpl::findVMState(llvm::Instruction* term, DominatorTree *DT) {
-  // At this time, we look for a vmstate call dominating 'term'
-  // By construction, if there was one in the original IR generated by the
-  // frontend, a valid one is still available.  
-
-  BasicBlock::reverse_iterator I = term->getParent()->rbegin(), E = term->getParent()->rend();
-  // Find the BasicBlock::reverse_iterator pointing to term.  Is there a direct way to do this?
-  while (&*I != term && I != E) I++;
-  assert(I != E && "term not in it's own BasicBlock?!");
-
-  while (true) {
-    // We search [I, E) for a VM state instruction.
-    BasicBlock::reverse_iterator maybeVMSAnchor = I;
-    while (maybeVMSAnchor != E) {
-      if (isJVMStateAnchorInstruction(&*maybeVMSAnchor)) {
-        StoreInst* SI = cast<StoreInst>(&*maybeVMSAnchor);
-        return cast<CallInst>(SI->getValueOperand());
-      }
-      // a call that holds a vmstate at callsite also acts
-      // as a VMSAnchor
-      if (isa<CallInst>(&*maybeVMSAnchor)) {
-        CallInst* CI = cast<CallInst>(&*maybeVMSAnchor);
-        if (CI->getNumArgOperands() != 0 && isJVMState(CI->getArgOperand(0)))
-          return cast<CallInst>(CI->getArgOperand(0));
-      }
-      maybeVMSAnchor++;
-    }
-
-    // We couldn't find a VM state in the current BasicBlock, go to its
-    // immediate dominator.
-    BUGPOINT_CLEAN_EXIT_IF(!I->getParent());
-    BUGPOINT_CLEAN_EXIT_IF(!DT->getNode(I->getParent()));
-    BUGPOINT_CLEAN_EXIT_IF(!DT->getNode(I->getParent())->getIDom());
-    if( !DT->getNode(I->getParent())->getIDom() ) break; // and crash
-    BasicBlock *immediateDominator = DT->getNode(I->getParent())->getIDom()->getBlock();
-    BUGPOINT_CLEAN_EXIT_IF(!immediateDominator);
-    if (immediateDominator == nullptr) break; // and crash!
-
-    I = immediateDominator->rbegin();
-    E = immediateDominator->rend();
-  }
-
-  return nullptr;
-}
 
 namespace {
 
@@ -2460,6 +3718,8 @@ namespace {
       assert( invoke && "only continues over invokes!");
       assert( invoke->getNormalDest() == bounds.second->getParent() &&
               "safepoint can only continue into normal exit block");
+      assert( invoke->getNormalDest()->getUniquePredecessor() == BB &&
+              "relocations must not be reachable along other paths");
     }
   }
   
@@ -2524,7 +3784,7 @@ void SafepointPlacementImpl::CreateSafepoint(const CallSite& CS, /* to replace *
   IRBuilder<> Builder(insertBefore);
   // First, create the statepoint (with all live ptrs as arguments).
   std::vector<llvm::Value*> args;
-  // target, #args, flags, bci, #stack, #locals, #monitors
+  // target, #args, flags, #caller frames, bci, #stack, #locals, #monitors
   Value* Target = CS.getCalledValue();
   // if the call is restored, callee need to be cast to the original function type and the number of
   // argument should be decreased by 1 to skip the extra jvmstate
@@ -2535,14 +3795,16 @@ void SafepointPlacementImpl::CreateSafepoint(const CallSite& CS, /* to replace *
 
   IntegerType *i32Ty = Type::getInt32Ty(M->getContext());
 
+  // The slots of the vm state and of the frames it was inlined into
+  std::vector<Value*> vmStateSlots;
   if( jvmStateCall ) {
     // Bugpoint doesn't know these are special and tries to remove arguments
     BUGPOINT_CLEAN_EXIT_IF(jvmStateCall->getNumArgOperands() < JVMStateBase::headerEndOffset());
 
     JVMState jvmState(jvmStateCall);
 
-    // TODO flatten the callerVMState
-    args.push_back( ConstantInt::get( i32Ty, 0 ) );
+    int numCallerFrames = flattenVMState(jvmStateCall, vmStateSlots);
+    args.push_back( ConstantInt::get( i32Ty, numCallerFrames ) );
     args.push_back( ConstantInt::get( i32Ty, jvmState.bci() ) );
     args.push_back( ConstantInt::get( i32Ty, jvmState.numStackElements() ) );
     args.push_back( ConstantInt::get( i32Ty, jvmState.numLocals() ) );
@@ -2570,25 +3832,7 @@ void SafepointPlacementImpl::CreateSafepoint(const CallSite& CS, /* to replace *
     args.insert(args.end(), CS.arg_begin(), CS.arg_end());
   }
 
-  if( jvmStateCall ) {
-    JVMState jvmState(jvmStateCall);
-
-    for (int i = 0; i < jvmState.numStackElements(); i++) {
-      args.push_back(ConstantInt::get(
-          i32Ty, jvmState.stackElementTypeAt(i).coerceToInt()));
-      args.push_back(jvmState.stackElementAt(i));
-    }
-
-    for (int i = 0; i < jvmState.numLocals(); i++) {
-      args.push_back(ConstantInt::get(
-          i32Ty, jvmState.localTypeAt(i).coerceToInt()));
-      args.push_back(jvmState.localAt(i));
-    }
-
-    for (int i = 0; i < jvmState.numMonitors(); i++) {
-      args.push_back(jvmState.monitorAt(i));
-    }
-  }
+  args.insert(args.end(), vmStateSlots.begin(), vmStateSlots.end());
 
   // add all the pointers to be relocated (gc arguments)
   // Capture the start of the live variable list for use in the gc_relocates
@@ -2597,6 +3841,7 @@ void SafepointPlacementImpl::CreateSafepoint(const CallSite& CS, /* to replace *
 
   // Create the statepoint given all the arguments
   Instruction* token = nullptr;
+  Instruction* landingToken = nullptr;
   if( CS.isCall() ) {
     CallInst* toReplace = cast<CallInst>(CS.getInstruction());
     CallInst* call = Builder.CreateCall(gc_statepoint_decl, args, "safepoint_token");
@@ -2618,44 +3863,35 @@ void SafepointPlacementImpl::CreateSafepoint(const CallSite& CS, /* to replace *
   } else if( CS.isInvoke() ) {
     InvokeInst* toReplace = cast<InvokeInst>(CS.getInstruction());
 
-    // Insert a new basic block which will become the normal destination of our
-    // modified invoke.  This is needed since the original normal destinition
-    // can potentially be reachable along other paths.  
-    BasicBlock* normalDest = 
-      BasicBlock::Create(M->getContext(),
-                         "invoke_safepoint_normal_dest",
-                         F, toReplace->getNormalDest());
-    BranchInst::Create(toReplace->getNormalDest(), normalDest);
-
-    // Loop over any phi nodes in the original normal dest, update them to
-    // point to the newly inserted block rather than the invoke BB.  
-    /* scope */ {
-      PHINode *PN = nullptr;
-      for (BasicBlock::iterator II = toReplace->getNormalDest()->begin();
-           (PN = dyn_cast<PHINode>(II)); ++II) {
-        int IDX = PN->getBasicBlockIndex(toReplace->getParent());
-        while (IDX != -1) {
-          PN->setIncomingBlock((unsigned)IDX, normalDest);
-          IDX = PN->getBasicBlockIndex(toReplace->getParent());
-        }
-      }
-    }
-
-    // TODO: since we're inserting basic blocks, do we need to update either DT
-    // or LI? Or stop claiming to preserveCFG?
+    // The normal and unwind destinations were given the invoke as their only
+    // predecessor up front (see normalizeInvokeParsePoints), so the
+    // relocations placed in them apply to exactly this safepoint.
+    BasicBlock* normalDest = toReplace->getNormalDest();
+    BasicBlock* unwindDest = toReplace->getUnwindDest();
+    assert( normalDest->getUniquePredecessor() == BB &&
+            unwindDest->getUniquePredecessor() == BB &&
+            "invoke destinations must be normalized");
 
     // Insert the new invoke into the old block.  We'll remove the old one in a
     // moment at which point this will become the new terminator for the
     // original block.
     InvokeInst* invoke = Builder.CreateInvoke(gc_statepoint_decl,
                                               normalDest,
-                                              toReplace->getUnwindDest(),
+                                              unwindDest,
                                               args); 
     invoke->setCallingConv(toReplace->getCallingConv());
     // I believe this copies both param and function attributes - TODO: test
     invoke->setAttributes(toReplace->getAttributes());
     token = invoke;
 
+    // The invoke doesn't dominate its unwind destination, so the relocations
+    // along the exceptional edge hang off a gc_landing_token instead.
+    IRBuilder<> UnwindBuilder(unwindDest->getFirstInsertionPt());
+    UnwindBuilder.SetCurrentDebugLocation(toReplace->getDebugLoc());
+    landingToken = UnwindBuilder.CreateCall(
+      Intrinsic::getDeclaration(M, Intrinsic::gc_landing_token),
+      "landing_token");
+
     // Put all the gc_result and gc_return value calls into the normal control
     // flow block
     Instruction* IP = &*(normalDest->getFirstInsertionPt());
@@ -2693,55 +3929,151 @@ void SafepointPlacementImpl::CreateSafepoint(const CallSite& CS, /* to replace *
   }
   result.result = gc_result;
 
-  // Second, create a gc.relocate for every live variable
-  std::vector<llvm::Instruction*> newDefs;
-  for(unsigned i = 0; i < liveVariables.size(); i++) {
-    // We generate a (potentially) unique declaration for every pointer type
-    // combination.  This results is some blow up the function declarations in
-    // the IR, but removes the need for argument bitcasts which shrinks the IR
-    // greatly and makes it much more readable.
-    vector<Type*> types; //one per 'any' type
-    types.push_back( liveVariables[i]->getType() ); //result type
-    Value* gc_relocate_decl = Intrinsic::getDeclaration(M, Intrinsic::gc_relocate, types);
-
-    // Generate the gc.relocate call and save the result
-    vector<Value*> args;
-    args.push_back( token );
-    args.push_back( ConstantInt::get( Type::getInt32Ty(M->getContext()), live_start + find_index(liveVariables, basePtrs[i])) );
-    args.push_back( ConstantInt::get( Type::getInt32Ty(M->getContext()), live_start + find_index(liveVariables, liveVariables[i])) );
-    // only specify a debug name if we can give a useful one
-    Value* reloc = Builder.CreateCall(gc_relocate_decl, args, liveVariables[i]->hasName() ? liveVariables[i]->getName() + ".relocated" : "");
-    // Trick CodeGen into thinking there are lots of free registers at this
-    // fake call.  
-    cast<CallInst>(reloc)->setCallingConv(CallingConv::Cold);
-
-    newDefs.push_back( cast<Instruction>(reloc) );
-  }
-  assert( newDefs.size() == liveVariables.size() && "missing or extra redefinition at safepoint");
-
-  // PERF: Using vectors where array literals and reserves would be better.
+  // Second, create a gc.relocate for every live variable.  Returns the last
+  // one created, if any.
+  auto createRelocates = [&](IRBuilder<>& Builder, Instruction* token) {
+    Instruction* last = nullptr;
+    for(unsigned i = 0; i < liveVariables.size(); i++) {
+      // We generate a (potentially) unique declaration for every pointer type
+      // combination.  This results is some blow up the function declarations in
+      // the IR, but removes the need for argument bitcasts which shrinks the IR
+      // greatly and makes it much more readable.
+      vector<Type*> types; //one per 'any' type
+      types.push_back( liveVariables[i]->getType() ); //result type
+      Value* gc_relocate_decl = Intrinsic::getDeclaration(M, Intrinsic::gc_relocate, types);
+
+      // Generate the gc.relocate call and save the result
+      vector<Value*> args;
+      args.push_back( token );
+      args.push_back( ConstantInt::get( Type::getInt32Ty(M->getContext()), live_start + find_index(liveVariables, basePtrs[i])) );
+      args.push_back( ConstantInt::get( Type::getInt32Ty(M->getContext()), live_start + find_index(liveVariables, liveVariables[i])) );
+      // only specify a debug name if we can give a useful one
+      CallInst* reloc = Builder.CreateCall(gc_relocate_decl, args, liveVariables[i]->hasName() ? liveVariables[i]->getName() + ".relocated" : "");
+      // Trick CodeGen into thinking there are lots of free registers at this
+      // fake call.  
+      reloc->setCallingConv(CallingConv::Cold);
+      last = reloc;
+    }
+    return last;
+  };
 
   // Need to pass through the last part of the safepoint block so that we
   // don't accidentally update uses in a following gc.relocate which is
   // still conceptually part of the same safepoint.  Gah.
-  Instruction* last = nullptr;
-  if( !newDefs.empty() ) {
-    last = newDefs.back();
-  } else if( gc_result ) {
-    last = gc_result;
-  } else {
-    last = token;
+  Instruction* last = createRelocates(Builder, token);
+  if( !last ) {
+    last = gc_result ? gc_result : token;
   }
   assert(last && "can't be null");
   const std::pair<Instruction*, Instruction*> bounds =
     make_pair( token, last);
 
+  if( landingToken ) {
+    BasicBlock::iterator next(landingToken);
+    next++;
+    IRBuilder<> UnwindBuilder(&*next);
+    UnwindBuilder.SetCurrentDebugLocation(landingToken->getDebugLoc());
+    Instruction* unwindLast = createRelocates(UnwindBuilder, landingToken);
+    result.unwindSafepoint =
+      make_pair( landingToken, unwindLast ? unwindLast : landingToken );
+  }
+
   // Sanity check our results - this is slightly non-trivial due to invokes
   VerifySafepointBounds(bounds);
 
   result.safepoint = bounds;
 }
 
+bool SafepointPlacementImpl::findRematerializationChain(Value* derived, Value* base,
+                                                        SmallVectorImpl<Instruction*>& chain,
+                                                        const TargetTransformInfo& TTI) {
+  // Only geps with constant indices are considered.  A variable index would
+  // have to stay live across the safepoint to recompute derived afterwards,
+  // which costs at least the register or stack slot the relocation saves.
+  unsigned cost = 0;
+  Value* current = derived;
+  while( current != base ) {
+    Instruction* inst = nullptr;
+    if( GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(current) ) {
+      if( !GEP->hasAllConstantIndices() ) {
+        return false;
+      }
+      inst = GEP;
+      current = GEP->getPointerOperand();
+    } else if( BitCastInst* BC = dyn_cast<BitCastInst>(current) ) {
+      inst = BC;
+      current = BC->getOperand(0);
+    } else {
+      return false;
+    }
+    cost += TTI.getUserCost(inst);
+    if( cost > RematerializationThreshold ) {
+      return false;
+    }
+    chain.push_back(inst);
+  }
+  return true;
+}
+
+void SafepointPlacementImpl::rematerializeDerivedPointers(
+    const std::vector<std::pair<Value*, SmallVector<Instruction*, 4> > >& remat,
+    PartiallyConstructedSafepointRecord& result) {
+  Instruction* statepoint = result.safepoint.first;
+  rematerializeDerivedPointers(remat, statepoint, result.safepoint,
+                               result.rematerialized);
+  if( result.unwindSafepoint.first ) {
+    rematerializeDerivedPointers(remat, statepoint, result.unwindSafepoint,
+                                 result.unwindRematerialized);
+  }
+  NumRematerialized += remat.size();
+}
+
+void SafepointPlacementImpl::rematerializeDerivedPointers(
+    const std::vector<std::pair<Value*, SmallVector<Instruction*, 4> > >& remat,
+    Instruction* statepoint,
+    const std::pair<Instruction*, Instruction*>& bounds,
+    std::vector<std::pair<Value*, Instruction*> >& rematerialized) {
+  DenseMap<Value*, Value*> relocated;
+  for(auto& Pair : remat) {
+    relocated[Pair.second.back()->getOperand(0)] = nullptr;
+  }
+  // The relocated values are read from the arguments of the new statepoint
+  // directly.  The original invoke is still in the block at this point, so a
+  // gc_landing_token can't yet be mapped back to the statepoint it stands in
+  // for.
+  ImmutableCallSite SP(statepoint);
+  for(User* U : bounds.first->users()) {
+    IntrinsicInst* use = cast<IntrinsicInst>(U);
+    if( use->getIntrinsicID() == Intrinsic::gc_relocate ) {
+      GCRelocateOperands relocate(use);
+      Value* def = *(SP.arg_begin() + relocate.derivedPtrIndex());
+      if( relocated.count(def) ) {
+        relocated[def] = use;
+      }
+    }
+  }
+
+  Instruction* insertAfter = bounds.second;
+  for(auto& Pair : remat) {
+    Value* derived = Pair.first;
+    const SmallVector<Instruction*, 4>& chain = Pair.second;
+    Value* current = relocated[chain.back()->getOperand(0)];
+    assert( current && "the base must be relocated by this safepoint");
+    for(auto itr = chain.rbegin(), end = chain.rend(); itr != end; itr++) {
+      Instruction* clone = (*itr)->clone();
+      clone->setOperand(0, current);
+      if( (*itr)->hasName() ) {
+        clone->setName((*itr)->getName() + ".remat");
+      }
+      clone->insertAfter(insertAfter);
+      insertAfter = clone;
+      current = clone;
+    }
+    rematerialized.push_back(std::make_pair(derived,
+                                            cast<Instruction>(current)));
+  }
+}
+
 void SafepointPlacementImpl::relocationViaAlloca(Function& F, DominatorTree& DT, const std::vector<Value*>& live, const std::vector<struct PartiallyConstructedSafepointRecord>& records) {
 #ifndef NDEBUG
   int initialAllocaNum = 0;
@@ -2780,34 +4112,47 @@ void SafepointPlacementImpl::relocationViaAlloca(Function& F, DominatorTree& DT,
   for (size_t i = 0; i < records.size(); i++) {
     const struct PartiallyConstructedSafepointRecord& info = records[i];
 
-    // PERF: Scan through the gc_relocates once per safepoint, not once per
-    // live value per safepoint.  This has a largish impact on performance
+    // An invoke is handled like two safepoints, one along each edge.
+    typedef std::pair<Instruction*, Instruction*> BoundsTy;
+    const BoundsTy* edges[] = { &info.safepoint, &info.unwindSafepoint };
+    for(const BoundsTy* bounds : edges) {
+      if( !bounds->first ) {
+        continue;
+      }
 
-    DenseMap<Value*, Value*> relocations;
-    for(auto Pair : allocaMap) {
-      Value* def = Pair.first;
-      relocations[def] = nullptr;
-    }
-    findRelocateValuesAtSP(info.safepoint.first, relocations);
+      // PERF: Scan through the gc_relocates once per safepoint, not once per
+      // live value per safepoint.  This has a largish impact on performance
 
-    for(auto Pair : relocations) {
-      Value* def = Pair.first;    
-      Value* relocatedValue = Pair.second;
-      assert( allocaMap.count(def) );
-      Value* alloca = allocaMap[def];
+      DenseMap<Value*, Value*> relocations;
+      for(auto Pair : allocaMap) {
+        Value* def = Pair.first;
+        relocations[def] = nullptr;
+      }
+      findRelocateValuesAtSP(bounds->first, relocations);
+      for(auto Pair : bounds == &info.safepoint ? info.rematerialized
+                                                 : info.unwindRematerialized) {
+        relocations[Pair.first] = Pair.second;
+      }
 
-      if( relocatedValue ) {
-        // this is a gc_relocate
-        StoreInst* store = new StoreInst(relocatedValue, alloca);
-        store->insertAfter(cast<Instruction>(relocatedValue));
-      } else if( def == info.result ) {
-        // gc_results must be handled like all original defs below
-      } else {
-        // a value not relocated by this safepoint is unused.  We store
-        // null in this case.
-        Constant* CPN = ConstantPointerNull::get(cast<PointerType>(def->getType()));
-        StoreInst* store = new StoreInst(CPN, alloca);
-        store->insertAfter(info.safepoint.second);
+      for(auto Pair : relocations) {
+        Value* def = Pair.first;    
+        Value* relocatedValue = Pair.second;
+        assert( allocaMap.count(def) );
+        Value* alloca = allocaMap[def];
+
+        if( relocatedValue ) {
+          // this is a gc_relocate
+          StoreInst* store = new StoreInst(relocatedValue, alloca);
+          store->insertAfter(cast<Instruction>(relocatedValue));
+        } else if( def == info.result ) {
+          // gc_results must be handled like all original defs below
+        } else {
+          // a value not relocated by this safepoint is unused.  We store
+          // null in this case.
+          Constant* CPN = ConstantPointerNull::get(cast<PointerType>(def->getType()));
+          StoreInst* store = new StoreInst(CPN, alloca);
+          store->insertAfter(bounds->second);
+        }
       }
     }
   }
@@ -2822,7 +4167,12 @@ void SafepointPlacementImpl::relocationViaAlloca(Function& F, DominatorTree& DT,
     // PERF: trade a linear scan for repeated reallocation
     uses.reserve(std::distance(def->user_begin(), def->user_end()));
     for(User* U : def->users()) {
-      uses.push_back(cast<Instruction>(U));
+      // Skip the constant expression users of a global and its uses in
+      // other functions, as relocationViaSSA does.
+      Instruction* use = dyn_cast<Instruction>(U);
+      if( use && use->getParent()->getParent() == &F ) {
+        uses.push_back(use);
+      }
     }
 
     std::sort(uses.begin(), uses.end());
@@ -2860,6 +4210,7 @@ void SafepointPlacementImpl::relocationViaAlloca(Function& F, DominatorTree& DT,
   assert(PromotableAllocas.size() == live.size() && "we must have the same allocas with lives");
   if (!PromotableAllocas.empty()) {
     // apply mem2reg to promote alloca to SSA
+    NamedRegionTimer T("mem2reg", TimerGroupName, TimePassesIsEnabled);
     PromoteMemToReg(PromotableAllocas, DT);
   }
 
@@ -2873,3 +4224,122 @@ void SafepointPlacementImpl::relocationViaAlloca(Function& F, DominatorTree& DT,
 #endif
 }
 
+void SafepointPlacementImpl::relocationViaSSA(Function& F,
+                                              const std::vector<Value*>& live,
+                                              const std::vector<struct PartiallyConstructedSafepointRecord>& records) {
+  // Find all the relocations of each live value with one scan over the uses
+  // of each statepoint.  Within a safepoint, the gc_relocates are in
+  // program order.
+  DenseMap<Value*, SmallVector<Instruction*, 4> > relocations;
+  for(size_t i = 0; i < records.size(); i++) {
+    const struct PartiallyConstructedSafepointRecord& info = records[i];
+    // An invoke relocates along its exceptional edge as well
+    Instruction* tokens[] = { info.safepoint.first, info.unwindSafepoint.first };
+    for(Instruction* token : tokens) {
+      if( !token ) {
+        continue;
+      }
+      for(User* U : token->users()) {
+        IntrinsicInst* use = cast<IntrinsicInst>(U);
+        // can be a gc_result use as well, we should ignore that
+        if( use->getIntrinsicID() == Intrinsic::gc_relocate ) {
+          GCRelocateOperands relocate(use);
+          Value* def = const_cast<Value*>(relocate.derivedPtr());
+          relocations[def].push_back(use);
+        }
+      }
+    }
+    for(auto Pair : info.rematerialized) {
+      relocations[Pair.first].push_back(Pair.second);
+    }
+    for(auto Pair : info.unwindRematerialized) {
+      relocations[Pair.first].push_back(Pair.second);
+    }
+  }
+
+  BasicBlock* entry = &F.getEntryBlock();
+  SmallVector<PHINode*, 16> insertedPHIs;
+  SSAUpdater updater(&insertedPHIs);
+  for(Value* def : live) {
+    // Relocating a constant (i.e. null) yields the same constant.  There's
+    // nothing to rewrite.
+    if( isa<Constant>(def) && !isa<GlobalValue>(def) ) {
+      continue;
+    }
+    assert( relocations.count(def) && "every gc argument is relocated");
+
+    // The definitions of def grouped by block.  Values which aren't
+    // instructions are defined on entry to the function.
+    DenseMap<BasicBlock*, SmallVector<Value*, 2> > defsInBlock;
+    SmallVector<BasicBlock*, 8> defBlocks;
+    auto addDef = [&](BasicBlock* BB, Value* V) {
+      SmallVector<Value*, 2>& defs = defsInBlock[BB];
+      if( defs.empty() ) {
+        defBlocks.push_back(BB);
+      }
+      defs.push_back(V);
+    };
+    if( Instruction* I = dyn_cast<Instruction>(def) ) {
+      addDef(I->getParent(), I);
+    } else {
+      addDef(entry, def);
+    }
+    for(Instruction* reloc : relocations[def]) {
+      addDef(reloc->getParent(), reloc);
+    }
+
+    // For uses in a block which also contains a definition, find the
+    // definition reaching the use with a single walk over the block.  A
+    // nullptr means the value live into the block reaches the use.  The
+    // definition live out of the block is the last one seen by the walk.
+    updater.Initialize(def->getType(), def->hasName() ? def->getName() : "");
+    DenseMap<Instruction*, Value*> reachingInBlock;
+    for(BasicBlock* BB : defBlocks) {
+      SmallPtrSet<Value*, 4> defs(defsInBlock[BB].begin(), defsInBlock[BB].end());
+      Value* current = (BB == entry && !isa<Instruction>(def)) ? def : nullptr;
+      for(Instruction& I : *BB) {
+        if( !isa<PHINode>(I) &&
+            std::find(I.op_begin(), I.op_end(), def) != I.op_end() ) {
+          reachingInBlock[&I] = current;
+        }
+        if( defs.count(&I) ) {
+          current = &I;
+        }
+      }
+      assert( current && "a definition must be in the block");
+      updater.AddAvailableValue(BB, current);
+    }
+
+    // Capture the uses before we start rewriting them.  A global can also
+    // be used by constant expressions (and by other functions); those don't
+    // refer to a particular definition and are left alone.
+    SmallVector<Use*, 16> uses;
+    for(Use& U : def->uses()) {
+      Instruction* user = dyn_cast<Instruction>(U.getUser());
+      if( user && user->getParent()->getParent() == &F ) {
+        uses.push_back(&U);
+      }
+    }
+
+    for(Use* U : uses) {
+      Instruction* user = cast<Instruction>(U->getUser());
+      Value* reaching = nullptr;
+      if( PHINode* phi = dyn_cast<PHINode>(user) ) {
+        reaching = updater.GetValueAtEndOfBlock(phi->getIncomingBlock(*U));
+      } else {
+        DenseMap<Instruction*, Value*>::iterator itr = reachingInBlock.find(user);
+        if( itr != reachingInBlock.end() && itr->second ) {
+          reaching = itr->second;
+        } else {
+          reaching = updater.GetValueInMiddleOfBlock(user->getParent());
+        }
+      }
+      assert( reaching && "must find a reaching definition");
+      if( reaching != def ) {
+        U->set(reaching);
+      }
+    }
+  }
+
+  NumRelocationPHIs += insertedPHIs.size();
+}
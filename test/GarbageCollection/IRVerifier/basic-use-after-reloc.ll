@@ -1,4 +1,5 @@
 ; RUN: opt -safepoint-ir-verifier-print-only -verify-safepoint-ir -S %s 2>&1 | FileCheck %s
+; RUN: opt -safepoint-ir-verifier-print-only -verify-safepoint-ir-each -instcombine -S %s 2>&1 | FileCheck %s
 
 ; This test is very simple.  It just checks that if a value is
 ; used immediately after a safepoint without using the relocated
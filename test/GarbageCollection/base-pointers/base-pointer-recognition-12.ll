@@ -0,0 +1,33 @@
+; RUN: llvm-link %s %p/../Inputs/lsp-library.ll -S | opt -spp-no-entry -spp-no-call -place-safepoints -spp-print-base-pointers -spp-all-functions -S 2>&1 | FileCheck %s
+
+; A cycle of phis spanning a loop nest which all derive from one base must
+; not need any base phis, even though the phis feed each other.
+; CHECK-LABEL: Base Pairs (w/o Relocation):
+; CHECK-NOT: base_phi
+; CHECK: derived %inner_cur base %obj
+; CHECK-NOT: base_phi
+; CHECK-LABEL: Base Pairs: (w/Relocation)
+
+declare i1 @runtime_value()
+
+define void @nested_same_base(i64* %obj) {
+entry:
+  br label %outer
+
+outer:
+  %outer_cur = phi i64* [ %obj, %entry ], [ %inner_cur, %outer_latch ]
+  br label %inner
+
+inner:
+  %inner_cur = phi i64* [ %outer_cur, %outer ], [ %inner_next, %inner ]
+  %inner_next = getelementptr i64* %inner_cur, i32 1
+  %c1 = call i1 @runtime_value()
+  br i1 %c1, label %inner, label %outer_latch
+
+outer_latch:
+  %c2 = call i1 @runtime_value()
+  br i1 %c2, label %outer, label %exit
+
+exit:
+  ret void
+}
@@ -0,0 +1,61 @@
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc | FileCheck %s -check-prefix=STACK
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -statepoint-max-gc-regs=2 -verify-machineinstrs | FileCheck %s -check-prefix=REGS
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -statepoint-max-gc-regs=1 -verify-machineinstrs | FileCheck %s -check-prefix=MIXED
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -statepoint-max-gc-regs=8 -verify-machineinstrs | FileCheck %s -check-prefix=FOLD
+
+declare void @foo()
+
+define i64 addrspace(1)* @test(i64 addrspace(1)* %a, i64 addrspace(1)* %b) {
+entry:
+  call void @foo()
+; By default every gc pointer is spilled across the statepoint.
+; STACK: #STATEPOINT <Constant 0>, {{.*}}, <Indirect RSP + {{[0-9]+}}>, <Indirect RSP + {{[0-9]+}}>, <Indirect RSP + {{[0-9]+}}>, <Indirect RSP + {{[0-9]+}}>,
+; STACK-NOT: Register
+
+; With enough budget both stay in callee saved registers and nothing is
+; spilled around the call.
+; REGS-NOT: Spill
+; REGS: callq foo
+; REGS: #STATEPOINT <Constant 0>, {{.*}}, <Register [[R1:[A-Z0-9]+]]>, <Register [[R1]]>, <Register [[R2:[A-Z0-9]+]]>, <Register [[R2]]>,
+; REGS-NOT: Indirect
+; REGS-NOT: Reload
+
+; Pointers beyond the budget keep their stack slots.
+; MIXED: #STATEPOINT <Constant 0>, {{.*}}, <Register [[R:[A-Z0-9]+]]>, <Register [[R]]>, <Indirect RSP + {{[0-9]+}}>, <Indirect RSP + {{[0-9]+}}>,
+  %x = load i64 addrspace(1)* %a
+  %p = getelementptr i64 addrspace(1)* %b, i64 %x
+  ret i64 addrspace(1)* %p
+}
+
+; More gc pointers than callee saved registers: the register allocator folds
+; the ones it cannot keep back into stack slots.
+define i64 @pressure(i64 addrspace(1)* %p0, i64 addrspace(1)* %p1, i64 addrspace(1)* %p2, i64 addrspace(1)* %p3, i64 addrspace(1)* %p4, i64 addrspace(1)* %p5, i64 addrspace(1)* %p6, i64 addrspace(1)* %p7) {
+entry:
+  call void @foo()
+; REGS-LABEL: pressure:
+; REGS: #STATEPOINT <Constant 0>, {{.*}}<Register
+; MIXED-LABEL: pressure:
+; MIXED: #STATEPOINT <Constant 0>, {{.*}}<Indirect
+
+; All eight fit the budget, but there are only six callee saved registers.
+; Some stay in registers and the rest are folded into Indirect locations.
+; FOLD-LABEL: pressure:
+; FOLD: <def,tied> = STATEPOINT {{.*}}, 1, 8, %RSP, {{[0-9]+}},
+; FOLD: #STATEPOINT <Constant 0>, <Constant 0>, <Constant -1>, <Constant 0>, <Constant 0>, <Constant 0>, {{(<(Register [A-Z0-9]+|Indirect RSP \+ [0-9]+)>, ){16}$}}
+  %v0 = load i64 addrspace(1)* %p0
+  %v1 = load i64 addrspace(1)* %p1
+  %v2 = load i64 addrspace(1)* %p2
+  %v3 = load i64 addrspace(1)* %p3
+  %v4 = load i64 addrspace(1)* %p4
+  %v5 = load i64 addrspace(1)* %p5
+  %v6 = load i64 addrspace(1)* %p6
+  %v7 = load i64 addrspace(1)* %p7
+  %s0 = add i64 %v0, %v1
+  %s1 = add i64 %s0, %v2
+  %s2 = add i64 %s1, %v3
+  %s3 = add i64 %s2, %v4
+  %s4 = add i64 %s3, %v5
+  %s5 = add i64 %s4, %v6
+  %s6 = add i64 %s5, %v7
+  ret i64 %s6
+}
@@ -0,0 +1,104 @@
+; RUN: llvm-link %s %p/Inputs/lsp-library.ll -S | opt -infer-gc-leaf -S | FileCheck %s -check-prefix=ATTRS
+; RUN: llvm-link %s %p/Inputs/lsp-library.ll -S | opt -infer-gc-leaf -place-safepoints -spp-all-functions -S | FileCheck %s
+
+; Functions which can never reach a safepoint are marked gc-leaf-inferred, and
+; calls to them are then placed like calls to gc-leaf-function ones.
+
+declare void @runtime_alloc()
+declare i32 @runtime_hash(i8 addrspace(1)*) "gc-leaf-function"="true"
+declare double @llvm.sqrt.f64(double)
+
+; ATTRS: define i32 @leaf(i8 addrspace(1)* %obj, double %d) #[[INFERRED:[0-9]+]]
+define i32 @leaf(i8 addrspace(1)* %obj, double %d) {
+; CHECK-LABEL: @leaf
+; CHECK-NOT: @do_safepoint
+; CHECK: ret i32
+entry:
+  %s = call double @llvm.sqrt.f64(double %d)
+  %h = call i32 @runtime_hash(i8 addrspace(1)* %obj)
+  br i1 undef, label %a, label %b
+
+a:
+  br label %b
+
+b:
+  ret i32 %h
+}
+
+; Calls to inferred leaves count too.
+; ATTRS: define i32 @calls_leaf(i8 addrspace(1)* %obj) #[[INFERRED]]
+define i32 @calls_leaf(i8 addrspace(1)* %obj) {
+entry:
+  %r = call i32 @leaf(i8 addrspace(1)* %obj, double 1.0)
+  ret i32 %r
+}
+
+; ATTRS: define void @allocates() {
+define void @allocates() {
+entry:
+  call void @runtime_alloc()
+  ret void
+}
+
+; ATTRS: define void @loops(i32 %n) {
+define void @loops(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; ATTRS: define i32 @recursive(i32 %n) {
+define i32 @recursive(i32 %n) {
+entry:
+  %c = icmp eq i32 %n, 0
+  br i1 %c, label %done, label %recurse
+
+recurse:
+  %m = sub i32 %n, 1
+  %r = call i32 @recursive(i32 %m)
+  ret i32 %r
+
+done:
+  ret i32 0
+}
+
+; ATTRS: define void @indirect(void ()* %f) {
+define void @indirect(void ()* %f) {
+entry:
+  call void %f()
+  ret void
+}
+
+; ATTRS: define weak i32 @overridable() {
+define weak i32 @overridable() {
+entry:
+  ret i32 0
+}
+
+; The call to @calls_leaf stays a plain call; only @allocates and the entry
+; poll need statepoints.
+define i8 addrspace(1)* @test(i8 addrspace(1)* %obj) {
+; CHECK-LABEL: @test
+; CHECK: entry:
+; CHECK-NEXT: %r = call i32 @calls_leaf(i8 addrspace(1)* %obj)
+; CHECK-NEXT: call i32 {{.*}}@llvm.statepoint.p0f_isVoidf(void ()* @allocates
+; CHECK-NEXT: %obj.relocated2 = call coldcc i8 addrspace(1)*
+; CHECK-NEXT: call i32 {{.*}}@llvm.statepoint.p0f_isVoidf(void ()* @do_safepoint
+; CHECK-NEXT: %obj.relocated = call coldcc i8 addrspace(1)*
+; CHECK-NEXT: ret i8 addrspace(1)* %obj.relocated
+entry:
+  %r = call i32 @calls_leaf(i8 addrspace(1)* %obj)
+  call void @allocates()
+  ret i8 addrspace(1)* %obj
+}
+
+; ATTRS-NOT: gc.safepoint_poll{{.*}}#[[INFERRED]]
+; ATTRS: attributes #[[INFERRED]] = { "gc-leaf-inferred"="true" }
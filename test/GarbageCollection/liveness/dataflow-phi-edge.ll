@@ -0,0 +1,36 @@
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-print-liveset -spp-all-functions -S 2>&1 | FileCheck %s
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -stats -S 2>&1 | FileCheck %s -check-prefix=STATS
+; REQUIRES: asserts
+
+; A value used only by a phi is live along the incoming edge for that phi,
+; not on every edge into the block containing the phi.  %left_only must not
+; be live at the call on the right path.
+; CHECK: Live Variables:
+; CHECK-NEXT: merged_input
+; CHECK-NOT: left_only
+; CHECK: Live Variables:
+
+; STATS: gc pointer values tracked by liveness
+
+%jObject = type { [8 x i8] }
+
+declare void @some_call(%jObject addrspace(1)*)
+declare void @other_call()
+
+define %jObject addrspace(1)* @test(%jObject addrspace(1)* %merged_input, i1 %c) {
+entry:
+  %left_only = getelementptr %jObject addrspace(1)* %merged_input, i64 1
+  br i1 %c, label %left, label %right
+
+right:
+  call void @some_call(%jObject addrspace(1)* %merged_input)
+  br label %merge
+
+left:
+  br label %merge
+
+merge:
+  %merged = phi %jObject addrspace(1)* [ %left_only, %left ], [ %merged_input, %right ]
+  call void @other_call()
+  ret %jObject addrspace(1)* %merged
+}
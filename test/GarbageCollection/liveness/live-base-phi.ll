@@ -1,4 +1,5 @@
 ; RUN:  opt %s -place-safepoints -S
+; RUN:  opt %s -place-safepoints -spp-verify-ir-level=3 -S
 
 %jNotAtSP = type { [8 x i8] }
 %jObject = type { [8 x i8] }
@@ -0,0 +1,41 @@
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived -spp-stats-yaml=- -disable-output | FileCheck %s
+
+; A YAML document summarizes each function which got safepoints.  Functions
+; without any are skipped.
+
+declare void @foo()
+
+; CHECK: ---
+; CHECK-NEXT: function: test
+; CHECK-NEXT: polls: 0
+; CHECK-NEXT: statepoints: 3
+; CHECK-NEXT: relocates: 4
+; CHECK-NEXT: rematerialized: 1
+; CHECK-NEXT: live-set-sizes:
+; CHECK-NEXT: - size: 1
+; CHECK-NEXT: count: 1
+; CHECK-NEXT: - size: 2
+; CHECK-NEXT: count: 2
+; CHECK-NEXT: relocate-counts:
+; CHECK-NEXT: - size: 1
+; CHECK-NEXT: count: 2
+; CHECK-NEXT: - size: 2
+; CHECK-NEXT: count: 1
+; CHECK-NOT: function: no_safepoints
+; CHECK: ...
+define i64 addrspace(1)* @test(i64 addrspace(1)* %a, i64 addrspace(1)* %b) {
+entry:
+  call void @foo()
+  store i64 1, i64 addrspace(1)* %b
+  %field = getelementptr i64 addrspace(1)* %a, i64 1
+  call void @foo()
+  store i64 0, i64 addrspace(1)* %field
+  call void @foo()
+  ret i64 addrspace(1)* %a
+}
+
+define void @no_safepoints(i64 addrspace(1)* %a) {
+entry:
+  store i64 0, i64 addrspace(1)* %a
+  ret void
+}
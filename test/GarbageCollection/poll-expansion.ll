@@ -0,0 +1,63 @@
+; RUN: opt %s -S -place-safepoints -spp-no-call -spp-use-vm-state=false -spp-verify-ir-level=3 | FileCheck %s
+
+; Each poll gets a copy of the poll body in place, laid out as if it had been
+; inlined.  The dominator tree is updated as the copies go in, which
+; -spp-verify-ir-level=3 checks after every poll.
+
+@flag = global i1 false
+
+declare void @do_safepoint()
+
+define void @gc.safepoint_poll() {
+entry:
+  %c = load volatile i1* @flag
+  br i1 %c, label %slow, label %fast
+
+slow:
+  tail call void @do_safepoint()
+  ret void
+
+fast:
+  ret void
+}
+
+define void @test(i32 %n) #0 {
+; CHECK-LABEL: @test
+; CHECK: entry:
+; CHECK-NEXT: %c.i5 = load volatile i1* @flag
+; CHECK-NEXT: br i1 %c.i5, label %slow.i6, label %fast.i7
+; CHECK: slow.i6:
+; CHECK-NEXT: call i32 {{.*}}@llvm.statepoint.p0f_isVoidf(void ()* @do_safepoint
+; CHECK-NEXT: br label %gc.safepoint_poll.exit8
+; CHECK: fast.i7:
+; CHECK-NEXT: br label %gc.safepoint_poll.exit8
+; CHECK: gc.safepoint_poll.exit8:
+; CHECK-NEXT: br label %first
+entry:
+  br label %first
+
+; CHECK: first:
+; CHECK: br i1 %c.i1, label %slow.i2, label %fast.i3
+; CHECK: gc.safepoint_poll.exit4:
+; CHECK-NEXT: br i1 %first.c, label %first, label %second.preheader
+first:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %first ]
+  %i.next = add i32 %i, 1
+  %first.c = icmp slt i32 %i.next, %n
+  br i1 %first.c, label %first, label %second
+
+; CHECK: second:
+; CHECK: br i1 %c.i, label %slow.i, label %fast.i
+; CHECK: gc.safepoint_poll.exit:
+; CHECK-NEXT: br i1 %second.c, label %second, label %exit
+second:
+  %j = phi i32 [ 0, %first ], [ %j.next, %second ]
+  %j.next = add i32 %j, 1
+  %second.c = icmp slt i32 %j.next, %n
+  br i1 %second.c, label %second, label %exit
+
+exit:
+  ret void
+}
+
+attributes #0 = { "gc-add-backedge-safepoints"="true" "gc-add-entry-safepoints"="true" }
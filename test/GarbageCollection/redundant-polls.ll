@@ -0,0 +1,81 @@
+; RUN: llvm-link %s %p/Inputs/lsp-library.ll -S | opt -place-safepoints -spp-all-functions -spp-elide-redundant-polls -S 2>&1 | FileCheck %s
+; RUN: llvm-link %s %p/Inputs/lsp-library.ll -S | opt -place-safepoints -spp-all-functions -S 2>&1 | FileCheck %s -check-prefix=ALL
+; RUN: llvm-link %s %p/Inputs/lsp-library.ll -S | opt -place-safepoints -spp-all-functions -spp-no-entry -S 2>&1 | FileCheck %s -check-prefix=BOUNDED
+; RUN: llvm-link %s %p/Inputs/lsp-library.ll -S | opt -place-safepoints -spp-all-functions -spp-no-entry -spp-max-bounded-trip-count=16 -S 2>&1 | FileCheck %s -check-prefix=SMALL
+
+; Polls are only needed where no call which itself polls is guaranteed to
+; execute, and loops with a small bounded trip count need none at all.
+
+declare void @foo()
+
+; A call on every iteration makes the backedge poll redundant, and the same
+; call is guaranteed before the return, so the entry poll goes too.
+define void @call_every_iteration(i1 %c) {
+; CHECK-LABEL: @call_every_iteration
+; CHECK-NOT: @do_safepoint
+; CHECK: ret void
+; ALL-LABEL: @call_every_iteration
+; ALL: entry:
+; ALL-NEXT: @do_safepoint
+; ALL: @foo
+; ALL-NEXT: @do_safepoint
+; ALL: ret void
+entry:
+  br label %loop
+
+loop:
+  call void @foo()
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; The call only executes on some iterations, so the backedge keeps its poll.
+; (The poll in the latch, which is inlined unconditionally here, then makes
+; the entry poll redundant.)
+define void @call_some_iterations(i1 %c, i1 %d) {
+; CHECK-LABEL: @call_some_iterations
+; CHECK: entry:
+; CHECK-NEXT: br label %loop
+; CHECK: latch:
+; CHECK-NEXT: @do_safepoint
+; CHECK: ret void
+entry:
+  br label %loop
+
+loop:
+  br i1 %d, label %call, label %latch
+
+call:
+  call void @foo()
+  br label %latch
+
+latch:
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; The trip count of this loop isn't known, but is bounded by the width of the
+; induction variable.
+define void @bounded_loop(i8 %n) {
+; BOUNDED-LABEL: @bounded_loop
+; BOUNDED-NOT: @do_safepoint
+; BOUNDED: ret void
+; SMALL-LABEL: @bounded_loop
+; SMALL: @do_safepoint
+; SMALL: ret void
+entry:
+  br label %loop
+
+loop:
+  %iv = phi i8 [ 0, %entry ], [ %iv.next, %loop ]
+  %iv.next = add nuw i8 %iv, 1
+  %cmp = icmp ult i8 %iv.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
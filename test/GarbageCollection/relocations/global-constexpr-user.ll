@@ -0,0 +1,35 @@
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-verify-ir-level=0 -S | FileCheck %s
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-verify-ir-level=0 -spp-dataflow-liveness=false -S | FileCheck %s
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-verify-ir-level=0 -spp-relocation-via-alloca -S | FileCheck %s
+
+; A global which is the base of a live derived pointer is relocated as well.
+; Its other users include a constant expression, and a function which has no
+; safepoint; rewriting the uses of the relocated value leaves both alone.
+; (The safepoint IR verifier doesn't accept a global as a gc pointer.)
+
+@g = external addrspace(1) global i64
+
+declare void @foo()
+
+define i64 @test() {
+; CHECK-LABEL: @test
+; CHECK: %g.relocated = call coldcc i64 addrspace(1)* @llvm.gc.relocate
+; CHECK: load i64 addrspace(1)* %d.relocated
+; CHECK: load i64 addrspace(1)* getelementptr inbounds (i64 addrspace(1)* @g, i64 1)
+entry:
+  %d = getelementptr i64 addrspace(1)* @g, i64 2
+  call void @foo()
+  %v = load i64 addrspace(1)* %d
+  %w = load i64 addrspace(1)* getelementptr (i64 addrspace(1)* @g, i64 1)
+  %s = add i64 %v, %w
+  ret i64 %s
+}
+
+define i64 @other() "gc-leaf-function"="true" {
+; CHECK-LABEL: @other
+; CHECK-NEXT: entry:
+; CHECK-NEXT: load i64 addrspace(1)* @g
+entry:
+  %v = load i64 addrspace(1)* @g
+  ret i64 %v
+}
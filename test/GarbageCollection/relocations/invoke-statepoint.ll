@@ -0,0 +1,60 @@
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -verify-safepoint-ir -S %s | FileCheck %s
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-relocation-via-alloca -verify-safepoint-ir -S %s | FileCheck %s -check-prefix=ALLOCA
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -verify-machineinstrs | FileCheck %s -check-prefix=ASM
+
+declare i64 addrspace(1)* @bar(i64 addrspace(1)*)
+declare i32 @__gxx_personality_v0(...)
+
+; Both invokes share their normal and unwind destinations, which get split
+; so the relocations along each edge belong to exactly one statepoint.  The
+; relocations along the exceptional edge hang off the landing pad's token.
+define i64 addrspace(1)* @test(i64 addrspace(1)* %a, i64 addrspace(1)* %b, i1 %c) {
+; CHECK-LABEL: @test
+; CHECK: left:
+; CHECK: invoke i32 {{.*}} @llvm.statepoint{{.*}}(i64 addrspace(1)* (i64 addrspace(1)*)* @bar, {{.*}}, i64 addrspace(1)* %a)
+; CHECK-NEXT: to label %[[NORMAL:[a-z._]+]] unwind label %[[UNWIND:[a-z.]+]]
+; CHECK: [[NORMAL]]:
+; CHECK-NEXT: %x{{[0-9]*}} = call i64 addrspace(1)* @llvm.gc.result.ptr
+; CHECK-NEXT: call coldcc i64 addrspace(1)* @llvm.gc.relocate
+; CHECK: [[UNWIND]]:
+; CHECK-NEXT: landingpad
+; CHECK-NEXT: cleanup
+; CHECK-NEXT: %landing_token = call i32 @llvm.gc.landing.token()
+; CHECK-NEXT: %a.relocated{{[0-9]+}} = call coldcc i64 addrspace(1)* @llvm.gc.relocate.p1i64(i32 %landing_token, i32 9, i32 9)
+; CHECK: lpad:
+; CHECK-NEXT: %r = phi i64 addrspace(1)* [ %a.relocated{{[0-9]+}}, %lpad.safepoint ], [ %b.relocated{{[0-9]+}}, %lpad.safepoint.split ]
+; ALLOCA-LABEL: @test
+; ALLOCA: lpad:
+; ALLOCA-NEXT: %r = phi i64 addrspace(1)* [ %a.relocated{{[0-9]+}}, %lpad.safepoint ], [ %b.relocated{{[0-9]+}}, %lpad.safepoint.split ]
+; ASM-LABEL: test:
+; ASM: movq %rdi, [[A:[0-9]+]](%rsp)
+; ASM: .Ltmp[[BEGIN:[0-9]+]]:
+; ASM-NEXT: callq bar
+; ASM-NEXT: .Ltmp{{[0-9]+}}:
+; ASM-NEXT: #STATEPOINT
+; ASM-NEXT: #STATEPOINT <Constant 0>, {{.*}}, <Indirect RSP + [[A]]>, <Indirect RSP + [[A]]>,
+; ASM: %lpad.safepoint
+; ASM-NEXT: .Ltmp[[LPAD:[0-9]+]]:
+; ASM-NEXT: movq [[A]](%rsp), %rax
+; ASM: %lpad.safepoint.split
+; ASM: jumps to .Ltmp[[LPAD]]
+entry:
+  br i1 %c, label %left, label %right
+
+left:
+  %x = invoke i64 addrspace(1)* @bar(i64 addrspace(1)* %a) to label %merge unwind label %lpad
+
+right:
+  %y = invoke i64 addrspace(1)* @bar(i64 addrspace(1)* %b) to label %merge unwind label %lpad
+
+merge:
+  %p = phi i64 addrspace(1)* [ %x, %left ], [ %y, %right ]
+  %q = getelementptr i64 addrspace(1)* %p, i64 1
+  ret i64 addrspace(1)* %q
+
+lpad:
+  %r = phi i64 addrspace(1)* [ %a, %left ], [ %b, %right ]
+  %lp = landingpad { i8*, i32 } personality i32 (...)* @__gxx_personality_v0
+          cleanup
+  ret i64 addrspace(1)* %r
+}
@@ -0,0 +1,139 @@
+; RUN: opt %s -spp-no-entry -place-safepoints -spp-all-functions -spp-verify-ir-level=2 -S | FileCheck %s
+; RUN: opt %s -spp-no-entry -place-safepoints -spp-all-functions -spp-verify-ir-level=2 -spp-relocation-via-alloca -S | FileCheck %s
+; RUN: opt %s -spp-no-entry -place-safepoints -spp-all-functions -stats -disable-output 2>&1 | FileCheck %s -check-prefix=STATS
+; REQUIRES: asserts
+
+; Many gc pointers live across several safepoints in a loop, in the style of
+; Inputs/lsp-lots-of-objs.cpp.  Every use after a safepoint must see the
+; relocated value, merged with phis only where relocations meet.  Both
+; relocation rewriters must produce the same shape; utils/lsp-bench.py
+; --relocation ssa,alloca compares their cost.
+
+declare void @some_function()
+declare i1 @unknown_condition() "gc-leaf-function"="true"
+
+define void @gc.safepoint_poll() {
+entry:
+  call void @do_safepoint()
+  ret void
+}
+declare void @do_safepoint()
+
+; STATS: 32 safepoint-placement - Number of phis inserted when rewriting relocated uses
+
+; CHECK-LABEL: @lots_of_live_objs
+define i8 addrspace(1)* @lots_of_live_objs(i8 addrspace(1)* %o0, i8 addrspace(1)* %o1, i8 addrspace(1)* %o2, i8 addrspace(1)* %o3, i8 addrspace(1)* %o4, i8 addrspace(1)* %o5, i8 addrspace(1)* %o6, i8 addrspace(1)* %o7, i8 addrspace(1)* %o8, i8 addrspace(1)* %o9, i8 addrspace(1)* %o10, i8 addrspace(1)* %o11, i8 addrspace(1)* %o12, i8 addrspace(1)* %o13, i8 addrspace(1)* %o14, i8 addrspace(1)* %o15) gc "statepoint-example" {
+entry:
+  br label %loop
+
+; CHECK: loop:
+; CHECK: = phi i8 addrspace(1)* {{.*}}[ %o15, %entry ]
+; CHECK: @llvm.statepoint
+; CHECK: left:
+; CHECK: @llvm.statepoint
+; CHECK: merge:
+; CHECK: = phi i8 addrspace(1)* {{.*}}[ %o15.relocated{{[0-9]+}}, %right ]
+; CHECK: @llvm.statepoint
+; CHECK: %o0.relocated = call coldcc
+; CHECK: exit:
+; CHECK-NEXT: icmp eq i8 addrspace(1)* %o0.relocated, null
+; CHECK: ret i8 addrspace(1)* %o15.relocated
+loop:
+  call void @some_function()
+  %c = call i1 @unknown_condition()
+  br i1 %c, label %left, label %right
+
+left:
+  call void @some_function()
+  br label %merge
+
+right:
+  br label %merge
+
+merge:
+  %c2 = call i1 @unknown_condition()
+  br i1 %c2, label %loop, label %exit
+
+exit:
+  %n0 = icmp eq i8 addrspace(1)* %o0, null
+  br i1 %n0, label %ret0, label %next0
+ret0:
+  ret i8 addrspace(1)* %o0
+next0:
+  %n1 = icmp eq i8 addrspace(1)* %o1, null
+  br i1 %n1, label %ret1, label %next1
+ret1:
+  ret i8 addrspace(1)* %o1
+next1:
+  %n2 = icmp eq i8 addrspace(1)* %o2, null
+  br i1 %n2, label %ret2, label %next2
+ret2:
+  ret i8 addrspace(1)* %o2
+next2:
+  %n3 = icmp eq i8 addrspace(1)* %o3, null
+  br i1 %n3, label %ret3, label %next3
+ret3:
+  ret i8 addrspace(1)* %o3
+next3:
+  %n4 = icmp eq i8 addrspace(1)* %o4, null
+  br i1 %n4, label %ret4, label %next4
+ret4:
+  ret i8 addrspace(1)* %o4
+next4:
+  %n5 = icmp eq i8 addrspace(1)* %o5, null
+  br i1 %n5, label %ret5, label %next5
+ret5:
+  ret i8 addrspace(1)* %o5
+next5:
+  %n6 = icmp eq i8 addrspace(1)* %o6, null
+  br i1 %n6, label %ret6, label %next6
+ret6:
+  ret i8 addrspace(1)* %o6
+next6:
+  %n7 = icmp eq i8 addrspace(1)* %o7, null
+  br i1 %n7, label %ret7, label %next7
+ret7:
+  ret i8 addrspace(1)* %o7
+next7:
+  %n8 = icmp eq i8 addrspace(1)* %o8, null
+  br i1 %n8, label %ret8, label %next8
+ret8:
+  ret i8 addrspace(1)* %o8
+next8:
+  %n9 = icmp eq i8 addrspace(1)* %o9, null
+  br i1 %n9, label %ret9, label %next9
+ret9:
+  ret i8 addrspace(1)* %o9
+next9:
+  %n10 = icmp eq i8 addrspace(1)* %o10, null
+  br i1 %n10, label %ret10, label %next10
+ret10:
+  ret i8 addrspace(1)* %o10
+next10:
+  %n11 = icmp eq i8 addrspace(1)* %o11, null
+  br i1 %n11, label %ret11, label %next11
+ret11:
+  ret i8 addrspace(1)* %o11
+next11:
+  %n12 = icmp eq i8 addrspace(1)* %o12, null
+  br i1 %n12, label %ret12, label %next12
+ret12:
+  ret i8 addrspace(1)* %o12
+next12:
+  %n13 = icmp eq i8 addrspace(1)* %o13, null
+  br i1 %n13, label %ret13, label %next13
+ret13:
+  ret i8 addrspace(1)* %o13
+next13:
+  %n14 = icmp eq i8 addrspace(1)* %o14, null
+  br i1 %n14, label %ret14, label %next14
+ret14:
+  ret i8 addrspace(1)* %o14
+next14:
+  %n15 = icmp eq i8 addrspace(1)* %o15, null
+  br i1 %n15, label %ret15, label %next15
+ret15:
+  ret i8 addrspace(1)* %o15
+next15:
+  ret i8 addrspace(1)* null
+}
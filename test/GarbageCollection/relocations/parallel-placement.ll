@@ -0,0 +1,69 @@
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S > %t.serial
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-liveness-threads=3 -S > %t.parallel
+; RUN: diff %t.serial %t.parallel
+; RUN: FileCheck %s < %t.parallel
+
+; The output with several liveness threads must be identical to the single
+; threaded run, including the order of the declarations created on demand.
+
+declare void @foo()
+declare i64 addrspace(1)* @bar()
+
+; CHECK-LABEL: @f1
+; CHECK: @llvm.statepoint
+; CHECK: %obj.relocated = call coldcc
+define i64 addrspace(1)* @f1(i64 addrspace(1)* %obj) {
+entry:
+  call void @foo()
+  ret i64 addrspace(1)* %obj
+}
+
+; CHECK-LABEL: @f2
+; CHECK: @llvm.statepoint
+; CHECK: %derived.relocated = call coldcc
+define i64 addrspace(1)* @f2(i64 addrspace(1)* %obj) {
+entry:
+  %derived = getelementptr i64 addrspace(1)* %obj, i64 4
+  call void @foo()
+  ret i64 addrspace(1)* %derived
+}
+
+; CHECK-LABEL: @f3
+; CHECK: @llvm.statepoint
+; CHECK: gc.result
+define i64 addrspace(1)* @f3() {
+entry:
+  %ret = call i64 addrspace(1)* @bar()
+  call void @foo()
+  ret i64 addrspace(1)* %ret
+}
+
+; CHECK-LABEL: @f4
+; CHECK: @llvm.statepoint
+define void @f4(i64 addrspace(1)* %a, i64 addrspace(1)* %b, i1 %c) {
+entry:
+  br i1 %c, label %left, label %right
+
+left:
+  call void @foo()
+  br label %merge
+
+right:
+  call void @foo()
+  br label %merge
+
+merge:
+  %m = phi i64 addrspace(1)* [ %a, %left ], [ %b, %right ]
+  call void @foo()
+  store i64 0, i64 addrspace(1)* %m
+  ret void
+}
+
+; CHECK-LABEL: @f5
+; CHECK: @llvm.statepoint
+define void @f5(i64 addrspace(1)* %obj) {
+entry:
+  call void @foo()
+  store i64 1, i64 addrspace(1)* %obj
+  ret void
+}
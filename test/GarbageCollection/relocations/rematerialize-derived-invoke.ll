@@ -0,0 +1,39 @@
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived -verify-safepoint-ir -S %s | FileCheck %s
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived -spp-relocation-via-alloca -verify-safepoint-ir -S %s | FileCheck %s -check-prefix=ALLOCA
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived -S %s | llc -verify-machineinstrs -o /dev/null
+
+; A derived pointer live across an invoke is recomputed from the relocated
+; base along both edges: at the start of the normal destination and after
+; the landing pad's relocations in the unwind destination.
+
+declare void @foo()
+declare i32 @__gxx_personality_v0(...)
+
+define i64 addrspace(1)* @test(i64 addrspace(1)* %obj) {
+; CHECK-LABEL: @test
+; CHECK: invoke i32 {{.*}} @llvm.statepoint{{.*}}(void ()* @foo, {{.*}}, i64 addrspace(1)* %obj)
+; CHECK-NOT: %derived.relocated
+; CHECK: %obj.relocated = call coldcc i64 addrspace(1)* @llvm.gc.relocate
+; CHECK-NEXT: %derived.remat = getelementptr i64 addrspace(1)* %obj.relocated, i64 4
+; CHECK-NEXT: ret i64 addrspace(1)* %derived.remat{{$}}
+; CHECK: landingpad
+; CHECK: %landing_token = call i32 @llvm.gc.landing.token()
+; CHECK-NEXT: %obj.relocated{{[0-9]+}} = call coldcc i64 addrspace(1)* @llvm.gc.relocate
+; CHECK-NEXT: %derived.remat{{[0-9]+}} = getelementptr i64 addrspace(1)* %obj.relocated{{[0-9]+}}, i64 4
+; CHECK-NEXT: ret i64 addrspace(1)* %derived.remat{{[0-9]+}}
+; ALLOCA-LABEL: @test
+; ALLOCA-NOT: %derived.relocated
+; ALLOCA: ret i64 addrspace(1)* %derived.remat{{$}}
+; ALLOCA: ret i64 addrspace(1)* %derived.remat{{[0-9]+}}
+entry:
+  %derived = getelementptr i64 addrspace(1)* %obj, i64 4
+  invoke void @foo() to label %normal unwind label %lpad
+
+normal:
+  ret i64 addrspace(1)* %derived
+
+lpad:
+  %lp = landingpad { i8*, i32 } personality i32 (...)* @__gxx_personality_v0
+          cleanup
+  ret i64 addrspace(1)* %derived
+}
@@ -0,0 +1,41 @@
+; RUN: llvm-link %s %p/../Inputs/lsp-library.ll -S | opt -spp-no-call -spp-no-entry -place-safepoints -spp-all-functions -spp-rematerialize-derived -S 2>&1 | FileCheck %s
+; RUN: llvm-link %s %p/../Inputs/lsp-library.ll -S | opt -spp-no-call -spp-no-entry -place-safepoints -spp-all-functions -spp-rematerialize-derived -spp-relocation-via-alloca -S 2>&1 | FileCheck %s -check-prefix=ALLOCA
+
+; With -spp-rematerialize-derived, a derived pointer live around a loop is
+; recomputed from its relocated base at the backedge safepoint, and the
+; recomputed value flows into the loop header phi in place of a relocate.
+
+declare i64* @generate_obj()
+declare void @consume_obj(i64*)
+declare i1 @rt()
+
+define void @test() {
+entry:
+  %obj_init = call i64* @generate_obj()
+  %obj = getelementptr i64* %obj_init, i32 42
+  br label %loop
+
+loop:
+; CHECK: loop:
+; CHECK-DAG: [ %obj_init.relocated, %loop.backedge ]
+; CHECK-DAG: [ %obj_init, %entry ]
+; CHECK-DAG: [ %obj.remat, %loop.backedge ]
+; CHECK-DAG: [ %obj, %entry ]
+; CHECK-NOT: %obj.relocated
+; CHECK: %obj.remat = getelementptr i64* %obj_init.relocated, i32 42
+; ALLOCA: phi i64* [ %obj, %entry ], [ %obj.remat, %loop.backedge ]
+; ALLOCA-NOT: %obj.relocated
+; ALLOCA: %obj.remat = getelementptr i64* %obj_init.relocated, i32 42
+  %index = phi i32 [ 0, %entry], [ %index.inc, %loop_x ], [ %index.inc, %loop_y ]
+  %location = getelementptr i64* %obj, i32 %index
+  call void @consume_obj(i64* %location)
+  %index.inc = add i32 %index, 1
+  %condition = call i1 @rt()
+  br i1 %condition, label %loop_x, label %loop_y
+
+loop_x:
+  br label %loop
+
+loop_y:
+  br label %loop
+}
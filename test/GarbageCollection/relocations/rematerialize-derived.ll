@@ -0,0 +1,51 @@
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived -spp-verify-ir-level=2 -S | FileCheck %s
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived -spp-relocation-via-alloca -spp-verify-ir-level=2 -S | FileCheck %s
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived -spp-rematerialization-threshold=0 -S | FileCheck %s -check-prefix=FREE
+; RUN: opt %s -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived=false -S | FileCheck %s -check-prefix=RELOC
+
+; Derived pointers which are cheap to compute from their base are recomputed
+; from the relocated base after the safepoint instead of being relocated
+; themselves.  Only the base takes up a slot in the statepoint.  Geps with
+; constant indices and bitcasts are free.  A gep with a variable index is
+; always relocated, since its index would have to stay live across the
+; safepoint instead.
+
+declare void @foo()
+
+define i8 addrspace(1)* @test(i64 addrspace(1)* %obj, i64 %idx) {
+; CHECK-LABEL: @test
+; CHECK: @llvm.statepoint{{.*}}(void ()* @foo, i32 0, i32 0, i32 0, i32 -1, i32 0, i32 0, i32 0, i64 addrspace(1)* %obj, i64 addrspace(1)* %var, i64 addrspace(1)* %var2)
+; CHECK-NEXT: %obj.relocated = call coldcc
+; CHECK-NEXT: %var.relocated = call coldcc
+; CHECK-NEXT: %var2.relocated = call coldcc
+; CHECK-NEXT: %field.remat = getelementptr i64 addrspace(1)* %obj.relocated, i64 2
+; CHECK-NEXT: %cast.remat = bitcast i64 addrspace(1)* %field.remat to i8 addrspace(1)*
+; CHECK-NEXT: %other.remat = getelementptr i64 addrspace(1)* %obj.relocated, i64 8
+; CHECK-NOT: %var.remat
+; CHECK-NOT: %var2.remat
+; CHECK: store i64 0, i64 addrspace(1)* %var.relocated
+; CHECK: store i64 1, i64 addrspace(1)* %other.remat
+; CHECK: store i64 2, i64 addrspace(1)* %var2.relocated
+; CHECK: ret i8 addrspace(1)* %cast.remat
+; FREE-LABEL: @test
+; FREE: %var.relocated = call coldcc
+; FREE: %cast.remat = bitcast
+; FREE: %other.remat = getelementptr
+; FREE-NOT: %var.remat
+; RELOC-LABEL: @test
+; RELOC: %cast.relocated = call coldcc
+; RELOC-NOT: remat
+; RELOC: ret i8 addrspace(1)* %cast.relocated
+entry:
+  %field = getelementptr i64 addrspace(1)* %obj, i64 2
+  %cast = bitcast i64 addrspace(1)* %field to i8 addrspace(1)*
+  %other = getelementptr i64 addrspace(1)* %obj, i64 8
+  %var = getelementptr i64 addrspace(1)* %obj, i64 %idx
+  %var1 = getelementptr i64 addrspace(1)* %obj, i64 %idx
+  %var2 = getelementptr i64 addrspace(1)* %var1, i64 %idx
+  call void @foo()
+  store i64 0, i64 addrspace(1)* %var
+  store i64 1, i64 addrspace(1)* %other
+  store i64 2, i64 addrspace(1)* %var2
+  ret i8 addrspace(1)* %cast
+}
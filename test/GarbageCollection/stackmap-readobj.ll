@@ -0,0 +1,57 @@
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -filetype=obj -o %t1.o
+; RUN: llvm-readobj -stackmap %t1.o | FileCheck %s -check-prefix=CHECK -check-prefix=V1
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -stackmap-version=2 -filetype=obj -o %t2.o
+; RUN: llvm-readobj -stackmap %t2.o | FileCheck %s -check-prefix=CHECK -check-prefix=V2
+
+declare void @foo()
+
+define i64 addrspace(1)* @test(i64 addrspace(1)* %a) {
+entry:
+  call void @foo()
+  call void @foo()
+  ret i64 addrspace(1)* %a
+}
+
+define i64 addrspace(1)* @test2(i64 addrspace(1)* %a, i64 addrspace(1)* %b) {
+entry:
+  call void @foo()
+  %c = icmp eq i64 addrspace(1)* %a, %b
+  %r = select i1 %c, i64 addrspace(1)* %a, i64 addrspace(1)* %b
+  ret i64 addrspace(1)* %r
+}
+
+; Only version 2 records which callsites belong to which function.
+; CHECK-LABEL: StackMap {
+; V1-NEXT: Version: 1
+; V2-NEXT: Version: 2
+; CHECK-NEXT: NumFunctions: 2
+; CHECK-NEXT: NumConstants: 0
+; CHECK-NEXT: NumCallsites: 3
+; CHECK: Function {
+; CHECK-NEXT: Address: 0x0
+; CHECK-NEXT: StackSize: 8
+; V2-NEXT: NumCallsites: 2
+; V2-NEXT: NumLocations: 16
+; CHECK-NEXT: }
+; CHECK: Function {
+; CHECK-NEXT: Address: 0x0
+; CHECK-NEXT: StackSize: 24
+; V2-NEXT: NumCallsites: 1
+; V2-NEXT: NumLocations: 10
+; CHECK-NEXT: }
+; CHECK: Callsites [
+; CHECK: ID: 0xABCDEF00
+; CHECK-NEXT: InstructionOffset:
+; CHECK-NEXT: NumLocations: 8
+; CHECK-NEXT: NumLiveOuts: 0
+; CHECK: NumLocations: 8
+; CHECK: NumLocations: 10
+; CHECK: LocationKinds {
+; CHECK-NEXT: Register: 0
+; CHECK-NEXT: Direct: 0
+; CHECK-NEXT: Indirect: 8
+; CHECK-NEXT: Constant: 18
+; CHECK-NEXT: ConstantIndex: 0
+; CHECK-NEXT: }
+; V1-NEXT: TotalBytes: 328
+; V2-NEXT: TotalBytes: 184
@@ -0,0 +1,62 @@
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -stackmap-version=2 | FileCheck %s
+
+declare void @foo()
+
+; The two functions have three callsites with the same locations, so the
+; location table holds each distinct location once and the records refer to
+; it by index.
+; CHECK-LABEL: __LLVM_StackMaps:
+; CHECK-NEXT: .byte 2
+; CHECK-NEXT: .byte 0
+; CHECK-NEXT: .short 0
+; Num functions, constants, locations and records.
+; CHECK-NEXT: .long 2
+; CHECK-NEXT: .long 0
+; CHECK-NEXT: .long 3
+; CHECK-NEXT: .long 3
+; CHECK-NEXT: .long 0
+; Functions, with their first callsite and number of callsites.
+; CHECK-NEXT: .quad test
+; CHECK-NEXT: .quad 8
+; CHECK-NEXT: .long 0
+; CHECK-NEXT: .long 2
+; CHECK-NEXT: .quad test2
+; CHECK-NEXT: .quad 8
+; CHECK-NEXT: .long 2
+; CHECK-NEXT: .long 1
+; Callsites, in instruction order, with the offset of their record.
+; CHECK-NEXT: .long .Ltmp{{[0-9]+}}-test
+; CHECK-NEXT: .long 0
+; CHECK-NEXT: .long .Ltmp{{[0-9]+}}-test
+; CHECK-NEXT: .long {{[0-9]+}}
+; CHECK-NEXT: .long .Ltmp{{[0-9]+}}-test2
+; CHECK-NEXT: .long {{[0-9]+}}
+; Locations: the two constants of the statepoint and the spill slot of %a.
+; CHECK-NEXT: .byte 4
+; CHECK-NEXT: .byte 8
+; CHECK-NEXT: .short 0
+; CHECK-NEXT: .long 0
+; CHECK-NEXT: .byte 4
+; CHECK-NEXT: .byte 8
+; CHECK-NEXT: .short 0
+; CHECK-NEXT: .long -1
+; CHECK-NEXT: .byte 3
+; CHECK-NEXT: .byte 8
+; CHECK-NEXT: .short 7
+; CHECK-NEXT: .long 0
+; Records: ID, 8 location indices and no live outs.
+; CHECK-NEXT: .asciz "\200\336\267\336\n\b\000\000\001\000\000\000\002\002\000
+; CHECK-NEXT: .align 8
+
+define i64 addrspace(1)* @test(i64 addrspace(1)* %a) {
+entry:
+  call void @foo()
+  call void @foo()
+  ret i64 addrspace(1)* %a
+}
+
+define i64 addrspace(1)* @test2(i64 addrspace(1)* %a) {
+entry:
+  call void @foo()
+  ret i64 addrspace(1)* %a
+}
@@ -0,0 +1,122 @@
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived=false -S %s | llvm-extract -delete -func=invoke -S | llc -O0 -fast-isel-abort -verify-machineinstrs | FileCheck %s
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived=false -S %s | llvm-extract -delete -func=invoke -S | llc -O0 -fast-isel=false | FileCheck %s
+; The landing pad of @invoke is never selected by FastISel, so it gets a run
+; of its own which checks that only the landing pad block is missed.
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived=false -S %s | llc -O0 -fast-isel-verbose -verify-machineinstrs -o %t.s 2>&1 | FileCheck %s -check-prefix=MISS
+; RUN: FileCheck %s -check-prefix=INVOKE < %t.s
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -spp-rematerialize-derived=false -S %s | llc -O0 -fast-isel=false | FileCheck %s -check-prefix=INVOKE
+
+; The baseline tier selects statepoints with FastISel.  It has to come up
+; with the same stack map as SelectionDAG, and the same STATEPOINT operands.
+
+declare i64 addrspace(1)* @make(i64 addrspace(1)*, i64)
+declare i64 @count(i64 addrspace(1)*)
+declare void @foo()
+declare i32 @__gxx_personality_v0(...)
+
+define i64 @test(i64 addrspace(1)* %a, i64 %x) {
+entry:
+; The derived pointer leads, then its base, and each is spilled once.
+; CHECK-LABEL: test:
+; CHECK: movq {{%[a-z]+}}, [[D:[0-9]+]](%rsp)
+; CHECK: movq %rdi, [[A:[0-9]+]](%rsp)
+; CHECK: callq make
+; CHECK: #STATEPOINT 2, <ga:@make>, {{.*}}, <regmask>, %RSP<imp-def>, %RAX<imp-def>;
+; CHECK: #STATEPOINT <Constant 0>, <Constant 0>, <Constant -1>, <Constant 0>, <Constant 0>, <Constant 0>, <Indirect RSP + [[D]]>, <Indirect RSP + [[A]]>, <Indirect RSP + [[A]]>, <Indirect RSP + [[A]]>,
+; The relocated derived pointer is reloaded, the result is in RAX.
+; CHECK: movq [[D]](%rsp), [[R:%[a-z]+]]
+; CHECK: movq ([[R]]), [[R]]
+; CHECK: (%rax)
+  %d = getelementptr i64 addrspace(1)* %a, i64 2
+  %r = call i64 addrspace(1)* @make(i64 addrspace(1)* %a, i64 %x)
+  %v1 = load i64 addrspace(1)* %d
+  %v2 = load i64 addrspace(1)* %r
+  %s = add i64 %v1, %v2
+  ret i64 %s
+}
+
+define i64 @result(i64 addrspace(1)* %a) {
+entry:
+; An integer gc.result is in RAX.
+; CHECK-LABEL: result:
+; CHECK: callq count
+; CHECK: #STATEPOINT 1, <ga:@count>, {{.*}}, <regmask>, %RSP<imp-def>, %RAX<imp-def>;
+; CHECK: #STATEPOINT <Constant 0>, <Constant 0>, <Constant -1>, <Constant 0>, <Constant 0>, <Constant 0>, <Indirect RSP + [[A:[0-9]+]]>, <Indirect RSP + [[A]]>,
+; CHECK: movq {{[0-9]*}}(%rsp), {{%[a-z]+}}
+; CHECK: addq {{.*}}, %rax
+  %n = call i64 @count(i64 addrspace(1)* %a)
+  %v = load i64 addrspace(1)* %a
+  %s = add i64 %n, %v
+  ret i64 %s
+}
+
+define i64 @two(i64 addrspace(1)* %a, i64 addrspace(1)* %b) {
+entry:
+; The second statepoint reuses the slots of the first by position.
+; CHECK-LABEL: two:
+; CHECK: callq count
+; CHECK: #STATEPOINT 1, <ga:@count>, {{.*}}, <regmask>, %RSP<imp-def>, %RAX<imp-def>;
+; CHECK: #STATEPOINT <Constant 0>, <Constant 0>, <Constant -1>, <Constant 0>, <Constant 0>, <Constant 0>, <Indirect RSP + [[A:[0-9]+]]>, <Indirect RSP + [[A]]>, <Indirect RSP + [[B:[0-9]+]]>, <Indirect RSP + [[B]]>,
+; CHECK: callq foo
+; CHECK: #STATEPOINT 0, <ga:@foo>, {{.*}}, <regmask>, %RSP<imp-def>;
+; CHECK: #STATEPOINT <Constant 0>, <Constant 0>, <Constant -1>, <Constant 0>, <Constant 0>, <Constant 0>, <Indirect RSP + [[A]]>, <Indirect RSP + [[A]]>, <Indirect RSP + [[B]]>, <Indirect RSP + [[B]]>,
+  %c = call i64 @count(i64 addrspace(1)* %b)
+  call void @foo()
+  %v1 = load i64 addrspace(1)* %a
+  %v2 = load i64 addrspace(1)* %b
+  %s = add i64 %v1, %v2
+  ret i64 %s
+}
+
+define i64 @vmstate(i64 addrspace(1)* %a, i64 %x) {
+entry:
+; Constants in the vm state are recorded as such, with the type of each stack
+; and local slot before it.  Everything else is spilled.
+; CHECK-LABEL: vmstate:
+; CHECK: movq %rsi, [[X:[0-9]+]](%rsp)
+; CHECK: callq foo
+; CHECK: #STATEPOINT <Constant 0>, <Constant 0>, <Constant 7>, <Constant 1>, <Constant 1>, <Constant 0>, <Constant 0>, <Constant 42>, <Constant 1>, <Indirect RSP + [[X]]>, <Indirect RSP + [[A:[0-9]+]]>, <Indirect RSP + [[A]]>,
+  %tok = call i32 (void ()*, i32, i32, i32, i32, i32, i32, i32, ...)* @llvm.statepoint.p0f_isVoidf(void ()* @foo, i32 0, i32 0, i32 0, i32 7, i32 1, i32 1, i32 0, i32 0, i32 42, i32 1, i64 %x, i64 addrspace(1)* %a)
+  %a.relocated = call coldcc i64 addrspace(1)* @llvm.gc.relocate.p1i64(i32 %tok, i32 12, i32 12)
+  %v = load i64 addrspace(1)* %a.relocated
+  ret i64 %v
+}
+
+define i64 @invoke(i64 addrspace(1)* %a, i64 %x) {
+entry:
+; The invoke itself is left to SelectionDAG, but FastISel selects the
+; gc.result and gc.relocate in the normal destination: the relocate reloads
+; the slot and the result was exported from the invoke's block.
+; MISS-NOT: FastISel miss
+; MISS: FastISel missed terminator: {{.*}} = invoke {{.*}}@llvm.statepoint
+; MISS-NOT: @llvm.gc.re
+; MISS: FastISel miss: {{.*}} = landingpad
+; MISS-NOT: FastISel
+; INVOKE-LABEL: invoke:
+; INVOKE: movq %rdi, [[A:[0-9]+]](%rsp)
+; INVOKE: callq make
+; INVOKE: #STATEPOINT 2, <ga:@make>, {{.*}}, <regmask>, %RSP<imp-def>, %RAX<imp-def>;
+; INVOKE: #STATEPOINT <Constant 0>, <Constant 0>, <Constant -1>, <Constant 0>, <Constant 0>, <Constant 0>, <Indirect RSP + [[A]]>, <Indirect RSP + [[A]]>,
+; INVOKE: movq %rax, [[S:[0-9]+]](%rsp)
+; INVOKE: %normal
+; INVOKE: movq [[A]](%rsp), [[R:%[a-z]+]]
+; INVOKE: movq ([[R]]), [[R]]
+; INVOKE: movq [[S]](%rsp), [[P:%[a-z]+]]
+; INVOKE: ([[P]])
+  %r = invoke i64 addrspace(1)* @make(i64 addrspace(1)* %a, i64 %x)
+          to label %normal unwind label %lpad
+
+normal:
+  %v1 = load i64 addrspace(1)* %a
+  %v2 = load i64 addrspace(1)* %r
+  %s = add i64 %v1, %v2
+  ret i64 %s
+
+lpad:
+  %lp = landingpad { i8*, i32 } personality i32 (...)* @__gxx_personality_v0
+          cleanup
+  ret i64 0
+}
+
+declare i32 @llvm.statepoint.p0f_isVoidf(void ()*, i32, i32, i32, i32, i32, i32, i32, ...)
+declare i64 addrspace(1)* @llvm.gc.relocate.p1i64(i32, i32, i32)
@@ -0,0 +1,41 @@
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -verify-machineinstrs | FileCheck %s
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -spp-all-functions -S %s | llc -statepoint-stack-slot-coloring=false | FileCheck %s -check-prefix=NOCOLOR
+
+declare void @foo()
+declare void @bar(i64, i64, i64, i64, i64, i64, i64, i64)
+
+; The gc pointers spilled at the first statepoint are dead by the time the
+; register allocator has to spill the integers live across the second call,
+; so both can share the same two stack slots.
+define i64 @test(i64 addrspace(1)* %a, i64 addrspace(1)* %b, i64 %x) {
+entry:
+; CHECK-LABEL: test:
+; CHECK: subq $40, %rsp
+; CHECK: #STATEPOINT <Constant 0>, {{.*}}, <Indirect RSP + [[A:[0-9]+]]>, <Indirect RSP + [[A]]>, <Indirect RSP + [[B:[0-9]+]]>, <Indirect RSP + [[B]]>,
+; CHECK-DAG: movq {{%[a-z]+}}, [[A]](%rsp) # 8-byte Spill
+; CHECK-DAG: movq {{%[a-z]+}}, [[B]](%rsp) # 8-byte Spill
+; CHECK: callq bar
+; NOCOLOR-LABEL: test:
+; NOCOLOR: subq $56, %rsp
+  call void @foo()
+  %va = load i64 addrspace(1)* %a
+  %vb = load i64 addrspace(1)* %b
+  %s = add i64 %va, %vb
+  %v0 = mul i64 %s, %x
+  %v1 = mul i64 %v0, %x
+  %v2 = mul i64 %v1, %x
+  %v3 = mul i64 %v2, %x
+  %v4 = mul i64 %v3, %x
+  %v5 = mul i64 %v4, %x
+  %v6 = mul i64 %v5, %x
+  %v7 = mul i64 %v6, %x
+  call void @bar(i64 %v0, i64 %v1, i64 %v2, i64 %v3, i64 %v4, i64 %v5, i64 %v6, i64 %v7)
+  %r0 = add i64 %v0, %v1
+  %r1 = add i64 %r0, %v2
+  %r2 = add i64 %r1, %v3
+  %r3 = add i64 %r2, %v4
+  %r4 = add i64 %r3, %v5
+  %r5 = add i64 %r4, %v6
+  %r6 = add i64 %r5, %v7
+  ret i64 %r6
+}
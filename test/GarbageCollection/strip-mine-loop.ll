@@ -0,0 +1,94 @@
+; RUN: llvm-link %s %p/Inputs/lsp-library.ll -S | opt -place-safepoints -spp-no-entry -spp-no-call -spp-all-functions -spp-strip-mine-loops -spp-strip-mine-chunk=64 -spp-verify-ir-level=2 -S | FileCheck %s
+
+; A counted loop is split into an inner loop of at most 64 iterations with
+; no poll and an outer loop which polls once per chunk.
+
+; CHECK-LABEL: @sum
+; CHECK: loop.outer:
+; CHECK: %acc.outer = phi i64 [ 0, %entry ], [ %acc.next, %loop.outer.latch ]
+; CHECK-NEXT: %iv.outer = phi i64 [ 0, %entry ], [ %iv.next.chunk, %loop.outer.latch ]
+; CHECK-NEXT: %chunk.sum = add i64 %iv.outer, 64
+; CHECK-NEXT: %chunk.ovf = icmp ult i64 %chunk.sum, %iv.outer
+; CHECK-NEXT: %chunk.cmp = icmp ult i64 %chunk.sum, %n
+; CHECK-NEXT: %chunk.min = select i1 %chunk.cmp, i64 %chunk.sum, i64 %n
+; CHECK-NEXT: %chunk.end = select i1 %chunk.ovf, i64 %n, i64 %chunk.min
+; CHECK-NEXT: br label %loop
+; CHECK: loop:
+; CHECK-NEXT: %acc = phi i64 [ %acc.outer, %loop.outer ], [ %acc.next, %loop ]
+; CHECK-NEXT: %iv = phi i64 [ %iv.outer, %loop.outer ], [ %iv.next, %loop ]
+; CHECK-NOT: statepoint
+; CHECK: %in.chunk = icmp ult i64 %iv.next, %chunk.end
+; CHECK-NEXT: br i1 %in.chunk, label %loop, label %loop.outer.latch
+; The inner loop's IV isn't used outside of it, which LoopVectorize requires.
+; CHECK: loop.outer.latch:
+; CHECK-NEXT: %chunk.first = add nuw i64 %iv.outer, 1
+; CHECK-NEXT: %chunk.short = icmp ult i64 %chunk.first, %chunk.end
+; CHECK-NEXT: %iv.next.chunk = select i1 %chunk.short, i64 %chunk.end, i64 %chunk.first
+; CHECK-NEXT: %more = icmp ult i64 %iv.next.chunk, %n
+; CHECK: statepoint
+; CHECK: br i1 %more, label %loop.outer, label %exit
+; CHECK: exit:
+; CHECK-NEXT: %res = phi i64 [ %acc.next, %loop.outer.latch ]
+define i64 @sum(i64 addrspace(1)* %arr, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %iv = phi i64 [ 0, %entry ], [ %iv.next, %loop ]
+  %addr = getelementptr i64 addrspace(1)* %arr, i64 %iv
+  %val = load i64 addrspace(1)* %addr
+  %acc.next = add i64 %acc, %val
+  %iv.next = add nuw nsw i64 %iv, 1
+  %cmp = icmp ult i64 %iv.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  %res = phi i64 [ %acc.next, %loop ]
+  ret i64 %res
+}
+
+; An exit test written the other way around is handled too.  The gc pointer
+; is relocated at the poll in the outer latch.
+; CHECK-LABEL: @fill
+; CHECK: %chunk.sum = add i32 %iv.outer, 64
+; CHECK: %in.chunk = icmp slt i32 %iv.next, %chunk.end
+; CHECK: %more = icmp slt i32 %iv.next.chunk, %n
+; CHECK: statepoint
+; CHECK: br i1 %more, label %loop.outer, label %exit
+; CHECK-NOT: statepoint
+; CHECK: ret void
+define void @fill(i32 addrspace(1)* %arr, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %iv = phi i32 [ 0, %entry ], [ %iv.next, %loop ]
+  %addr = getelementptr i32 addrspace(1)* %arr, i32 %iv
+  store i32 0, i32 addrspace(1)* %addr
+  %iv.next = add nsw i32 %iv, 1
+  %done = icmp sge i32 %iv.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; Without a no-wrap increment, the chunk isn't bounded, so the loop keeps its
+; poll on every iteration.
+; CHECK-LABEL: @wrapping
+; CHECK-NOT: chunk
+; CHECK: ret void
+define void @wrapping(i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %iv = phi i32 [ 0, %entry ], [ %iv.next, %loop ]
+  %iv.next = add i32 %iv, 1
+  %cmp = icmp ult i32 %iv.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -1,10 +1,14 @@
 ; RUN: llc %s -safepoint-machineInstr-verifier-print-only -verify-safepoint-machineinstrs 2>&1 | FileCheck %s
+; RUN: llc %s -o - -safepoint-machineInstr-verifier-print-only -verify-safepoint-machineinstrs -safepoint-machineInstr-verifier-sample=0 2>&1 | FileCheck %s -check-prefix=SAMPLED
 
 ; CHECK:      Illegal use of unrelocated machine value after safepoint found!
 ; CHECK-NEXT: MachineInstr:   %RDI<def> = COPY %vreg0; GR64:%vreg0
 ; CHECK-NEXT: Illegal use of unrelocated machine value after safepoint found!
 ; CHECK-NEXT: MachineInstr:   %RDI<def> = COPY %vreg0; GR64:%vreg0
 
+; SAMPLED-NOT: Illegal use
+; SAMPLED: test:
+
 ; ModuleID = '<stdin>'
 
 declare  void @"some_call"(i64 addrspace(1)*)
@@ -26,7 +30,7 @@ useblock:                                         ; preds = %loop
   ret i64 %result
 
 safepointblock:                                   ; preds = %loop
-  %safepoint_token = call i32 (void ()*, i32, i32, i32, i32, i32, i32, i32, ...)* @llvm.statepoint.p0f_isVoidf(void ()* @do_safepoint, i32 0, i32 0, i32 -1, i32 0, i32 0, i32 0, i32 0, i64 addrspace(1)* %relocated)
+  %safepoint_token = call i32 (void ()*, i32, i32, i32, i32, i32, i32, i32, ...)* @llvm.statepoint.p0f_isVoidf(void ()* @do_safepoint, i32 0, i32 0, i32 0, i32 -1, i32 0, i32 0, i32 0, i64 addrspace(1)* %relocated)
   %obj.relocated = call coldcc i64 addrspace(1)* @llvm.gc.relocate.p1i64(i32 %safepoint_token, i32 8, i32 8)
   tail call void @"some_call"(i64 addrspace(1)* %relocated_copy) 
   br label %loop
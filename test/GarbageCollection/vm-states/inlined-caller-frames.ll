@@ -0,0 +1,53 @@
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -S %s | FileCheck %s
+; RUN: opt -spp-no-entry -spp-no-backedge -place-safepoints -remove-fake-vmstate-calls -S %s | llc | FileCheck %s -check-prefix=ASM
+
+; The statepoint records the frame of the inlined callee followed by the
+; frame of its caller, whose header is kept inline.  Constant and undef
+; slots are recorded as constants instead of being spilled.
+
+@llvm.jvmstate_anchor = private global i32 0
+
+declare void @callee_call(i64 addrspace(1)*)
+declare i32 @llvm.jvmstate_0(i32, i32, i32, i32, i32, i32, i64, i32, i64 addrspace(1)*)
+declare i32 @llvm.jvmstate_1(i32, i32, i32, i32, i32, i32, i64, i32, double, i32, i32)
+
+define void @test(i64 addrspace(1)* %obj, i64 %x) #0 {
+; CHECK-LABEL: @test
+entry:
+  %caller = call i32 @llvm.jvmstate_0(i32 0, i32 7, i32 1, i32 1, i32 0, i32 12, i64 %x, i32 10, i64 addrspace(1)* %obj)
+  %callee = call i32 @llvm.jvmstate_1(i32 %caller, i32 3, i32 1, i32 2, i32 0, i32 12, i64 123456789012, i32 13, double 1.0, i32 12, i32 undef)
+  store volatile i32 %callee, i32* @llvm.jvmstate_anchor
+; CHECK: @llvm.statepoint.p0f_isVoidp1i64f(void (i64 addrspace(1)*)* @callee_call, i32 1, i32 0, i32 1, i32 3, i32 1, i32 2, i32 0, i64 addrspace(1)* %obj, i32 12, i64 123456789012, i32 13, double 1.000000e+00, i32 12, i32 undef, i32 7, i32 1, i32 1, i32 0, i32 12, i64 %x, i32 10, i64 addrspace(1)* %obj, i64 addrspace(1)* %obj)
+  call void @callee_call(i64 addrspace(1)* %obj)
+  ret void
+}
+
+; ASM-LABEL: test:
+; ASM: #STATEPOINT
+; ASM: <Constant 1>
+; ASM: <Constant 3>
+; ASM: <Constant 1>
+; ASM: <Constant 2>
+; ASM: <Constant 0>
+; ASM: <Constant 12>
+; ASM: <Constant 123456789012>
+; ASM: <Constant 13>
+; ASM: <Constant 4607182418800017408>
+; ASM: <Constant 12>
+; ASM: <Constant 0>
+; ASM: <Constant 7>
+; ASM: <Constant 1>
+; ASM: <Constant 1>
+; ASM: <Constant 0>
+; ASM: <Constant 12>
+; ASM: <Indirect
+; ASM: <Constant 10>
+; ASM: <Indirect
+; The constants which don't fit a location are pooled
+; ASM: __LLVM_StackMaps:
+; ASM: .long 2
+; ASM-NEXT: .long 1
+; ASM: .quad 123456789012
+; ASM-NEXT: .quad 4607182418800017408
+
+attributes #0 = { "gc-add-call-safepoints"="true" }
@@ -0,0 +1,52 @@
+;; RUN: opt -place-safepoints %s -S | FileCheck %s
+
+; Each parse point takes the vm state of the closest anchor before it, in
+; its own block or else in the nearest dominator which has one.  A block
+; without an anchor passes on the state it inherited.
+
+declare i32 @llvm.jvmstate_1(i32, i32, i32, i32, i32)
+declare i32 @llvm.jvmstate_2(i32, i32, i32, i32, i32)
+declare i32 @llvm.jvmstate_3(i32, i32, i32, i32, i32)
+
+@llvm.jvmstate_anchor = private global i32 0
+
+declare void @parse_point()
+
+define void @test(i1 %c) #0 {
+; CHECK-LABEL: @test
+entry:
+  %a = call i32 @llvm.jvmstate_1(i32 0, i32 1, i32 0, i32 0, i32 0)
+  store volatile i32 %a, i32* @llvm.jvmstate_anchor
+  br label %pass
+
+pass:
+  br i1 %c, label %left, label %right
+
+left:
+; CHECK: left:
+; CHECK: @llvm.statepoint.p0f_isVoidf(void ()* @parse_point, i32 0, i32 0, i32 0, i32 1, i32 0, i32 0, i32 0)
+; CHECK: @llvm.statepoint.p0f_isVoidf(void ()* @parse_point, i32 0, i32 0, i32 0, i32 2, i32 0, i32 0, i32 0)
+  call void @parse_point()
+  %b = call i32 @llvm.jvmstate_2(i32 0, i32 2, i32 0, i32 0, i32 0)
+  store volatile i32 %b, i32* @llvm.jvmstate_anchor
+  call void @parse_point()
+  br label %left.next
+
+left.next:
+; CHECK: left.next:
+; CHECK: @llvm.statepoint.p0f_isVoidf(void ()* @parse_point, i32 0, i32 0, i32 0, i32 2, i32 0, i32 0, i32 0)
+  call void @parse_point()
+  ret void
+
+right:
+; CHECK: right:
+; CHECK: @llvm.statepoint.p0f_isVoidf(void ()* @parse_point, i32 0, i32 0, i32 0, i32 1, i32 0, i32 0, i32 0)
+; CHECK: @llvm.statepoint.p0f_isVoidf(void ()* @parse_point, i32 0, i32 0, i32 0, i32 3, i32 0, i32 0, i32 0)
+  call void @parse_point()
+  %d = call i32 @llvm.jvmstate_3(i32 0, i32 3, i32 0, i32 0, i32 0)
+  store volatile i32 %d, i32* @llvm.jvmstate_anchor
+  call void @parse_point()
+  ret void
+}
+
+attributes #0 = { nounwind "gc-add-call-safepoints"="true" }
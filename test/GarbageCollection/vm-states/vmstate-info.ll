@@ -0,0 +1,43 @@
+; RUN: opt -analyze -vmstate-info %s | FileCheck %s
+
+; %a is available before %b on entry to the loop, but not along the
+; backedge, as the call to @clobber can't be replayed.  Seeing that takes
+; a second sweep over the loop.  %b is always available before %c.  Each
+; call is reached by the last state stored to the anchor before it.
+
+declare i32 @llvm.jvmstate_1(i32, i32, i32, i32, i32)
+declare i32 @llvm.jvmstate_2(i32, i32, i32, i32, i32)
+declare i32 @llvm.jvmstate_3(i32, i32, i32, i32, i32)
+
+@llvm.jvmstate_anchor = private global i32 0
+
+declare void @clobber()
+
+define void @test(i1 %cond) {
+; CHECK-LABEL: 'VM State Availability' for function 'test':
+; CHECK-NEXT: %a
+; CHECK-NEXT: %b
+; CHECK-NEXT: %c: another state available before
+; CHECK-NEXT: reaching %c: call void @clobber()
+entry:
+  %a = call i32 @llvm.jvmstate_1(i32 0, i32 1, i32 0, i32 0, i32 0)
+  store volatile i32 %a, i32* @llvm.jvmstate_anchor
+  br label %loop
+
+loop:
+  %b = call i32 @llvm.jvmstate_2(i32 0, i32 2, i32 0, i32 0, i32 0)
+  store volatile i32 %b, i32* @llvm.jvmstate_anchor
+  %c = call i32 @llvm.jvmstate_3(i32 0, i32 3, i32 0, i32 0, i32 0)
+  store volatile i32 %c, i32* @llvm.jvmstate_anchor
+  br i1 %cond, label %call, label %latch
+
+call:
+  call void @clobber()
+  br label %latch
+
+latch:
+  br i1 %cond, label %loop, label %exit
+
+exit:
+  ret void
+}
@@ -17,6 +17,7 @@
 #include "ARMEHABIPrinter.h"
 #include "Error.h"
 #include "ObjDumper.h"
+#include "StackMapPrinter.h"
 #include "StreamWriter.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/SmallString.h"
@@ -25,6 +26,7 @@
 #include "llvm/Support/ARMBuildAttributes.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -50,6 +52,8 @@ public:
   void printDynamicSymbols() override;
   void printUnwindInfo() override;
 
+  void printStackMap() override;
+
   void printDynamicTable() override;
   void printNeededLibraries() override;
   void printProgramHeaders() override;
@@ -995,6 +999,28 @@ void ELFDumper<ELFT>::printProgramHeaders() {
   }
 }
 
+template <class ELFT>
+void ELFDumper<ELFT>::printStackMap() {
+  if ((ELFT::TargetEndianness == support::little) != sys::IsLittleEndianHost) {
+    W.startLine() << "StackMap of a foreign byte order not implemented.\n";
+    return;
+  }
+
+  for (typename ELFO::Elf_Shdr_Iter SecI = Obj->begin_sections(),
+                                    SecE = Obj->end_sections();
+       SecI != SecE; ++SecI) {
+    StringRef Name = errorOrDefault(Obj->getSectionName(&*SecI));
+    if (Name != ".llvm_stackmaps")
+      continue;
+
+    ArrayRef<uint8_t> Contents =
+        errorOrDefault(Obj->getSectionContents(&*SecI));
+    printStackMapSection(W, StringRef(reinterpret_cast<const char *>(
+                                          Contents.data()), Contents.size()));
+    return;
+  }
+}
+
 template <class ELFT>
 void ELFDumper<ELFT>::printAttributes() {
   W.startLine() << "Attributes not implemented.\n";
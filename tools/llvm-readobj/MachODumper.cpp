@@ -14,11 +14,13 @@
 #include "llvm-readobj.h"
 #include "Error.h"
 #include "ObjDumper.h"
+#include "StackMapPrinter.h"
 #include "StreamWriter.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/Object/MachO.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/Host.h"
 
 using namespace llvm;
 using namespace object;
@@ -37,6 +39,7 @@ public:
   virtual void printSymbols() override;
   virtual void printDynamicSymbols() override;
   virtual void printUnwindInfo() override;
+  virtual void printStackMap() override;
 
 private:
   void printSymbol(const SymbolRef &Symbol);
@@ -410,3 +413,22 @@ void MachODumper::printSymbol(const SymbolRef &Symbol) {
 void MachODumper::printUnwindInfo() {
   W.startLine() << "UnwindInfo not implemented.\n";
 }
+
+void MachODumper::printStackMap() {
+  if (Obj->isLittleEndian() != sys::IsLittleEndianHost) {
+    W.startLine() << "StackMap of a foreign byte order not implemented.\n";
+    return;
+  }
+
+  for (const SectionRef &Section : Obj->sections()) {
+    StringRef Name;
+    if (error(Section.getName(Name)) || Name != "__llvm_stackmaps")
+      continue;
+
+    StringRef Contents;
+    if (error(Section.getContents(Contents)))
+      return;
+    printStackMapSection(W, Contents);
+    return;
+  }
+}
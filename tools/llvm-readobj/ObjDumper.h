@@ -32,6 +32,9 @@ public:
   virtual void printDynamicSymbols() = 0;
   virtual void printUnwindInfo() = 0;
 
+  // Only implemented for ELF and MachO at this time.
+  virtual void printStackMap() { }
+
   // Only implemented for ELF at this time.
   virtual void printDynamicTable() { }
   virtual void printNeededLibraries() { }
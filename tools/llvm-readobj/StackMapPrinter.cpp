@@ -0,0 +1,94 @@
+//===--- StackMapPrinter.cpp - .llvm_stackmaps section printer ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "StackMapPrinter.h"
+#include "Error.h"
+#include "StreamWriter.h"
+#include "llvm-readobj.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Object/StackMapParser.h"
+
+using namespace llvm;
+using namespace object;
+
+static const char *const LocationKindNames[] = {
+  "Register", "Direct", "Indirect", "Constant", "ConstantIndex"
+};
+
+void llvm::printStackMapSection(StreamWriter &W, StringRef Contents) {
+  ErrorOr<StackMapParser> ParserOrErr = StackMapParser::create(Contents);
+  if (error(ParserOrErr.getError()))
+    return;
+  const StackMapParser &Parser = *ParserOrErr;
+
+  DictScope D(W, "StackMap");
+  W.printNumber("Version", Parser.getVersion());
+  W.printNumber("NumFunctions", Parser.getNumFunctions());
+  W.printNumber("NumConstants", Parser.getNumConstants());
+  W.printNumber("NumCallsites", Parser.getNumCallsites());
+
+  // Walk the records once up front, so each function can be printed with
+  // the number of locations of its callsites.
+  uint64_t KindCounts[array_lengthof(LocationKindNames)] = {};
+  SmallVector<unsigned, 64> CallsiteLocations;
+  CallsiteLocations.reserve(Parser.getNumCallsites());
+  for (StackMapParser::callsite_iterator I = Parser.callsite_begin(),
+                                         E = Parser.callsite_end();
+       I != E; ++I) {
+    CallsiteLocations.push_back(I->Locations.size());
+    for (const auto &Loc : I->Locations)
+      ++KindCounts[Loc.Kind - StackMapV2Reader::Register];
+  }
+
+  {
+    ListScope L(W, "Functions");
+    for (unsigned F = 0, E = Parser.getNumFunctions(); F != E; ++F) {
+      StackMapParser::Function Fn = Parser.getFunction(F);
+      DictScope FD(W, "Function");
+      W.printHex("Address", Fn.Address);
+      W.printNumber("StackSize", Fn.StackSize);
+      // Version 1 does not say which callsites belong to which function.
+      if (!Parser.hasFunctionCallsites())
+        continue;
+      uint64_t NumLocations = 0;
+      for (unsigned C = 0; C != Fn.NumCallsites; ++C)
+        NumLocations += CallsiteLocations[Fn.FirstCallsite + C];
+      W.printNumber("NumCallsites", Fn.NumCallsites);
+      W.printNumber("NumLocations", NumLocations);
+    }
+  }
+
+  {
+    ListScope L(W, "Constants");
+    for (unsigned C = 0, E = Parser.getNumConstants(); C != E; ++C)
+      W.printNumber("Constant", Parser.getConstant(C));
+  }
+
+  {
+    ListScope L(W, "Callsites");
+    for (StackMapParser::callsite_iterator I = Parser.callsite_begin(),
+                                           E = Parser.callsite_end();
+         I != E; ++I) {
+      DictScope CD(W, "Callsite");
+      W.printHex("ID", I->ID);
+      W.printHex("InstructionOffset", I->InstructionOffset);
+      W.printNumber("NumLocations", uint64_t(I->Locations.size()));
+      W.printNumber("NumLiveOuts", uint64_t(I->LiveOuts.size()));
+    }
+  }
+
+  {
+    DictScope LK(W, "LocationKinds");
+    for (unsigned K = 0; K != array_lengthof(LocationKindNames); ++K)
+      W.printNumber(LocationKindNames[K], KindCounts[K]);
+  }
+
+  W.printNumber("TotalBytes", uint64_t(Parser.getSize()));
+}
@@ -0,0 +1,25 @@
+//===--- StackMapPrinter.h - .llvm_stackmaps section printer ----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_READOBJ_STACKMAPPRINTER_H
+#define LLVM_READOBJ_STACKMAPPRINTER_H
+
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class StreamWriter;
+
+/// Print the stack map in Contents, which must be in host byte order: its
+/// functions and callsites with their location counts, a histogram of the
+/// location kinds, and the size of the section.
+void printStackMapSection(StreamWriter &W, StringRef Contents);
+
+} // namespace llvm
+
+#endif
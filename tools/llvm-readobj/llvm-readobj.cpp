@@ -136,6 +136,11 @@ namespace opts {
   cl::alias ARMAttributesShort("-a", cl::desc("Alias for --arm-attributes"),
                                cl::aliasopt(ARMAttributes));
 
+  // -stackmap
+  cl::opt<bool>
+  PrintStackMap("stackmap",
+                cl::desc("Display the contents of the stackmap section"));
+
   // -mips-plt-got
   cl::opt<bool>
   MipsPLTGOT("mips-plt-got",
@@ -248,6 +253,8 @@ static void dumpObject(const ObjectFile *Obj) {
     Dumper->printNeededLibraries();
   if (opts::ProgramHeaders)
     Dumper->printProgramHeaders();
+  if (opts::PrintStackMap)
+    Dumper->printStackMap();
   if (Obj->getArch() == llvm::Triple::arm && Obj->isELF())
     if (opts::ARMAttributes)
       Dumper->printAttributes();
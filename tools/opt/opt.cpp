@@ -27,6 +27,7 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/LegacyPassNameParser.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/SafepointIRVerifier.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/InitializePasses.h"
@@ -97,6 +98,11 @@ NoVerify("disable-verify", cl::desc("Do not verify result module"), cl::Hidden);
 static cl::opt<bool>
 VerifyEach("verify-each", cl::desc("Verify after each transform"));
 
+static cl::opt<bool>
+VerifySafepointIREach("verify-safepoint-ir-each",
+  cl::desc("Verify that no unrelocated value is used after a safepoint "
+           "after each transform"));
+
 static cl::opt<bool>
 StripDebug("strip-debug",
            cl::desc("Strip debugger symbol info from translation unit"));
@@ -196,6 +202,8 @@ static inline void addPass(PassManagerBase &PM, Pass *P) {
     PM.add(createVerifierPass());
     PM.add(createDebugInfoVerifierPass());
   }
+  if (VerifySafepointIREach)
+    PM.add(createSafepointIRVerifierPass());
 }
 
 /// AddOptimizationPasses - This routine adds optimization passes
@@ -14,6 +14,10 @@
 
 #include "llvm/ExecutionEngine/MCJIT.h"
 #include "MCJITTestBase.h"
+#include "llvm/ExecutionEngine/StackMapRegistry.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/Object/Error.h"
+#include "llvm/Support/CommandLine.h"
 #include "gtest/gtest.h"
 
 using namespace llvm;
@@ -23,8 +27,44 @@ namespace {
 class MCJITTest : public testing::Test, public MCJITTestBase {
 protected:
   virtual void SetUp() { M.reset(createEmptyModule("<main>")); }
+
+  Function *insertFunctionWithStackMap(Module *M, StringRef Name,
+                                       uint64_t ID) {
+    Function *F = startFunction<void(void)>(M, Name);
+    Value *Args[] = { ConstantInt::get(Type::getInt64Ty(Context), ID),
+                      ConstantInt::get(Type::getInt32Ty(Context), 0) };
+    Builder.CreateCall(
+        Intrinsic::getDeclaration(M, Intrinsic::experimental_stackmap), Args);
+    endFunctionWithRet(F, nullptr);
+    return F;
+  }
 };
 
+/// Overrides -stackmap-version for the lifetime of the object.
+class StackMapVersionOverride {
+  cl::opt<int> *Version;
+  int OldVersion;
+
+public:
+  explicit StackMapVersionOverride(int NewVersion) : Version(nullptr) {
+    StringMap<cl::Option *> Opts;
+    cl::getRegisteredOptions(Opts);
+    Version = static_cast<cl::opt<int> *>(Opts.lookup("stackmap-version"));
+    OldVersion = *Version;
+    *Version = NewVersion;
+  }
+  ~StackMapVersionOverride() { *Version = OldVersion; }
+};
+
+/// Returns the record of the only stack map in the function at FnAddr.
+static const StackMapRegistry::CallsiteRecord *
+findRecord(const StackMapRegistry &Registry, uint64_t FnAddr) {
+  const StackMapRegistry::CallsiteRecord *R = nullptr;
+  for (uint64_t Addr = FnAddr; !R && Addr != FnAddr + 64; ++Addr)
+    R = Registry.lookup(Addr);
+  return R;
+}
+
 // FIXME: Ensure creating an execution engine does not crash when constructed
 //        with a null module.
 /*
@@ -187,4 +227,114 @@ TEST_F(MCJITTest, multiple_functions) {
 
 #endif /*!defined(__arm__)*/
 
+TEST_F(MCJITTest, stack_map_registry) {
+  SKIP_UNSUPPORTED_PLATFORM;
+
+  Function *F = insertFunctionWithStackMap(M.get(), "with_stackmap", 42);
+
+  StackMapRegistry Registry;
+  static_cast<SectionMemoryManager *>(MM)->setStackMapRegistry(&Registry);
+  createJIT(M.release());
+  uint64_t FnAddr = TheJIT->getFunctionAddress(F->getName().str());
+  ASSERT_TRUE(0 != FnAddr) << "Unable to get pointer to function from JIT";
+
+  EXPECT_EQ(1u, static_cast<SectionMemoryManager *>(MM)
+                    ->getStackMapSections().size());
+  ASSERT_EQ(1u, Registry.getNumStackMaps());
+  ASSERT_EQ(1u, Registry.getNumCallsites());
+
+  // Find the record from the address of the stack map in the function
+  const StackMapRegistry::CallsiteRecord *R = findRecord(Registry, FnAddr);
+  ASSERT_TRUE(nullptr != R) << "No stack map record in the function";
+  EXPECT_EQ(42u, R->Record.ID);
+  EXPECT_EQ(FnAddr, R->FunctionAddress);
+  uint64_t ReturnAddr = R->getReturnAddress();
+  EXPECT_EQ(R, Registry.lookup(ReturnAddr));
+
+  // Freeing the code removes its records.
+  TheJIT.reset();
+  EXPECT_EQ(0u, Registry.getNumStackMaps());
+  EXPECT_TRUE(nullptr == Registry.lookup(ReturnAddr));
+}
+
+TEST_F(MCJITTest, stack_map_registry_rejects_v1) {
+  SKIP_UNSUPPORTED_PLATFORM;
+
+  // A version 1 section doesn't say which of several functions a record is
+  // in.  The registry rejects it, which the memory manager records.
+  StackMapVersionOverride Version(1);
+  Function *F = insertFunctionWithStackMap(M.get(), "first", 1);
+  insertFunctionWithStackMap(M.get(), "second", 2);
+
+  StackMapRegistry Registry;
+  SectionMemoryManager *SMM = static_cast<SectionMemoryManager *>(MM);
+  SMM->setStackMapRegistry(&Registry);
+  createJIT(M.release());
+  uint64_t FnAddr = TheJIT->getFunctionAddress(F->getName().str());
+  ASSERT_TRUE(0 != FnAddr) << "Unable to get pointer to function from JIT";
+
+  EXPECT_EQ(std::error_code(object::object_error::parse_failed),
+            SMM->getStackMapError());
+  EXPECT_EQ(1u, SMM->getStackMapSections().size());
+  EXPECT_EQ(0u, Registry.getNumStackMaps());
+  EXPECT_EQ(0u, Registry.getNumCallsites());
+}
+
+TEST_F(MCJITTest, stack_map_registry_v2) {
+  SKIP_UNSUPPORTED_PLATFORM;
+
+  // Two objects, the first with two functions.
+  StackMapVersionOverride Version(2);
+  Function *F1 = insertFunctionWithStackMap(M.get(), "first", 1);
+  Function *F2 = insertFunctionWithStackMap(M.get(), "second", 2);
+  std::unique_ptr<Module> M2(createEmptyModule("<other module>"));
+  Function *F3 = insertFunctionWithStackMap(M2.get(), "third", 3);
+
+  StackMapRegistry Registry;
+  SectionMemoryManager *SMM = static_cast<SectionMemoryManager *>(MM);
+  SMM->setStackMapRegistry(&Registry);
+  createJIT(M.release());
+  TheJIT->addModule(M2.release());
+
+  // Each object is loaded and registered on the first lookup in it.
+  uint64_t FnAddr1 = TheJIT->getFunctionAddress(F1->getName().str());
+  uint64_t FnAddr2 = TheJIT->getFunctionAddress(F2->getName().str());
+  ASSERT_EQ(1u, SMM->getStackMapSections().size());
+  sys::MemoryBlock First = SMM->getStackMapSections()[0];
+  uint64_t FnAddr3 = TheJIT->getFunctionAddress(F3->getName().str());
+  ASSERT_TRUE(0 != FnAddr1 && 0 != FnAddr2 && 0 != FnAddr3)
+      << "Unable to get pointer to function from JIT";
+
+  // Both are merged into the index.
+  EXPECT_FALSE(SMM->getStackMapError());
+  EXPECT_EQ(2u, SMM->getStackMapSections().size());
+  ASSERT_EQ(2u, Registry.getNumStackMaps());
+  ASSERT_EQ(3u, Registry.getNumCallsites());
+
+  const uint64_t FnAddrs[] = { FnAddr1, FnAddr2, FnAddr3 };
+  uint64_t ReturnAddrs[3];
+  for (unsigned i = 0; i != 3; ++i) {
+    const StackMapRegistry::CallsiteRecord *R =
+        findRecord(Registry, FnAddrs[i]);
+    ASSERT_TRUE(nullptr != R) << "No stack map record in function " << i;
+    EXPECT_EQ(i + 1, R->Record.ID);
+    EXPECT_EQ(FnAddrs[i], R->FunctionAddress);
+    ReturnAddrs[i] = R->getReturnAddress();
+  }
+
+  // Removing the first object leaves the records of the other.
+  SMM->deregisterStackMaps((uint8_t *)First.base(), 0, First.size());
+  EXPECT_EQ(1u, Registry.getNumStackMaps());
+  EXPECT_EQ(1u, Registry.getNumCallsites());
+  EXPECT_TRUE(nullptr == Registry.lookup(ReturnAddrs[0]));
+  EXPECT_TRUE(nullptr == Registry.lookup(ReturnAddrs[1]));
+  const StackMapRegistry::CallsiteRecord *R = Registry.lookup(ReturnAddrs[2]);
+  ASSERT_TRUE(nullptr != R);
+  EXPECT_EQ(3u, R->Record.ID);
+  EXPECT_EQ(FnAddr3, R->FunctionAddress);
+
+  TheJIT.reset();
+  EXPECT_EQ(0u, Registry.getNumStackMaps());
+}
+
 }
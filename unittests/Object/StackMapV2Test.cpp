@@ -0,0 +1,337 @@
+//===- llvm/unittest/Object/StackMapV2Test.cpp - StackMapV2Reader tests ---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Object/StackMapV2.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Object/Error.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <cstring>
+
+using namespace llvm;
+using namespace llvm::object;
+
+namespace {
+
+/// Builds a version 2 stack map section in host byte order, laid out as
+/// StackMaps::emitStackMapV2 does.
+struct StackMapV2Builder {
+  struct CallsiteDesc {
+    uint32_t InstructionOffset;
+    uint64_t ID;
+    std::vector<unsigned> Locations;
+    std::vector<std::pair<unsigned, unsigned> > LiveOuts;
+  };
+  struct FunctionDesc {
+    uint64_t Address;
+    uint64_t StackSize;
+    std::vector<CallsiteDesc> Callsites;
+  };
+
+  std::vector<int64_t> Constants;
+  std::vector<StackMapV2Reader::Location> Locations;
+  std::vector<FunctionDesc> Functions;
+
+  unsigned getNumCallsites() const {
+    unsigned N = 0;
+    for (unsigned i = 0, e = Functions.size(); i != e; ++i)
+      N += Functions[i].Callsites.size();
+    return N;
+  }
+
+  uint64_t getFunctionsOffset() const { return 24 + 8 * Constants.size(); }
+  uint64_t getCallsitesOffset() const {
+    return getFunctionsOffset() + 24 * Functions.size();
+  }
+  uint64_t getLocationsOffset() const {
+    return getCallsitesOffset() + 8 * getNumCallsites();
+  }
+  uint64_t getRecordsOffset() const {
+    return getLocationsOffset() + 8 * Locations.size();
+  }
+
+  template <typename T> static void append(std::string &S, T V) {
+    S.append(reinterpret_cast<const char *>(&V), sizeof(V));
+  }
+
+  std::string build() const {
+    SmallString<64> Records;
+    raw_svector_ostream RecordOS(Records);
+    std::vector<uint32_t> RecordOffsets;
+    for (unsigned i = 0, e = Functions.size(); i != e; ++i)
+      for (unsigned j = 0, je = Functions[i].Callsites.size(); j != je; ++j) {
+        const CallsiteDesc &CS = Functions[i].Callsites[j];
+        RecordOffsets.push_back(RecordOS.tell());
+        encodeULEB128(CS.ID, RecordOS);
+        encodeULEB128(CS.Locations.size(), RecordOS);
+        for (unsigned k = 0, ke = CS.Locations.size(); k != ke; ++k)
+          encodeULEB128(CS.Locations[k], RecordOS);
+        encodeULEB128(CS.LiveOuts.size(), RecordOS);
+        for (unsigned k = 0, ke = CS.LiveOuts.size(); k != ke; ++k) {
+          encodeULEB128(CS.LiveOuts[k].first, RecordOS);
+          encodeULEB128(CS.LiveOuts[k].second, RecordOS);
+        }
+      }
+    RecordOS.flush();
+
+    std::string S;
+    append<uint8_t>(S, 2);
+    append<uint8_t>(S, 0);
+    append<uint16_t>(S, 0);
+    append<uint32_t>(S, Functions.size());
+    append<uint32_t>(S, Constants.size());
+    append<uint32_t>(S, Locations.size());
+    append<uint32_t>(S, RecordOffsets.size());
+    append<uint32_t>(S, 0);
+    for (unsigned i = 0, e = Constants.size(); i != e; ++i)
+      append<int64_t>(S, Constants[i]);
+    uint32_t First = 0;
+    for (unsigned i = 0, e = Functions.size(); i != e; ++i) {
+      append<uint64_t>(S, Functions[i].Address);
+      append<uint64_t>(S, Functions[i].StackSize);
+      append<uint32_t>(S, First);
+      append<uint32_t>(S, Functions[i].Callsites.size());
+      First += Functions[i].Callsites.size();
+    }
+    unsigned Record = 0;
+    for (unsigned i = 0, e = Functions.size(); i != e; ++i)
+      for (unsigned j = 0, je = Functions[i].Callsites.size(); j != je; ++j) {
+        append<uint32_t>(S, Functions[i].Callsites[j].InstructionOffset);
+        append<uint32_t>(S, RecordOffsets[Record++]);
+      }
+    for (unsigned i = 0, e = Locations.size(); i != e; ++i) {
+      append<uint8_t>(S, Locations[i].Kind);
+      append<uint8_t>(S, Locations[i].Size);
+      append<uint16_t>(S, Locations[i].DwarfRegNum);
+      append<int32_t>(S, Locations[i].Offset);
+    }
+    S.append(Records.begin(), Records.end());
+    while (S.size() % 8)
+      S.push_back(0);
+    return S;
+  }
+};
+
+template <typename T> void writeAt(std::string &S, uint64_t Offset, T V) {
+  ASSERT_LE(Offset + sizeof(V), S.size());
+  memcpy(&S[Offset], &V, sizeof(V));
+}
+
+class StackMapV2Test : public testing::Test {
+protected:
+  StackMapV2Builder B;
+
+  void SetUp() override {
+    B.Constants.push_back(1LL << 40);
+    StackMapV2Reader::Location Reg = { StackMapV2Reader::Register, 8, 3, 0 };
+    StackMapV2Reader::Location Ind = { StackMapV2Reader::Indirect, 8, 7, 16 };
+    StackMapV2Reader::Location Con = { StackMapV2Reader::ConstantIndex, 8, 0,
+                                       0 };
+    B.Locations.push_back(Reg);
+    B.Locations.push_back(Ind);
+    B.Locations.push_back(Con);
+
+    // A function with three callsites, one with a single callsite and one
+    // with none
+    StackMapV2Builder::FunctionDesc F0 = { 0x1000, 32, {} };
+    StackMapV2Builder::CallsiteDesc CS0 = { 4, 100, {}, {} };
+    CS0.Locations.push_back(1);
+    CS0.Locations.push_back(1);
+    StackMapV2Builder::CallsiteDesc CS1 = { 10, 101, {}, {} };
+    CS1.Locations.push_back(0);
+    CS1.Locations.push_back(2);
+    CS1.LiveOuts.push_back(std::make_pair(3u, 8u));
+    StackMapV2Builder::CallsiteDesc CS2 = { 300, 102, {}, {} };
+    F0.Callsites.push_back(CS0);
+    F0.Callsites.push_back(CS1);
+    F0.Callsites.push_back(CS2);
+    StackMapV2Builder::FunctionDesc F1 = { 0x2000, 8, {} };
+    StackMapV2Builder::CallsiteDesc CS3 = { 8, 103, {}, {} };
+    F1.Callsites.push_back(CS3);
+    StackMapV2Builder::FunctionDesc F2 = { 0x3000, 0, {} };
+    B.Functions.push_back(F0);
+    B.Functions.push_back(F1);
+    B.Functions.push_back(F2);
+  }
+};
+
+TEST_F(StackMapV2Test, Contents) {
+  std::string Data = B.build();
+  ErrorOr<StackMapV2Reader> R = StackMapV2Reader::create(Data);
+  ASSERT_FALSE(R.getError());
+  EXPECT_EQ(3u, R->getNumFunctions());
+  EXPECT_EQ(4u, R->getNumCallsites());
+  EXPECT_EQ(3u, R->getNumLocations());
+  ASSERT_EQ(1u, R->getNumConstants());
+  EXPECT_EQ(1LL << 40, R->getConstant(0));
+
+  StackMapV2Reader::Function Fn = R->getFunction(1);
+  EXPECT_EQ(0x2000u, Fn.Address);
+  EXPECT_EQ(8u, Fn.StackSize);
+  EXPECT_EQ(3u, Fn.FirstCallsite);
+  EXPECT_EQ(1u, Fn.NumCallsites);
+
+  StackMapV2Reader::Callsite CS;
+  R->getCallsite(1, CS);
+  EXPECT_EQ(101u, CS.ID);
+  EXPECT_EQ(10u, CS.InstructionOffset);
+  ASSERT_EQ(2u, CS.Locations.size());
+  EXPECT_EQ(StackMapV2Reader::Register, CS.Locations[0].Kind);
+  EXPECT_EQ(3u, CS.Locations[0].DwarfRegNum);
+  EXPECT_EQ(StackMapV2Reader::ConstantIndex, CS.Locations[1].Kind);
+  ASSERT_EQ(1u, CS.LiveOuts.size());
+  EXPECT_EQ(3u, CS.LiveOuts[0].DwarfRegNum);
+  EXPECT_EQ(8u, CS.LiveOuts[0].Size);
+
+  // Shared locations are decoded for every use.
+  R->getCallsite(0, CS);
+  ASSERT_EQ(2u, CS.Locations.size());
+  EXPECT_EQ(StackMapV2Reader::Indirect, CS.Locations[1].Kind);
+  EXPECT_EQ(16, CS.Locations[1].Offset);
+  EXPECT_EQ(0u, CS.LiveOuts.size());
+}
+
+TEST_F(StackMapV2Test, FindFunction) {
+  std::string Data = B.build();
+  ErrorOr<StackMapV2Reader> R = StackMapV2Reader::create(Data);
+  ASSERT_FALSE(R.getError());
+  EXPECT_EQ(0, R->findFunction(0x1000));
+  EXPECT_EQ(1, R->findFunction(0x2000));
+  EXPECT_EQ(2, R->findFunction(0x3000));
+  EXPECT_EQ(-1, R->findFunction(0));
+  EXPECT_EQ(-1, R->findFunction(0xfff));
+  EXPECT_EQ(-1, R->findFunction(0x1001));
+  EXPECT_EQ(-1, R->findFunction(0x3001));
+}
+
+TEST_F(StackMapV2Test, FindCallsite) {
+  std::string Data = B.build();
+  ErrorOr<StackMapV2Reader> R = StackMapV2Reader::create(Data);
+  ASSERT_FALSE(R.getError());
+
+  // The first, middle and last callsites of a function
+  EXPECT_EQ(0, R->findCallsite(0, 4));
+  EXPECT_EQ(1, R->findCallsite(0, 10));
+  EXPECT_EQ(2, R->findCallsite(0, 300));
+  // Before, between and after them
+  EXPECT_EQ(-1, R->findCallsite(0, 0));
+  EXPECT_EQ(-1, R->findCallsite(0, 3));
+  EXPECT_EQ(-1, R->findCallsite(0, 5));
+  EXPECT_EQ(-1, R->findCallsite(0, 299));
+  EXPECT_EQ(-1, R->findCallsite(0, 301));
+
+  // Callsites of the neighbouring function aren't found.
+  EXPECT_EQ(3, R->findCallsite(1, 8));
+  EXPECT_EQ(-1, R->findCallsite(1, 4));
+  EXPECT_EQ(-1, R->findCallsite(0, 8));
+  EXPECT_EQ(-1, R->findCallsite(1, 7));
+  EXPECT_EQ(-1, R->findCallsite(1, 9));
+
+  // A function without callsites
+  EXPECT_EQ(-1, R->findCallsite(2, 0));
+  EXPECT_EQ(-1, R->findCallsite(2, 8));
+}
+
+TEST_F(StackMapV2Test, Empty) {
+  StackMapV2Builder Empty;
+  std::string Data = Empty.build();
+  ErrorOr<StackMapV2Reader> R = StackMapV2Reader::create(Data);
+  ASSERT_FALSE(R.getError());
+  EXPECT_EQ(0u, R->getNumFunctions());
+  EXPECT_EQ(0u, R->getNumCallsites());
+  EXPECT_EQ(-1, R->findFunction(0));
+}
+
+TEST_F(StackMapV2Test, Truncated) {
+  std::string Data = B.build();
+  EXPECT_EQ(object_error::unexpected_eof,
+            StackMapV2Reader::create(StringRef()).getError());
+  EXPECT_EQ(object_error::unexpected_eof,
+            StackMapV2Reader::create(StringRef(Data.data(), 23)).getError());
+
+  // Cut off in the tables
+  uint64_t RecordsOffset = B.getRecordsOffset();
+  EXPECT_EQ(object_error::unexpected_eof,
+            StackMapV2Reader::create(StringRef(Data.data(), RecordsOffset - 1))
+                .getError());
+  EXPECT_EQ(object_error::unexpected_eof,
+            StackMapV2Reader::create(StringRef(Data.data(),
+                                               B.getCallsitesOffset()))
+                .getError());
+
+  // Cut off in the records
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(StringRef(Data.data(), RecordsOffset))
+                .getError());
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(StringRef(Data.data(), RecordsOffset + 3))
+                .getError());
+}
+
+TEST_F(StackMapV2Test, Inconsistent) {
+  const std::string Good = B.build();
+  std::string Data;
+
+  // Unknown version
+  Data = Good;
+  Data[0] = 3;
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(Data).getError());
+
+  // The callsites of function 1 don't follow those of function 0.
+  Data = Good;
+  writeAt<uint32_t>(Data, B.getFunctionsOffset() + 24 + 16, 2);
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(Data).getError());
+
+  // Function 1 claims more callsites than there are.
+  Data = Good;
+  writeAt<uint32_t>(Data, B.getFunctionsOffset() + 24 + 20, 2);
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(Data).getError());
+
+  // Function 0 claims fewer callsites than it has.
+  Data = Good;
+  writeAt<uint32_t>(Data, B.getFunctionsOffset() + 20, 2);
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(Data).getError());
+
+  // The callsites of function 0 aren't sorted by offset.
+  Data = Good;
+  writeAt<uint32_t>(Data, B.getCallsitesOffset() + 8, 2);
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(Data).getError());
+
+  // A location of unknown kind
+  Data = Good;
+  writeAt<uint8_t>(Data, B.getLocationsOffset(), 0);
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(Data).getError());
+
+  // A ConstantIndex location past the constants
+  Data = Good;
+  writeAt<int32_t>(Data, B.getLocationsOffset() + 2 * 8 + 4, 1);
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(Data).getError());
+
+  // A record offset past the end of the section
+  Data = Good;
+  writeAt<uint32_t>(Data, B.getCallsitesOffset() + 4, Data.size());
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(Data).getError());
+}
+
+TEST_F(StackMapV2Test, BadLocationIndex) {
+  B.Functions[0].Callsites[1].Locations.push_back(3);
+  EXPECT_EQ(object_error::parse_failed,
+            StackMapV2Reader::create(B.build()).getError());
+}
+
+} // end anonymous namespace
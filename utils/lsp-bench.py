@@ -0,0 +1,429 @@
+#!/usr/bin/env python
+
+"""Compile time and code quality benchmarks for late safepoint placement.
+
+Runs the same matrix as the lsp-integ tests (see
+test/GarbageCollection/Inputs/generate-lsp-tests.py) and, optionally,
+synthetic stress inputs whose live set size and loop depth can be scaled up.
+For each run it records the time per pass of opt and llc, their peak memory,
+the number of polls, statepoints and relocates inserted, the stack slots
+allocated for statepoints and the size of the stack map section.  The results
+are written as JSON, and two result files can be compared to find
+regressions.
+
+Run the matrix on a build and compare with an earlier run:
+
+  utils/lsp-bench.py run --bindir build/bin -o new.json \\
+      --synthetic-live 16,128 --synthetic-depth 1,4
+  utils/lsp-bench.py compare old.json new.json
+
+To compare the two ways of rewriting the uses of relocated values on inputs
+in the style of lsp-lots-of-objs (many objects live across the safepoints),
+run both and look at the relocation summary printed at the end:
+
+  utils/lsp-bench.py run --bindir build/bin --relocation ssa,alloca \\
+      --synthetic-live 16,64,256 --synthetic-depth 1,3 --llc-modes asm
+
+The counts come from -stats, so the tools need to be built with assertions
+(or LLVM_ENABLE_STATS).  The C++ inputs need clang; they are skipped if it
+can't be found.
+"""
+
+from __future__ import print_function
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+INPUTS_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                          os.pardir, 'test', 'GarbageCollection', 'Inputs')
+
+# The same variants as generate-lsp-tests.py
+LSP_FLAGS = {'call': ['-spp-no-backedge', '-spp-no-entry'],
+             'loop': ['-spp-no-call', '-spp-no-entry'],
+             'both': ['-spp-no-entry']}
+CLANG_OPTS = [0, 3]
+OPT_OPTS = [0, 3]
+LLC_MODES = ['asm', 'obj']
+# How the uses of relocated values are rewritten
+RELOCATION_FLAGS = {'ssa': [], 'alloca': ['-spp-relocation-via-alloca']}
+# The -time-passes row of the rewriting (which includes mem2reg for alloca)
+RELOCATION_TIMER = 'Relocation rewriting'
+
+# -stats descriptions of the counts recorded for each run
+OPT_STATS = {'polls': 'Number of safepoint polls inserted',
+             'statepoints': 'Number of statepoints inserted',
+             'relocates': 'Number of gc.relocates inserted'}
+LLC_STATS = {'spill_slots': 'Number of stack slots allocated for statepoints',
+             'gc_ptrs_in_registers':
+               'Number of statepoint gc pointers passed in registers'}
+
+# Metrics where any increase is a regression, and those which are noisy and
+# are only reported past the threshold
+EXACT_METRICS = ['polls', 'statepoints', 'relocates', 'spill_slots',
+                 'stackmap_bytes']
+NOISY_METRICS = ['opt_seconds', 'llc_seconds', 'relocation_seconds',
+                 'opt_peak_rss_kb', 'llc_peak_rss_kb']
+
+
+class BenchError(Exception):
+  pass
+
+
+def run_tool(args, stdout_path=os.devnull):
+  """Run a tool, returning its stderr, wall time and peak RSS in kilobytes."""
+  with open(os.devnull) as fin:
+    with open(stdout_path, 'w') as fout:
+      with tempfile.TemporaryFile() as ferr:
+        start = time.time()
+        p = subprocess.Popen(args, stdin=fin, stdout=fout, stderr=ferr)
+        # wait4 gives the resource usage of just this child
+        _, status, usage = os.wait4(p.pid, 0)
+        p.returncode = status = os.WEXITSTATUS(status) or os.WTERMSIG(status)
+        elapsed = time.time() - start
+        ferr.seek(0)
+        err = ferr.read().decode('utf-8', 'replace')
+  if status != 0:
+    raise BenchError('%s failed:\n%s' % (' '.join(args), err))
+  peak = usage.ru_maxrss
+  if sys.platform == 'darwin':
+    peak //= 1024 # bytes there
+  return err, elapsed, peak
+
+
+def parse_stats(err, names):
+  """Pick the counts in names out of -stats output.  Zero counts aren't
+  printed."""
+  result = dict((key, 0) for key in names)
+  for line in err.splitlines():
+    m = re.match(r'\s*(\d+) \S+\s+- (.*)$', line)
+    if not m:
+      continue
+    for key, desc in names.items():
+      if m.group(2).strip() == desc:
+        result[key] = int(m.group(1))
+  return result
+
+
+def parse_timers(err):
+  """Map 'group: name' to wall seconds for every row of -time-passes output."""
+  result = {}
+  group = None
+  rows = False
+  for line in err.splitlines():
+    if line.startswith('===---'):
+      rows = False
+      continue
+    if group is None or not rows:
+      title = line.strip()
+      if title and not title.startswith('Total Execution Time'):
+        if '--- Name ---' in line:
+          rows = True
+        elif not title.startswith('---'):
+          group = title.strip('. ')
+      continue
+    # The wall time is the last of the columns before the name
+    m = re.match(r'\s*((?:[\d.]+\s+\(\s*[\d.]+%\)\s+)+)(.*)$', line)
+    if not m:
+      continue
+    name = m.group(2).strip()
+    if name == 'Total':
+      continue
+    wall = float(re.findall(r'([\d.]+)\s+\(', m.group(1))[-1])
+    key = '%s: %s' % (group, name)
+    result[key] = result.get(key, 0.0) + wall
+  return result
+
+
+def stackmap_bytes(readobj, obj):
+  out = subprocess.check_output([readobj, '-sections', obj])
+  out = out.decode('utf-8', 'replace')
+  m = re.search(r'Name: \.llvm_stackmaps[^\n]*\n(?:[^\n]*\n)*?\s*Size: (\d+)',
+                out)
+  return int(m.group(1)) if m else 0
+
+
+def gen_synthetic(live, depth):
+  """A function keeping live derived pointers into as many objects live over
+  a call nested depth loops deep."""
+  ptr = 'i8 addrspace(1)*'
+  args = ', '.join('%s %%p%d' % (ptr, i) for i in range(live))
+  lines = ['declare void @opaque()',
+           'declare void @sink(...)',
+           '',
+           'define void @stress(%s, i32 %%n) {' % args,
+           'entry:']
+  for i in range(live):
+    lines.append('  %%d%d = getelementptr %s %%p%d, i64 8' % (i, ptr, i))
+  lines.append('  br label %loop0')
+  for d in range(depth):
+    pred = 'entry' if d == 0 else 'loop%d' % (d - 1)
+    lines += ['loop%d:' % d,
+              '  %%i%d = phi i32 [ 0, %%%s ], [ %%i%d.next, %%latch%d ]' %
+                (d, pred, d, d),
+              '  br label %%%s' % ('loop%d' % (d + 1) if d + 1 < depth
+                                   else 'body')]
+  lines += ['body:',
+            '  call void @opaque()',
+            '  br label %%latch%d' % (depth - 1)]
+  for d in reversed(range(depth)):
+    exit = 'exit' if d == 0 else 'latch%d' % (d - 1)
+    lines += ['latch%d:' % d,
+              '  %%i%d.next = add i32 %%i%d, 1' % (d, d),
+              '  %%c%d = icmp slt i32 %%i%d.next, %%n' % (d, d),
+              '  br i1 %%c%d, label %%loop%d, label %%%s' % (d, d, exit)]
+  lines += ['exit:',
+            '  call void (...)* @sink(%s)' %
+              ', '.join('%s %%d%d' % (ptr, i) for i in range(live)),
+            '  ret void',
+            '}']
+  return '\n'.join(lines) + '\n'
+
+
+class Bench(object):
+  def __init__(self, args, workdir):
+    self.args = args
+    self.workdir = workdir
+    self.results = []
+
+  def tool(self, name):
+    return os.path.join(self.args.bindir, name)
+
+  def work(self, name):
+    return os.path.join(self.workdir, name)
+
+  def link(self, ll, out):
+    run_tool([self.tool('llvm-link'), ll,
+              os.path.join(INPUTS_DIR, 'lsp-library.ll'), '-S', '-o', out])
+
+  def run_variants(self, name, linked, record):
+    """Run placement and codegen on linked for each lsp, opt, relocation and
+    llc variant."""
+    for lsp in self.args.lsp:
+      for opt_o in OPT_OPTS:
+        for reloc in self.args.relocation:
+          self.run_variant(name, linked, record, lsp, opt_o, reloc)
+
+  def run_variant(self, name, linked, record, lsp, opt_o, reloc):
+    placed = self.work('%s-%s-O%d-%s.ll' % (name, lsp, opt_o, reloc))
+    opt_args = [self.tool('opt'), linked, '-S', '-o', placed] + \
+               LSP_FLAGS[lsp] + RELOCATION_FLAGS[reloc] + \
+               ['-place-safepoints', '-spp-all-functions']
+    if opt_o:
+      opt_args.append('-O%d' % opt_o)
+    best = None
+    for _ in range(self.args.repeat):
+      err, secs, peak = run_tool(opt_args + ['-time-passes', '-stats'])
+      if best is None or secs < best[1]:
+        best = (err, secs, peak)
+    opt_err, opt_secs, opt_peak = best
+    opt_passes = parse_timers(opt_err)
+    reloc_secs = sum(secs for key, secs in opt_passes.items()
+                     if key.endswith(': ' + RELOCATION_TIMER))
+
+    for mode in self.args.llc_modes:
+      out = placed + ('.o' if mode == 'obj' else '.s')
+      llc_args = [self.tool('llc'), '-spp-all-functions',
+                  '-filetype=%s' % mode, placed, '-o', out,
+                  '-time-passes', '-stats']
+      best = None
+      for _ in range(self.args.repeat):
+        err, secs, peak = run_tool(llc_args)
+        if best is None or secs < best[1]:
+          best = (err, secs, peak)
+      llc_err, llc_secs, llc_peak = best
+
+      r = dict(record)
+      r.update({'lsp': lsp, 'opt_opt': opt_o, 'llc_mode': mode,
+                'relocation': reloc,
+                'opt_seconds': opt_secs, 'llc_seconds': llc_secs,
+                'relocation_seconds': reloc_secs,
+                'opt_peak_rss_kb': opt_peak, 'llc_peak_rss_kb': llc_peak,
+                'opt_passes': opt_passes,
+                'llc_passes': parse_timers(llc_err),
+                'stackmap_bytes': None})
+      r.update(parse_stats(opt_err, OPT_STATS))
+      r.update(parse_stats(llc_err, LLC_STATS))
+      if mode == 'obj':
+        r['stackmap_bytes'] = stackmap_bytes(self.tool('llvm-readobj'), out)
+      self.results.append(r)
+      print('%-40s %-4s opt -O%d %-6s %-3s  opt %.3fs  llc %.3fs  '
+            '%d statepoints' % (name, lsp, opt_o, reloc, mode, opt_secs,
+                                llc_secs, r['statepoints']))
+
+  def run_cpp(self, cpp):
+    name = os.path.splitext(os.path.basename(cpp))[0]
+    for clang_o in CLANG_OPTS:
+      ll = self.work('%s-O%d.ll' % (name, clang_o))
+      run_tool([self.args.clang, cpp, '-S', '-emit-llvm', '-o', ll,
+                '-O%d' % clang_o])
+      linked = self.work('%s-O%d-linked.ll' % (name, clang_o))
+      self.link(ll, linked)
+      self.run_variants('%s-O%d' % (name, clang_o), linked,
+                        {'input': name, 'clang_opt': clang_o})
+
+  def run_synthetic(self, live, depth):
+    name = 'synthetic-live%d-depth%d' % (live, depth)
+    ll = self.work(name + '.ll')
+    with open(ll, 'w') as f:
+      f.write(gen_synthetic(live, depth))
+    linked = self.work(name + '-linked.ll')
+    self.link(ll, linked)
+    self.run_variants(name, linked, {'input': name, 'clang_opt': None,
+                                     'live': live, 'depth': depth})
+
+
+def have_tool(path):
+  try:
+    with open(os.devnull, 'w') as null:
+      subprocess.call([path, '--version'], stdout=null, stderr=null)
+    return True
+  except OSError:
+    return False
+
+
+def int_list(s):
+  return [int(x) for x in s.split(',') if x]
+
+
+def cmd_run(args):
+  bench_inputs = args.inputs
+  if bench_inputs is None:
+    bench_inputs = sorted(glob.glob(os.path.join(INPUTS_DIR, '*.cpp')))
+  if bench_inputs and not have_tool(args.clang):
+    print('warning: %s not found, skipping the C++ inputs' % args.clang,
+          file=sys.stderr)
+    bench_inputs = []
+
+  workdir = tempfile.mkdtemp(prefix='lsp-bench')
+  try:
+    bench = Bench(args, workdir)
+    for cpp in bench_inputs:
+      bench.run_cpp(cpp)
+    for live in args.synthetic_live:
+      for depth in args.synthetic_depth:
+        bench.run_synthetic(live, depth)
+  except BenchError as e:
+    print('error: %s' % e, file=sys.stderr)
+    return 1
+  finally:
+    if args.keep:
+      print('intermediate files kept in %s' % workdir)
+    else:
+      shutil.rmtree(workdir)
+
+  with open(args.output, 'w') as f:
+    json.dump({'version': 1, 'runs': bench.results}, f, indent=1,
+              sort_keys=True)
+  if len(args.relocation) > 1 and bench.results:
+    print_relocation_summary(bench.results)
+  return 0
+
+
+def run_key(r):
+  # Results from before the relocation variants were all 'ssa'
+  return (r['input'], r['clang_opt'], r['lsp'], r['opt_opt'],
+          r.get('relocation', 'ssa'), r['llc_mode'])
+
+
+def print_relocation_summary(results):
+  """Compare the time spent rewriting relocated uses by each relocation
+  variant on the same placement."""
+  times = {}
+  for r in results:
+    if r['llc_mode'] != results[0]['llc_mode']:
+      continue # the same opt run for each llc mode
+    key = (r['input'], r['clang_opt'], r['lsp'], r['opt_opt'])
+    times.setdefault(key, {})[r['relocation']] = r['relocation_seconds']
+  modes = sorted(set(m for t in times.values() for m in t))
+  print('\nrelocation rewriting seconds')
+  print('%-60s %s' % ('', ' '.join('%10s' % m for m in modes)))
+  totals = dict((m, 0.0) for m in modes)
+  for key in sorted(times, key=str):
+    print('%-60s %s' % ('/'.join(str(k) for k in key),
+                        ' '.join('%10.4f' % times[key].get(m, 0.0)
+                                 for m in modes)))
+    for m in modes:
+      totals[m] += times[key].get(m, 0.0)
+  print('%-60s %s' % ('total', ' '.join('%10.4f' % totals[m] for m in modes)))
+
+
+def cmd_compare(args):
+  with open(args.old) as f:
+    old = dict((run_key(r), r) for r in json.load(f)['runs'])
+  with open(args.new) as f:
+    new = dict((run_key(r), r) for r in json.load(f)['runs'])
+
+  regressions = 0
+  for key in sorted(set(old) & set(new), key=str):
+    o, n = old[key], new[key]
+    for metric in EXACT_METRICS + NOISY_METRICS:
+      before, after = o.get(metric), n.get(metric)
+      if before is None or after is None or after <= before:
+        continue
+      if metric in NOISY_METRICS and \
+         after <= before * (1 + args.threshold) + args.min_delta:
+        continue
+      regressions += 1
+      print('%s: %s %s -> %s' % ('/'.join(str(k) for k in key), metric,
+                                  before, after))
+  for key in sorted(set(old) ^ set(new), key=str):
+    print('%s: only in %s' % ('/'.join(str(k) for k in key),
+                              args.old if key in old else args.new))
+  print('%d regressions' % regressions)
+  return 1 if regressions else 0
+
+
+def main():
+  parser = argparse.ArgumentParser(
+    description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+  sub = parser.add_subparsers(dest='command')
+
+  run = sub.add_parser('run', help='run the benchmarks')
+  run.add_argument('--bindir', required=True,
+                   help='directory with opt, llc, llvm-link and llvm-readobj')
+  run.add_argument('--clang', default='clang')
+  run.add_argument('-o', '--output', default='lsp-bench.json')
+  run.add_argument('--inputs', nargs='*',
+                   help='C++ inputs (default: the lsp-integ ones)')
+  run.add_argument('--lsp', type=lambda s: s.split(','),
+                   default=sorted(LSP_FLAGS),
+                   help='comma separated placement variants (call,loop,both)')
+  run.add_argument('--llc-modes', type=lambda s: s.split(','),
+                   default=LLC_MODES)
+  run.add_argument('--relocation', type=lambda s: s.split(','),
+                   default=['ssa'],
+                   help='comma separated ways of rewriting relocated uses '
+                        '(ssa,alloca)')
+  run.add_argument('--synthetic-live', type=int_list, default=[],
+                   help='comma separated live set sizes of synthetic inputs')
+  run.add_argument('--synthetic-depth', type=int_list, default=[1],
+                   help='comma separated loop depths of synthetic inputs')
+  run.add_argument('--repeat', type=int, default=1,
+                   help='run each tool this many times and keep the fastest')
+  run.add_argument('--keep', action='store_true',
+                   help="don't delete the intermediate files")
+
+  compare = sub.add_parser('compare', help='report regressions in new')
+  compare.add_argument('old')
+  compare.add_argument('new')
+  compare.add_argument('--threshold', type=float, default=0.1,
+                       help='relative slack for times and memory')
+  compare.add_argument('--min-delta', type=float, default=0.05,
+                       help='absolute slack for times and memory')
+
+  args = parser.parse_args()
+  if args.command == 'run':
+    return cmd_run(args)
+  return cmd_compare(args)
+
+
+if __name__ == '__main__':
+  sys.exit(main())